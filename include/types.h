@@ -176,6 +176,8 @@ struct aa_args {
 	bool csi;
 	bool pec;
 	bool ic;
+	bool async;
+	bool meb;
 	int thread_id;
 };
 
@@ -2,9 +2,18 @@
 #include <stdlib.h>
 
 #include "main.h"
+#include "nvme_meb.h"
+#include "i2c.h"
+#include "mctp_inventory.h"
 
 extern const struct function_list func_list[];
 
+static const char *help_topology =
+        "  'topology' has one segment behind an I2C mux per line:\n"
+        "    <segment> <parent_segment> <mux_addr> <channel> [pca9548|pca9546|pca9544|pca9542]\n"
+        "  segment 0 being the adapter's own bus. The muxes are only written when\n"
+        "  the segment in use changes\n\n";
+
 void help(int func_idx)
 {
 	const char *func_name = func_list[func_idx].name;
@@ -222,19 +231,484 @@ void help(int func_idx)
 		break;
 	case FUNC_IDX_TEST_MCTP:
 		printf(
-		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] %s [port] [slv_addr]\n"
-		        "                [owner_eid] [tar_eid]\n\n"
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-o <format>] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] <script> <report>\n\n"
 		        "  option is one of:\n"
 		        "    -a (all range address)\n"
 		        "    -b <bit-rate> (bit rate)\n"
 		        "    -c (pec)\n"
 		        "    -k (keep target power)\n"
+		        "    -o <format> (response output: text, json, binary or none)\n"
 		        "    -p (enable target power)\n"
 		        "    -u (pull-up SCL and SDA)\n\n"
 		        "  'port' is an integer to indicate a valid port to use\n\n"
 		        "  'eid' is an integer (0x00, 0x08 - 0xfe)\n\n"
+		        "  'script' has one command or directive per line:\n"
+		        "    repeat <rounds>, interval <ms>, report <rounds>, pipeline <0|1>,\n"
+		        "    target <addr> <eid>, or a command such as identify-ctrl, smart <rae>,\n"
+		        "    subsys-health <cs>, vpd-read <offset> <len>, wait, sleep <ms>\n"
+		        "  Without it the built-in command sequence runs forever. Latency\n"
+		        "  percentiles and errors per line are printed at the end and written\n"
+		        "  to 'report' as CSV\n\n"
+		        "  With '-U <path>', MCTP packets go through the unix domain socket at\n"
+		        "  'path' and ARP is skipped\n\n"
+		        "Example:\n"
+		        "  # aardvark -kcpu %s 0 0x1d 0x08 0x09\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 soak.txt soak.csv\n"
+		        "  # aardvark -U /tmp/mctp.sock %s 0 0x1d 0x08 0x09\n\n"
+		        , func_name, func_name, func_name, func_name
+		);
+		break;
+	case FUNC_IDX_I2C_DETECT:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-k] [-m <topology>] [-o <format>] [-p] [-u] %s\n"
+		        "                [port,...] [<mode>] [<addrs>] [<cache_file>] [<max_age>]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (scan every segment behind the I2C muxes as well)\n"
+		        "    -o <format> (text or json)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'port,...' are the adapters to scan, each one in a thread of its own. With\n"
+		        "  '-m' the segments of a port are scanned in turn, see 'topology' below\n\n"
+		        "  'mode' is auto (default), quick (quick write) or read (receive byte)\n\n"
+		        "  'addrs' is '-' (0x03 - 0x77 or 0x00 - 0x7f if '-a' is given), a range\n"
+		        "  <first>-<last> or a comma separated list of the known addresses\n\n"
+		        "  'cache_file' keeps the result of every port. Until the last full sweep is\n"
+		        "  'max_age' seconds old (default %d), only the addresses that were present\n"
+		        "  or have no cached state are probed\n\n"
+		        "  The present addresses are also printed as a 128-bit hex bitmap, address n\n"
+		        "  is bit n\n\n"
+		        "Example (Scan the EEPROM range of four adapters):\n"
+		        "  # aardvark -o json %s 0,1,2,3 read 0x50-0x57 /tmp/i2c.cache\n\n"
+		        "%s"
+		        , func_name, I2C_SCAN_MAX_AGE, func_name, help_topology
+		);
+		break;
+	case FUNC_IDX_MCTP_BRIDGE:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-m <topology>] [-p] [-u] %s [port] [port2]\n"
+		        "                [addr] [addr2] [<route_file>]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes of 'port', routes to it are [<segment>:]<addr>)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'port', 'port2' are the two adapters to forward MCTP packets between\n\n"
+		        "  'addr', 'addr2' are the slave addresses of the bridge on each port\n\n"
+		        "  'route_file' has one route per line: <eid_start> <eid_end> <port> [<segment>:]<addr>\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 1 0x10 0x20 routes.txt\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_FW:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [image] [<slot>]\n"
+		        "                [<action>] [<ckpt_file>]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'image' is sent with Firmware Image Download, one piece in flight on each\n"
+		        "  command slot, and committed to 'slot' (0, the default, lets the controller\n"
+		        "  choose) with Firmware Commit\n\n"
+		        "  'action' is one of:\n"
+		        "    replace (store the image in the slot)\n"
+		        "    activate (store it and activate it at the next reset, the default)\n"
+		        "    set-active (activate the image already in the slot at the next reset)\n"
+		        "    immediate (store it and activate it without a reset)\n\n"
+		        "  'ckpt_file' records the acknowledged offset, an interrupted download of\n"
+		        "  the same image to the same drive (by Serial Number) resumes from there\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 fw.bin 2 activate fw.ckpt\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_MEB:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [operation] ...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'operation' is one of:\n"
+		        "    read <offset> <len> [<file>] (MEB Read, dumped without 'file')\n"
+		        "    write <offset> <file> (MEB Write of 'file')\n"
+		        "    log <lid> <len> [<file>] (Get Log Page into the MEB, then read it)\n\n"
+		        "  The Management Endpoint Buffer is moved in pieces that fit one message,\n"
+		        "  one in flight on each command slot, up to %d bytes\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 log 0x02 512 smart.bin\n\n"
+		        , func_name, NVME_MEB_SIZE_MAX, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_CACHE:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-o <format>] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [cache_dir]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -o <format> (response output: text, json, binary or none)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Identify Controller, NVM Subsystem, Port and Controller Information, the\n"
+		        "  Optionally Supported Command List and VPD are kept in 'cache_dir', one file\n"
+		        "  per UDID, or per Serial Number with -U. Only missing data is read; the cache\n"
+		        "  is dropped when the drive reports Firmware Activated or Namespace Attribute\n"
+		        "  Changed, or shows another Serial Number or Firmware Revision\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 /var/cache/aardvark\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_VPD:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [operation] <file>\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'operation' is one of:\n"
+		        "    show (read the VPD and decode its areas and MultiRecords)\n"
+		        "    dump (read the VPD into 'file')\n"
+		        "    update (write the VPD image in 'file', only bytes that differ are written)\n\n"
+		        "  The VPD is read with as few VPD Read commands as the areas it contains\n"
+		        "  allow. 'update' refuses an image with checksum errors and reads every\n"
+		        "  written range back\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 update vpd.bin\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_CP:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [primitive] <csi> <cpsp>\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'primitive' is one of pause, resume, abort, get-state or replay\n\n"
+		        "  'csi' selects the Command Slot for abort, get-state and replay\n\n"
+		        "  'cpsp' is the Control Primitive Specific Parameter, e.g. 1 clears the\n"
+		        "  error flags with get-state, or the packet offset to replay from\n\n"
+		        "  Commands without a response are aborted with the Abort primitive once\n"
+		        "  their deadline passes, and a response lost to a PEC error is replayed\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 get-state 0 1\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_NS:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [ports] [owner_eid] [cache_dir] [slv_addr] [tar_eid]\n"
+		        "                [<slv_addr> <tar_eid>]...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Lists the active namespaces of every drive with their size, capacity,\n"
+		        "  utilization and LBA format. The inventory is kept in 'cache_dir' with\n"
+		        "  the rest of the drive cache and read again after a Namespace Attribute\n"
+		        "  Changed\n\n"
+		        "  'ports' is a comma separated list of adapters, a drive address written\n"
+		        "  as <port>/<slv_addr> is on that port and on the first one otherwise.\n"
+		        "  Every adapter is run by a process of its own, so the adapters work in\n"
+		        "  parallel; the Identify commands of the drives of one adapter are\n"
+		        "  interleaved on its two command slots\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x08 /var/cache/aardvark 0x1d 0x09 0x1e 0x0a\n"
+		        "  # aardvark -cu %s 0,1 0x08 /var/cache/aardvark 0x1d 0x09 1/0x1d 0x0a\n\n"
+		        , func_name, func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_TELEMETRY:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [log] [store]\n"
+		        "                <area> <interval> <count>\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'log' is one of:\n"
+		        "    host (Telemetry Host-Initiated, the last capture)\n"
+		        "    host-create (Telemetry Host-Initiated, a new capture each time)\n"
+		        "    ctrl (Telemetry Controller-Initiated)\n\n"
+		        "  Blocks are appended to 'store'.tld and indexed in 'store'.tlx. Only Data\n"
+		        "  Areas of a new generation, or blocks an area grew by, are read; 'area' is\n"
+		        "  the last Data Area collected (default 3). With 'interval' seconds and\n"
+		        "  'count' the log is collected repeatedly, a count of 0 runs until stopped\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x1d 0x08 0x09 ctrl /var/lib/aardvark/ssd0 3 60 0\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_EVENTS:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-o <format>] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [slv_addr] [owner_eid] [tar_eid] [log] [cursor_dir]\n"
+		        "                <interval> <count>\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -o <format> (event output: text, json, binary or none)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'log' is one of:\n"
+		        "    error (Error Information)\n"
+		        "    pel (Persistent Event Log)\n"
+		        "    all (both)\n\n"
+		        "  Only entries newer than the cursor of the drive are returned, oldest\n"
+		        "  first. The cursor is kept in 'cursor_dir', one file per UDID; a poll\n"
+		        "  without news reads one error entry or the event log header. With\n"
+		        "  'interval' seconds and 'count' the logs are polled repeatedly, a count\n"
+		        "  of 0 runs until stopped\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu -o json %s 0 0x1d 0x08 0x09 all /var/lib/aardvark 60 0\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_FEATURES:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [owner_eid] [snap_dir] [baseline] [slv_addr] [tar_eid]\n"
+		        "                [<slv_addr> <tar_eid>]...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Takes a snapshot of the current, default and saved value of every\n"
+		        "  feature a drive reports Supported Capabilities for, with both command\n"
+		        "  slots in flight. Each snapshot is kept in 'snap_dir', one file per UDID,\n"
+		        "  and compared with 'baseline'; if 'baseline' does not exist the snapshot\n"
+		        "  of the first drive is written to it\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x08 /var/lib/aardvark /etc/aardvark/golden.nfsn 0x1d 0x09\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_FANOUT:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-m <topology>] [-o <format>] [-p] [-u]\n"
+		        "                [-U <path>] %s [ports] [owner_eid] [targets] [op] <params>...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes in front of the targets)\n"
+		        "    -o <format> (result output: text, json, binary or none)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Runs one op of the test-mctp script set on every target at once and\n"
+		        "  prints each result with its latency in the order of 'targets', a list\n"
+		        "  of [<port>/][<segment>:]<slv_addr>:<tar_eid> separated by commas. The\n"
+		        "  port is one of 'ports', a comma separated list of adapters, and the\n"
+		        "  first one by default\n\n"
+		        "  Every adapter is run by a process of its own, so the adapters work in\n"
+		        "  parallel. The targets of one adapter share its bus, which has at most\n"
+		        "  two commands in flight, one per command slot: N targets of an adapter\n"
+		        "  take about N/2 round trips. They are visited segment by segment, so\n"
+		        "  that every mux is switched as few times as possible\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x08 0x1d:0x09,0x1e:0x0a,0x1f:0x0b smart 1\n"
+		        "  # aardvark -cu %s 0,1 0x08 0x1d:0x09,1/0x1d:0x0a smart 1\n"
+		        "  # aardvark -cu -m rack.mux %s 0 0x08 1:0x1d:0x09,2:0x1d:0x0a smart 1\n\n"
+		        "%s"
+		        , func_name, func_name, func_name, func_name, help_topology
+		);
+		break;
+	case FUNC_IDX_DAEMON:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-m <topology>] [-o <format>] [-p] [-u]\n"
+		        "                [-U <path>] %s [port] [owner_eid] [sock] [<slv_addr> <tar_eid>]...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes, addresses are [<segment>:]<addr>)\n"
+		        "    -o <format> (default output format of the requests)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Keeps the adapter open and serves requests from 'client' on the local\n"
+		        "  socket 'sock' until a shutdown request, SIGINT or SIGTERM. Endpoints stay\n"
+		        "  assigned and discovered between requests; those listed are opened at\n"
+		        "  start. A request holds one line per session command or NVMe-MI op:\n"
+		        "    open <addr> <eid>  (bring up an endpoint, make it current)\n"
+		        "    close <addr>       (forget an endpoint)\n"
+		        "    sessions           (list the endpoints)\n"
+		        "    fanout <op> [params] (run one op on every open endpoint at once)\n"
+		        "    format <format>    (output format of the request)\n"
+		        "    shutdown           (stop the daemon)\n"
+		        "    target <addr> <eid>, <op> [params]  (as in test-mctp scripts)\n\n"
+		        "Example:\n"
+		        "  # aardvark -cu %s 0 0x08 /run/aardvark.sock 0x1d 0x09 &\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_CLIENT:
+		printf(
+		        "Usage: aardvark [-o <format>] %s [sock] [request]...\n\n"
+		        "  option is one of:\n"
+		        "    -o <format> (output format: text, json, binary or none)\n\n"
+		        "  Sends 'request' as one line to the daemon on 'sock' and prints its\n"
+		        "  output, a request of '-' is read from stdin. Exits with failure when a\n"
+		        "  line of the request failed\n\n"
+		        "Example:\n"
+		        "  # aardvark -o json %s /run/aardvark.sock smart 1\n"
+		        "  # printf 'target 0x1d 0x09\\nsubsys-health 1\\n' | aardvark %s /run/aardvark.sock -\n\n"
+		        , func_name, func_name, func_name
+		);
+		break;
+	case FUNC_IDX_SESSION:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-m <topology>] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [owner_eid] [<slv_addr> <tar_eid>]...\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes, addresses are [<segment>:]<addr>)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  Keeps the adapter open and reads one record per line from stdin until\n"
+		        "  end of file, writing one '<seq> <status> [payload]' line per record to\n"
+		        "  stdout. Records are:\n"
+		        "    i2c-write <addr> <hex>, i2c-read <addr> <len>,\n"
+		        "    i2c-write-read <addr> <hex> <len>  (payload: data read, in hex)\n"
+		        "    smb-send-byte <addr> <data>, smb-block-write <addr> <cmd> <hex>,\n"
+		        "    smb-write-byte|word|32|64 <addr> <cmd> <data>\n"
+		        "    open|target <addr> <eid>, close <addr>\n"
+		        "    <op> [params]  (test-mctp script op to the current endpoint,\n"
+		        "                    payload: the result as JSON)\n"
+		        "  Status is 0, a negative error or the NVMe-MI response status. Ops keep\n"
+		        "  both command slots busy, results stay in record order and are flushed\n"
+		        "  whenever no further record is waiting\n\n"
+		        "Example:\n"
+		        "  # printf 'smart 1\\nsubsys-health 1\\n' | aardvark -cu %s 0 0x08 0x1d 0x09\n\n"
+		        , func_name, func_name
+		);
+		break;
+	case FUNC_IDX_EEPROM:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-k] [-m <topology>] [-p] [-u] %s [port]\n"
+		        "                [slv_addr] [chip] read [offset] [length] [<file>]\n"
+		        "       aardvark [-a] [-b <bit-rate>] [-k] [-m <topology>] [-p] [-u] %s [port]\n"
+		        "                [slv_addr] [chip] write|verify [offset] [file]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes, 'slv_addr' may be <segment>:<addr>)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'chip' is 24c01, 24c02, 24c04, 24c08, 24c16, 24c32, 24c64, 24c128, 24c256,\n"
+		        "  24c512 or <size>:<page_size>:<address_bytes>\n\n"
+		        "  read dumps 'length' bytes from 'offset', or saves them to 'file'. write\n"
+		        "  programs the image in 'file' at 'offset' a page at a time, skipping the\n"
+		        "  pages that already hold it and polling the address for the end of each\n"
+		        "  write cycle, then reads it back to verify. verify only compares\n\n"
+		        "Example (Program a FRU image to a 24C256 at 0x50):\n"
+		        "  # aardvark -u -b 400 %s 0 0x50 24c256 write 0 fru.bin\n\n"
+		        , func_name, func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_EMU:
+		printf(
+		        "Usage: aardvark [-a] [-b <bit-rate>] [-c] [-k] [-p] [-u] [-U <path>] [-V] %s [port]\n"
+		        "                [own_addr] [eid] [<model_file>] [<idle_ms>]\n"
+		        "       aardvark [-c] %s bench [<count>] [<model_file>]\n\n"
+		        "  option is one of:\n"
+		        "    -a (all range address)\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n"
+		        "    -U <path> (serve MCTP on a local socket instead of the adapter)\n"
+		        "    -V (verbose)\n\n"
+		        "  The adapter answers as an NVMe-MI Management Endpoint at 'own_addr':\n"
+		        "  MCTP control messages (including Get Vendor Defined Message Support),\n"
+		        "  health status polls, Read NVMe-MI Data Structure, Configuration Set/Get,\n"
+		        "  Identify Controller, the SMART log, the temperature threshold feature and\n"
+		        "  control primitives. Responses are written back to the requester as master\n"
+		        "  writes. With -U the endpoint listens on 'path' for requesters run with\n"
+		        "  the same -U, and 'port' is not used. It runs until no request has come\n"
+		        "  for 'idle_ms', or forever\n\n"
+		        "  'model_file' has one '<key> <value>' per line, '-' keeps the default:\n"
+		        "    vid, ssvid, did, ssid, sn, mn, fr, cntlid, nn, wctemp, cctemp, ctemp,\n"
+		        "    pdlu, spare, spare_thresh, cwarn, rdy, poh, power_cycles, mtus_max\n"
+		        "  Temperatures are in degrees Celsius\n\n"
+		        "  bench feeds 'count' rounds of five requests to the responder without an\n"
+		        "  adapter and reports the time per request\n\n"
+		        "Example (Two adapters back to back, port 1 emulates the drive at 0x1d):\n"
+		        "  # aardvark -u -c %s 1 0x1d 0x09 - 60000 &\n"
+		        "  # aardvark -u -c nvme-cache 0 0x1d 0x08 0x09 cache\n\n"
+		        "Example (The same over a local socket, no adapter):\n"
+		        "  # aardvark -U /tmp/emu.sock %s 0 0x1d 0x09 &\n"
+		        "  # aardvark -U /tmp/emu.sock nvme-cp 0 0x1d 0x08 0x09 get-state 0 0\n\n"
+		        , func_name, func_name, func_name, func_name
+		);
+		break;
+	case FUNC_IDX_NVME_MONITOR:
+		printf(
+		        "Usage: aardvark [-b <bit-rate>] [-c] [-k] [-o <format>] [-p] [-u] [-U <path>] %s\n"
+		        "                [port] [owner_eid] [plan_file] [<duration_ms>]\n\n"
+		        "  option is one of:\n"
+		        "    -b <bit-rate> (bit rate)\n"
+		        "    -c (pec)\n"
+		        "    -k (keep target power)\n"
+		        "    -o <format> (response output: text, json, binary or none)\n"
+		        "    -p (enable target power)\n"
+		        "    -u (pull-up SCL and SDA)\n\n"
+		        "  'plan_file' has one statement per line:\n"
+		        "    budget <percent>                        (bus time the monitor may use)\n"
+		        "    aem <aeid>...                           (enable asynchronous events)\n"
+		        "    drive <slv_addr> <eid>                  (following commands poll this drive)\n"
+		        "    <command> <period_ms> <prio> [change]   (change: only after a health change or event)\n"
+		        "  'command' is one of subsys-health, ctrl-health, smart, temp-thresh\n\n"
+		        "  'duration_ms' stops the monitor after that time, 0 or none runs forever\n\n"
 		        "Example:\n"
-		        "  # aardvark -kcpu %s 0 0x1d 0x08 0x09\n\n"
+		        "  # aardvark -cu -o json %s 0 0x08 plan.txt 60000\n\n"
 		        , func_name, func_name
 		);
 		break;
@@ -253,10 +727,15 @@ void help(int func_idx)
 		        "    -b <bit-rate> (bit rate)\n"
 		        "    -c (pec)\n"
 		        "    -d (directed)\n"
+		        "    -i <file> (MCTP endpoint inventory, default ./" MCTP_INVENTORY_FILE
+		        " in the working directory)\n"
 		        "    -k (keep target power)\n"
+		        "    -m <topology> (I2C muxes, an address <segment>:<addr> is behind them)\n"
+		        "    -o <format> (NVMe-MI response output: text, json, binary or none)\n"
 		        "    -p (enable target power)\n"
 		        "    -s (enable I2C slave mode)\n"
 		        "    -u (pull-up SCL and SDA)\n"
+		        "    -U <path> (MCTP over unix domain socket instead of the adapter)\n"
 		);
 		break;
 	}
@@ -2,7 +2,70 @@
 #define I2C_H
 
 #include "aardvark.h"
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
 
-int scan_i2c_bus(Aardvark handle);
+#define I2C_ADDR_NUM                    (128)
+#define I2C_BITMAP_SIZE                 (I2C_ADDR_NUM / 8)
+// Range of i2cdetect, the reserved addresses are left out
+#define I2C_SCAN_FIRST                  (0x03)
+#define I2C_SCAN_LAST                   (0x77)
+#define I2C_SCAN_PORT_MAX               (16)
+// Seconds between the full sweeps of a cached scan
+#define I2C_SCAN_MAX_AGE                (60)
+
+enum i2c_error {
+	I2C_SUCCESS = 0,
+	I2C_ERR_PARAM,
+	I2C_ERR_IO,
+};
+
+enum i2c_scan_mode {
+	I2C_SCAN_AUTO = 0,              // Receive byte at 0x30-0x37 and 0x50-0x5f, quick write elsewhere
+	I2C_SCAN_QUICK,                 // Quick write
+	I2C_SCAN_READ,                  // Receive byte
+	I2C_SCAN_MODE_MAX,
+};
+
+/**
+ * Bit n of a bitmap (byte n / 8, bit n % 8) stands for address n. Printed as
+ * one hex number, address 0 is the least significant bit.
+ */
+#define i2c_bitmap_test(map, addr)      (((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+#define i2c_bitmap_set(map, addr)       ((map)[(addr) >> 3] |= 1 << ((addr) & 7))
+#define i2c_bitmap_clear(map, addr)     ((map)[(addr) >> 3] &= ~(1 << ((addr) & 7)))
+
+/**
+ * The scan of one adapter, or one mux segment of it. Addresses of a cache entry younger than max_age
+ * are only probed again if they were present, the ones seen absent keep
+ * that state until the next full sweep.
+ */
+struct i2c_scan {
+	Aardvark handle;
+	int port;
+	int seg;                        // Mux segment, see i2c_mux
+	enum i2c_scan_mode mode;
+	uint32_t max_age;               // Seconds between full sweeps, 0 to always probe everything
+	u8 want[I2C_BITMAP_SIZE];       // Addresses to look at, a range or a list of known ones
+	u8 present[I2C_BITMAP_SIZE];
+	u8 cached[I2C_BITMAP_SIZE];     // Addresses with a known state
+	uint64_t swept;                 // Time of the last full sweep
+	// Last run
+	u8 probed[I2C_BITMAP_SIZE];
+	uint32_t elapsed_us;
+	int ret;
+};
+
+const char *i2c_scan_mode_name(enum i2c_scan_mode mode);
+int i2c_scan_parse_mode(const char *text);
+int i2c_scan_parse_addr(u8 *want, const char *text, bool all_addr);
+void i2c_scan_init(struct i2c_scan *scan, Aardvark handle, int port, int seg,
+                   enum i2c_scan_mode mode, const u8 *want, uint32_t max_age);
+int i2c_scan_run(struct i2c_scan *scan);
+int i2c_scan_run_all(struct i2c_scan *scan, int n);
+void i2c_scan_show(const struct i2c_scan *scan, bool json);
+int i2c_scan_cache_load(const char *path, struct i2c_scan *scan, int n);
+int i2c_scan_cache_save(const char *path, const struct i2c_scan *scan, int n);
 
 #endif  // I2C_H
@@ -0,0 +1,277 @@
+#include "aardvark.h"
+#include "smbus.h"
+#include "utility.h"
+#include "types.h"
+#include "i2c_eeprom.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *name;
+	uint32_t size;
+	u16 page_size;
+	u8 addr_len;
+} i2c_eeprom_chips[] = {
+	{"24c01",  128,   8,   1},
+	{"24c02",  256,   8,   1},
+	{"24c04",  512,   16,  1},
+	{"24c08",  1024,  16,  1},
+	{"24c16",  2048,  16,  1},
+	{"24c32",  4096,  32,  2},
+	{"24c64",  8192,  32,  2},
+	{"24c128", 16384, 64,  2},
+	{"24c256", 32768, 64,  2},
+	{"24c512", 65536, 128, 2},
+};
+
+/**
+ * chip is one of the parts of the table or <size>:<page_size>:<addr_len> for
+ * any other.
+ */
+int i2c_eeprom_init(struct i2c_eeprom *ee, Aardvark handle, u8 slv_addr, const char *chip)
+{
+	unsigned long size, page_size, addr_len;
+	char *end;
+
+	memset(ee, 0, sizeof(*ee));
+	ee->handle = handle;
+	ee->slv_addr = slv_addr;
+	ee->write_timeout_us = I2C_EEPROM_WRITE_TIMEOUT_US;
+
+	for (int i = 0; i < sizeof(i2c_eeprom_chips) / sizeof(i2c_eeprom_chips[0]); i++) {
+		if (strcmp(chip, i2c_eeprom_chips[i].name))
+			continue;
+		size = i2c_eeprom_chips[i].size;
+		page_size = i2c_eeprom_chips[i].page_size;
+		addr_len = i2c_eeprom_chips[i].addr_len;
+		goto check;
+	}
+
+	size = strtoul(chip, &end, 0);
+	if (*end != ':')
+		return -I2C_EEPROM_ERR_PARAM;
+	page_size = strtoul(end + 1, &end, 0);
+	if (*end != ':')
+		return -I2C_EEPROM_ERR_PARAM;
+	addr_len = strtoul(end + 1, &end, 0);
+	if (*end)
+		return -I2C_EEPROM_ERR_PARAM;
+
+check:
+	if ((addr_len != 1 && addr_len != 2) || !page_size || page_size > I2C_EEPROM_PAGE_MAX ||
+	    (page_size & (page_size - 1)) || !size || size > I2C_EEPROM_SIZE_MAX || size % page_size)
+		return -I2C_EEPROM_ERR_PARAM;
+
+	// Up to three offset bits go to the slave address, which has to leave them clear.
+	if (addr_len == 1 && (size > 2048 || (slv_addr & ((size - 1) >> 8))))
+		return -I2C_EEPROM_ERR_PARAM;
+
+	ee->size = size;
+	ee->page_size = page_size;
+	ee->addr_len = addr_len;
+
+	return I2C_EEPROM_SUCCESS;
+}
+
+// Put the word address of offset in out, return the slave address to send it to.
+static u8 i2c_eeprom_addr(const struct i2c_eeprom *ee, uint32_t offset, u8 *out)
+{
+	if (ee->addr_len == 2) {
+		out[0] = offset >> 8;
+		out[1] = offset;
+		return ee->slv_addr;
+	}
+
+	out[0] = offset;
+	return ee->slv_addr | (offset >> 8);
+}
+
+// Sequential reads, one transfer per chunk with the word address in front.
+int i2c_eeprom_read(struct i2c_eeprom *ee, uint32_t offset, u8 *buf, uint32_t len)
+{
+	u16 num_written, num_read;
+	uint32_t n;
+	u8 out[2], dev;
+	int status;
+
+	if (offset > ee->size || len > ee->size - offset)
+		return -I2C_EEPROM_ERR_PARAM;
+
+	while (len) {
+		n = len < I2C_EEPROM_READ_CHUNK ? len : I2C_EEPROM_READ_CHUNK;
+		// One address byte reaches 256 bytes, the next block has another slave address.
+		if (ee->addr_len == 1 && n > 256 - (offset & 0xFF))
+			n = 256 - (offset & 0xFF);
+
+		dev = i2c_eeprom_addr(ee, offset, out);
+		status = aa_i2c_write_read(ee->handle, dev, AA_I2C_NO_FLAGS, ee->addr_len, out,
+		                           &num_written, n, buf, &num_read);
+		if (status || num_read != n) {
+			smbus_trace(ERROR, "eeprom %02x read at %04x (%d)\n", dev, offset, status);
+			return -I2C_EEPROM_ERR_IO;
+		}
+
+		offset += n;
+		buf += n;
+		len -= n;
+	}
+
+	return I2C_EEPROM_SUCCESS;
+}
+
+/**
+ * The device does not ack its address while the write cycle runs, the first
+ * ack ends the wait.
+ */
+static int i2c_eeprom_poll(struct i2c_eeprom *ee, u8 dev)
+{
+	uint64_t start = time_us();
+	int status;
+
+	do {
+		ee->polls++;
+		status = aa_i2c_write_ext(ee->handle, dev, AA_I2C_NO_FLAGS, 0, NULL, NULL);
+		if (status == AA_I2C_STATUS_OK)
+			return I2C_EEPROM_SUCCESS;
+		if (status < 0)
+			return -I2C_EEPROM_ERR_IO;
+	} while (time_us() - start < ee->write_timeout_us);
+
+	smbus_trace(ERROR, "eeprom %02x write cycle timeout\n", dev);
+
+	return -I2C_EEPROM_ERR_TIMEOUT;
+}
+
+/**
+ * Write data page by page, leaving alone the pages that already hold it.
+ * The current contents come from one sequential read, and each page write
+ * is followed by ACK polling instead of a fixed delay, so programming takes
+ * as long as the write cycles of the device.
+ */
+int i2c_eeprom_write(struct i2c_eeprom *ee, uint32_t offset, const u8 *data, uint32_t len)
+{
+	u8 out[2 + I2C_EEPROM_PAGE_MAX], dev, *cur;
+	uint64_t start = time_us();
+	uint32_t pos = 0, n;
+	u16 num_written;
+	int status, ret;
+
+	if (offset > ee->size || len > ee->size - offset)
+		return -I2C_EEPROM_ERR_PARAM;
+
+	ee->pages_written = 0;
+	ee->pages_skipped = 0;
+	ee->polls = 0;
+
+	cur = malloc(len ? len : 1);
+	if (!cur)
+		return -I2C_EEPROM_ERR_IO;
+
+	ret = i2c_eeprom_read(ee, offset, cur, len);
+
+	while (!ret && pos < len) {
+		// Up to the end of the page, a write wraps around within its page.
+		n = ee->page_size - (offset + pos) % ee->page_size;
+		if (n > len - pos)
+			n = len - pos;
+
+		if (!memcmp(cur + pos, data + pos, n)) {
+			ee->pages_skipped++;
+			pos += n;
+			continue;
+		}
+
+		dev = i2c_eeprom_addr(ee, offset + pos, out);
+		memcpy(out + ee->addr_len, data + pos, n);
+		status = aa_i2c_write_ext(ee->handle, dev, AA_I2C_NO_FLAGS, ee->addr_len + n, out,
+		                          &num_written);
+		if (status || num_written != ee->addr_len + n) {
+			smbus_trace(ERROR, "eeprom %02x write at %04x (%d)\n", dev, offset + pos, status);
+			ret = -I2C_EEPROM_ERR_IO;
+			break;
+		}
+
+		ret = i2c_eeprom_poll(ee, dev);
+		ee->pages_written++;
+		pos += n;
+	}
+
+	free(cur);
+	ee->elapsed_us = time_us() - start;
+
+	return ret;
+}
+
+int i2c_eeprom_verify(struct i2c_eeprom *ee, uint32_t offset, const u8 *data, uint32_t len)
+{
+	uint64_t start = time_us();
+	u8 *cur;
+	int ret;
+
+	cur = malloc(len ? len : 1);
+	if (!cur)
+		return -I2C_EEPROM_ERR_IO;
+
+	ret = i2c_eeprom_read(ee, offset, cur, len);
+	for (uint32_t i = 0; !ret && i < len; i++) {
+		if (cur[i] != data[i]) {
+			ee->mismatch = offset + i;
+			smbus_trace(ERROR, "eeprom %04x: %02x, expected %02x\n", offset + i, cur[i], data[i]);
+			ret = -I2C_EEPROM_ERR_VERIFY;
+		}
+	}
+
+	free(cur);
+	ee->elapsed_us = time_us() - start;
+
+	return ret;
+}
+
+// Read an image of at most size bytes.
+int i2c_eeprom_load(const char *path, u8 *buf, uint32_t size, uint32_t *len)
+{
+	FILE *fp = fopen(path, "rb");
+	int ret = I2C_EEPROM_SUCCESS;
+
+	if (!fp) {
+		smbus_trace(ERROR, "fopen %s\n", path);
+		return -I2C_EEPROM_ERR_IO;
+	}
+
+	*len = fread(buf, 1, size, fp);
+	if (ferror(fp))
+		ret = -I2C_EEPROM_ERR_IO;
+	else if (fgetc(fp) != EOF)
+		ret = -I2C_EEPROM_ERR_PARAM;
+	fclose(fp);
+
+	if (ret == -I2C_EEPROM_ERR_PARAM)
+		smbus_trace(ERROR, "%s is larger than %u bytes\n", path, size);
+
+	return ret;
+}
+
+void i2c_eeprom_dump(uint32_t offset, const u8 *buf, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++) {
+		if ((i & 0x0F) == 0)
+			printf("%s%04x:  ", i ? "\n" : "", offset + i);
+		printf("%02x ", buf[i]);
+		if (((i + 1) & 0x07) == 0)
+			printf(" ");
+	}
+	printf("\n");
+}
+
+void i2c_eeprom_show(const struct i2c_eeprom *ee)
+{
+	printf("Size                        : %u bytes\n", ee->size);
+	printf("Page Size                   : %d bytes\n", ee->page_size);
+	printf("Address Bytes               : %d\n", ee->addr_len);
+	printf("Pages Written               : %u\n", ee->pages_written);
+	printf("Pages Skipped               : %u\n", ee->pages_skipped);
+	printf("Write Cycle Polls           : %u\n", ee->polls);
+	printf("Elapsed                     : %llu us\n", (unsigned long long)ee->elapsed_us);
+}
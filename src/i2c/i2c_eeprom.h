@@ -0,0 +1,51 @@
+#ifndef I2C_EEPROM_H
+#define I2C_EEPROM_H
+
+#include "aardvark.h"
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define I2C_EEPROM_PAGE_MAX             (256)
+#define I2C_EEPROM_SIZE_MAX             (64 * 1024)
+// Longest write cycle waited for, datasheets give 5 - 10 ms
+#define I2C_EEPROM_WRITE_TIMEOUT_US     (25000)
+// Largest sequential read of one transfer
+#define I2C_EEPROM_READ_CHUNK           (32 * 1024)
+
+enum i2c_eeprom_error {
+	I2C_EEPROM_SUCCESS = 0,
+	I2C_EEPROM_ERR_PARAM,
+	I2C_EEPROM_ERR_IO,
+	I2C_EEPROM_ERR_TIMEOUT,
+	I2C_EEPROM_ERR_VERIFY,
+};
+
+/**
+ * A 24Cxx style EEPROM. With one address byte, the bits of the offset above
+ * the first 256 bytes go to the low bits of the slave address (24C04 - 24C16).
+ */
+struct i2c_eeprom {
+	Aardvark handle;
+	u8 slv_addr;
+	u8 addr_len;                    // Word address bytes, 1 or 2
+	u16 page_size;
+	uint32_t size;
+	uint32_t write_timeout_us;
+	// Last operation
+	uint32_t pages_written;
+	uint32_t pages_skipped;
+	uint32_t polls;                 // Address ACK polls while write cycles were running
+	uint32_t mismatch;              // Offset of the first byte that failed to verify
+	uint64_t elapsed_us;
+};
+
+int i2c_eeprom_init(struct i2c_eeprom *ee, Aardvark handle, u8 slv_addr, const char *chip);
+int i2c_eeprom_read(struct i2c_eeprom *ee, uint32_t offset, u8 *buf, uint32_t len);
+int i2c_eeprom_write(struct i2c_eeprom *ee, uint32_t offset, const u8 *data, uint32_t len);
+int i2c_eeprom_verify(struct i2c_eeprom *ee, uint32_t offset, const u8 *data, uint32_t len);
+int i2c_eeprom_load(const char *path, u8 *buf, uint32_t size, uint32_t *len);
+void i2c_eeprom_dump(uint32_t offset, const u8 *buf, uint32_t len);
+void i2c_eeprom_show(const struct i2c_eeprom *ee);
+
+#endif  // I2C_EEPROM_H
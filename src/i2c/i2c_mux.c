@@ -0,0 +1,377 @@
+#include "aardvark.h"
+#include "smbus.h"
+#include "types.h"
+#include "i2c_mux.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const struct {
+	const char *name;
+	u8 channels;
+} i2c_mux_types[I2C_MUX_TYPE_MAX] = {
+	[I2C_MUX_PCA9548] = {"pca9548", 8},
+	[I2C_MUX_PCA9546] = {"pca9546", 4},
+	[I2C_MUX_PCA9544] = {"pca9544", 4},
+	[I2C_MUX_PCA9542] = {"pca9542", 2},
+};
+
+static struct i2c_mux_bus *i2c_mux_bus_list[I2C_MUX_BUS_MAX];
+
+const char *i2c_mux_type_name(enum i2c_mux_type type)
+{
+	return type < I2C_MUX_TYPE_MAX ? i2c_mux_types[type].name : "unknown";
+}
+
+static int i2c_mux_parse_type(const char *text)
+{
+	for (int i = 0; i < I2C_MUX_TYPE_MAX; i++)
+		if (!strcmp(text, i2c_mux_types[i].name))
+			return i;
+
+	return -I2C_MUX_ERR_SYNTAX;
+}
+
+// Number the segments depth first from seg, so the ones behind a mux are next to each other.
+static void i2c_mux_rank_segment(struct i2c_mux_bus *bus, int seg, int *rank)
+{
+	bus->seg[seg].rank = (*rank)++;
+
+	for (int m = 0; m < bus->nmux; m++) {
+		if (bus->mux[m].parent != seg)
+			continue;
+		for (int c = 0; c < i2c_mux_types[bus->mux[m].type].channels; c++)
+			for (int i = 0; i < I2C_MUX_SEGMENT_MAX; i++)
+				if (bus->seg[i].used && bus->seg[i].mux == m && bus->seg[i].channel == c)
+					i2c_mux_rank_segment(bus, i, rank);
+	}
+}
+
+/**
+ * One segment per line: <segment> <parent_segment> <mux_addr> <channel> [<type>].
+ * The mux is the one at mux_addr on the parent segment, a pca9548 unless
+ * another type is given. Segment 0 is the adapter's own bus.
+ */
+int i2c_mux_load(struct i2c_mux_bus *bus, Aardvark handle, const char *path)
+{
+	char line[128], type_name[16];
+	int seg, parent, addr, channel, type, m, n, rank = 0, lineno = 0;
+	int ret = I2C_MUX_SUCCESS;
+	FILE *fp;
+
+	memset(bus, 0, sizeof(*bus));
+	bus->handle = handle;
+	bus->cur = -1;
+	bus->seg[I2C_MUX_SEGMENT_ROOT].used = true;
+	bus->seg[I2C_MUX_SEGMENT_ROOT].mux = -1;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		smbus_trace(ERROR, "fopen %s\n", path);
+		return -I2C_MUX_ERR_IO;
+	}
+
+	while (!ret && fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#')
+			continue;
+
+		n = sscanf(line, "%i %i %i %i %15s", &seg, &parent, &addr, &channel, type_name);
+		if (n <= 0)
+			continue;
+
+		type = n == 5 ? i2c_mux_parse_type(type_name) : I2C_MUX_PCA9548;
+		if (n < 4 || type < 0 || seg <= I2C_MUX_SEGMENT_ROOT || seg >= I2C_MUX_SEGMENT_MAX ||
+		    bus->seg[seg].used || parent < 0 || parent >= I2C_MUX_SEGMENT_MAX ||
+		    !bus->seg[parent].used || bus->seg[parent].depth == I2C_MUX_DEPTH_MAX ||
+		    addr < 0 || addr > 0x7F || channel < 0 || channel >= i2c_mux_types[type].channels) {
+			ret = -I2C_MUX_ERR_SYNTAX;
+			break;
+		}
+
+		// A mux is known by the segment it sits on and its address.
+		for (m = 0; m < bus->nmux; m++)
+			if (bus->mux[m].parent == parent && bus->mux[m].addr == addr)
+				break;
+		if (m == bus->nmux) {
+			if (bus->nmux == I2C_MUX_MAX) {
+				ret = -I2C_MUX_ERR_SYNTAX;
+				break;
+			}
+			bus->mux[m].addr = addr;
+			bus->mux[m].type = type;
+			bus->mux[m].parent = parent;
+			bus->mux[m].ctrl = -1;
+			bus->nmux++;
+		} else if (bus->mux[m].type != type) {
+			ret = -I2C_MUX_ERR_SYNTAX;
+			break;
+		}
+
+		for (int i = 0; i < I2C_MUX_SEGMENT_MAX; i++)
+			if (bus->seg[i].used && bus->seg[i].mux == m && bus->seg[i].channel == channel)
+				ret = -I2C_MUX_ERR_SYNTAX;
+
+		bus->seg[seg].used = true;
+		bus->seg[seg].mux = m;
+		bus->seg[seg].channel = channel;
+		bus->seg[seg].depth = bus->seg[parent].depth + 1;
+	}
+	fclose(fp);
+
+	if (ret) {
+		smbus_trace(ERROR, "%s:%d: invalid segment\n", path, lineno);
+		return ret;
+	}
+
+	i2c_mux_rank_segment(bus, I2C_MUX_SEGMENT_ROOT, &rank);
+
+	return I2C_MUX_SUCCESS;
+}
+
+// Make the topology the one used for the addresses with a segment on its adapter.
+int i2c_mux_attach(struct i2c_mux_bus *bus)
+{
+	int slot = -1;
+
+	for (int i = 0; i < I2C_MUX_BUS_MAX; i++) {
+		if (i2c_mux_bus_list[i] && i2c_mux_bus_list[i]->handle == bus->handle) {
+			i2c_mux_bus_list[i] = bus;
+			return I2C_MUX_SUCCESS;
+		}
+		if (!i2c_mux_bus_list[i] && slot < 0)
+			slot = i;
+	}
+
+	if (slot < 0)
+		return -I2C_MUX_ERR_PARAM;
+	i2c_mux_bus_list[slot] = bus;
+
+	return I2C_MUX_SUCCESS;
+}
+
+void i2c_mux_detach(Aardvark handle)
+{
+	for (int i = 0; i < I2C_MUX_BUS_MAX; i++)
+		if (i2c_mux_bus_list[i] && i2c_mux_bus_list[i]->handle == handle)
+			i2c_mux_bus_list[i] = NULL;
+}
+
+struct i2c_mux_bus *i2c_mux_get(Aardvark handle)
+{
+	for (int i = 0; i < I2C_MUX_BUS_MAX; i++)
+		if (i2c_mux_bus_list[i] && i2c_mux_bus_list[i]->handle == handle)
+			return i2c_mux_bus_list[i];
+
+	return NULL;
+}
+
+static u8 i2c_mux_ctrl(const struct i2c_mux *mux, u8 channel)
+{
+	if (mux->type == I2C_MUX_PCA9548 || mux->type == I2C_MUX_PCA9546)
+		return 1 << channel;
+
+	return 0x04 | channel;
+}
+
+// Write the control register, unless it already holds ctrl.
+static int i2c_mux_write(struct i2c_mux_bus *bus, int m, u8 ctrl)
+{
+	struct i2c_mux *mux = &bus->mux[m];
+	u16 num_written = 0;
+	int status;
+
+	if (mux->ctrl == ctrl)
+		return I2C_MUX_SUCCESS;
+
+	status = aa_i2c_write_ext(bus->handle, mux->addr, AA_I2C_NO_FLAGS, 1, &ctrl, &num_written);
+	if (status || num_written != 1) {
+		smbus_trace(ERROR, "mux %02x on segment %d (%d)\n", mux->addr, mux->parent, status);
+		mux->ctrl = -1;
+		return -I2C_MUX_ERR_IO;
+	}
+
+	mux->ctrl = ctrl;
+	bus->writes++;
+
+	return I2C_MUX_SUCCESS;
+}
+
+// Turn off the muxes of a segment that was just connected, but the one in use next.
+static int i2c_mux_quiet(struct i2c_mux_bus *bus, int seg, int next)
+{
+	int ret;
+
+	for (int m = 0; m < bus->nmux; m++) {
+		if (bus->mux[m].parent != seg || m == next)
+			continue;
+		ret = i2c_mux_write(bus, m, 0);
+		if (ret)
+			return ret;
+	}
+
+	return I2C_MUX_SUCCESS;
+}
+
+// Segments from the first behind the root to seg.
+static int i2c_mux_path(const struct i2c_mux_bus *bus, int seg, u8 *path)
+{
+	int depth = bus->seg[seg].depth;
+
+	for (int i = depth - 1; i >= 0; i--) {
+		path[i] = seg;
+		seg = bus->mux[bus->seg[seg].mux].parent;
+	}
+
+	return depth;
+}
+
+/**
+ * Nothing is known of the muxes, which may have been left on by someone
+ * else: turn the ones on the root off, the deeper ones are turned off as
+ * their segments get connected.
+ */
+int i2c_mux_reset(struct i2c_mux_bus *bus)
+{
+	int ret;
+
+	for (int m = 0; m < bus->nmux; m++)
+		bus->mux[m].ctrl = -1;
+
+	bus->cur = -1;
+	ret = i2c_mux_quiet(bus, I2C_MUX_SEGMENT_ROOT, -1);
+	if (!ret)
+		bus->cur = I2C_MUX_SEGMENT_ROOT;
+
+	return ret;
+}
+
+/**
+ * Switch the bus to seg. Only the muxes where the paths to the old and the
+ * new segment part are written: the ones of the old path are turned off from
+ * the deepest up while they can still be reached, then the new path is
+ * turned on from the root down.
+ */
+int i2c_mux_select(struct i2c_mux_bus *bus, int seg)
+{
+	u8 old[I2C_MUX_DEPTH_MAX], new[I2C_MUX_DEPTH_MAX];
+	int nold, nnew, k, i, m, next, ret;
+
+	if (seg < 0 || seg >= I2C_MUX_SEGMENT_MAX || !bus->seg[seg].used)
+		return -I2C_MUX_ERR_PARAM;
+
+	if (seg == bus->cur)
+		return I2C_MUX_SUCCESS;
+
+	if (bus->cur < 0) {
+		ret = i2c_mux_reset(bus);
+		if (ret)
+			return ret;
+	}
+
+	nold = i2c_mux_path(bus, bus->cur, old);
+	nnew = i2c_mux_path(bus, seg, new);
+	for (k = 0; k < nold && k < nnew && old[k] == new[k]; k++)
+		;
+
+	for (i = nold - 1; i >= k; i--) {
+		m = bus->seg[old[i]].mux;
+		// Where the paths part on one mux, it only changes channel.
+		if (i == k && i < nnew && bus->seg[new[i]].mux == m)
+			break;
+		ret = i2c_mux_write(bus, m, 0);
+		if (ret)
+			goto fail;
+	}
+
+	for (i = k; i < nnew; i++) {
+		m = bus->seg[new[i]].mux;
+		next = i + 1 < nnew ? bus->seg[new[i + 1]].mux : -1;
+		ret = i2c_mux_write(bus, m, i2c_mux_ctrl(&bus->mux[m], bus->seg[new[i]].channel));
+		if (!ret)
+			ret = i2c_mux_quiet(bus, new[i], next);
+		if (ret)
+			goto fail;
+	}
+
+	bus->cur = seg;
+	bus->selects++;
+
+	return I2C_MUX_SUCCESS;
+
+fail:
+	bus->cur = -1;
+	return ret;
+}
+
+// Switch the adapter to seg, an adapter without muxes only has the root.
+int i2c_mux_route(Aardvark handle, int seg)
+{
+	struct i2c_mux_bus *bus = i2c_mux_get(handle);
+
+	if (!bus)
+		return seg == I2C_MUX_SEGMENT_ROOT ? I2C_MUX_SUCCESS : -I2C_MUX_ERR_PARAM;
+
+	return i2c_mux_select(bus, seg);
+}
+
+// Segment the adapter is switched to, the root without muxes or in an unknown state.
+int i2c_mux_current(Aardvark handle)
+{
+	struct i2c_mux_bus *bus = i2c_mux_get(handle);
+
+	return bus && bus->cur > 0 ? bus->cur : I2C_MUX_SEGMENT_ROOT;
+}
+
+// Sort key of work on seg, going through the segments in rank order switches the least.
+int i2c_mux_rank(Aardvark handle, int seg)
+{
+	struct i2c_mux_bus *bus = i2c_mux_get(handle);
+
+	if (!bus || seg < 0 || seg >= I2C_MUX_SEGMENT_MAX || !bus->seg[seg].used)
+		return seg;
+
+	return bus->seg[seg].rank;
+}
+
+// [<segment>:]<address>, an address without a segment is on the root.
+int i2c_mux_parse_addr(const char *text, int *seg, int *addr)
+{
+	char *end;
+	long val = strtol(text, &end, 0);
+
+	*seg = I2C_MUX_SEGMENT_ROOT;
+	if (*end == ':') {
+		if (end == text || val < 0 || val >= I2C_MUX_SEGMENT_MAX)
+			return -I2C_MUX_ERR_SYNTAX;
+		*seg = val;
+		text = end + 1;
+		val = strtol(text, &end, 0);
+	}
+
+	if (*end || end == text || val < 0 || val > 0x7F)
+		return -I2C_MUX_ERR_SYNTAX;
+	*addr = val;
+
+	return I2C_MUX_SUCCESS;
+}
+
+void i2c_mux_show(const struct i2c_mux_bus *bus)
+{
+	printf("Muxes                       : %d\n", bus->nmux);
+	printf("Selected Segment            : %d\n", bus->cur);
+	printf("Segment Changes             : %d\n", bus->selects);
+	printf("Control Writes              : %d\n", bus->writes);
+	printf("  %-4s %-6s %-4s %-8s %s\n", "seg", "parent", "mux", "type", "channel");
+	for (int i = 1; i < I2C_MUX_SEGMENT_MAX; i++) {
+		const struct i2c_mux_segment *s = &bus->seg[i];
+		const struct i2c_mux *mux;
+
+		if (!s->used)
+			continue;
+		mux = &bus->mux[s->mux];
+		printf("%c %-4d %-6d %02x   %-8s %d\n", i == bus->cur ? '*' : ' ', i, mux->parent,
+		       mux->addr, i2c_mux_type_name(mux->type), s->channel);
+	}
+}
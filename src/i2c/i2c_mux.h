@@ -0,0 +1,75 @@
+#ifndef I2C_MUX_H
+#define I2C_MUX_H
+
+#include "aardvark.h"
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define I2C_MUX_MAX                     (16)
+// Segment 0 is the bus of the adapter itself
+#define I2C_MUX_SEGMENT_MAX             (64)
+#define I2C_MUX_SEGMENT_ROOT            (0)
+#define I2C_MUX_DEPTH_MAX               (4)
+// Adapters with a topology attached
+#define I2C_MUX_BUS_MAX                 (16)
+
+enum i2c_mux_error {
+	I2C_MUX_SUCCESS = 0,
+	I2C_MUX_ERR_PARAM,
+	I2C_MUX_ERR_SYNTAX,
+	I2C_MUX_ERR_IO,
+};
+
+enum i2c_mux_type {
+	I2C_MUX_PCA9548 = 0,            // 8 channels, one enable bit each
+	I2C_MUX_PCA9546,                // 4 channels, one enable bit each
+	I2C_MUX_PCA9544,                // 4 channels, enable bit and channel number
+	I2C_MUX_PCA9542,                // 2 channels, enable bit and channel number
+	I2C_MUX_TYPE_MAX,
+};
+
+struct i2c_mux {
+	u8 addr;
+	u8 type;
+	u8 parent;                      // Segment the mux sits on
+	s16 ctrl;                       // Control register as last written, -1 if not known
+};
+
+struct i2c_mux_segment {
+	bool used;
+	s8 mux;                         // Mux the segment is a channel of, -1 for the root
+	u8 channel;
+	u8 depth;
+	u8 rank;                        // Depth-first order, segments behind one mux are next to each other
+};
+
+/**
+ * The muxes of one adapter and the segment the bus is switched to. Only
+ * the segments on the path to the selected one are enabled, every other
+ * mux that can be reached has all of its channels off.
+ */
+struct i2c_mux_bus {
+	Aardvark handle;
+	u8 nmux;
+	struct i2c_mux mux[I2C_MUX_MAX];
+	struct i2c_mux_segment seg[I2C_MUX_SEGMENT_MAX];
+	int cur;                        // Selected segment, -1 until the muxes are in a known state
+	uint32_t selects;               // Segment changes
+	uint32_t writes;                // Control register writes
+};
+
+const char *i2c_mux_type_name(enum i2c_mux_type type);
+int i2c_mux_load(struct i2c_mux_bus *bus, Aardvark handle, const char *path);
+int i2c_mux_attach(struct i2c_mux_bus *bus);
+void i2c_mux_detach(Aardvark handle);
+struct i2c_mux_bus *i2c_mux_get(Aardvark handle);
+int i2c_mux_reset(struct i2c_mux_bus *bus);
+int i2c_mux_select(struct i2c_mux_bus *bus, int seg);
+int i2c_mux_route(Aardvark handle, int seg);
+int i2c_mux_current(Aardvark handle);
+int i2c_mux_rank(Aardvark handle, int seg);
+int i2c_mux_parse_addr(const char *text, int *seg, int *addr);
+void i2c_mux_show(const struct i2c_mux_bus *bus);
+
+#endif  // I2C_MUX_H
@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 // #include <linux/i2c.h>
 // #include <linux/i2c-dev.h>
 // #include <i2c/smbus.h>
@@ -36,95 +38,388 @@
 #include "smbus.h"
 #include "global.h"
 #include "types.h"
+#include "utility.h"
+#include "i2c.h"
+#include "i2c_mux.h"
 
-#define MODE_AUTO       0
-#define MODE_QUICK      1
-#define MODE_READ       2
-#define MODE_FUNC       3
+static const char *i2c_scan_mode_names[I2C_SCAN_MODE_MAX] = {
+	[I2C_SCAN_AUTO] = "auto",
+	[I2C_SCAN_QUICK] = "quick",
+	[I2C_SCAN_READ] = "read",
+};
 
+const char *i2c_scan_mode_name(enum i2c_scan_mode mode)
+{
+	return mode < I2C_SCAN_MODE_MAX ? i2c_scan_mode_names[mode] : "unknown";
+}
+
+int i2c_scan_parse_mode(const char *text)
+{
+	for (int i = 0; i < I2C_SCAN_MODE_MAX; i++)
+		if (!strcmp(text, i2c_scan_mode_names[i]))
+			return i;
+
+	return -I2C_ERR_PARAM;
+}
+
+/**
+ * "-" for the default range, "<first>-<last>" for a range, or a comma
+ * separated list of the known addresses to look at.
+ */
+int i2c_scan_parse_addr(u8 *want, const char *text, bool all_addr)
+{
+	int min = all_addr ? 0x00 : I2C_SCAN_FIRST;
+	int max = all_addr ? 0x7f : I2C_SCAN_LAST;
+	int first = min, last = max, addr;
+	char *end;
+
+	memset(want, 0, I2C_BITMAP_SIZE);
+
+	if (strcmp(text, "-")) {
+		first = strtol(text, &end, 0);
+		if (*end == '-') {
+			last = strtol(end + 1, &end, 0);
+			if (*end || first < min || last > max || first > last)
+				return -I2C_ERR_PARAM;
+		} else {
+			while (true) {
+				if ((*end && *end != ',') || first < min || first > max)
+					return -I2C_ERR_PARAM;
+				i2c_bitmap_set(want, first);
+				if (!*end)
+					return I2C_SUCCESS;
+				first = strtol(end + 1, &end, 0);
+			}
+		}
+	}
+
+	for (addr = first; addr <= last; addr++)
+		i2c_bitmap_set(want, addr);
+
+	return I2C_SUCCESS;
+}
+
+static void i2c_bitmap_str(const u8 *map, char *str)
+{
+	// Address 0 ends up as the least significant bit of the number.
+	for (int i = 0; i < I2C_BITMAP_SIZE; i++)
+		sprintf(str + i * 2, "%02x", map[I2C_BITMAP_SIZE - 1 - i]);
+}
+
+static int i2c_bitmap_parse(const char *str, u8 *map)
+{
+	unsigned int byte;
+
+	if (strlen(str) != I2C_BITMAP_SIZE * 2)
+		return -I2C_ERR_PARAM;
+
+	for (int i = 0; i < I2C_BITMAP_SIZE; i++) {
+		if (sscanf(str + i * 2, "%2x", &byte) != 1)
+			return -I2C_ERR_PARAM;
+		map[I2C_BITMAP_SIZE - 1 - i] = byte;
+	}
+
+	return I2C_SUCCESS;
+}
+
+void i2c_scan_init(struct i2c_scan *scan, Aardvark handle, int port, int seg,
+                   enum i2c_scan_mode mode, const u8 *want, uint32_t max_age)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->handle = handle;
+	scan->port = port;
+	scan->seg = seg;
+	scan->mode = mode;
+	scan->max_age = max_age;
+	memcpy(scan->want, want, I2C_BITMAP_SIZE);
+}
+
+/**
+ * Return 1 if the address acks, 0 if not, or a negative error if the adapter
+ * could not be talked to.
+ */
+static int i2c_scan_probe(Aardvark handle, u8 addr, enum i2c_scan_mode mode)
+{
+	u16 num_read;
+	u8 data;
+	int ret;
+
+	/* Select detection command for this address */
+	if (mode == I2C_SCAN_AUTO) {
+		if ((addr >= 0x30 && addr <= 0x37) || (addr >= 0x50 && addr <= 0x5F))
+			mode = I2C_SCAN_READ;
+		else
+			mode = I2C_SCAN_QUICK;
+	}
+
+	/* Probe this address */
+	switch (mode) {
+	default: /* I2C_SCAN_QUICK */
+		/* This is known to corrupt the Atmel AT24RF08
+		   EEPROM */
+		ret = aa_i2c_write_ext(handle, addr, AA_I2C_NO_FLAGS, 0, NULL, NULL);
+		break;
+	case I2C_SCAN_READ:
+		/* This is known to lock SMBus on various
+		   write-only chips (mainly clock chips) */
+		ret = aa_i2c_read_ext(handle, addr, AA_I2C_NO_FLAGS, 1, &data, &num_read);
+		if (ret == AA_I2C_STATUS_OK && num_read != 1)
+			ret = AA_I2C_STATUS_DATA_NACK;
+		break;
+	}
+
+	if (ret < 0)
+		return -I2C_ERR_IO;
+
+	return ret == AA_I2C_STATUS_OK;
+}
+
+int i2c_scan_run(struct i2c_scan *scan)
+{
+	uint64_t start = time_us(), now = time(NULL);
+	bool full = !scan->max_age || now - scan->swept >= scan->max_age;
+	int addr, ret;
+
+	memset(scan->probed, 0, sizeof(scan->probed));
+	scan->ret = I2C_SUCCESS;
+
+	if (i2c_mux_route(scan->handle, scan->seg)) {
+		scan->ret = -I2C_ERR_IO;
+		scan->elapsed_us = time_us() - start;
+		return scan->ret;
+	}
+
+	for (addr = 0; addr < I2C_ADDR_NUM; addr++) {
+		if (!i2c_bitmap_test(scan->want, addr))
+			continue;
+
+		// Nothing answered there at the last sweep, wait for the next one.
+		if (!full && i2c_bitmap_test(scan->cached, addr) && !i2c_bitmap_test(scan->present, addr))
+			continue;
+
+		ret = i2c_scan_probe(scan->handle, addr, scan->mode);
+		if (ret < 0) {
+			scan->ret = ret;
+			break;
+		}
+
+		i2c_bitmap_set(scan->probed, addr);
+		i2c_bitmap_set(scan->cached, addr);
+		if (ret)
+			i2c_bitmap_set(scan->present, addr);
+		else
+			i2c_bitmap_clear(scan->present, addr);
+	}
 
+	if (full && !scan->ret)
+		scan->swept = now;
+	scan->elapsed_us = time_us() - start;
 
-// static int scan_i2c_bus(int file, int mode, unsigned long funcs,
-//                         int first, int last)
-int scan_i2c_bus(Aardvark handle)
+	return scan->ret;
+}
+
+struct i2c_scan_group {
+	struct i2c_scan *scan;
+	int n;
+	Aardvark handle;
+};
+
+// Scan the segments of one adapter one after the other, in the order given.
+static void *i2c_scan_thread(void *arg)
+{
+	struct i2c_scan_group *group = arg;
+
+	for (int i = 0; i < group->n; i++)
+		if (group->scan[i].handle == group->handle)
+			i2c_scan_run(&group->scan[i]);
+
+	return NULL;
+}
+
+/**
+ * Every adapter is a bus of its own, so each one is scanned by a thread of
+ * its own and the whole set takes about as long as the slowest bus. The
+ * segments behind the muxes of an adapter share its bus and are scanned in
+ * turn by its thread.
+ */
+int i2c_scan_run_all(struct i2c_scan *scan, int n)
 {
-	int i, j;
-	int cmd;
-	int res;
+	struct i2c_scan_group group[I2C_SCAN_PORT_MAX];
+	pthread_t tid[I2C_SCAN_PORT_MAX];
+	int i, j, ngroup = 0, started, ret = I2C_SUCCESS;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < ngroup && group[j].handle != scan[i].handle; j++)
+			;
+		if (j < ngroup)
+			continue;
+		if (ngroup == I2C_SCAN_PORT_MAX)
+			return -I2C_ERR_PARAM;
+		group[ngroup].scan = scan;
+		group[ngroup].n = n;
+		group[ngroup++].handle = scan[i].handle;
+	}
+
+	if (!ngroup)
+		return -I2C_ERR_PARAM;
+
+	if (ngroup == 1) {
+		i2c_scan_thread(&group[0]);
+	} else {
+		for (started = 0; started < ngroup; started++)
+			if (pthread_create(&tid[started], NULL, i2c_scan_thread, &group[started]))
+				break;
 
+		// The ones that could not get a thread are scanned here.
+		for (i = started; i < ngroup; i++)
+			i2c_scan_thread(&group[i]);
+
+		for (i = 0; i < started; i++)
+			pthread_join(tid[i], NULL);
+	}
+
+	for (i = 0; i < n; i++)
+		if (scan[i].ret && !ret)
+			ret = scan[i].ret;
+
+	return ret;
+}
+
+void i2c_scan_show(const struct i2c_scan *scan, bool json)
+{
+	char present_str[I2C_BITMAP_SIZE * 2 + 1], probed_str[I2C_BITMAP_SIZE * 2 + 1];
+	u8 present[I2C_BITMAP_SIZE];
+	int i, j, nprobe = 0;
+
+	for (i = 0; i < I2C_BITMAP_SIZE; i++) {
+		present[i] = scan->present[i] & scan->want[i];
+		for (j = 0; j < 8; j++)
+			nprobe += (scan->probed[i] >> j) & 1;
+	}
+	i2c_bitmap_str(present, present_str);
+	i2c_bitmap_str(scan->probed, probed_str);
+
+	if (json) {
+		printf("{\"port\":%d,\"segment\":%d,\"mode\":\"%s\",\"present\":\"%s\","
+		       "\"probed\":\"%s\",\"elapsed_us\":%u,\"ret\":%d}\n", scan->port, scan->seg,
+		       i2c_scan_mode_name(scan->mode), present_str, probed_str, scan->elapsed_us, scan->ret);
+		return;
+	}
+
+	printf("Port %d segment %d (%s): %d probed in %u us\n", scan->port, scan->seg,
+	       i2c_scan_mode_name(scan->mode), nprobe, scan->elapsed_us);
 	printf("     0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f\n");
 
-	for (i = 0; i < 128; i += 16) {
+	for (i = 0; i < I2C_ADDR_NUM; i += 16) {
 		printf("%02x: ", i);
 		for (j = 0; j < 16; j++) {
-			fflush(stdout);
-
-			/* Select detection command for this address */
-			// switch (mode) {
-			// default:
-			//      cmd = mode;
-			//      break;
-			// case MODE_AUTO:
-			if ((i + j >= 0x30 && i + j <= 0x37)
-			    || (i + j >= 0x50 && i + j <= 0x5F))
-				cmd = MODE_READ;
+			/* Skip unwanted addresses */
+			if (!i2c_bitmap_test(scan->want, i + j))
+				printf("   ");
+			else if (i2c_bitmap_test(present, i + j))
+				printf("%02x ", i + j);
 			else
-				cmd = MODE_QUICK;
-			//      break;
-			// }
-
-			// /* Skip unwanted addresses */
-			// if (i + j < first || i + j > last
-			//     || (cmd == MODE_READ &&
-			//         !(funcs & I2C_FUNC_SMBUS_READ_BYTE))
-			//     || (cmd == MODE_QUICK &&
-			//         !(funcs & I2C_FUNC_SMBUS_QUICK))) {
-			//      printf("   ");
-			//      continue;
-			// }
-
-			// /* Set slave address */
-			// if (ioctl(file, I2C_SLAVE, i + j) < 0) {
-			//      if (errno == EBUSY) {
-			//              printf("UU ");
-			//              continue;
-			//      } else {
-			//              fprintf(stderr, "Error: Could not set "
-			//                      "address to 0x%02x: %s\n", i + j,
-			//                      strerror(errno));
-			//              return -1;
-			//      }
-			// }
-
-			/* Probe this address */
-			switch (cmd) {
-			default: /* MODE_QUICK */
-				/* This is known to corrupt the Atmel AT24RF08
-				   EEPROM */
-				// res = i2c_smbus_write_quick(file, I2C_SMBUS_WRITE);
-				res = aa_i2c_write_ext(handle, i + j, AA_I2C_NO_FLAGS, 0, NULL, NULL);
-				break;
-			case MODE_READ:
-				/* This is known to lock SMBus on various
-				   write-only chips (mainly clock chips) */
-				// res = i2c_smbus_read_byte(file);
-				u8 data;
-				u16 num_read;
-				res = aa_i2c_read_ext(handle, i + j, AA_I2C_NO_FLAGS, 1, &data, &num_read);
-				if (res == 0 && num_read != 1)
-					res = -1;
-				break;
-			}
-			// res = aa_i2c_write_ext(handle, i + j, AA_I2C_NO_FLAGS, 0, NULL, NULL);
-			if (res)
 				printf("-- ");
-			else
-				printf("%02x ", i + j);
 		}
 		printf("\n");
 	}
 
-	return 0;
+	printf("Present: %s\n", present_str);
+}
+
+/**
+ * One line per segment: <port> <segment> <mode> <cached> <present> <swept>. An entry
+ * only applies to a scan of the same mode, another probe may get another
+ * answer from the same device.
+ */
+int i2c_scan_cache_load(const char *path, struct i2c_scan *scan, int n)
+{
+	char line[128], mode[16], cached[64], present[64];
+	unsigned long long swept;
+	FILE *fp = fopen(path, "r");
+	int port, seg;
+
+	// No cache yet, everything is probed.
+	if (!fp)
+		return I2C_SUCCESS;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' ||
+		    sscanf(line, "%d %d %15s %63s %63s %llu", &port, &seg, mode, cached, present,
+		           &swept) != 6)
+			continue;
+
+		for (int i = 0; i < n; i++) {
+			if (scan[i].port != port || scan[i].seg != seg ||
+			    strcmp(mode, i2c_scan_mode_name(scan[i].mode)))
+				continue;
+
+			if (i2c_bitmap_parse(cached, scan[i].cached) ||
+			    i2c_bitmap_parse(present, scan[i].present)) {
+				memset(scan[i].cached, 0, I2C_BITMAP_SIZE);
+				memset(scan[i].present, 0, I2C_BITMAP_SIZE);
+				continue;
+			}
+			scan[i].swept = swept;
+		}
+	}
+	fclose(fp);
+
+	return I2C_SUCCESS;
+}
+
+int i2c_scan_cache_save(const char *path, const struct i2c_scan *scan, int n)
+{
+	char tmp[256], line[128], cached[I2C_BITMAP_SIZE * 2 + 1], present[I2C_BITMAP_SIZE * 2 + 1];
+	FILE *fp, *old;
+	int i, port, seg, ret = I2C_SUCCESS;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+		return -I2C_ERR_PARAM;
+
+	fp = fopen(tmp, "w");
+	if (!fp)
+		return -I2C_ERR_IO;
+
+	fprintf(fp, "# port segment mode cached present swept\n");
+
+	// Keep the entries of the segments that were not scanned this time.
+	old = fopen(path, "r");
+	if (old) {
+		while (fgets(line, sizeof(line), old)) {
+			if (line[0] == '#' || sscanf(line, "%d %d", &port, &seg) != 2)
+				continue;
+			for (i = 0; i < n && (scan[i].port != port || scan[i].seg != seg); i++)
+				;
+			if (i == n)
+				fputs(line, fp);
+		}
+		fclose(old);
+	}
+
+	for (i = 0; i < n; i++) {
+		i2c_bitmap_str(scan[i].cached, cached);
+		i2c_bitmap_str(scan[i].present, present);
+		fprintf(fp, "%d %d %s %s %s %llu\n", scan[i].port, scan[i].seg,
+		        i2c_scan_mode_name(scan[i].mode), cached, present, (unsigned long long)scan[i].swept);
+	}
+
+	if (ferror(fp))
+		ret = -I2C_ERR_IO;
+	if (fclose(fp))
+		ret = -I2C_ERR_IO;
+
+#ifdef WIN32
+	if (!ret)
+		remove(path);
+#endif
+	if (!ret && rename(tmp, path))
+		ret = -I2C_ERR_IO;
+
+	if (ret)
+		remove(tmp);
+
+	return ret;
 }
 
 // struct func {
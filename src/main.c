@@ -10,8 +10,26 @@
 #include "mctp_core.h"
 #include "mctp_transport.h"
 #include "mctp_message.h"
+#include "mctp_route.h"
+#include "mctp_bridge.h"
+#include "mctp_socket.h"
+#include "mctp_inventory.h"
 
 #include "nvme_cmd.h"
+#include "nvme_format.h"
+#include "nvme_meb.h"
+#include "nvme_fw.h"
+#include "nvme_monitor.h"
+#include "nvme_cache.h"
+#include "nvme_vpd.h"
+#include "nvme_ns.h"
+#include "nvme_telemetry.h"
+#include "nvme_event.h"
+#include "nvme_feat.h"
+#include "nvme_script.h"
+#include "session.h"
+#include "nvme_fanout.h"
+#include "nvme_emu.h"
 #include "nvme/nvme.h"
 #include "libnvme_types.h"
 #include "libnvme_mi_mi.h"
@@ -21,6 +39,8 @@
 #include "types.h"
 
 #include "i2c.h"
+#include "i2c_mux.h"
+#include "i2c_eeprom.h"
 
 #include <stdbool.h>
 
@@ -59,6 +79,23 @@ const struct function_list func_list[] = {
 	{"test-mctp",         FUNC_IDX_TEST_MCTP},
 	{"smb-slv-poll",      FUNC_IDX_SMB_DEVICE_POLL},
 	{"i2cdetect",         FUNC_IDX_I2C_DETECT},
+	{"mctp-bridge",       FUNC_IDX_MCTP_BRIDGE},
+	{"nvme-fw",           FUNC_IDX_NVME_FW},
+	{"nvme-meb",          FUNC_IDX_NVME_MEB},
+	{"nvme-monitor",      FUNC_IDX_NVME_MONITOR},
+	{"nvme-cache",        FUNC_IDX_NVME_CACHE},
+	{"nvme-vpd",          FUNC_IDX_NVME_VPD},
+	{"nvme-cp",           FUNC_IDX_NVME_CP},
+	{"nvme-ns",           FUNC_IDX_NVME_NS},
+	{"nvme-telemetry",    FUNC_IDX_NVME_TELEMETRY},
+	{"nvme-events",       FUNC_IDX_NVME_EVENTS},
+	{"nvme-features",     FUNC_IDX_NVME_FEATURES},
+	{"nvme-fanout",       FUNC_IDX_NVME_FANOUT},
+	{"daemon",            FUNC_IDX_DAEMON},
+	{"client",            FUNC_IDX_CLIENT},
+	{"session",           FUNC_IDX_SESSION},
+	{"eeprom",            FUNC_IDX_EEPROM},
+	{"nvme-emu",          FUNC_IDX_NVME_EMU},
 	// {"i2c-write-file",    FUNC_IDX_I2C_MASTER_WRITE_FILE},
 	// {"i2c-slave-poll",    FUNC_IDX_I2C_SLAVE_POLL},
 	// {"test-smb-ctrl-tar", FUNC_IDX_TEST},
@@ -75,6 +112,8 @@ const char *main_trace_header[TRACE_TYPE_MAX] =  {
 };
 
 static int m_keep_power = 0;
+// Muxes of the adapter (-m), the addresses with a segment are behind them
+static struct i2c_mux_bus *m_mux;
 static u8 block[BLOCK_SIZE_MAX];
 
 int parse_eid(const char *eid_opt)
@@ -124,9 +163,33 @@ int parse_bit_rate(const char *bit_rate_opt)
 	return I2C_DEFAULT_BITRATE;
 }
 
+/**
+ * Return the segment of a [<segment>:]<address> argument, the root if it has
+ * none, or a negative value if the segment is invalid.
+ */
+int parse_i2c_segment(const char *addr_opt)
+{
+	const char *sep = addr_opt ? strchr(addr_opt, ':') : NULL;
+	char *end;
+	long seg;
+
+	if (!sep)
+		return I2C_MUX_SEGMENT_ROOT;
+
+	seg = strtol(addr_opt, &end, 0);
+	if (end != sep || end == addr_opt || seg < 0 || seg >= I2C_MUX_SEGMENT_MAX) {
+		main_trace(ERROR, "invalid segment '%s'\n", addr_opt);
+		return -1;
+	}
+
+	return seg;
+}
+
 /**
  * Parse a CHIP-ADDRESS command line argument and return the corresponding
- * chip address, or a negative value if the address is invalid.
+ * chip address, or a negative value if the address is invalid. An address
+ * given as <segment>:<address> is behind the muxes of -m, which are switched
+ * to the segment.
  */
 int parse_i2c_address(const char *addr_opt, int all_addrs)
 {
@@ -134,12 +197,19 @@ int parse_i2c_address(const char *addr_opt, int all_addrs)
 	char *end;
 	long min_addr = 0x08;
 	long max_addr = 0x77;
+	int seg;
 
 	if (!addr_opt) {
 		main_trace(ERROR, "null addr_opt\n");
 		return -1;
 	}
 
+	seg = parse_i2c_segment(addr_opt);
+	if (seg < 0)
+		return -1;
+	if (strchr(addr_opt, ':'))
+		addr_opt = strchr(addr_opt, ':') + 1;
+
 	address = strtol(addr_opt, &end, 0);
 	if (*end || !*addr_opt) {
 		main_trace(ERROR, "invalid address '%s'\n", addr_opt);
@@ -157,6 +227,11 @@ int parse_i2c_address(const char *addr_opt, int all_addrs)
 		return -1;
 	}
 
+	if (m_mux ? i2c_mux_select(m_mux, seg) : seg != I2C_MUX_SEGMENT_ROOT) {
+		main_trace(ERROR, "no route to segment %d\n", seg);
+		return -1;
+	}
+
 	return address;
 }
 
@@ -173,6 +248,106 @@ static int check_argc_range(int argc, int min, int max)
 	return 0;
 }
 
+/**
+ * Reset the ARP state of the target, read its UDID and assign slv_addr to it.
+ */
+int arp_assign_address(Aardvark handle, int slv_addr, int pec)
+{
+	int ret;
+	union udid_ds udid;
+
+	ret = smbus_arp_cmd_prepare_to_arp(handle, pec);
+	if (ret) {
+		main_trace(ERROR, "smbus_arp_cmd_prepare_to_arp (%d)\n", ret);
+		return ret;
+	}
+
+	ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 0, pec);
+	if (ret) {
+		main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
+		return ret;
+	}
+
+	reverse(&udid, sizeof(udid));
+	print_udid(&udid);
+	reverse(&udid, sizeof(udid));
+
+	ret = smbus_arp_cmd_assign_address(handle, &udid, slv_addr, pec);
+	if (ret) {
+		main_trace(ERROR, "smbus_arp_cmd_assign_address (%d)\n", ret);
+		return ret;
+	}
+
+	ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 1, pec);
+	if (ret) {
+		main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
+		return ret;
+	}
+
+	reverse(&udid, sizeof(udid));
+	print_udid(&udid);
+
+	return 0;
+}
+
+/**
+ * Bring up MCTP towards one NVMe-MI endpoint: assign its address with ARP
+ * unless packets go through a socket, then set its EID and discover it.
+ */
+int mctp_open_endpoint(Aardvark handle, const char *sock_path, int slv_addr, int owner_eid,
+                       int tar_eid, int pec, int verbose)
+{
+	int ret;
+
+	if (!sock_path) {
+		aa_i2c_slave_enable(handle, SMBUS_ADDR_IPMI_BMC, 0, 0);
+		ret = arp_assign_address(handle, slv_addr, pec);
+		if (ret)
+			return ret;
+	}
+
+	ret = mctp_init(handle, owner_eid, tar_eid, SMBUS_ADDR_IPMI_BMC,
+	                MCTP_BASELINE_TRAN_UNIT_SIZE, pec);
+	if (ret) {
+		main_trace(ERROR, "mctp_init (%d)\n", ret);
+		return ret;
+	}
+
+	if (sock_path) {
+		ret = mctp_socket_init(sock_path, false, SMBUS_ADDR_IPMI_BMC);
+		if (ret) {
+			main_trace(ERROR, "mctp_socket_init (%d)\n", ret);
+			return ret;
+		}
+	}
+
+	ret = mctp_message_set_eid(slv_addr, EID_NULL_DST, SET_EID, tar_eid, 1, 0, verbose);
+	if (ret) {
+		main_trace(ERROR, "mctp_message_set_eid (%d)\n", ret);
+		return ret;
+	}
+
+	ret = mctp_poll(handle, 100, verbose);
+	if (ret && ret != 0xFF) {
+		main_trace(ERROR, "mctp_poll (%d)\n", ret);
+		return ret;
+	}
+
+	ret = mctp_discover_endpoint(slv_addr, tar_eid, false, 100, verbose);
+	if (ret)
+		main_trace(WARN, "mctp_discover_endpoint (%d)\n", ret);
+
+	return 0;
+}
+
+static void main_close_adapter(Aardvark handle)
+{
+	if (!m_keep_power)
+		aa_target_power(handle, AA_TARGET_POWER_NONE);
+	i2c_mux_detach(handle);
+	aa_close(handle);
+}
+
 static void main_exit(int status_code, int handle, int func_idx, const char *fmt, ...)
 {
 	/**
@@ -203,6 +378,140 @@ static void main_exit(int status_code, int handle, int func_idx, const char *fmt
 	exit(status_code);
 }
 
+/**
+ * Open one adapter of a port list and set it up with the options of the
+ * command line, the topology of -m included. Returns 0 on failure.
+ */
+static Aardvark main_open_adapter(int port, int bit_rate, int pull_up, int power,
+                                  struct i2c_mux_bus *mux, const char *mux_opt)
+{
+	Aardvark handle = aa_open(port);
+
+	if (handle <= 0) {
+		main_trace(ERROR, "unable to open Aardvark device on port %d\n", port);
+		main_trace(ERROR, "Error code = %d\n", handle);
+		return 0;
+	}
+
+	aa_configure(handle, AA_CONFIG_GPIO_I2C);
+	aa_i2c_bitrate(handle, bit_rate);
+	if (pull_up)
+		aa_i2c_pullup(handle, AA_I2C_PULLUP_BOTH);
+	if (power)
+		aa_target_power(handle, AA_TARGET_POWER_BOTH);
+
+	if (mux_opt && (i2c_mux_load(mux, handle, mux_opt) || i2c_mux_attach(mux) ||
+	                i2c_mux_reset(mux))) {
+		main_close_adapter(handle);
+		return 0;
+	}
+
+	return handle;
+}
+
+// Adapters of a port list, the first one is the adapter every command opens.
+struct main_ports {
+	int n;
+	int port[I2C_SCAN_PORT_MAX];
+	Aardvark handle[I2C_SCAN_PORT_MAX];
+	struct i2c_mux_bus mux[I2C_SCAN_PORT_MAX];
+};
+
+// Open the ports of the list after the first one, a socket has no other.
+static int main_open_ports(struct main_ports *ports, const char *list, int bit_rate,
+                           int pull_up, int power, const char *mux_opt, bool sock)
+{
+	char *end;
+
+	for (const char *p = strchr(list, ','); p; p = strchr(p + 1, ',')) {
+		int port = strtol(p + 1, &end, 0);
+
+		if ((*end && *end != ',') || port < 0 || sock || ports->n == I2C_SCAN_PORT_MAX) {
+			main_trace(ERROR, "invalid port list %s\n", list);
+			return -1;
+		}
+		ports->handle[ports->n] = main_open_adapter(port, bit_rate, pull_up, power,
+		                                            &ports->mux[ports->n], mux_opt);
+		if (!ports->handle[ports->n])
+			return -1;
+		ports->port[ports->n++] = port;
+	}
+
+	return 0;
+}
+
+static void main_close_ports(struct main_ports *ports)
+{
+	for (int i = 1; i < ports->n; i++)
+		main_close_adapter(ports->handle[i]);
+	ports->n = 1;
+}
+
+/**
+ * Take the adapter of an address written as [<port>/]<address>, the first one
+ * of the list without a port. Returns the address or NULL.
+ */
+static const char *main_parse_port(const struct main_ports *ports, const char *s,
+                                   Aardvark *handle)
+{
+	const char *sep = strchr(s, '/');
+	char *end;
+	int port, i = 0;
+
+	if (sep) {
+		port = strtol(s, &end, 0);
+		for (i = 0; i < ports->n && ports->port[i] != port; i++)
+			;
+		if (end != sep || i == ports->n)
+			return NULL;
+		s = sep + 1;
+	}
+	*handle = ports->handle[i];
+
+	return s;
+}
+
+/**
+ * Session of a worker of a port list, whose MCTP stack is up on one adapter
+ * only.
+ */
+static struct session *main_worker_session(void *priv, Aardvark handle)
+{
+	struct session *s = priv;
+
+	if (s->mctp_up && s->handle != handle) {
+		main_trace(ERROR, "adapter %d already in use\n", handle);
+		return NULL;
+	}
+	s->handle = handle;
+
+	return s;
+}
+
+// Bring up a fan-out target, in the worker of its adapter.
+static int main_fanout_open(void *priv, const struct nvme_fanout_result *r)
+{
+	struct session *s = main_worker_session(priv, r->handle);
+
+	return s && session_open(s, r->seg, r->slv_addr, r->eid) ? 0 : -1;
+}
+
+// Bring up a drive of the namespace inventory, in the worker of its adapter.
+static int main_ns_open(void *priv, const struct nvme_ns_drive *drive, u8 *udid)
+{
+	struct session *s = main_worker_session(priv, drive->handle);
+	struct session_endpoint *ep;
+
+	ep = s ? session_open(s, I2C_MUX_SEGMENT_ROOT, drive->slv_addr, drive->eid) : NULL;
+	if (!ep)
+		return -1;
+
+	// The UDID names the cache file, without ARP on a socket the EID tells drives apart.
+	memcpy(udid, &ep->udid, sizeof(ep->udid));
+
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 #if (OPT_ARDVARK_TRACE)
@@ -211,7 +520,6 @@ int main(int argc, char *argv[])
 		const char *arg = argv[i];
 		printf("%d,%s\n", strlen(arg), arg);
 	}
-#endif
 #include "crc8.h"
 	u8 data[2];
 	data[0] = 0xC2;
@@ -220,6 +528,7 @@ int main(int argc, char *argv[])
 	data[0] = 0x03;
 	data[1] = 0xC2;
 	printf("crc8:%x\n", crc8(data, sizeof(data)));
+#endif
 
 	// exit(0);
 
@@ -228,13 +537,14 @@ int main(int argc, char *argv[])
 	int func_idx = FUNC_IDX_NULL;
 	int all_addr = 0, pec = 0,  power = 0, pull_up = 0, version = 0, manual = 0,
 	    directed = 0, i2c_slave_mode = 0, wrong_pec = 0, verbose = 0;
-	int opt, port, real_bit_rate, bit_rate, slv_addr, cmd_code;
-	const char *file_name;
+	int opt, port, real_bit_rate, bit_rate, slv_addr, cmd_code, out_fmt;
+	const char *file_name, *sock_path = NULL, *fmt_opt = NULL, *mux_opt = NULL;
+	static struct i2c_mux_bus mux;
 
 	real_bit_rate = bit_rate = I2C_DEFAULT_BITRATE;
 
 	/* handle (optional) flags first */
-	while ((opt = getopt(argc, argv, "ab:cdhkps:uvV")) != -1) {
+	while ((opt = getopt(argc, argv, "ab:cdhi:km:o:ps:uU:vV")) != -1) {
 		switch (opt) {
 		case 'a':
 			all_addr = 1;
@@ -248,9 +558,22 @@ int main(int argc, char *argv[])
 		case 'd':
 			directed = 1;
 			break;
+		case 'i':
+			mctp_inventory_set_path(optarg);
+			break;
 		case 'k':
 			m_keep_power = 1;
 			break;
+		case 'm':
+			mux_opt = optarg;
+			break;
+		case 'o':
+			out_fmt = nvme_format_parse(optarg);
+			if (out_fmt < 0)
+				main_exit(EXIT_FAILURE, 0, FUNC_IDX_MAX, "error: unknown output format %s\n", optarg);
+			nvme_format_set(out_fmt);
+			fmt_opt = optarg;
+			break;
 		case 'p':
 			power = 1;
 			break;
@@ -261,6 +584,9 @@ int main(int argc, char *argv[])
 		case 'u':
 			pull_up = 1;
 			break;
+		case 'U':
+			sock_path = optarg;
+			break;
 		case 'v':
 			version = 1;
 			break;
@@ -307,46 +633,211 @@ int main(int argc, char *argv[])
 	if (argc < optind + 2)
 		main_exit(EXIT_FAILURE, 0, func_idx, "error: too few arguments\n");
 
-	// argc == optind + 2
-	port = strtol(argv[optind + 1], &end, 0);
-	if (*end || port < 0)
-		main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid port number\n");
+	// A client only talks to the daemon, which holds the adapter.
+	if (func_idx == FUNC_IDX_CLIENT) {
+		char *req = malloc(SESSION_REQUEST_MAX);
+		size_t len = 0;
+		int ret;
 
-	// Open the device
-	handle = aa_open(port);
-	if (handle <= 0) {
-		main_trace(ERROR, "unable to open Aardvark device on port %d\n", port);
-		main_trace(ERROR, "Error code = %d\n", handle);
-		main_exit(EXIT_FAILURE, 0, -1, NULL);
+		if (check_argc_range(argc, optind + 3, argc) || !req)
+			main_exit(EXIT_FAILURE, 0, func_idx, NULL);
+
+		if (fmt_opt)
+			len = snprintf(req, SESSION_REQUEST_MAX, "format %s\n", fmt_opt);
+
+		if (!strcmp(argv[optind + 2], "-")) {
+			len += fread(req + len, 1, SESSION_REQUEST_MAX - 1 - len, stdin);
+			req[len] = 0;
+		} else {
+			for (int i = optind + 2; i < argc && len < SESSION_REQUEST_MAX; i++)
+				len += snprintf(req + len, SESSION_REQUEST_MAX - len, "%s%s", argv[i],
+				                i + 1 < argc ? " " : "\n");
+		}
+		if (len >= SESSION_REQUEST_MAX - 1)
+			main_exit(EXIT_FAILURE, 0, -1, "error: request too long\n");
+
+		ret = session_request(argv[optind + 1], req, stdout);
+		free(req);
+		if (ret)
+			main_trace(ERROR, "request (%d)\n", ret);
+
+		main_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS, 0, -1, NULL);
 	}
 
-	// Ensure that the I2C subsystem is enabled
-	aa_configure(handle, AA_CONFIG_GPIO_I2C);
+	// The bench feeds the responder directly, no adapter takes part.
+	if (func_idx == FUNC_IDX_NVME_EMU && !strcmp(argv[optind + 1], "bench")) {
+		static struct nvme_emu emu;
+		struct nvme_emu_model model;
+		unsigned long count = 100000;
+		int ret;
 
-	bit_rate = parse_bit_rate(bit_rate_opt);
-	if (bit_rate < 0)
-		goto exit;
+		if (check_argc_range(argc, optind + 2, optind + 4))
+			main_exit(EXIT_FAILURE, 0, func_idx, NULL);
 
-	// Setup the bit rate
-	real_bit_rate = aa_i2c_bitrate(handle, bit_rate);
-	if (real_bit_rate != bit_rate)
-		main_trace(WARN, "the bitrate is different from user input\n");
+		if (argc > optind + 2) {
+			count = strtoul(argv[optind + 2], &end, 0);
+			if (*end || !count)
+				main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid count\n");
+		}
 
-	/**
-	 * Enable the I2C bus pullup resistors (2.2k resistors). This command is
-	 * only effective on v2.0 hardware or greater. The pullup resistors on the
-	 * v1.02 hardware are enabled by default.
-	 */
-	if (pull_up)
-		aa_i2c_pullup(handle, AA_I2C_PULLUP_BOTH);
+		nvme_emu_model_default(&model);
+		if (argc > optind + 3 && nvme_emu_model_load(&model, argv[optind + 3]))
+			main_exit(EXIT_FAILURE, 0, -1, "error: invalid model %s\n", argv[optind + 3]);
+
+		nvme_emu_init(&emu, &model, 0x1d, 0x09, pec);
+		ret = nvme_emu_bench(&emu, count);
+		if (ret)
+			main_trace(ERROR, "nvme_emu_bench (%d)\n", ret);
+
+		main_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS, 0, -1, NULL);
+	}
+
+	// Every adapter of the list is opened here and scanned by a thread of its own.
+	if (func_idx == FUNC_IDX_I2C_DETECT) {
+		static struct i2c_scan scan[I2C_SCAN_PORT_MAX * I2C_MUX_SEGMENT_MAX];
+		static struct i2c_mux_bus scan_mux[I2C_SCAN_PORT_MAX];
+		Aardvark scan_handle[I2C_SCAN_PORT_MAX];
+		u8 want[I2C_BITMAP_SIZE];
+		const char *cache = NULL, *p;
+		uint32_t max_age = 0;
+		int n = 0, nport = 0, nseg, mode = I2C_SCAN_AUTO, ret = 0;
+
+		if (check_argc_range(argc, optind + 2, optind + 6))
+			main_exit(EXIT_FAILURE, 0, func_idx, NULL);
+
+		if (argc > optind + 2) {
+			mode = i2c_scan_parse_mode(argv[optind + 2]);
+			if (mode < 0)
+				main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid mode %s\n", argv[optind + 2]);
+		}
+
+		if (i2c_scan_parse_addr(want, argc > optind + 3 ? argv[optind + 3] : "-", all_addr))
+			main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid addresses %s\n", argv[optind + 3]);
+
+		if (argc > optind + 4) {
+			cache = argv[optind + 4];
+			max_age = I2C_SCAN_MAX_AGE;
+		}
+
+		if (argc > optind + 5) {
+			max_age = strtoul(argv[optind + 5], &end, 0);
+			if (*end)
+				main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid max age\n");
+		}
+
+		bit_rate = parse_bit_rate(bit_rate_opt);
+		if (bit_rate < 0)
+			main_exit(EXIT_FAILURE, 0, -1, NULL);
+
+		for (p = argv[optind + 1]; !ret; p = end + 1) {
+			port = strtol(p, &end, 0);
+			if ((*end && *end != ',') || port < 0 || nport == I2C_SCAN_PORT_MAX) {
+				main_trace(ERROR, "invalid port list %s\n", argv[optind + 1]);
+				ret = -1;
+				break;
+			}
+
+			handle = main_open_adapter(port, bit_rate, pull_up, power, &scan_mux[nport], mux_opt);
+			if (!handle) {
+				ret = -1;
+				break;
+			}
+			scan_handle[nport++] = handle;
+
+			// Every segment of the port, in rank order.
+			nseg = 0;
+			for (int seg = 0; !ret && seg < I2C_MUX_SEGMENT_MAX; seg++) {
+				if (seg != I2C_MUX_SEGMENT_ROOT && !(mux_opt && scan_mux[nport - 1].seg[seg].used))
+					continue;
+				i2c_scan_init(&scan[n + i2c_mux_rank(handle, seg)], handle, port, seg, mode, want,
+				              max_age);
+				nseg++;
+			}
+			n += nseg;
+
+			if (!*end)
+				break;
+		}
+
+		if (!ret) {
+			if (cache)
+				i2c_scan_cache_load(cache, scan, n);
+
+			ret = i2c_scan_run_all(scan, n);
+			for (int i = 0; i < n; i++) {
+				if (scan[i].ret)
+					main_trace(ERROR, "scan port %d segment %d (%d)\n", scan[i].port, scan[i].seg,
+					           scan[i].ret);
+				i2c_scan_show(&scan[i], nvme_format_get() == NVME_FORMAT_JSON);
+			}
+
+			if (cache && i2c_scan_cache_save(cache, scan, n)) {
+				main_trace(ERROR, "write %s\n", cache);
+				ret = -1;
+			}
+		}
+
+		for (int i = 0; i < nport; i++)
+			main_close_adapter(scan_handle[i]);
+
+		main_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS, 0, -1, NULL);
+	}
+
+	// argc == optind + 2
+	port = strtol(argv[optind + 1], &end, 0);
+	// The fan-out and the namespace inventory open the rest of their port list themselves.
+	if ((*end && !((func_idx == FUNC_IDX_NVME_FANOUT || func_idx == FUNC_IDX_NVME_NS) &&
+	               *end == ',')) || port < 0)
+		main_exit(EXIT_FAILURE, 0, func_idx, "error: invalid port number\n");
 
 	/**
-	 * Enable the Aardvark adapter's power pins. This command is only effective
-	 * on v2.0 hardware or greater. The power pins on the v1.02 hardware are not
-	 * enabled by default.
+	 * MCTP over a local socket (-U) exchanges packets with a software
+	 * endpoint, so no adapter is opened.
 	 */
-	if (power)
-		aa_target_power(handle, AA_TARGET_POWER_BOTH);
+	if (!sock_path) {
+		// Open the device
+		handle = aa_open(port);
+		if (handle <= 0) {
+			main_trace(ERROR, "unable to open Aardvark device on port %d\n", port);
+			main_trace(ERROR, "Error code = %d\n", handle);
+			main_exit(EXIT_FAILURE, 0, -1, NULL);
+		}
+
+		// Ensure that the I2C subsystem is enabled
+		aa_configure(handle, AA_CONFIG_GPIO_I2C);
+
+		bit_rate = parse_bit_rate(bit_rate_opt);
+		if (bit_rate < 0)
+			goto exit;
+
+		// Setup the bit rate
+		real_bit_rate = aa_i2c_bitrate(handle, bit_rate);
+		if (real_bit_rate != bit_rate)
+			main_trace(WARN, "the bitrate is different from user input\n");
+
+		/**
+		 * Enable the I2C bus pullup resistors (2.2k resistors). This command is
+		 * only effective on v2.0 hardware or greater. The pullup resistors on the
+		 * v1.02 hardware are enabled by default.
+		 */
+		if (pull_up)
+			aa_i2c_pullup(handle, AA_I2C_PULLUP_BOTH);
+
+		/**
+		 * Enable the Aardvark adapter's power pins. This command is only effective
+		 * on v2.0 hardware or greater. The power pins on the v1.02 hardware are not
+		 * enabled by default.
+		 */
+		if (power)
+			aa_target_power(handle, AA_TARGET_POWER_BOTH);
+
+		if (mux_opt) {
+			if (i2c_mux_load(&mux, handle, mux_opt) || i2c_mux_attach(&mux) ||
+			    i2c_mux_reset(&mux))
+				goto exit;
+			m_mux = &mux;
+		}
+	}
 
 	// if (i2c_slave_mode)
 	//      aa_i2c_slave_enable(handle, SMBUS_ADDR_NVME_MI_BMC, 0, 0);
@@ -588,11 +1079,10 @@ int main(int argc, char *argv[])
 	}
 	case FUNC_IDX_TEST_MCTP: {
 		int ret;
-		union udid_ds udid;
 		u8 host_addr;
 		int owner_eid, tar_eid;
 
-		if (check_argc_range(argc, optind + 5, optind + 5))
+		if (check_argc_range(argc, optind + 5, optind + 7))
 			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
 
 		if (i2c_slave_mode) {
@@ -602,7 +1092,8 @@ int main(int argc, char *argv[])
 		} else
 			host_addr = SMBUS_ADDR_IPMI_BMC;
 
-		aa_i2c_slave_enable(handle, host_addr, 0, 0);
+		if (!sock_path)
+			aa_i2c_slave_enable(handle, host_addr, 0, 0);
 
 		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
 		if (slv_addr < 0)
@@ -621,37 +1112,12 @@ int main(int argc, char *argv[])
 		}
 
 		main_trace(INFO, "eid (%d,%d)\n", owner_eid, tar_eid);
-		ret = smbus_arp_cmd_prepare_to_arp(handle, pec);
-		if (ret) {
-			main_trace(ERROR, "smbus_arp_cmd_prepare_to_arp (%d)\n", ret);
-			goto exit;
-		}
-
-		ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 0, pec);
-		if (ret) {
-			main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
-			goto exit;
-		}
-
-		reverse(&udid, sizeof(udid));
-		print_udid(&udid);
-		reverse(&udid, sizeof(udid));
-
-		ret = smbus_arp_cmd_assign_address(handle, &udid, slv_addr, pec);
-		if (ret) {
-			main_trace(ERROR, "smbus_arp_cmd_assign_address (%d)\n", ret);
-			goto exit;
-		}
-
-		ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 1, pec);
-		if (ret) {
-			main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
-			goto exit;
+		if (!sock_path) {
+			ret = arp_assign_address(handle, slv_addr, pec);
+			if (ret)
+				goto exit;
 		}
 
-		reverse(&udid, sizeof(udid));
-		print_udid(&udid);
-
 		// owner_eid = (owner_eid == 0 ? 8 : owner_eid);
 		// tar_eid = (owner_eid == 0xfe ? owner_eid - 1 : owner_eid + 1);
 
@@ -662,18 +1128,30 @@ int main(int argc, char *argv[])
 			goto exit;
 		}
 
+		if (sock_path) {
+			ret = mctp_socket_init(sock_path, false, host_addr);
+			if (ret) {
+				main_trace(ERROR, "mctp_socket_init (%d)\n", ret);
+				goto exit;
+			}
+		}
+
 		ret = mctp_message_set_eid(slv_addr, EID_NULL_DST, SET_EID, tar_eid, 1, 0, verbose);
 		if (ret) {
 			main_trace(ERROR, "mctp_message_set_eid (%d)\n", ret);
 			goto exit;
 		}
 
-		ret = smbus_slave_poll(handle, 100, pec, mctp_receive_packet_handle, verbose);
+		ret = mctp_poll(handle, 100, verbose);
 		if (ret && ret != 0xFF) {
-			main_trace(ERROR, "smbus_slave_poll (%d)\n", ret);
+			main_trace(ERROR, "mctp_poll (%d)\n", ret);
 			goto exit;
 		}
 
+		ret = mctp_discover_endpoint(slv_addr, tar_eid, false, 100, verbose);
+		if (ret)
+			main_trace(WARN, "mctp_discover_endpoint (%d)\n", ret);
+
 #if (!CONFIG_AA_MULTI_THREAD)
 		struct aa_args args = {
 			.handle = handle,
@@ -686,467 +1164,44 @@ int main(int argc, char *argv[])
 			.ic = true,
 			.timeout = 100,
 		};
-		int count = 0;
-		while (1) {
-			args.csi = 0;
-			union temp_thresh {
-				struct {
-					uint32_t tmpth  : 16;
-					uint32_t tmpsel : 4;
-					uint32_t thsel  : 2;
-					uint32_t rsvd   : 10;
-				};
-				uint32_t value;
-			};
-
-			union temp_thresh tt = {
-				.value = 0x137
-			};
-
-			args.csi = !args.csi;
-			ret = nvme_set_features_temp_thresh(&args, tt.value, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_set_features_temp_thresh (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_features_temp_thresh(&args, NVME_GET_FEATURES_SEL_CURRENT);
-			if (ret) {
-				main_trace(ERROR, "nvme_get_features_temp_thresh (%d)\n", ret);
-				goto exit;
-			}
+		struct nvme_script *script = malloc(sizeof(*script));
 
-			args.csi = !args.csi;
-			ret = nvme_get_features_power_mgmt(&args, NVME_GET_FEATURES_SEL_CURRENT);
-			if (ret) {
-				main_trace(ERROR, "nvme_get_features_power_mgmt (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_identify_ctrl(&args);
-			if (ret) {
-				main_trace(ERROR, "nvme_identify_ctrl (%d)\n", ret);
-				goto exit;
-			}
+		if (!script) {
+			main_trace(ERROR, "malloc\n");
+			goto exit;
+		}
 
-			args.csi = !args.csi;
-			ret = nvme_get_log_smart(&args, NVME_NSID_ALL, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_get_log_smart (%d)\n", ret);
-				goto exit;
-			}
+		// Without a script the built-in sequence runs forever.
+		if (argc > optind + 5)
+			ret = nvme_script_load(script, argv[optind + 5]);
+		else
+			ret = nvme_script_compile(script, nvme_script_default, "default");
+		if (ret) {
+			free(script);
+			goto exit;
+		}
 
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_subsystem_health_status_poll(&args, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_subsystem_health_status_poll (%d)\n", ret);
-				goto exit;
-			}
+		// Other endpoints of the script get the EID they are addressed with.
+		for (int i = 0; i < script->ntarget; i++) {
+			if (script->target[i].slv_addr == slv_addr && script->target[i].eid == tar_eid)
+				continue;
+			ret = mctp_message_set_eid(script->target[i].slv_addr, EID_NULL_DST, SET_EID,
+			                           script->target[i].eid, 1, 0, verbose);
+			if (!ret)
+				ret = mctp_discover_endpoint(script->target[i].slv_addr, script->target[i].eid,
+				                             false, 100, verbose);
+			if (ret)
+				main_trace(WARN, "endpoint %02x/%d (%d)\n", script->target[i].slv_addr,
+				           script->target[i].eid, ret);
+		}
 
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_controller_health_status_poll(&args, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_controller_health_status_poll (%d)\n", ret);
-				goto exit;
-			}
+		nvme_script_run(&args, script);
+		nvme_script_show(script);
+		if (argc > optind + 6 && nvme_script_save_report(script, argv[optind + 6]))
+			main_trace(ERROR, "nvme_script_save_report\n");
 
-			tt.value = 0x189;
-			args.csi = !args.csi;
-			ret = nvme_set_features_temp_thresh(&args, tt.value, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_set_features_temp_thresh (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_features_temp_thresh(&args, NVME_GET_FEATURES_SEL_CURRENT);
-			if (ret) {
-				main_trace(ERROR, "nvme_get_features_temp_thresh (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_log_smart(&args, NVME_NSID_ALL, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_get_log_smart (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_subsystem_health_status_poll(&args, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_subsystem_health_status_poll (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_controller_health_status_poll(&args, true);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_controller_health_status_poll (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			union nvme_mi_nmd0 nmd0 = {.value = 0,};
-			union nvme_mi_nmd1 nmd1 = {.value = 0,};
-			ret = nvme_mi_mi_config_get(&args, nmd0, nmd1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_get_sif (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_set(&args, nmd0, nmd1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_get_sif (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_get_sif(&args);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_get_sif (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_get_mtus(&args);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_get_mtus (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_get_hsc(&args);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_get_hsc (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_set_sif(&args, NVME_MI_PORT_ID_SMBUS, SMBUS_FREQ_400KHZ);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_set_sif (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_set_sif(&args, NVME_MI_PORT_ID_PCIE, SMBUS_FREQ_100KHZ);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_set_sif (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			union nmd1_config_hsc hsc = {
-				.value = 0xFFFFFFFF,
-			};
-			ret = nvme_mi_mi_config_set_hsc(&args, hsc);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_set_hsc (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			union nmd1_config_mtus mtus = {
-				.value = 0xFFFFFFFF,
-			};
-			ret = nvme_mi_mi_config_set_mtus(&args, NVME_MI_PORT_ID_SMBUS, mtus);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_set_mtus (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_config_set_mtus(&args, NVME_MI_PORT_ID_PCIE, mtus);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_config_set_mtus (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_nvm_subsys_info(&args);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_nvm_subsys_info (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_port_info(&args, NVME_MI_PORT_ID_PCIE);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_port_info (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_port_info(&args, NVME_MI_PORT_ID_SMBUS);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_port_info (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_ctrl_list(&args, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_ctrl_list (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_ctrl_list(&args, 1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_ctrl_list (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_ctrl_info(&args, 1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_ctrl_info (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_ctrl_info(&args, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_ctrl_info (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_opt_cmd_support(&args, 0, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_opt_cmd_support (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_opt_cmd_support(&args, 1, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_opt_cmd_support (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_opt_cmd_support(&args, 0, 1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_opt_cmd_support (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_data_read_opt_cmd_support(&args, 1, 1);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_data_read_opt_cmd_support (%d)\n", ret);
-				goto exit;
-			}
-
-			char vpd[256];
-			memset(vpd, 0, sizeof(vpd));
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_read(&args, 0, 256, vpd);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_read (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_read(&args, 1, 256, vpd);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_read (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_read(&args, 0, 257, vpd);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_read (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_write(&args, 0, 128, vpd);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_write (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_write(&args, 128, 128, vpd + 128);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_write (%d)\n", ret);
-				goto exit;
-			}
-
-			memset(vpd, 0, sizeof(vpd));
-
-			args.csi = !args.csi;
-			ret = nvme_mi_mi_vpd_read(&args, 0, 256, vpd);
-			if (ret) {
-				main_trace(ERROR, "nvme_mi_mi_vpd_read (%d)\n", ret);
-				goto exit;
-			}
-
-			tt.value = 0x189;
-			args.csi = !args.csi;
-			ret = nvme_set_features_temp_thresh(&args, tt.value, 0);
-			if (ret) {
-				main_trace(ERROR, "nvme_set_features_temp_thresh (%d)\n", ret);
-				goto exit;
-			}
-
-			/**
-			 * Set/Get Feature - Metadata
-			 */
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata_2(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata_3(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata_3(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = test_set_feature_controller_metadata_2(&args);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_DEFAULT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			/**
-			 * Get Feature - Metadata
-			 */
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_DEFAULT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_SAVED, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_SAVED, 1);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_enhanced_controller_metadata(&args, NVME_GET_FEATURES_SEL_SUPPORTED, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_SUPPORTED, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_namespace_metadata(&args, NVME_GET_FEATURES_SEL_SUPPORTED, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			args.csi = !args.csi;
-			ret = nvme_get_feature_controller_metadata(&args, NVME_GET_FEATURES_SEL_CURRENT, 0);
-			if (ret) {
-				main_trace(ERROR, "test_set_feature_controller_metadata (%d)\n", ret);
-				goto exit;
-			}
-
-			// break;
-
-			printf("Round #%d done\n", ++count);
-#ifdef WIN32
-			Sleep(1000);
-#else
-			usleep(1000 * 1000);
-#endif
-			// break;
-		}
+		nvme_script_free(script);
+		free(script);
 #else
 		pthread_t t1;
 		struct aa_args t1_args = {
@@ -1219,8 +1274,1105 @@ int main(int argc, char *argv[])
 
 		break;
 	}
-	case FUNC_IDX_I2C_DETECT: {
-		scan_i2c_bus(handle);
+	case FUNC_IDX_MCTP_BRIDGE: {
+		int ret, port2, addr1, addr2;
+		Aardvark handle2;
+		struct mctp_bridge_port ports[MCTP_BRIDGE_PORT_MAX];
+
+		if (check_argc_range(argc, optind + 5, optind + 6))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		port2 = strtol(argv[optind + 2], &end, 0);
+		if (*end || port2 < 0 || port2 == port)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid port number\n");
+
+		addr1 = parse_i2c_address(argv[optind + 3], all_addr);
+		if (addr1 < 0)
+			goto exit;
+
+		addr2 = parse_i2c_address(argv[optind + 4], all_addr);
+		if (addr2 < 0)
+			goto exit;
+
+		handle2 = aa_open(port2);
+		if (handle2 <= 0) {
+			main_trace(ERROR, "unable to open Aardvark device on port %d\n", port2);
+			main_trace(ERROR, "Error code = %d\n", handle2);
+			goto exit;
+		}
+
+		aa_configure(handle2, AA_CONFIG_GPIO_I2C);
+		aa_i2c_bitrate(handle2, bit_rate);
+		if (pull_up)
+			aa_i2c_pullup(handle2, AA_I2C_PULLUP_BOTH);
+		if (power)
+			aa_target_power(handle2, AA_TARGET_POWER_BOTH);
+
+		mctp_route_init(handle);
+
+		/**
+		 * Static routes, one per line: <eid_start> <eid_end> <port> [<segment>:]<addr>.
+		 * Routes back to the requesters are learnt from the traffic.
+		 */
+		if (argc == optind + 6) {
+			char line[128];
+			FILE *fp = fopen(argv[optind + 5], "r");
+			if (!fp) {
+				perror("fopen");
+				aa_close(handle2);
+				goto exit;
+			}
+
+			while (fgets(line, sizeof(line), fp)) {
+				int eid_start, eid_end, rt_port, rt_seg, rt_addr;
+				char rt_text[32];
+				if (line[0] == '#' ||
+				    sscanf(line, "%i %i %i %31s", &eid_start, &eid_end, &rt_port, rt_text) != 4 ||
+				    i2c_mux_parse_addr(rt_text, &rt_seg, &rt_addr))
+					continue;
+
+				if (rt_port != port && rt_port != port2) {
+					main_trace(WARN, "skip route to port %d\n", rt_port);
+					continue;
+				}
+
+				mctp_route_add(eid_start, eid_end, rt_port == port ? handle : handle2, rt_seg,
+				               rt_addr, MCTP_ROUTE_ENDPOINT);
+			}
+			fclose(fp);
+		}
+
+		memset(ports, 0, sizeof(ports));
+		ports[0].handle = handle;
+		ports[0].own_addr = addr1;
+		ports[0].pec = pec;
+		ports[1].handle = handle2;
+		ports[1].own_addr = addr2;
+		ports[1].pec = pec;
+
+		ret = mctp_bridge_run(ports, MCTP_BRIDGE_PORT_MAX, -1, verbose);
+		if (ret)
+			main_trace(ERROR, "mctp_bridge_run (%d)\n", ret);
+
+		if (!m_keep_power)
+			aa_target_power(handle2, AA_TARGET_POWER_NONE);
+		aa_close(handle2);
+
+		break;
+	}
+	case FUNC_IDX_NVME_FW: {
+		static const char *_ca[NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE_IMMEDIATE + 1] = {
+			[NVME_FW_COMMIT_CA_REPLACE] = "replace",
+			[NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE] = "activate",
+			[NVME_FW_COMMIT_CA_SET_ACTIVE] = "set-active",
+			[NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE_IMMEDIATE] = "immediate",
+		};
+		struct nvme_fw_update fw = {
+			.action = NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE,
+		};
+		int ret, owner_eid, tar_eid, ca = 0;
+		unsigned long fs = 0;
+
+		if (check_argc_range(argc, optind + 6, optind + 9))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		fw.path = argv[optind + 5];
+		if (argc > optind + 6) {
+			fs = strtoul(argv[optind + 6], &end, 0);
+			if (*end || fs > 7)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid slot\n");
+		}
+		if (argc > optind + 7) {
+			for (ca = 0; ca <= NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE_IMMEDIATE; ca++)
+				if (!strcmp(argv[optind + 7], _ca[ca]))
+					break;
+			if (ca > NVME_FW_COMMIT_CA_REPLACE_AND_ACTIVATE_IMMEDIATE) {
+				main_trace(ERROR, "unknown action %s\n", argv[optind + 7]);
+				main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+			}
+			fw.action = ca;
+		}
+		if (argc > optind + 8)
+			fw.ckpt_path = argv[optind + 8];
+		fw.slot = fs;
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		ret = nvme_fw_update(&args, &fw);
+		printf("%d of %d bytes acknowledged in %llu ms (%d B/s)\n", fw.offset, fw.size,
+		       (unsigned long long)fw.elapsed_us / 1000, fw.throughput);
+		if (ret) {
+			main_trace(ERROR, "nvme_fw_update (%d)\n", ret);
+			goto exit;
+		}
+
+		break;
+	}
+	case FUNC_IDX_NVME_MEB: {
+		int ret, owner_eid, tar_eid;
+		unsigned long val, len = 0;
+		const char *op, *file = NULL;
+		uint32_t size;
+		uint8_t *buf;
+
+		if (check_argc_range(argc, optind + 8, optind + 9))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		// read <offset> <len> [file], write <offset> <file>, log <lid> <len> [file]
+		op = argv[optind + 5];
+		val = strtoul(argv[optind + 6], &end, 0);
+		if (*end)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid offset or lid\n");
+		if (!strcmp(op, "write")) {
+			if (argc != optind + 8)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: too many arguments\n");
+			file = argv[optind + 7];
+		} else if (!strcmp(op, "read") || !strcmp(op, "log")) {
+			len = strtoul(argv[optind + 7], &end, 0);
+			if (*end || !len || len > NVME_MEB_SIZE_MAX)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid length\n");
+			if (argc > optind + 8)
+				file = argv[optind + 8];
+		} else {
+			main_trace(ERROR, "unknown operation %s\n", op);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+		if ((!strcmp(op, "log") && val > 0xFF) || val > UINT32_MAX - len)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid offset or lid\n");
+
+		buf = malloc(NVME_MEB_SIZE_MAX);
+		if (!buf) {
+			main_trace(ERROR, "malloc\n");
+			goto exit;
+		}
+
+		// Load the data first, a bad file should not cost a bus transaction.
+		size = len;
+		if (!strcmp(op, "write") && nvme_meb_load_file(file, buf, &size))
+			goto meb_exit;
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto meb_exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		if (!strcmp(op, "read"))
+			ret = nvme_meb_read(&args, val, size, buf);
+		else if (!strcmp(op, "write"))
+			ret = nvme_meb_write(&args, val, size, buf);
+		else
+			ret = nvme_meb_get_log_page(&args, val, buf, size);
+		if (ret) {
+			main_trace(ERROR, "meb %s (%d)\n", op, ret);
+		} else if (strcmp(op, "write")) {
+			if (file)
+				ret = nvme_meb_save_file(file, buf, size);
+			else
+				print_buf(buf, size, "MEB");
+		} else {
+			printf("%d bytes written at %lu\n", size, val);
+		}
+
+meb_exit:
+		free(buf);
+
+		break;
+	}
+	case FUNC_IDX_NVME_MONITOR: {
+		int ret, owner_eid;
+		uint32_t duration = 0;
+		static struct nvme_monitor mon;
+
+		if (check_argc_range(argc, optind + 4, optind + 5))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		owner_eid = parse_eid(argv[optind + 2]);
+		if (owner_eid < 8)
+			goto exit;
+
+		if (argc == optind + 5) {
+			duration = strtoul(argv[optind + 4], &end, 0);
+			if (*end)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid duration\n");
+		}
+
+		nvme_monitor_init(&mon, 10);
+		ret = nvme_monitor_load_plan(&mon, argv[optind + 3]);
+		if (ret || !mon.ndrive) {
+			main_trace(ERROR, "nvme_monitor_load_plan (%d)\n", ret);
+			goto exit;
+		}
+
+		if (!sock_path)
+			aa_i2c_slave_enable(handle, SMBUS_ADDR_IPMI_BMC, 0, 0);
+
+		ret = mctp_init(handle, owner_eid, mon.drive[0].eid, SMBUS_ADDR_IPMI_BMC,
+		                MCTP_BASELINE_TRAN_UNIT_SIZE, pec);
+		if (ret) {
+			main_trace(ERROR, "mctp_init (%d)\n", ret);
+			goto exit;
+		}
+
+		if (sock_path) {
+			ret = mctp_socket_init(sock_path, false, SMBUS_ADDR_IPMI_BMC);
+			if (ret) {
+				main_trace(ERROR, "mctp_socket_init (%d)\n", ret);
+				goto exit;
+			}
+		}
+
+		// Every drive of the plan gets the EID it is monitored with.
+		for (int i = 0; i < mon.ndrive; i++) {
+			ret = mctp_message_set_eid(mon.drive[i].slv_addr, EID_NULL_DST, SET_EID,
+			                           mon.drive[i].eid, 1, 0, verbose);
+			if (!ret)
+				ret = mctp_poll(handle, 100, verbose);
+			if (ret && ret != 0xFF)
+				main_trace(WARN, "set eid %d on %02x (%d)\n", mon.drive[i].eid,
+				           mon.drive[i].slv_addr, ret);
+
+			ret = mctp_discover_endpoint(mon.drive[i].slv_addr, mon.drive[i].eid, false, 100,
+			                             verbose);
+			if (ret)
+				main_trace(WARN, "mctp_discover_endpoint (%d)\n", ret);
+		}
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.nsid = NVME_NSID_ALL,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		ret = nvme_monitor_run(&args, &mon, duration);
+		if (ret)
+			main_trace(ERROR, "nvme_monitor_run (%d)\n", ret);
+
+		nvme_monitor_show(&mon);
+
+		break;
+	}
+	case FUNC_IDX_NVME_CACHE: {
+		int ret, owner_eid, tar_eid;
+		union udid_ds udid;
+		struct nvme_cache cache;
+
+		if (check_argc_range(argc, optind + 6, optind + 6))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto exit;
+
+		// The UDID names the cache file, without ARP on a socket the Serial Number does.
+		memset(&udid, 0, sizeof(udid));
+		if (!sock_path) {
+			ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 1, pec);
+			if (ret) {
+				main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
+				goto exit;
+			}
+		}
+
+		ret = nvme_cache_open(&cache, argv[optind + 5], (void *)&udid);
+		if (ret)
+			goto exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		ret = nvme_cache_warm_start(&args, &cache);
+		if (ret)
+			main_trace(ERROR, "nvme_cache_warm_start (%d)\n", ret);
+
+		nvme_cache_show(&cache);
+		nvme_cache_close(&cache);
+
+		break;
+	}
+	case FUNC_IDX_NVME_VPD: {
+		int ret, owner_eid, tar_eid;
+		const char *op, *file = NULL;
+		struct nvme_vpd *vpd = NULL;
+		uint8_t *want = NULL;
+		uint32_t size = 0, written;
+
+		if (check_argc_range(argc, optind + 6, optind + 7))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		op = argv[optind + 5];
+		if (argc > optind + 6)
+			file = argv[optind + 6];
+		if (strcmp(op, "show") && strcmp(op, "dump") && strcmp(op, "update")) {
+			main_trace(ERROR, "unknown operation %s\n", op);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+		if (!file && strcmp(op, "show")) {
+			main_trace(ERROR, "%s needs a file\n", op);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+
+		vpd = malloc(sizeof(*vpd));
+		want = malloc(NVME_VPD_SIZE_MAX);
+		if (!vpd || !want) {
+			main_trace(ERROR, "malloc\n");
+			goto vpd_exit;
+		}
+
+		// Load the image first, a bad file should not cost a bus transaction.
+		if (!strcmp(op, "update") && nvme_vpd_load_file(file, want, &size))
+			goto vpd_exit;
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto vpd_exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		ret = nvme_vpd_read(&args, vpd, size);
+		if (ret) {
+			main_trace(ERROR, "nvme_vpd_read (%d)\n", ret);
+		} else if (!strcmp(op, "show")) {
+			nvme_vpd_show(vpd);
+		} else if (!strcmp(op, "dump")) {
+			ret = nvme_vpd_save_file(file, vpd);
+			if (ret)
+				main_trace(ERROR, "nvme_vpd_save_file (%d)\n", ret);
+		} else {
+			ret = nvme_vpd_update(&args, vpd, want, size, &written);
+			if (ret)
+				main_trace(ERROR, "nvme_vpd_update (%d)\n", ret);
+			printf("%d of %d bytes written\n", written, size);
+		}
+
+vpd_exit:
+		free(want);
+		free(vpd);
+
+		break;
+	}
+	case FUNC_IDX_NVME_CP: {
+		static const char *_cp[NVME_MI_CP_MAX] = {
+			[NVME_MI_CP_PAUSE] = "pause",
+			[NVME_MI_CP_RESUME] = "resume",
+			[NVME_MI_CP_ABORT] = "abort",
+			[NVME_MI_CP_GET_STATE] = "get-state",
+			[NVME_MI_CP_REPLAY] = "replay",
+		};
+		struct nvme_mi_cp_result res;
+		int ret, owner_eid, tar_eid, cpo;
+		unsigned long cpsp = 0;
+
+		if (check_argc_range(argc, optind + 6, optind + 8))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		for (cpo = 0; cpo < NVME_MI_CP_MAX; cpo++)
+			if (!strcmp(argv[optind + 5], _cp[cpo]))
+				break;
+		if (cpo == NVME_MI_CP_MAX) {
+			main_trace(ERROR, "unknown control primitive %s\n", argv[optind + 5]);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+
+		if (argc > optind + 7)
+			cpsp = strtoul(argv[optind + 7], NULL, 0);
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.csi = argc > optind + 6 && strtoul(argv[optind + 6], NULL, 0),
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		memset(&res, 0, sizeof(res));
+		ret = nvme_mi_send_control_primitive(&args, cpo, cpsp, &res);
+		if (ret && ret != -NVME_MI_CP_ERR_STATUS)
+			main_trace(ERROR, "nvme_mi_send_control_primitive (%d)\n", ret);
+		else
+			nvme_mi_cp_show(cpo, &res);
+
+		break;
+	}
+	case FUNC_IDX_NVME_NS: {
+		static struct main_ports ports;
+		struct nvme_ns_inventory *inv;
+		struct session *session;
+		int ret, owner_eid;
+
+		if (check_argc_range(argc, optind + 6, optind + 4 + 2 * NVME_NS_DRIVE_MAX) ||
+		    (argc - optind) % 2)
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		owner_eid = parse_eid(argv[optind + 2]);
+		if (owner_eid < 8)
+			goto exit;
+
+		inv = malloc(sizeof(*inv));
+		session = malloc(sizeof(*session));
+		if (!inv || !session) {
+			main_trace(ERROR, "malloc\n");
+			free(inv);
+			free(session);
+			goto exit;
+		}
+		memset(inv, 0, sizeof(*inv));
+		session_init(session, handle, sock_path, owner_eid, pec, verbose);
+		inv->dir = argv[optind + 3];
+		inv->open = main_ns_open;
+		inv->priv = session;
+		ports.n = 1;
+		ports.port[0] = port;
+		ports.handle[0] = handle;
+
+		if (main_open_ports(&ports, argv[optind + 1], bit_rate, pull_up, power, mux_opt,
+		                    sock_path))
+			goto ns_exit;
+
+		// Drives are [<port>/]<slv_addr> <tar_eid>, brought up by the worker of their adapter.
+		for (int i = optind + 4; i < argc; i += 2) {
+			const char *drive;
+			Aardvark drive_handle;
+			int addr = -1, eid = parse_eid(argv[i + 1]);
+
+			drive = main_parse_port(&ports, argv[i], &drive_handle);
+			if (drive)
+				addr = parse_i2c_address(drive, all_addr);
+			if (addr < 0 || eid < 8 || eid == owner_eid) {
+				main_trace(ERROR, "wrong drive %s or eid (%d,%d)\n", argv[i], owner_eid, eid);
+				goto ns_exit;
+			}
+
+			if (nvme_ns_add_drive(inv, drive_handle, addr, eid))
+				goto ns_exit;
+		}
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		ret = nvme_ns_run(&args, inv);
+		if (ret)
+			main_trace(ERROR, "nvme_ns_run (%d)\n", ret);
+
+		nvme_ns_show(inv);
+ns_exit:
+		nvme_ns_free(inv);
+		free(inv);
+		session_deinit(session);
+		free(session);
+		main_close_ports(&ports);
+
+		break;
+	}
+	case FUNC_IDX_NVME_TELEMETRY: {
+		struct nvme_telemetry tl;
+		int ret, owner_eid, tar_eid;
+		const char *log;
+		unsigned long max_area = NVME_TELEMETRY_DA_3, interval = 0, count = 1;
+		char *end = "";
+
+		if (check_argc_range(argc, optind + 7, optind + 10))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		log = argv[optind + 5];
+		if (strcmp(log, "host") && strcmp(log, "host-create") && strcmp(log, "ctrl")) {
+			main_trace(ERROR, "unknown log %s\n", log);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+
+		if (argc > optind + 7)
+			max_area = strtoul(argv[optind + 7], &end, 0);
+		if (!*end && argc > optind + 8)
+			interval = strtoul(argv[optind + 8], &end, 0);
+		if (!*end && argc > optind + 9)
+			count = strtoul(argv[optind + 9], &end, 0);
+		if (*end || !max_area || max_area > NVME_TELEMETRY_AREA_MAX)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid area, interval or count\n");
+
+		ret = nvme_telemetry_open(&tl, argv[optind + 6],
+		                          strcmp(log, "ctrl") ? NVME_LOG_LID_TELEMETRY_HOST :
+		                          NVME_LOG_LID_TELEMETRY_CTRL);
+		if (ret) {
+			main_trace(ERROR, "nvme_telemetry_open (%d)\n", ret);
+			goto exit;
+		}
+		tl.create = !strcmp(log, "host-create");
+		tl.max_area = max_area;
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret) {
+			nvme_telemetry_close(&tl);
+			goto exit;
+		}
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		// A count of 0 collects until interrupted.
+		for (unsigned long i = 0; !count || i < count; i++) {
+			if (i) {
+#ifdef WIN32
+				Sleep(interval * 1000);
+#else
+				sleep(interval);
+#endif
+			}
+
+			ret = nvme_telemetry_collect(&args, &tl);
+			if (ret)
+				main_trace(ERROR, "nvme_telemetry_collect (%d)\n", ret);
+			nvme_telemetry_show(&tl);
+		}
+
+		nvme_telemetry_close(&tl);
+
+		break;
+	}
+	case FUNC_IDX_NVME_EVENTS: {
+		struct nvme_event_reader er;
+		union udid_ds udid;
+		int ret, owner_eid, tar_eid;
+		const char *log;
+		unsigned long interval = 0, count = 1;
+		char *end = "";
+
+		if (check_argc_range(argc, optind + 7, optind + 9))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		owner_eid = parse_eid(argv[optind + 3]);
+		tar_eid = parse_eid(argv[optind + 4]);
+		if (slv_addr < 0 || owner_eid < 8 || tar_eid < 8 || owner_eid == tar_eid) {
+			main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", slv_addr, owner_eid, tar_eid);
+			goto exit;
+		}
+
+		log = argv[optind + 5];
+		if (strcmp(log, "error") && strcmp(log, "pel") && strcmp(log, "all")) {
+			main_trace(ERROR, "unknown log %s\n", log);
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+		}
+
+		if (argc > optind + 7)
+			interval = strtoul(argv[optind + 7], &end, 0);
+		if (!*end && argc > optind + 8)
+			count = strtoul(argv[optind + 8], &end, 0);
+		if (*end)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid interval or count\n");
+
+		ret = mctp_open_endpoint(handle, sock_path, slv_addr, owner_eid, tar_eid, pec, verbose);
+		if (ret)
+			goto exit;
+
+		// The UDID names the cursor file, a socket has no ARP so all drives share one.
+		memset(&udid, 0, sizeof(udid));
+		if (!sock_path) {
+			ret = smbus_arp_cmd_get_udid(handle, &udid, slv_addr, 1, pec);
+			if (ret) {
+				main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
+				goto exit;
+			}
+		}
+
+		if (nvme_event_open(&er, argv[optind + 6], (void *)&udid))
+			goto exit;
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.slv_addr = slv_addr,
+			.dst_eid = tar_eid,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		// A count of 0 polls until interrupted.
+		for (unsigned long i = 0; !count || i < count; i++) {
+			if (i) {
+#ifdef WIN32
+				Sleep(interval * 1000);
+#else
+				sleep(interval);
+#endif
+			}
+
+			if (strcmp(log, "pel")) {
+				ret = nvme_event_read_errors(&args, &er);
+				if (ret)
+					main_trace(ERROR, "nvme_event_read_errors (%d)\n", ret);
+			}
+			if (strcmp(log, "error")) {
+				ret = nvme_event_read_pel(&args, &er);
+				if (ret)
+					main_trace(ERROR, "nvme_event_read_pel (%d)\n", ret);
+			}
+			if (nvme_format_get() == NVME_FORMAT_TEXT)
+				nvme_event_show(&er);
+		}
+
+		break;
+	}
+	case FUNC_IDX_NVME_FEATURES: {
+		struct nvme_feat_snapshot *snap, *base;
+		const char *base_path;
+		char path[256];
+		bool have_base;
+		int ret, owner_eid, ndiff = 0;
+
+		if (check_argc_range(argc, optind + 7, optind + 5 + 2 * NVME_FEAT_DRIVE_MAX) ||
+		    (argc - optind) % 2 == 0)
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		owner_eid = parse_eid(argv[optind + 2]);
+		if (owner_eid < 8)
+			goto exit;
+
+		snap = malloc(2 * sizeof(*snap));
+		if (!snap) {
+			main_trace(ERROR, "malloc\n");
+			goto exit;
+		}
+		base = snap + 1;
+
+		base_path = argv[optind + 4];
+		have_base = !nvme_feat_load(base_path, base);
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		for (int i = optind + 5; i < argc; i += 2) {
+			int addr = parse_i2c_address(argv[i], all_addr);
+			int eid = parse_eid(argv[i + 1]);
+			union udid_ds udid;
+			int len;
+
+			if (addr < 0 || eid < 8 || eid == owner_eid) {
+				main_trace(ERROR, "wrong address or eid (%d,%d,%d)\n", addr, owner_eid, eid);
+				goto feat_exit;
+			}
+
+			if (i == optind + 5) {
+				ret = mctp_open_endpoint(handle, sock_path, addr, owner_eid, eid, pec, verbose);
+			} else {
+				ret = mctp_message_set_eid(addr, EID_NULL_DST, SET_EID, eid, 1, 0, verbose);
+				if (!ret)
+					ret = mctp_discover_endpoint(addr, eid, false, 100, verbose);
+			}
+			if (ret) {
+				main_trace(ERROR, "endpoint %02x/%d (%d)\n", addr, eid, ret);
+				goto feat_exit;
+			}
+
+			// The UDID names the snapshot, without ARP on a socket the EID tells drives apart.
+			memset(&udid, 0, sizeof(udid));
+			if (sock_path) {
+				udid.data[sizeof(udid) - 1] = eid;
+			} else {
+				ret = smbus_arp_cmd_get_udid(handle, &udid, addr, 1, pec);
+				if (ret) {
+					main_trace(ERROR, "smbus_arp_cmd_get_udid (%d)\n", ret);
+					goto feat_exit;
+				}
+			}
+
+			args.slv_addr = addr;
+			args.dst_eid = eid;
+			ret = nvme_feat_snapshot(&args, snap, nvme_feat_default_fid, nvme_feat_default_nfid);
+			if (ret) {
+				main_trace(ERROR, "nvme_feat_snapshot (%d)\n", ret);
+				goto feat_exit;
+			}
+			memcpy(snap->hdr.udid, &udid, sizeof(snap->hdr.udid));
+
+			len = snprintf(path, sizeof(path), "%s/", argv[optind + 3]);
+			for (int j = 0; j < sizeof(udid) && len < sizeof(path); j++)
+				len += snprintf(path + len, sizeof(path) - len, "%02x", udid.data[j]);
+			if (len < sizeof(path))
+				snprintf(path + len, sizeof(path) - len, ".nfsn");
+			nvme_feat_save(path, snap);
+
+			printf("Drive %02x/%d\n", addr, eid);
+			nvme_feat_show(snap);
+
+			// Without a baseline the first drive becomes it.
+			if (!have_base) {
+				*base = *snap;
+				have_base = !nvme_feat_save(base_path, base);
+				printf("Baseline                    : %s (new)\n", base_path);
+				continue;
+			}
+
+			ret = nvme_feat_diff(stdout, base, snap);
+			printf("Differences                 : %d\n", ret);
+			ndiff += ret;
+		}
+
+		if (ndiff)
+			main_trace(WARN, "%d features differ from %s\n", ndiff, base_path);
+feat_exit:
+		free(snap);
+
+		break;
+	}
+	case FUNC_IDX_NVME_FANOUT: {
+		static struct main_ports ports;
+		struct session *session;
+		struct nvme_fanout *fo;
+		char *t, *end;
+		int ret, owner_eid, n = 0;
+
+		if (check_argc_range(argc, optind + 5, optind + 5 + NVME_SCRIPT_PARAM_MAX))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		owner_eid = parse_eid(argv[optind + 2]);
+		if (owner_eid < 8)
+			goto exit;
+
+		session = malloc(sizeof(*session));
+		fo = calloc(1, sizeof(*fo));
+		if (!session || !fo) {
+			main_trace(ERROR, "malloc\n");
+			free(session);
+			free(fo);
+			goto exit;
+		}
+		session_init(session, handle, sock_path, owner_eid, pec, verbose);
+		ports.n = 1;
+		ports.port[0] = port;
+		ports.handle[0] = handle;
+
+		fo->cmd = nvme_script_find(argv[optind + 4]);
+		for (int i = optind + 5; fo->cmd && i < argc; i++) {
+			fo->param[n++] = strtoul(argv[i], &end, 0);
+			if (*end)
+				fo->cmd = NULL;
+		}
+		if (!fo->cmd || n < fo->cmd->min || n > fo->cmd->max) {
+			main_trace(ERROR, "invalid op %s\n", argv[optind + 4]);
+			goto fanout_exit;
+		}
+
+		if (main_open_ports(&ports, argv[optind + 1], bit_rate, pull_up, power, mux_opt,
+		                    sock_path))
+			goto fanout_exit;
+
+		// Targets are [<port>/][<segment>:]<slv_addr>:<tar_eid> separated by commas.
+		for (t = strtok(argv[optind + 3], ","); t; t = strtok(NULL, ",")) {
+			char *sep = strrchr(t, ':');
+			const char *tar;
+			unsigned long eid;
+			Aardvark tar_handle;
+			int seg, addr;
+
+			if (!sep)
+				break;
+			eid = strtoul(sep + 1, &end, 0);
+			if (*end || eid > 0xFF)
+				break;
+			*sep = 0;
+			tar = main_parse_port(&ports, t, &tar_handle);
+			if (!tar || i2c_mux_parse_addr(tar, &seg, &addr)) {
+				*sep = ':';
+				break;
+			}
+
+			if (nvme_fanout_add_target(fo, tar_handle, seg, addr, eid))
+				main_trace(WARN, "target %s:%lu skipped\n", t, eid);
+		}
+		if (t) {
+			main_trace(ERROR, "invalid target %s\n", t);
+			goto fanout_exit;
+		}
+
+		struct aa_args args = {
+			.handle = handle,
+			.verbose = verbose,
+			.pec = pec,
+			.ic = true,
+			.timeout = 100,
+		};
+
+		fo->open = main_fanout_open;
+		fo->priv = session;
+		ret = nvme_fanout_run(&args, fo);
+		if (ret)
+			main_trace(WARN, "nvme_fanout_run (%d)\n", ret);
+		nvme_fanout_show(fo);
+
+fanout_exit:
+		session_deinit(session);
+		free(session);
+		free(fo);
+		main_close_ports(&ports);
+
+		break;
+	}
+	case FUNC_IDX_SESSION:
+	case FUNC_IDX_DAEMON: {
+		struct session *session;
+		int ret, owner_eid, first;
+
+		// The daemon takes its socket path ahead of the endpoints.
+		first = func_idx == FUNC_IDX_DAEMON ? optind + 4 : optind + 3;
+		if (check_argc_range(argc, first, first + 2 * SESSION_ENDPOINT_MAX) ||
+		    (argc - first) % 2)
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		owner_eid = parse_eid(argv[optind + 2]);
+		if (owner_eid < 8)
+			goto exit;
+
+		session = malloc(sizeof(*session));
+		if (!session) {
+			main_trace(ERROR, "malloc\n");
+			goto exit;
+		}
+		session_init(session, handle, sock_path, owner_eid, pec, verbose);
+
+		// Endpoints given up front are ready before the first request.
+		for (int i = first; i < argc; i += 2) {
+			int seg = parse_i2c_segment(argv[i]);
+			int addr = parse_i2c_address(argv[i], all_addr);
+			int eid = parse_eid(argv[i + 1]);
+
+			if (seg < 0 || addr < 0 || eid < 0 || !session_open(session, seg, addr, eid))
+				main_trace(WARN, "endpoint %s/%s not opened\n", argv[i], argv[i + 1]);
+		}
+
+		if (func_idx == FUNC_IDX_DAEMON)
+			ret = session_serve(session, argv[optind + 3]);
+		else
+			ret = session_stream(session);
+		if (ret)
+			main_trace(ERROR, "session (%d)\n", ret);
+
+		session_deinit(session);
+		free(session);
+
+		break;
+	}
+	case FUNC_IDX_EEPROM: {
+		static u8 image[I2C_EEPROM_SIZE_MAX];
+		struct i2c_eeprom ee;
+		unsigned long offset, len;
+		const char *cmd;
+		uint32_t n;
+		uint64_t us;
+		int ret;
+
+		if (check_argc_range(argc, optind + 6, optind + 8))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		if (slv_addr < 0)
+			goto exit;
+
+		if (i2c_eeprom_init(&ee, handle, slv_addr, argv[optind + 3]))
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid chip %s\n", argv[optind + 3]);
+
+		cmd = argv[optind + 4];
+		offset = strtoul(argv[optind + 5], &end, 0);
+		if (*end || offset >= ee.size)
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid offset\n");
+
+		if (!strcmp(cmd, "read")) {
+			if (argc < optind + 7)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: too few arguments\n");
+			len = strtoul(argv[optind + 6], &end, 0);
+			if (*end || !len || len > ee.size - offset)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid length\n");
+
+			ret = i2c_eeprom_read(&ee, offset, image, len);
+			if (!ret && argc == optind + 8) {
+				FILE *fp = fopen(argv[optind + 7], "wb");
+
+				if (!fp || fwrite(image, 1, len, fp) != len)
+					ret = -I2C_EEPROM_ERR_IO;
+				if (fp && fclose(fp))
+					ret = -I2C_EEPROM_ERR_IO;
+			} else if (!ret) {
+				i2c_eeprom_dump(offset, image, len);
+			}
+		} else if (!strcmp(cmd, "write") || !strcmp(cmd, "verify")) {
+			if (argc != optind + 7)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: too many arguments\n");
+
+			ret = i2c_eeprom_load(argv[optind + 6], image, ee.size - offset, &n);
+			if (!ret && !strcmp(cmd, "write"))
+				ret = i2c_eeprom_write(&ee, offset, image, n);
+
+			// What was written is read back in one go.
+			if (!ret) {
+				us = ee.elapsed_us;
+				ret = i2c_eeprom_verify(&ee, offset, image, n);
+				ee.elapsed_us += us;
+			}
+
+			i2c_eeprom_show(&ee);
+			if (!ret)
+				printf("Verified                    : %u bytes\n", n);
+		} else {
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: unknown command %s\n", cmd);
+		}
+
+		if (ret) {
+			main_trace(ERROR, "eeprom %s (%d)\n", cmd, ret);
+			goto exit;
+		}
+
+		break;
+	}
+	case FUNC_IDX_NVME_EMU: {
+		static struct nvme_emu emu;
+		struct nvme_emu_model model;
+		int ret, eid, idle_ms = -1;
+
+		if (check_argc_range(argc, optind + 4, optind + 6))
+			main_exit(EXIT_FAILURE, handle, func_idx, NULL);
+
+		slv_addr = parse_i2c_address(argv[optind + 2], all_addr);
+		if (slv_addr < 0)
+			goto exit;
+
+		eid = parse_eid(argv[optind + 3]);
+		if (eid < 0)
+			goto exit;
+
+		nvme_emu_model_default(&model);
+		if (argc > optind + 4 && strcmp(argv[optind + 4], "-") &&
+		    nvme_emu_model_load(&model, argv[optind + 4]))
+			main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid model %s\n", argv[optind + 4]);
+
+		if (argc > optind + 5) {
+			idle_ms = strtol(argv[optind + 5], &end, 0);
+			if (*end)
+				main_exit(EXIT_FAILURE, handle, func_idx, "error: invalid idle time\n");
+		}
+
+		// A socket carries no PEC.
+		nvme_emu_init(&emu, &model, slv_addr, eid, pec && !sock_path);
+		if (sock_path)
+			ret = nvme_emu_run_socket(&emu, sock_path, idle_ms, verbose);
+		else
+			ret = nvme_emu_run(&emu, handle, idle_ms, verbose);
+		if (ret) {
+			main_trace(ERROR, "nvme_emu_run (%d)\n", ret);
+			goto exit;
+		}
+
+		nvme_emu_show(&emu);
+
 		break;
 	}
 #if 0
@@ -9,6 +9,8 @@
         | BITLSHIFT(1, INIT) \
         )
 
+extern const char *main_trace_header[];
+
 #if 1
 #define main_trace(type, ...) \
 do { \
@@ -44,6 +46,23 @@ enum function_index {
 
 	FUNC_IDX_SMB_DEVICE_POLL,
 	FUNC_IDX_I2C_DETECT,
+	FUNC_IDX_MCTP_BRIDGE,
+	FUNC_IDX_NVME_FW,
+	FUNC_IDX_NVME_MEB,
+	FUNC_IDX_NVME_MONITOR,
+	FUNC_IDX_NVME_CACHE,
+	FUNC_IDX_NVME_VPD,
+	FUNC_IDX_NVME_CP,
+	FUNC_IDX_NVME_NS,
+	FUNC_IDX_NVME_TELEMETRY,
+	FUNC_IDX_NVME_EVENTS,
+	FUNC_IDX_NVME_FEATURES,
+	FUNC_IDX_NVME_FANOUT,
+	FUNC_IDX_DAEMON,
+	FUNC_IDX_CLIENT,
+	FUNC_IDX_SESSION,
+	FUNC_IDX_EEPROM,
+	FUNC_IDX_NVME_EMU,
 	// FUNC_IDX_I2C_MASTER_WRITE,
 	// FUNC_IDX_I2C_MASTER_READ,
 	// FUNC_IDX_I2C_MASTER_WRITE_FILE,
@@ -60,4 +79,8 @@ struct function_list {
 	enum function_index func_idx;
 };
 
+int arp_assign_address(int handle, int slv_addr, int pec);
+int mctp_open_endpoint(int handle, const char *sock_path, int slv_addr, int owner_eid,
+                       int tar_eid, int pec, int verbose);
+
 #endif // ~ MAIN_H
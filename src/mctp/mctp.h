@@ -8,6 +8,8 @@
 
 //
 #define MCTP_MSG_SIZE_MAX               (4224)
+// Message tags are 3 bits, a requester has at most this many requests outstanding.
+#define MCTP_MSG_TAG_MAX                (8)
 /**
  * DSP0236, 8.3 Packet payload and transmission unit sizes
  *
@@ -75,8 +77,21 @@ enum mctp_msg_type {
 enum mctp_ctrl_cmd_code {
 	MCTP_CTRL_MSG_SET_EID = 1,
 	MCTP_CTRL_MSG_GET_EID = 2,
+	MCTP_CTRL_MSG_GET_UUID = 3,
+	MCTP_CTRL_MSG_GET_VERSION = 4,
+	MCTP_CTRL_MSG_GET_MSG_TYPE = 5,
+	MCTP_CTRL_MSG_GET_VENDOR_MSG = 6,
 };
 
+/**
+ * DSP0236, 11.2 MCTP control message format
+ *
+ * The request message body follows the command code directly, while the
+ * response message body starts with the completion code. So the request data
+ * begins one byte earlier than mctp_ctrl_message.msg_data.
+ */
+#define MCTP_CTRL_REQ_HEAD_SIZE         (3)
+
 enum mctp_error_status {
 	MCTP_SUCCESS = 0,
 	MCTP_SMBUS_BUSY = 1,
@@ -192,6 +207,25 @@ union mctp_req_msg_set_eid {
 	u8 data[2];
 };
 
+union mctp_req_msg_get_version {
+	struct {
+		// Message type number for which version information is requested.
+		u8 msg_type;
+	};
+	u8 data[1];
+};
+
+union mctp_req_msg_get_vendor_msg {
+	struct {
+		/**
+		 * Vendor ID set selector. The value 0x00 selects the first vendor ID
+		 * set, and the response returns the selector of the next set.
+		 */
+		u8 vid_set_sel;
+	};
+	u8 data[1];
+};
+
 #pragma pack(pop)
 
 #endif // ~ MCTP_H
@@ -0,0 +1,173 @@
+#include "mctp.h"
+#include "mctp_bridge.h"
+#include "mctp_route.h"
+#include "mctp_smbus.h"
+
+#include "aardvark.h"
+#include "i2c_mux.h"
+#include "smbus.h"
+#include "crc8.h"
+#include "utility.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * DSP0236, 9.1 Bridging
+ *
+ * An MCTP bridge routes packets, not messages. A packet received on one bus is
+ * forwarded as is to the bus and physical address given by the routing table
+ * for its destination EID, so no message assembly takes place on the bridge.
+ */
+static int mctp_bridge_forward(struct mctp_bridge_port *port, int port_cnt, int rx,
+                               u8 *buf, u16 len, int verbose)
+{
+	int ret;
+	const union mctp_smbus_packet *pkt = (void *)buf;
+	const struct mctp_route *rt;
+	struct mctp_bridge_port *tx = NULL;
+	u8 src_addr = pkt->medi_head.src_slv_addr >> 1;
+
+	if (len < sizeof(pkt->medi_head) + sizeof(pkt->tran_head) ||
+	    pkt->medi_head.cmd_code != SMBUS_CMD_CODE_MCTP ||
+	    mctp_smbus_check_packet(&pkt->medi_head) != MCTP_SUCCESS) {
+		++port[rx].drop_cnt;
+		return -MCTP_SMBUS_ERR_INVLD_SUP;
+	}
+
+	/**
+	 * Learn the route back to the source endpoint, so that the response finds
+	 * its way without a static route. The packet came in on the segment the
+	 * port is switched to.
+	 */
+	if (pkt->tran_head.src_eid != EID_NULL_SRC && !mctp_route_lookup(pkt->tran_head.src_eid) &&
+	    mctp_route_add(pkt->tran_head.src_eid, pkt->tran_head.src_eid, port[rx].handle,
+	                   i2c_mux_current(port[rx].handle), src_addr, MCTP_ROUTE_ENDPOINT))
+		mctp_trace(WARN, "no route learnt back to eid %x at %x\n", pkt->tran_head.src_eid,
+		           src_addr);
+
+	rt = mctp_route_lookup(pkt->tran_head.dst_eid);
+	if (rt) {
+		for (int i = 0; i < port_cnt; i++) {
+			if (port[i].handle == rt->handle)
+				tx = &port[i];
+		}
+	}
+
+	// Unroutable, or routed back to the bus it came from.
+	if (!tx || tx == &port[rx]) {
+		if (verbose)
+			mctp_trace(WARN, "drop packet to eid %x from %x\n", pkt->tran_head.dst_eid,
+			           src_addr);
+		++port[rx].drop_cnt;
+		return -MCTP_TRAN_ERR_UNROU_EID;
+	}
+
+	/**
+	 * DSP0237, The source slave address is replaced with the address of the
+	 * bridge on the outgoing bus. The byte count and the MCTP packet itself are
+	 * left untouched, and the PEC is regenerated by smbus_block_write.
+	 */
+	buf[3] = tx->own_addr << 1 | MCTP_OVER_SMBUS;
+
+	ret = i2c_mux_route(tx->handle, rt->bus);
+	if (ret) {
+		mctp_trace(ERROR, "no route to segment %d (%d)\n", rt->bus, ret);
+		++port[rx].drop_cnt;
+		return -MCTP_TRAN_ERR_UNROU_EID;
+	}
+
+	ret = smbus_block_write(tx->handle, rt->phy_addr, SMBUS_CMD_CODE_MCTP,
+	                        pkt->medi_head.byte_cnt, &buf[3], tx->pec, verbose);
+	if (ret) {
+		mctp_trace(ERROR, "smbus_block_write (%d)\n", ret);
+		++port[rx].drop_cnt;
+		return ret;
+	}
+
+	++tx->tx_cnt;
+
+	return MCTP_SUCCESS;
+}
+
+/**
+ * Forward MCTP packets between the ports until no packet has been seen on any
+ * of them for idle_ms, or forever if idle_ms is negative.
+ */
+int mctp_bridge_run(struct mctp_bridge_port *port, int port_cnt, int idle_ms, int verbose)
+{
+	int status;
+	int idle = 0;
+	u8 buf[SMBUS_BUF_MAX + 1];
+
+	if (port_cnt > MCTP_BRIDGE_PORT_MAX)
+		return -MCTP_ERROR;
+
+	for (int i = 0; i < port_cnt; i++) {
+		status = aa_i2c_slave_enable(port[i].handle, port[i].own_addr, 0, 0);
+		if (status) {
+			mctp_trace(ERROR, "aa_i2c_slave_enable (%d)\n", status);
+			return -MCTP_ERROR;
+		}
+		port[i].rx_cnt = port[i].tx_cnt = port[i].drop_cnt = 0;
+	}
+
+	mctp_route_show();
+
+	while (idle_ms < 0 || idle < idle_ms) {
+		bool active = false;
+
+		for (int i = 0; i < port_cnt; i++) {
+			u16 num_read;
+			u8 slv_addr;
+
+			// Do not block on one port while the other has packets pending.
+			status = aa_async_poll(port[i].handle, 1);
+			if (status == AA_ASYNC_I2C_WRITE) {
+				u16 num_written;
+				aa_i2c_slave_write_stats_ext(port[i].handle, &num_written);
+				continue;
+			} else if (status != AA_ASYNC_I2C_READ) {
+				continue;
+			}
+
+			status = aa_i2c_slave_read_ext(port[i].handle, &slv_addr, SMBUS_BUF_MAX,
+			                               &buf[1], &num_read);
+			if (status) {
+				mctp_trace(ERROR, "aa_i2c_slave_read_ext (%d)\n", status);
+				continue;
+			}
+
+			buf[0] = slv_addr << 1 | I2C_WRITE;
+			++num_read;
+			++port[i].rx_cnt;
+			active = true;
+
+			if (verbose)
+				print_buf(buf, num_read, "[%s] port %d rx (%d)", __func__, i, num_read);
+
+			if (port[i].pec && crc8(buf, num_read) != 0) {
+				mctp_trace(ERROR, "pec error on port %d\n", i);
+				++port[i].drop_cnt;
+				continue;
+			}
+
+			mctp_bridge_forward(port, port_cnt, i, buf, num_read - port[i].pec, verbose);
+		}
+
+		// Each idle pass waits up to 1 ms per port.
+		idle = active ? 0 : idle + port_cnt;
+	}
+
+	for (int i = 0; i < port_cnt; i++) {
+		mctp_trace(INFO, "port %d: rx %d, tx %d, drop %d\n", i, port[i].rx_cnt,
+		           port[i].tx_cnt, port[i].drop_cnt);
+		aa_i2c_slave_disable(port[i].handle);
+	}
+
+	return MCTP_SUCCESS;
+}
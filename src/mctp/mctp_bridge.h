@@ -0,0 +1,23 @@
+#ifndef MCTP_BRIDGE_H
+#define MCTP_BRIDGE_H
+
+#include "mctp.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#define MCTP_BRIDGE_PORT_MAX            (2)
+
+struct mctp_bridge_port {
+	int handle;
+	// Slave address the bridge answers to on this port
+	u8 own_addr;
+	bool pec;
+	u32 rx_cnt;
+	u32 tx_cnt;
+	u32 drop_cnt;
+};
+
+int mctp_bridge_run(struct mctp_bridge_port *port, int port_cnt, int idle_ms, int verbose);
+
+#endif // ~ MCTP_BRIDGE_H
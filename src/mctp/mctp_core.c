@@ -4,6 +4,9 @@
 #include "mctp_message.h"
 #include "mctp_transport.h"
 #include "mctp_smbus.h"
+#include "mctp_inventory.h"
+#include "mctp_route.h"
+#include "mctp_socket.h"
 
 #include "types.h"
 #include <stdbool.h>
@@ -37,10 +40,11 @@ int mctp_receive_packet_handle(const void *buf, u32 len, int verbose)
 		return ret;
 	}
 
-	if (mctp_transport_req_sent())
-		msg = g_mctp_resp_msg;
-	else
+	// A packet of a request we answer carries TO set, a response to ours has it cleared.
+	if (pkt->tran_head.tag_owner)
 		msg = g_mctp_req_msg;
+	else
+		msg = g_mctp_resp_msg;
 
 	if (verbose > 1)
 		mctp_trace(INFO, "[%d] req: %p, resp: %p\n", mctp_transport_req_sent(), g_mctp_req_msg, g_mctp_resp_msg);
@@ -82,12 +86,130 @@ int mctp_receive_packet_handle(const void *buf, u32 len, int verbose)
 	return MCTP_SUCCESS;
 }
 
+/**
+ * Receive packets through the current binding and feed them to
+ * mctp_receive_packet_handle until the medium is idle for timeout_ms.
+ */
+int mctp_poll(int handle, int timeout_ms, int verbose)
+{
+	const struct mctp_binding *binding = mctp_transport_get_binding();
+
+	return binding->poll(handle, timeout_ms, mctp_receive_packet_handle, verbose);
+}
+
+static int mctp_wait_response(int timeout, int verbose)
+{
+	int ret = mctp_poll(0, timeout, verbose);
+	if (ret && ret != 0xFF) {
+		mctp_trace(ERROR, "mctp_poll (%d)\n", ret);
+		mctp_transport_expire_request(mctp_transport_get_req_tag());
+	}
+
+	return ret == 0xFF ? MCTP_SUCCESS : ret;
+}
+
+/**
+ * Query the MCTP control properties of an endpoint and file them into the
+ * endpoint inventory. An endpoint that is already complete in the inventory
+ * (loaded from a previous session) is not queried again unless force is set.
+ */
+int mctp_discover_endpoint(u8 slv_addr, u8 eid, bool force, int timeout, int verbose)
+{
+	int ret;
+	struct mctp_endpoint_info *ep = mctp_inventory_get(eid);
+
+	mctp_transport_update_addr(slv_addr, eid);
+
+	if (!force && mctp_inventory_complete(eid, slv_addr)) {
+		mctp_trace(INFO, "eid %x found in inventory\n", eid);
+		if (verbose)
+			mctp_inventory_show(eid);
+		return MCTP_SUCCESS;
+	}
+
+	mctp_inventory_invalidate(eid);
+
+	ret = mctp_message_get_eid(slv_addr, eid, true, false, verbose);
+	if (!ret)
+		ret = mctp_wait_response(timeout, verbose);
+	if (ret || !(ep->flags & MCTP_INV_EID)) {
+		mctp_trace(ERROR, "get endpoint id (%d)\n", ret);
+		return ret ? ret : -MCTP_ERROR;
+	}
+
+	ret = mctp_message_get_uuid(slv_addr, eid, true, false, verbose);
+	if (!ret)
+		ret = mctp_wait_response(timeout, verbose);
+	if (ret || !(ep->flags & MCTP_INV_UUID)) {
+		mctp_trace(ERROR, "get endpoint uuid (%d)\n", ret);
+		return ret ? ret : -MCTP_ERROR;
+	}
+
+	ret = mctp_message_get_msg_type(slv_addr, eid, true, false, verbose);
+	if (!ret)
+		ret = mctp_wait_response(timeout, verbose);
+	if (ret || !(ep->flags & MCTP_INV_MSG_TYPE)) {
+		mctp_trace(ERROR, "get message type support (%d)\n", ret);
+		return ret ? ret : -MCTP_ERROR;
+	}
+
+	// The base specification (0xFF) and control message versions first.
+	for (int i = -2; i < ep->msg_type_cnt; i++) {
+		u8 msg_type = i == -2 ? 0xFF : i == -1 ? MCTP_MSG_TYPE_CTRL : ep->msg_type[i];
+
+		ret = mctp_message_get_version(slv_addr, eid, msg_type, true, false, verbose);
+		if (!ret)
+			ret = mctp_wait_response(timeout, verbose);
+		if (ret) {
+			mctp_trace(ERROR, "get mctp version support (%d)\n", ret);
+			return ret;
+		}
+	}
+
+	u8 vid_set_sel = 0;
+	do {
+		ret = mctp_message_get_vendor_msg(slv_addr, eid, vid_set_sel, true, false, verbose);
+		if (!ret)
+			ret = mctp_wait_response(timeout, verbose);
+		if (ret) {
+			mctp_trace(ERROR, "get vendor defined message support (%d)\n", ret);
+			return ret;
+		}
+		if (ep->flags & MCTP_INV_VENDOR)
+			break;
+
+		/**
+		 * The selector does not advance if no valid response was received, so
+		 * stop instead of asking for the same set again.
+		 */
+		if (mctp_message_next_vid_set_sel() == vid_set_sel)
+			break;
+		vid_set_sel = mctp_message_next_vid_set_sel();
+	} while (vid_set_sel != MCTP_VENDOR_ID_SET_LAST);
+
+	if ((ep->flags & MCTP_INV_ALL) != MCTP_INV_ALL) {
+		mctp_trace(ERROR, "incomplete endpoint inventory (%x)\n", ep->flags);
+		return -MCTP_ERROR;
+	}
+
+	if (verbose)
+		mctp_inventory_show(eid);
+
+	return MCTP_SUCCESS;
+}
+
 int mctp_init(int handle, u8 owner_eid, u8 tar_eid, u8 src_slv_addr,
               u16 nego_size, bool pec_flag)
 {
 	int ret;
 	mctp_trace(INIT, "%s\n", __func__);
 
+	ret = mctp_route_init(handle);
+	if (ret) {
+		mctp_trace(ERROR, "mctp_route_init (%d)\n", ret);
+		return ret;
+	}
+
 	ret = mctp_message_init();
 	if (ret) {
 		mctp_trace(ERROR, "mctp_message_init (%d)\n", ret);
@@ -106,6 +228,12 @@ int mctp_init(int handle, u8 owner_eid, u8 tar_eid, u8 src_slv_addr,
 		return ret;
 	}
 
+	ret = mctp_inventory_init();
+	if (ret) {
+		mctp_trace(ERROR, "mctp_inventory_init (%d)\n", ret);
+		return ret;
+	}
+
 	return MCTP_SUCCESS;
 }
 
@@ -116,6 +244,9 @@ int mctp_deinit(void)
 	mctp_message_deinit();
 	mctp_transport_deinit();
 	mctp_smbus_deinit();
+	mctp_inventory_deinit();
+	mctp_route_deinit();
+	mctp_socket_deinit();
 
 	return MCTP_SUCCESS;
 }
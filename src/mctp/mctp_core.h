@@ -5,6 +5,8 @@
 #include <stdbool.h>
 
 int mctp_receive_packet_handle(const void *buf, u32 len, int verbose);
+int mctp_poll(int handle, int timeout_ms, int verbose);
+int mctp_discover_endpoint(u8 slv_addr, u8 eid, bool force, int timeout, int verbose);
 int mctp_init(int handle, u8 owner_eid, u8 tar_eid, u8 src_slv_addr,
               u16 nego_size, bool pec_flag);
 int mctp_deinit(void);
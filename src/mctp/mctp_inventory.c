@@ -0,0 +1,204 @@
+#include "mctp.h"
+#include "mctp_message.h"
+#include "mctp_inventory.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct mctp_endpoint_info mctp_inv[MCTP_INVENTORY_SIZE];
+static bool mctp_inv_dirty;
+static const char *mctp_inv_path = MCTP_INVENTORY_FILE;
+
+struct mctp_endpoint_info *mctp_inventory_get(u8 eid)
+{
+	return &mctp_inv[eid];
+}
+
+bool mctp_inventory_complete(u8 eid, u8 slv_addr)
+{
+	const struct mctp_endpoint_info *ep = &mctp_inv[eid];
+
+	/**
+	 * The EID of an endpoint is assigned by us through Set Endpoint ID, so the
+	 * entry only stands for the same device if it is still reached through the
+	 * same physical address.
+	 */
+	if (ep->slv_addr != slv_addr)
+		return false;
+
+	/**
+	 * A drive may have been replaced or updated behind the same address, so an
+	 * entry is only trusted for MCTP_INVENTORY_AGE_MAX. A timestamp ahead of the
+	 * clock wraps around and counts as stale too.
+	 */
+	if ((u64)time(NULL) - ep->updated > MCTP_INVENTORY_AGE_MAX)
+		return false;
+
+	return (ep->flags & MCTP_INV_ALL) == MCTP_INV_ALL;
+}
+
+void mctp_inventory_invalidate(u8 eid)
+{
+	memset(&mctp_inv[eid], 0, sizeof(mctp_inv[eid]));
+	mctp_inv_dirty = true;
+}
+
+void mctp_inventory_touch(u8 eid, u8 flag)
+{
+	mctp_inv[eid].eid = eid;
+	mctp_inv[eid].flags |= flag;
+	mctp_inv[eid].updated = time(NULL);
+	mctp_inv_dirty = true;
+}
+
+struct mctp_version_info *mctp_inventory_get_version(u8 eid, u8 msg_type)
+{
+	struct mctp_endpoint_info *ep = &mctp_inv[eid];
+
+	for (int i = 0; i < ep->ver_cnt; i++) {
+		if (ep->ver[i].msg_type == msg_type)
+			return &ep->ver[i];
+	}
+
+	if (ep->ver_cnt >= MCTP_MSG_TYPE_ENTRY_MAX)
+		return NULL;
+
+	memset(&ep->ver[ep->ver_cnt], 0, sizeof(ep->ver[0]));
+	ep->ver[ep->ver_cnt].msg_type = msg_type;
+
+	return &ep->ver[ep->ver_cnt++];
+}
+
+void mctp_inventory_show(u8 eid)
+{
+	const struct mctp_endpoint_info *ep = &mctp_inv[eid];
+
+	if (!ep->flags) {
+		mctp_trace(INFO, "eid %x not in inventory\n", eid);
+		return;
+	}
+
+	mctp_trace(INFO, "Endpoint inventory (eid %x):\n", eid);
+	mctp_trace(INFO, "Slave Address        : %x\n", ep->slv_addr);
+	mctp_trace(INFO, "Flags                : %x\n", ep->flags);
+	mctp_trace(INFO, "EID Type             : %x\n", ep->eid_type);
+	mctp_trace(INFO, "Endpoint Type        : %x\n", ep->endpoint_type);
+	mctp_trace(INFO, "UUID                 : ");
+	for (int i = 0; i < sizeof(ep->uuid); i++)
+		fprintf(stderr, "%02x%s", ep->uuid[i], (i == 3 || i == 5 || i == 7 || i == 9) ? "-" : "");
+	fprintf(stderr, "\n");
+	for (int i = 0; i < ep->msg_type_cnt; i++)
+		mctp_trace(INFO, "Message Type         : %x\n", ep->msg_type[i]);
+	for (int i = 0; i < ep->ver_cnt; i++) {
+		for (int j = 0; j < ep->ver[i].cnt; j++)
+			mctp_trace(INFO, "Version (type %02x)    : %08x\n", ep->ver[i].msg_type,
+			           ep->ver[i].ver[j]);
+	}
+	for (int i = 0; i < ep->vendor_cnt; i++)
+		mctp_trace(INFO, "Vendor ID            : %s %x, cmd set %x\n",
+		           ep->vendor[i].vid_fmt == VENDOR_ID_FMT_PCI ? "pci" : "iana",
+		           ep->vendor[i].vid, ep->vendor[i].cmd_set);
+	mctp_trace(INFO, "\n");
+}
+
+int mctp_inventory_load(const char *path)
+{
+	FILE *fp;
+	struct mctp_inventory_file_header head;
+	struct mctp_endpoint_info ep;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -MCTP_ERROR;
+
+	if (fread(&head, sizeof(head), 1, fp) != 1 ||
+	    head.magic != MCTP_INVENTORY_MAGIC ||
+	    head.version != MCTP_INVENTORY_VERSION ||
+	    head.entry_size != sizeof(ep) ||
+	    head.count > MCTP_INVENTORY_SIZE) {
+		mctp_trace(WARN, "ignore incompatible inventory %s\n", path);
+		fclose(fp);
+		return -MCTP_ERROR;
+	}
+
+	for (u32 i = 0; i < head.count; i++) {
+		if (fread(&ep, sizeof(ep), 1, fp) != 1) {
+			mctp_trace(WARN, "truncated inventory %s (%d,%d)\n", path, i, head.count);
+			break;
+		}
+		mctp_inv[ep.eid] = ep;
+	}
+
+	fclose(fp);
+	mctp_inv_dirty = false;
+
+	return MCTP_SUCCESS;
+}
+
+int mctp_inventory_save(const char *path)
+{
+	FILE *fp;
+	struct mctp_inventory_file_header head = {
+		.magic = MCTP_INVENTORY_MAGIC,
+		.version = MCTP_INVENTORY_VERSION,
+		.entry_size = sizeof(struct mctp_endpoint_info),
+		.count = 0,
+	};
+
+	if (!mctp_inv_dirty)
+		return MCTP_SUCCESS;
+
+	for (int i = 0; i < MCTP_INVENTORY_SIZE; i++) {
+		if (mctp_inv[i].flags)
+			++head.count;
+	}
+
+	fp = fopen(path, "wb");
+	if (!fp) {
+		mctp_trace(ERROR, "fopen %s\n", path);
+		return -MCTP_ERROR;
+	}
+
+	fwrite(&head, sizeof(head), 1, fp);
+	for (int i = 0; i < MCTP_INVENTORY_SIZE; i++) {
+		if (mctp_inv[i].flags)
+			fwrite(&mctp_inv[i], sizeof(mctp_inv[i]), 1, fp);
+	}
+
+	fclose(fp);
+	mctp_inv_dirty = false;
+
+	return MCTP_SUCCESS;
+}
+
+/**
+ * Set the file the inventory is loaded from by mctp_inventory_init and saved to
+ * by mctp_inventory_deinit. The string is not copied.
+ */
+void mctp_inventory_set_path(const char *path)
+{
+	mctp_inv_path = path;
+}
+
+int mctp_inventory_init(void)
+{
+	mctp_trace(INIT, "%s\n", __func__);
+	memset(mctp_inv, 0, sizeof(mctp_inv));
+
+	if (mctp_inventory_load(mctp_inv_path) == MCTP_SUCCESS)
+		mctp_trace(INIT, "inventory loaded from %s\n", mctp_inv_path);
+
+	return MCTP_SUCCESS;
+}
+
+int mctp_inventory_deinit(void)
+{
+	mctp_trace(INIT, "%s\n", __func__);
+
+	return mctp_inventory_save(mctp_inv_path);
+}
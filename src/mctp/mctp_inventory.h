@@ -0,0 +1,80 @@
+#ifndef MCTP_INVENTORY_H
+#define MCTP_INVENTORY_H
+
+#include "mctp.h"
+#include "mctp_message.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+// Default inventory path, relative to the working directory unless set with -i
+#define MCTP_INVENTORY_FILE             "mctp_inventory.bin"
+// Entries older than this (in seconds) are discovered again
+#define MCTP_INVENTORY_AGE_MAX          (24 * 60 * 60)
+// "MINV"
+#define MCTP_INVENTORY_MAGIC            (0x564E494D)
+#define MCTP_INVENTORY_VERSION          (1)
+// One entry per EID, indexed directly by the EID value.
+#define MCTP_INVENTORY_SIZE             (256)
+#define MCTP_INVENTORY_VENDOR_MAX       (4)
+
+enum mctp_inventory_flag {
+	MCTP_INV_EID            = BITLSHIFT(1, 0),
+	MCTP_INV_UUID           = BITLSHIFT(1, 1),
+	MCTP_INV_MSG_TYPE       = BITLSHIFT(1, 2),
+	MCTP_INV_VERSION        = BITLSHIFT(1, 3),
+	MCTP_INV_VENDOR         = BITLSHIFT(1, 4),
+
+	MCTP_INV_ALL            = MCTP_INV_EID | MCTP_INV_UUID | MCTP_INV_MSG_TYPE |
+	                          MCTP_INV_VERSION | MCTP_INV_VENDOR,
+};
+
+struct mctp_version_info {
+	u8 msg_type;
+	u8 cnt;
+	u32 ver[MCTP_VERSION_ENTRY_MAX];
+};
+
+struct mctp_vendor_info {
+	u8 vid_fmt;
+	u32 vid;
+	u16 cmd_set;
+};
+
+struct mctp_endpoint_info {
+	u8 eid;
+	u8 slv_addr;
+	u8 flags;
+	u8 eid_type;
+	u8 endpoint_type;
+	u8 medium_spec;
+	u8 uuid[16];
+	u8 msg_type_cnt;
+	u8 msg_type[MCTP_MSG_TYPE_ENTRY_MAX];
+	u8 ver_cnt;
+	struct mctp_version_info ver[MCTP_MSG_TYPE_ENTRY_MAX];
+	u8 vendor_cnt;
+	struct mctp_vendor_info vendor[MCTP_INVENTORY_VENDOR_MAX];
+	u64 updated;
+};
+
+struct mctp_inventory_file_header {
+	u32 magic;
+	u16 version;
+	u16 entry_size;
+	u32 count;
+};
+
+struct mctp_endpoint_info *mctp_inventory_get(u8 eid);
+bool mctp_inventory_complete(u8 eid, u8 slv_addr);
+void mctp_inventory_invalidate(u8 eid);
+void mctp_inventory_touch(u8 eid, u8 flag);
+struct mctp_version_info *mctp_inventory_get_version(u8 eid, u8 msg_type);
+void mctp_inventory_show(u8 eid);
+int mctp_inventory_load(const char *path);
+int mctp_inventory_save(const char *path);
+void mctp_inventory_set_path(const char *path);
+int mctp_inventory_init(void);
+int mctp_inventory_deinit(void);
+
+#endif // ~ MCTP_INVENTORY_H
@@ -1,6 +1,8 @@
 #include "mctp.h"
 #include "mctp_message.h"
 #include "mctp_transport.h"
+#include "mctp_smbus.h"
+#include "mctp_inventory.h"
 #include "crc32.h"
 #include "utility.h"
 #include "nvme_mi.h"
@@ -33,8 +35,12 @@ int mctp_send_control_request_message(u8 slv_addr, u8 dst_eid, enum mctp_ctrl_cm
                                       union mctp_ctrl_message *msg, size_t req_size,
                                       bool ic, bool retry, int verbose)
 {
-	memset(msg, 0, sizeof(msg->ctrl_msg_head));
-	u16 msg_size = sizeof(msg->ctrl_msg_head) + req_size;
+	/**
+	 * The request data has been filled in right after the command code, so
+	 * only clear the fields that precede it.
+	 */
+	memset(msg, 0, MCTP_CTRL_REQ_HEAD_SIZE);
+	u16 msg_size = MCTP_CTRL_REQ_HEAD_SIZE + req_size;
 
 	msg->ctrl_msg_head.mt = MCTP_MSG_TYPE_CTRL;
 	msg->ctrl_msg_head.ic = ic;
@@ -70,7 +76,7 @@ int mctp_message_set_eid(u8 slv_addr, u8 dst_eid, enum set_eid_operation oper,
 
 	msg = malloc(sizeof(*msg));
 
-	req_data = (void *)msg->msg_data;
+	req_data = (void *)(msg->data + MCTP_CTRL_REQ_HEAD_SIZE);
 	memset(req_data, 0, sizeof(*req_data));
 
 	mctp_transport_update_addr(slv_addr, eid);
@@ -78,7 +84,7 @@ int mctp_message_set_eid(u8 slv_addr, u8 dst_eid, enum set_eid_operation oper,
 	req_data->eid = eid;
 
 	if (verbose)
-		print_buf(msg->msg_data, sizeof(*req_data), "[%s]: req data (%d)", __func__, sizeof(*req_data));
+		print_buf(req_data, sizeof(*req_data), "[%s]: req data (%d)", __func__, sizeof(*req_data));
 
 	ret = mctp_send_control_request_message(slv_addr, dst_eid, MCTP_CTRL_MSG_SET_EID,
 	                                        msg, sizeof(*req_data), ic, retry, verbose);
@@ -90,6 +96,95 @@ int mctp_message_set_eid(u8 slv_addr, u8 dst_eid, enum set_eid_operation oper,
 	return ret;
 }
 
+static int mctp_message_ctrl_request(u8 slv_addr, u8 dst_eid, enum mctp_ctrl_cmd_code cmd_code,
+                                     const void *req_data, size_t req_size, bool ic, bool retry,
+                                     int verbose)
+{
+	int ret;
+	union mctp_ctrl_message *msg;
+
+	msg = malloc(sizeof(*msg));
+
+	if (req_size) {
+		memcpy(msg->data + MCTP_CTRL_REQ_HEAD_SIZE, req_data, req_size);
+		if (verbose)
+			print_buf(req_data, req_size, "[%s]: req data (%d)", __func__, req_size);
+	}
+
+	ret = mctp_send_control_request_message(slv_addr, dst_eid, cmd_code, msg, req_size, ic,
+	                                        retry, verbose);
+	if (ret)
+		mctp_trace(ERROR, "mctp_send_control_request_message (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
+
+int mctp_message_get_eid(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose)
+{
+	return mctp_message_ctrl_request(slv_addr, dst_eid, MCTP_CTRL_MSG_GET_EID, NULL, 0, ic,
+	                                 retry, verbose);
+}
+
+int mctp_message_get_uuid(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose)
+{
+	return mctp_message_ctrl_request(slv_addr, dst_eid, MCTP_CTRL_MSG_GET_UUID, NULL, 0, ic,
+	                                 retry, verbose);
+}
+
+/**
+ * DSP0236, 12.6 Get MCTP version support
+ *
+ * The message type number 0xFF is used to request the version of the MCTP base
+ * specification that the endpoint supports.
+ */
+int mctp_message_get_version(u8 slv_addr, u8 dst_eid, u8 msg_type, bool ic, bool retry,
+                             int verbose)
+{
+	union mctp_req_msg_get_version req_data = {.msg_type = msg_type};
+
+	mctp_msg_ctx.req_msg_type = msg_type;
+
+	return mctp_message_ctrl_request(slv_addr, dst_eid, MCTP_CTRL_MSG_GET_VERSION,
+	                                 &req_data, sizeof(req_data), ic, retry, verbose);
+}
+
+int mctp_message_get_msg_type(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose)
+{
+	return mctp_message_ctrl_request(slv_addr, dst_eid, MCTP_CTRL_MSG_GET_MSG_TYPE, NULL, 0,
+	                                 ic, retry, verbose);
+}
+
+int mctp_message_get_vendor_msg(u8 slv_addr, u8 dst_eid, u8 vid_set_sel, bool ic,
+                                bool retry, int verbose)
+{
+	union mctp_req_msg_get_vendor_msg req_data = {.vid_set_sel = vid_set_sel};
+
+	mctp_msg_ctx.req_vid_set_sel = vid_set_sel;
+	mctp_msg_ctx.next_vid_set_sel = MCTP_VENDOR_ID_SET_LAST;
+
+	return mctp_message_ctrl_request(slv_addr, dst_eid, MCTP_CTRL_MSG_GET_VENDOR_MSG,
+	                                 &req_data, sizeof(req_data), ic, retry, verbose);
+}
+
+u8 mctp_message_next_vid_set_sel(void)
+{
+	return mctp_msg_ctx.next_vid_set_sel;
+}
+
+void mctp_message_set_uuid(const u8 *uuid)
+{
+	memcpy(mctp_msg_ctx.uuid, uuid, sizeof(mctp_msg_ctx.uuid));
+}
+
+void mctp_message_set_vendor_id(u8 vid_fmt, u32 vid, u16 cmd_set)
+{
+	mctp_msg_ctx.vid_fmt = vid_fmt;
+	mctp_msg_ctx.vid = vid;
+	mctp_msg_ctx.cmd_set = cmd_set;
+}
+
 static const char *eid_assign_sts[EID_ASSIGN_STATUS_MAX] = {
 	"accepted",
 	"rejected",
@@ -104,13 +199,35 @@ static const char *eid_alloc_sts[EID_ALLOC_STATUS_MAX] = {
 	"reserved"
 };
 
-u8 mctp_ctrl_resp_set_eid(const union mctp_ctrl_message *msg)
+// Response data received after the control header, size is without the MIC.
+static u16 mctp_ctrl_resp_data_len(const union mctp_ctrl_message *msg, u16 size)
+{
+	return size > sizeof(msg->ctrl_msg_head) ? size - sizeof(msg->ctrl_msg_head) : 0;
+}
+
+static bool mctp_ctrl_resp_short(const union mctp_ctrl_message *msg, u16 size, u16 need)
+{
+	u16 len = mctp_ctrl_resp_data_len(msg, size);
+
+	if (len >= need)
+		return false;
+
+	mctp_trace(ERROR, "short response %d (%d,%d)\n", msg->ctrl_msg_head.cmd_code, len, need);
+	return true;
+}
+
+u8 mctp_ctrl_resp_set_eid(const union mctp_ctrl_message *msg, u16 size)
 {
 	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
 	const union mctp_resp_data_set_eid *resp_data = (void *)msg->msg_data;
 
 	mctp_trace(INFO, "Set Endpoint ID response message:\n");
 	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		return cmpl_code;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(*resp_data)))
+		return MCTP_CMPL_ERROR;
+
 	mctp_trace(INFO, "Endpoint ID Allocation Status : %s\n", eid_alloc_sts[resp_data->eid_alloc_sts]);
 	mctp_trace(INFO, "EID Assignment Status         : %s\n", eid_assign_sts[resp_data->eid_assign_sts]);
 	mctp_trace(INFO, "EID Setting                   : %x\n", resp_data->eid_setting);
@@ -120,9 +237,436 @@ u8 mctp_ctrl_resp_set_eid(const union mctp_ctrl_message *msg)
 	return cmpl_code;
 }
 
-static int mctp_control_request_message_handle(const union mctp_ctrl_message *msg, u16 size)
+/**
+ * Look up the inventory entry of the endpoint that sent the response. An entry
+ * that was learnt through a different physical address belongs to another
+ * device and is dropped.
+ */
+static struct mctp_endpoint_info *mctp_ctrl_resp_endpoint(void)
 {
-	return MCTP_SUCCESS;
+	u8 eid = mctp_transport_get_src_eid();
+	u8 addr = mctp_smbus_get_peer_addr();
+	struct mctp_endpoint_info *ep = mctp_inventory_get(eid);
+
+	if (ep->flags && ep->slv_addr != addr)
+		mctp_inventory_invalidate(eid);
+
+	ep->slv_addr = addr;
+
+	return ep;
+}
+
+u8 mctp_ctrl_resp_get_eid(const union mctp_ctrl_message *msg, u16 size)
+{
+	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
+	const union mctp_resp_data_get_eid *resp_data = (void *)msg->msg_data;
+	struct mctp_endpoint_info *ep;
+
+	mctp_trace(INFO, "Get Endpoint ID response message:\n");
+	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		return cmpl_code;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(*resp_data)))
+		return MCTP_CMPL_ERROR;
+
+	mctp_trace(INFO, "Endpoint ID                   : %x\n", resp_data->eid);
+	mctp_trace(INFO, "Endpoint Type                 : %x\n", resp_data->endpoint_type);
+	mctp_trace(INFO, "Endpoint ID Type              : %x\n", resp_data->eid_type);
+	mctp_trace(INFO, "Medium-Specific Information   : %x\n", resp_data->medium_spec);
+	mctp_trace(INFO, "\n");
+
+	ep = mctp_ctrl_resp_endpoint();
+	ep->eid_type = resp_data->eid_type;
+	ep->endpoint_type = resp_data->endpoint_type;
+	ep->medium_spec = resp_data->medium_spec;
+	mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_EID);
+
+	return cmpl_code;
+}
+
+u8 mctp_ctrl_resp_get_uuid(const union mctp_ctrl_message *msg, u16 size)
+{
+	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
+	const union mctp_resp_data_get_uuid *resp_data = (void *)msg->msg_data;
+	struct mctp_endpoint_info *ep;
+
+	mctp_trace(INFO, "Get Endpoint UUID response message:\n");
+	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		return cmpl_code;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(resp_data->uuid)))
+		return MCTP_CMPL_ERROR;
+
+	print_buf(resp_data->uuid, sizeof(resp_data->uuid), "UUID");
+
+	ep = mctp_ctrl_resp_endpoint();
+	memcpy(ep->uuid, resp_data->uuid, sizeof(ep->uuid));
+	mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_UUID);
+
+	return cmpl_code;
+}
+
+u8 mctp_ctrl_resp_get_version(const union mctp_ctrl_message *msg, u16 size)
+{
+	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
+	const union mctp_resp_data_get_version *resp_data = (void *)msg->msg_data;
+	struct mctp_version_info *ver;
+	u8 cnt;
+
+	mctp_trace(INFO, "Get MCTP Version Support response message:\n");
+	mctp_trace(INFO, "Message Type                  : %x\n", mctp_msg_ctx.req_msg_type);
+	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+
+	mctp_ctrl_resp_endpoint();
+	ver = mctp_inventory_get_version(mctp_transport_get_src_eid(), mctp_msg_ctx.req_msg_type);
+	if (!ver)
+		return MCTP_CMPL_ERROR;
+
+	/**
+	 * A message type that is not supported is recorded with no version entry,
+	 * so it is not asked for again.
+	 */
+	if (cmpl_code == MCTP_CMPL_MSG_TYPE_NOT_SUP) {
+		ver->cnt = 0;
+		mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_VERSION);
+		return MCTP_CMPL_SUCCESS;
+	} else if (cmpl_code != MCTP_CMPL_SUCCESS) {
+		return cmpl_code;
+	}
+
+	if (mctp_ctrl_resp_short(msg, size, sizeof(resp_data->entry_cnt)))
+		return MCTP_CMPL_ERROR;
+
+	// Only the entries that were received are taken, up to what is kept.
+	cnt = resp_data->entry_cnt;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(resp_data->entry_cnt) +
+	                         cnt * sizeof(resp_data->entry[0])))
+		cnt = (mctp_ctrl_resp_data_len(msg, size) - sizeof(resp_data->entry_cnt)) /
+		      sizeof(resp_data->entry[0]);
+	if (cnt > MCTP_VERSION_ENTRY_MAX) {
+		mctp_trace(WARN, "version entry count (%d,%d)\n", cnt, MCTP_VERSION_ENTRY_MAX);
+		cnt = MCTP_VERSION_ENTRY_MAX;
+	}
+
+	ver->cnt = cnt;
+	for (int i = 0; i < cnt; i++) {
+		const u8 *e = resp_data->entry[i];
+		ver->ver[i] = (u32)e[0] << 24 | (u32)e[1] << 16 | (u32)e[2] << 8 | e[3];
+		mctp_trace(INFO, "Version Number Entry %d        : %08x\n", i, ver->ver[i]);
+	}
+	mctp_trace(INFO, "\n");
+
+	mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_VERSION);
+
+	return cmpl_code;
+}
+
+u8 mctp_ctrl_resp_get_msg_type(const union mctp_ctrl_message *msg, u16 size)
+{
+	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
+	const union mctp_resp_data_get_msg_type *resp_data = (void *)msg->msg_data;
+	struct mctp_endpoint_info *ep;
+	u8 cnt;
+
+	mctp_trace(INFO, "Get Message Type Support response message:\n");
+	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		return cmpl_code;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(resp_data->msg_type_cnt)))
+		return MCTP_CMPL_ERROR;
+
+	// Only the message types that were received are taken, up to what is kept.
+	cnt = resp_data->msg_type_cnt;
+	if (mctp_ctrl_resp_short(msg, size, sizeof(resp_data->msg_type_cnt) + cnt))
+		cnt = mctp_ctrl_resp_data_len(msg, size) - sizeof(resp_data->msg_type_cnt);
+	if (cnt > MCTP_MSG_TYPE_ENTRY_MAX) {
+		mctp_trace(WARN, "message type count (%d,%d)\n", cnt, MCTP_MSG_TYPE_ENTRY_MAX);
+		cnt = MCTP_MSG_TYPE_ENTRY_MAX;
+	}
+
+	ep = mctp_ctrl_resp_endpoint();
+	ep->msg_type_cnt = cnt;
+	for (int i = 0; i < cnt; i++) {
+		ep->msg_type[i] = resp_data->msg_type[i];
+		mctp_trace(INFO, "Message Type                  : %x\n", ep->msg_type[i]);
+	}
+	mctp_trace(INFO, "\n");
+
+	mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_MSG_TYPE);
+
+	return cmpl_code;
+}
+
+u8 mctp_ctrl_resp_get_vendor_msg(const union mctp_ctrl_message *msg, u16 size)
+{
+	u8 cmpl_code = msg->ctrl_msg_head.cmpl_code;
+	const union mctp_resp_data_get_vendor_msg *resp_data = (void *)msg->msg_data;
+	struct mctp_endpoint_info *ep;
+	struct mctp_vendor_info *vendor;
+	const u8 *vid = resp_data->vid;
+
+	mctp_trace(INFO, "Get Vendor Defined Message Support response message:\n");
+	mctp_trace(INFO, "Completion code               : %x\n", cmpl_code);
+
+	ep = mctp_ctrl_resp_endpoint();
+	if (mctp_msg_ctx.req_vid_set_sel == 0)
+		ep->vendor_cnt = 0;
+
+	/**
+	 * An endpoint that does not support vendor defined messages answers the
+	 * first selector with ERROR_INVALID_DATA.
+	 */
+	if (cmpl_code == MCTP_CMPL_ERR_INVLD_DATA && mctp_msg_ctx.req_vid_set_sel == 0) {
+		mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_VENDOR);
+		return MCTP_CMPL_SUCCESS;
+	} else if (cmpl_code != MCTP_CMPL_SUCCESS) {
+		return cmpl_code;
+	}
+
+	// A PCI Vendor ID set is two bytes shorter than an IANA one.
+	if (mctp_ctrl_resp_short(msg, size, 2) ||
+	    mctp_ctrl_resp_short(msg, size, resp_data->vid_fmt == VENDOR_ID_FMT_PCI ?
+	                         sizeof(resp_data->data) - 2 : sizeof(resp_data->data)))
+		return MCTP_CMPL_ERROR;
+
+	mctp_msg_ctx.next_vid_set_sel = resp_data->vid_set_sel;
+
+	if (ep->vendor_cnt < MCTP_INVENTORY_VENDOR_MAX) {
+		vendor = &ep->vendor[ep->vendor_cnt++];
+		vendor->vid_fmt = resp_data->vid_fmt;
+		if (resp_data->vid_fmt == VENDOR_ID_FMT_PCI) {
+			vendor->vid = (u32)vid[0] << 8 | vid[1];
+			vendor->cmd_set = (u16)vid[2] << 8 | vid[3];
+		} else {
+			vendor->vid = (u32)vid[0] << 24 | (u32)vid[1] << 16 | (u32)vid[2] << 8 | vid[3];
+			vendor->cmd_set = (u16)vid[4] << 8 | vid[5];
+		}
+		mctp_trace(INFO, "Vendor ID Format              : %x\n", vendor->vid_fmt);
+		mctp_trace(INFO, "Vendor ID                     : %x\n", vendor->vid);
+		mctp_trace(INFO, "Command Set Type              : %x\n", vendor->cmd_set);
+	}
+	mctp_trace(INFO, "Next Vendor ID Set Selector   : %x\n", resp_data->vid_set_sel);
+	mctp_trace(INFO, "\n");
+
+	if (resp_data->vid_set_sel == MCTP_VENDOR_ID_SET_LAST)
+		mctp_inventory_touch(mctp_transport_get_src_eid(), MCTP_INV_VENDOR);
+
+	return cmpl_code;
+}
+
+static u8 mctp_ctrl_req_set_eid(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	const union mctp_req_msg_set_eid *req_data = (void *)req;
+	union mctp_resp_data_set_eid *resp_data = (void *)resp;
+
+	if (req_size < sizeof(*req_data))
+		return MCTP_CMPL_ERR_INVLD_LEN;
+
+	memset(resp_data, 0, sizeof(*resp_data));
+
+	switch (req_data->oper) {
+	case SET_EID:
+	case FORCE_EID:
+		if (req_data->eid == EID_NULL_DST || req_data->eid == EID_BROADCAST)
+			return MCTP_CMPL_ERR_INVLD_DATA;
+		mctp_transport_set_owner_eid(req_data->eid);
+		break;
+	case RESET_EID:
+	case SET_DISC_FLAG:
+		// Static EID and discovery are not supported by this endpoint.
+		return MCTP_CMPL_ERR_INVLD_DATA;
+	}
+
+	resp_data->eid_assign_sts = EID_ASSIGN_ACCEPT;
+	resp_data->eid_alloc_sts = EID_ALLOC_SIMPLE;
+	resp_data->eid_setting = mctp_transport_get_owner_eid();
+	*resp_size = sizeof(*resp_data);
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static u8 mctp_ctrl_req_get_eid(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	union mctp_resp_data_get_eid *resp_data = (void *)resp;
+
+	memset(resp_data, 0, sizeof(*resp_data));
+	resp_data->eid = mctp_transport_get_owner_eid();
+	resp_data->eid_type = EID_TYPE_DYNAMIC;
+	resp_data->endpoint_type = ENDPOINT_TYPE_SIMPLE;
+	*resp_size = sizeof(*resp_data);
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static u8 mctp_ctrl_req_get_uuid(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	union mctp_resp_data_get_uuid *resp_data = (void *)resp;
+
+	/**
+	 * Without mctp_message_set_uuid, report an RFC4122 version 4 (random) UUID
+	 * that stays the same for the rest of the session.
+	 */
+	if (!(mctp_msg_ctx.uuid[6] & 0xF0)) {
+		for (int i = 0; i < sizeof(mctp_msg_ctx.uuid); i++)
+			mctp_msg_ctx.uuid[i] = rand();
+		mctp_msg_ctx.uuid[6] = (mctp_msg_ctx.uuid[6] & 0x0F) | 0x40;
+		mctp_msg_ctx.uuid[8] = (mctp_msg_ctx.uuid[8] & 0x3F) | 0x80;
+	}
+
+	memcpy(resp_data->uuid, mctp_msg_ctx.uuid, sizeof(resp_data->uuid));
+	*resp_size = sizeof(*resp_data);
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static u8 mctp_ctrl_req_get_version(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	const union mctp_req_msg_get_version *req_data = (void *)req;
+	union mctp_resp_data_get_version *resp_data = (void *)resp;
+	u32 ver;
+
+	if (req_size < sizeof(*req_data))
+		return MCTP_CMPL_ERR_INVLD_LEN;
+
+	switch (req_data->msg_type) {
+	// MCTP base specification and control protocol, DSP0236 1.3.1
+	case 0xFF:
+	case MCTP_MSG_TYPE_CTRL:
+		ver = MCTP_VERSION(1, 3, 1, 0);
+		break;
+	// NVMe-MI over MCTP message, DSP0235 1.0
+	case MCTP_MSG_TYPE_NVME_MM:
+		ver = MCTP_VERSION(1, 0, 0, 0);
+		break;
+	default:
+		return MCTP_CMPL_MSG_TYPE_NOT_SUP;
+	}
+
+	resp_data->entry_cnt = 1;
+	resp_data->entry[0][0] = ver >> 24;
+	resp_data->entry[0][1] = ver >> 16;
+	resp_data->entry[0][2] = ver >> 8;
+	resp_data->entry[0][3] = ver;
+	*resp_size = 1 + 4 * resp_data->entry_cnt;
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static u8 mctp_ctrl_req_get_msg_type(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	union mctp_resp_data_get_msg_type *resp_data = (void *)resp;
+
+	/**
+	 * DSP0236, 12.7 Get Message Type Support
+	 *
+	 * The MCTP control message type is not included in the list because it is
+	 * required to be supported by all endpoints.
+	 */
+	resp_data->msg_type_cnt = 1;
+	resp_data->msg_type[0] = MCTP_MSG_TYPE_NVME_MM;
+	*resp_size = 1 + resp_data->msg_type_cnt;
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static u8 mctp_ctrl_req_get_vendor_msg(const u8 *req, u16 req_size, u8 *resp, u16 *resp_size)
+{
+	const union mctp_req_msg_get_vendor_msg *req_data = (void *)req;
+	union mctp_resp_data_get_vendor_msg *resp_data = (void *)resp;
+	u8 *vid = resp_data->vid;
+
+	if (req_size < sizeof(*req_data))
+		return MCTP_CMPL_ERR_INVLD_LEN;
+
+	// Only a single vendor ID set is reported, and none if no vendor is set.
+	if (!mctp_msg_ctx.vid || req_data->vid_set_sel != 0)
+		return MCTP_CMPL_ERR_INVLD_DATA;
+
+	resp_data->vid_set_sel = MCTP_VENDOR_ID_SET_LAST;
+	resp_data->vid_fmt = mctp_msg_ctx.vid_fmt;
+	if (mctp_msg_ctx.vid_fmt == VENDOR_ID_FMT_PCI) {
+		vid[0] = mctp_msg_ctx.vid >> 8;
+		vid[1] = mctp_msg_ctx.vid;
+		vid[2] = mctp_msg_ctx.cmd_set >> 8;
+		vid[3] = mctp_msg_ctx.cmd_set;
+		*resp_size = 2 + 4;
+	} else {
+		vid[0] = mctp_msg_ctx.vid >> 24;
+		vid[1] = mctp_msg_ctx.vid >> 16;
+		vid[2] = mctp_msg_ctx.vid >> 8;
+		vid[3] = mctp_msg_ctx.vid;
+		vid[4] = mctp_msg_ctx.cmd_set >> 8;
+		vid[5] = mctp_msg_ctx.cmd_set;
+		*resp_size = 2 + 6;
+	}
+
+	return MCTP_CMPL_SUCCESS;
+}
+
+static int mctp_control_request_message_handle(const union mctp_ctrl_message *msg, u16 size,
+                                               int verbose)
+{
+	int ret;
+	u8 cmd_code = msg->ctrl_msg_head.cmd_code;
+	const u8 *req_data = msg->data + MCTP_CTRL_REQ_HEAD_SIZE;
+	u16 req_size = size > MCTP_CTRL_REQ_HEAD_SIZE ? size - MCTP_CTRL_REQ_HEAD_SIZE : 0;
+	union mctp_ctrl_message *resp = (void *)g_mctp_resp_msg;
+	u16 resp_size = 0;
+	u8 cmpl_code;
+
+	if (verbose)
+		mctp_trace(INFO, "mctp request: %d\n", cmd_code);
+
+	switch (cmd_code) {
+	case MCTP_CTRL_MSG_SET_EID:
+		cmpl_code = mctp_ctrl_req_set_eid(req_data, req_size, resp->msg_data, &resp_size);
+		break;
+	case MCTP_CTRL_MSG_GET_EID:
+		cmpl_code = mctp_ctrl_req_get_eid(req_data, req_size, resp->msg_data, &resp_size);
+		break;
+	case MCTP_CTRL_MSG_GET_UUID:
+		cmpl_code = mctp_ctrl_req_get_uuid(req_data, req_size, resp->msg_data, &resp_size);
+		break;
+	case MCTP_CTRL_MSG_GET_VERSION:
+		cmpl_code = mctp_ctrl_req_get_version(req_data, req_size, resp->msg_data, &resp_size);
+		break;
+	case MCTP_CTRL_MSG_GET_MSG_TYPE:
+		cmpl_code = mctp_ctrl_req_get_msg_type(req_data, req_size, resp->msg_data, &resp_size);
+		break;
+	case MCTP_CTRL_MSG_GET_VENDOR_MSG:
+		cmpl_code = mctp_ctrl_req_get_vendor_msg(req_data, req_size, resp->msg_data,
+		                                         &resp_size);
+		break;
+	default:
+		cmpl_code = MCTP_CMPL_ERR_UNSUP_CMD;
+		break;
+	}
+
+	// An error response carries the completion code only.
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		resp_size = 0;
+
+	resp->ctrl_msg_head.value = msg->ctrl_msg_head.value;
+	resp->ctrl_msg_head.rq_bit = 0;
+	resp->ctrl_msg_head.d_bit = 0;
+	resp->ctrl_msg_head.cmpl_code = cmpl_code;
+	resp_size += sizeof(resp->ctrl_msg_head);
+
+	if (resp->ctrl_msg_head.ic)
+		resp_size = mctp_message_append_mic(resp, resp_size);
+
+	if (verbose)
+		print_buf(resp, resp_size, "[%s]: mctp control response message (%d)", __func__,
+		          resp_size);
+
+	ret = mctp_transport_send_message(mctp_smbus_get_peer_addr(), EID_NULL_DST, resp,
+	                                  resp_size, 0, false, verbose);
+	if (ret) {
+		mctp_trace(ERROR, "mctp_transport_send_message (%d)\n", ret);
+		return MCTP_CMPL_ERROR;
+	}
+
+	return MCTP_CMPL_SUCCESS;
 }
 
 static int mctp_control_response_message_handle(const union mctp_ctrl_message *msg, u16 size)
@@ -132,22 +676,39 @@ static int mctp_control_response_message_handle(const union mctp_ctrl_message *m
 	// const void *resp_data = msg->msg_data;
 
 	mctp_trace(INFO, "mctp response: %d\n", cmd_code);
+	if (size < sizeof(msg->ctrl_msg_head))
+		return MCTP_CMPL_ERROR;
 
 	switch (cmd_code) {
 	case MCTP_CTRL_MSG_SET_EID:
-		cmpl_code = mctp_ctrl_resp_set_eid(msg);
+		cmpl_code = mctp_ctrl_resp_set_eid(msg, size);
+		break;
+	case MCTP_CTRL_MSG_GET_EID:
+		cmpl_code = mctp_ctrl_resp_get_eid(msg, size);
+		break;
+	case MCTP_CTRL_MSG_GET_UUID:
+		cmpl_code = mctp_ctrl_resp_get_uuid(msg, size);
+		break;
+	case MCTP_CTRL_MSG_GET_VERSION:
+		cmpl_code = mctp_ctrl_resp_get_version(msg, size);
+		break;
+	case MCTP_CTRL_MSG_GET_MSG_TYPE:
+		cmpl_code = mctp_ctrl_resp_get_msg_type(msg, size);
+		break;
+	case MCTP_CTRL_MSG_GET_VENDOR_MSG:
+		cmpl_code = mctp_ctrl_resp_get_vendor_msg(msg, size);
 		break;
 	}
 
 	return cmpl_code;
 }
 
-static int mctp_control_message_handle(const union mctp_ctrl_message *msg, u16 size)
+static int mctp_control_message_handle(const union mctp_ctrl_message *msg, u16 size, int verbose)
 {
 	u8 cmpl_code;
 
 	if (msg->ctrl_msg_head.rq_bit) {
-		cmpl_code = mctp_control_request_message_handle(msg, size);
+		cmpl_code = mctp_control_request_message_handle(msg, size, verbose);
 		return cmpl_code == MCTP_CMPL_SUCCESS ? MCTP_SUCCESS : MCTP_MSG_ERR_CTRL_REQ_MSG;
 	} else {
 		cmpl_code = mctp_control_response_message_handle(msg, size);
@@ -163,7 +724,7 @@ int mctp_message_handle(const union mctp_message *msg, u16 size, int verbose)
 		mctp_trace(INFO, "message type: %d\n", mt);
 	switch (msg->msg_head.mt) {
 	case MCTP_MSG_TYPE_CTRL:
-		ret = mctp_control_message_handle((void *)msg, size);
+		ret = mctp_control_message_handle((void *)msg, size, verbose);
 		if (ret)
 			mctp_trace(ERROR, "mctp_control_message_handle (%d)\n", ret);
 		break;
@@ -182,6 +743,7 @@ int mctp_message_init(void)
 {
 	mctp_trace(INIT, "%s\n", __func__);
 	memset(&mctp_msg_ctx, 0, sizeof(mctp_msg_ctx));
+
 	g_mctp_req_msg = malloc(MCTP_MSG_SIZE_MAX);
 	g_mctp_resp_msg = malloc(MCTP_MSG_SIZE_MAX);
 
@@ -193,6 +755,9 @@ int mctp_message_deinit(void)
 	mctp_trace(INIT, "%s\n", __func__);
 	free(g_mctp_req_msg);
 	free(g_mctp_resp_msg);
+	// Nothing is left dangling for a later mctp_init.
+	g_mctp_req_msg = NULL;
+	g_mctp_resp_msg = NULL;
 
 	return MCTP_SUCCESS;
 }
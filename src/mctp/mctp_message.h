@@ -113,15 +113,142 @@ union mctp_resp_data_set_eid {
 	u8 data[3];
 } __attribute__((packed));
 
+// Endpoint ID type (Get Endpoint ID response, byte 2 bit[1:0])
+enum eid_type {
+	// Dynamic EID
+	EID_TYPE_DYNAMIC = 0,
+	// Static EID supported
+	EID_TYPE_STATIC,
+	// Static EID supported, present EID matches static EID
+	EID_TYPE_STATIC_MATCH,
+	// Static EID supported, present EID does not match static EID
+	EID_TYPE_STATIC_NOT_MATCH,
+};
+
+// Endpoint type (Get Endpoint ID response, byte 2 bit[5:4])
+enum endpoint_type {
+	ENDPOINT_TYPE_SIMPLE = 0,
+	ENDPOINT_TYPE_BRIDGE = 1,
+};
+
+// Vendor ID format (Get Vendor Defined Message Support response)
+enum vendor_id_format {
+	VENDOR_ID_FMT_PCI = 0,
+	VENDOR_ID_FMT_IANA = 1,
+};
+
+/**
+ * DSP0236, 12.6 Get MCTP version support
+ *
+ * The version number is returned in BCD format with the upper nibble of each
+ * field set to 0xF for the major, minor and update versions.
+ */
+#define MCTP_VERSION(major, minor, update, alpha) \
+	((u32)(0xF0 | (major)) << 24 | (u32)(0xF0 | (minor)) << 16 | \
+	 (u32)(0xF0 | (update)) << 8 | (u32)(alpha))
+
+#define MCTP_VERSION_ENTRY_MAX          (8)
+#define MCTP_MSG_TYPE_ENTRY_MAX         (16)
+#define MCTP_VENDOR_ID_SET_LAST         (0xFF)
+
+#pragma pack(push)
+#pragma pack(1)
+
+union mctp_resp_data_get_eid {
+	struct {
+		// Byte[0] Endpoint ID
+		u8 eid;
+		// Byte[1]
+		struct {
+			// Bit[1:0] Endpoint ID type
+			u8 eid_type : 2;
+			// Bit[3:2] Reserved
+			u8 rsvd1 : 2;
+			// Bit[5:4] Endpoint type
+			u8 endpoint_type : 2;
+			// Bit[7:6] Reserved
+			u8 rsvd2 : 2;
+		};
+		// Byte[2] Medium-Specific Information
+		u8 medium_spec;
+	};
+	u8 data[3];
+};
+
+union mctp_resp_data_get_uuid {
+	struct {
+		// Byte[15:0] UUID, RFC4122 format
+		u8 uuid[16];
+	};
+	u8 data[16];
+};
+
+union mctp_resp_data_get_version {
+	struct {
+		// Byte[0] Version Number Entry Count
+		u8 entry_cnt;
+		// Byte[4*N:1] Version Number Entries, big endian
+		u8 entry[MCTP_VERSION_ENTRY_MAX][4];
+	};
+	u8 data[1 + MCTP_VERSION_ENTRY_MAX * 4];
+};
+
+union mctp_resp_data_get_msg_type {
+	struct {
+		// Byte[0] MCTP Message Type Count
+		u8 msg_type_cnt;
+		// Byte[N:1] List of Message Type numbers
+		u8 msg_type[MCTP_MSG_TYPE_ENTRY_MAX];
+	};
+	u8 data[1 + MCTP_MSG_TYPE_ENTRY_MAX];
+};
+
+union mctp_resp_data_get_vendor_msg {
+	struct {
+		// Byte[0] Vendor ID Set Selector of the next set, 0xFF if last
+		u8 vid_set_sel;
+		// Byte[1] Vendor ID Format
+		u8 vid_fmt;
+		/**
+		 * Byte[3:2] PCI Vendor ID and Byte[5:4] Command Set Type, or
+		 * Byte[5:2] IANA Enterprise ID and Byte[7:6] Command Set Type,
+		 * big endian
+		 */
+		u8 vid[6];
+	};
+	u8 data[8];
+};
+
+#pragma pack(pop)
+
 struct mctp_message_context {
 	// union mctp_ctrl_msg_header ctrl_msg_head;
 	byte inst_id;
+	// Parameters of the outstanding request, used to file the response
+	u8 req_msg_type;
+	u8 req_vid_set_sel;
+	u8 next_vid_set_sel;
+	// Endpoint properties reported when acting as the responder
+	u8 uuid[16];
+	u8 vid_fmt;
+	u32 vid;
+	u16 cmd_set;
 };
 
 void mctp_message_increase_inst_id(void);
 u16 mctp_message_append_mic(void *msg, u16 msg_size);
 int mctp_message_set_eid(u8 slv_addr, u8 dst_eid, enum set_eid_operation oper,
                          u8 eid, bool ic, bool retry, int verbose);
+int mctp_message_get_eid(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose);
+int mctp_message_get_uuid(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose);
+int mctp_message_get_version(u8 slv_addr, u8 dst_eid, u8 msg_type, bool ic, bool retry,
+                             int verbose);
+int mctp_message_get_msg_type(u8 slv_addr, u8 dst_eid, bool ic, bool retry, int verbose);
+int mctp_message_get_vendor_msg(u8 slv_addr, u8 dst_eid, u8 vid_set_sel, bool ic,
+                                bool retry, int verbose);
+u8 mctp_message_next_vid_set_sel(void);
+void mctp_message_set_uuid(const u8 *uuid);
+void mctp_message_set_vendor_id(u8 vid_fmt, u32 vid, u16 cmd_set);
 int mctp_message_handle(const union mctp_message *msg, word size, int verbose);
 void *mctp_message_alloc(void);
 void mctp_message_free(void);
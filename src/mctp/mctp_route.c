@@ -0,0 +1,146 @@
+#include "mctp.h"
+#include "mctp_route.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct mctp_route_context {
+	int def_handle;
+	u8 cnt;
+	struct mctp_route route[MCTP_ROUTE_MAX];
+	/**
+	 * EID to route index (+1) map, so that a lookup is a single array access
+	 * however many routes are installed.
+	 */
+	u8 map[MCTP_ROUTE_EID_MAX];
+};
+
+static struct mctp_route_context mctp_route_ctx;
+
+const struct mctp_route *mctp_route_lookup(u8 eid)
+{
+	u8 idx = mctp_route_ctx.map[eid];
+
+	if (idx == MCTP_ROUTE_NONE)
+		return NULL;
+
+	return &mctp_route_ctx.route[idx - 1];
+}
+
+/**
+ * Rebuild the map for an EID range from the remaining routes. Later routes take
+ * precedence over earlier ones for overlapping ranges.
+ */
+static void mctp_route_remap(u8 eid_start, u8 eid_end)
+{
+	for (int eid = eid_start; eid <= eid_end; eid++)
+		mctp_route_ctx.map[eid] = MCTP_ROUTE_NONE;
+
+	for (int i = 0; i < mctp_route_ctx.cnt; i++) {
+		const struct mctp_route *rt = &mctp_route_ctx.route[i];
+		int start = rt->eid_start > eid_start ? rt->eid_start : eid_start;
+		int end = rt->eid_end < eid_end ? rt->eid_end : eid_end;
+
+		for (int eid = start; eid <= end; eid++)
+			mctp_route_ctx.map[eid] = i + 1;
+	}
+}
+
+int mctp_route_add(u8 eid_start, u8 eid_end, int handle, u8 bus, u8 phy_addr,
+                   enum mctp_route_type type)
+{
+	struct mctp_route *rt = NULL;
+
+	if (eid_start > eid_end) {
+		mctp_trace(ERROR, "invalid eid range (%x,%x)\n", eid_start, eid_end);
+		return -MCTP_ERROR;
+	}
+
+	for (int i = 0; i < mctp_route_ctx.cnt; i++) {
+		if (mctp_route_ctx.route[i].eid_start == eid_start &&
+		    mctp_route_ctx.route[i].eid_end == eid_end) {
+			rt = &mctp_route_ctx.route[i];
+			break;
+		}
+	}
+
+	if (!rt) {
+		if (mctp_route_ctx.cnt >= MCTP_ROUTE_MAX) {
+			mctp_trace(ERROR, "routing table full (%d)\n", MCTP_ROUTE_MAX);
+			return -MCTP_ERROR;
+		}
+		rt = &mctp_route_ctx.route[mctp_route_ctx.cnt++];
+	} else if (rt->handle != handle || rt->bus != bus || rt->phy_addr != phy_addr) {
+		mctp_trace(INFO, "route %x-%x changed (%x,%d,%x)\n", eid_start, eid_end,
+		           rt->handle, rt->bus, rt->phy_addr);
+	}
+
+	rt->eid_start = eid_start;
+	rt->eid_end = eid_end;
+	rt->handle = handle;
+	rt->bus = bus;
+	rt->phy_addr = phy_addr;
+	rt->type = type;
+
+	for (int eid = eid_start; eid <= eid_end; eid++)
+		mctp_route_ctx.map[eid] = rt - mctp_route_ctx.route + 1;
+
+	return MCTP_SUCCESS;
+}
+
+int mctp_route_del(u8 eid_start, u8 eid_end)
+{
+	for (int i = 0; i < mctp_route_ctx.cnt; i++) {
+		struct mctp_route *rt = &mctp_route_ctx.route[i];
+
+		if (rt->eid_start != eid_start || rt->eid_end != eid_end)
+			continue;
+
+		memmove(rt, rt + 1, (mctp_route_ctx.cnt - i - 1) * sizeof(*rt));
+		--mctp_route_ctx.cnt;
+
+		// Indexes behind the removed entry have moved, so rebuild all of it.
+		mctp_route_remap(0, MCTP_ROUTE_EID_MAX - 1);
+
+		return MCTP_SUCCESS;
+	}
+
+	return -MCTP_TRAN_ERR_UNROU_EID;
+}
+
+void mctp_route_show(void)
+{
+	mctp_trace(INFO, "MCTP routing table (%d):\n", mctp_route_ctx.cnt);
+	for (int i = 0; i < mctp_route_ctx.cnt; i++) {
+		const struct mctp_route *rt = &mctp_route_ctx.route[i];
+		mctp_trace(INFO, "eid %02x-%02x -> handle %d, bus %d, addr %02x (%s)\n",
+		           rt->eid_start, rt->eid_end, rt->handle, rt->bus, rt->phy_addr,
+		           rt->type == MCTP_ROUTE_BRIDGE ? "bridge" : "endpoint");
+	}
+}
+
+int mctp_route_get_default_handle(void)
+{
+	return mctp_route_ctx.def_handle;
+}
+
+int mctp_route_init(int handle)
+{
+	mctp_trace(INIT, "%s\n", __func__);
+	memset(&mctp_route_ctx, 0, sizeof(mctp_route_ctx));
+	mctp_route_ctx.def_handle = handle;
+
+	return MCTP_SUCCESS;
+}
+
+int mctp_route_deinit(void)
+{
+	mctp_trace(INIT, "%s\n", __func__);
+	memset(&mctp_route_ctx, 0, sizeof(mctp_route_ctx));
+
+	return MCTP_SUCCESS;
+}
@@ -0,0 +1,48 @@
+#ifndef MCTP_ROUTE_H
+#define MCTP_ROUTE_H
+
+#include "mctp.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+/**
+ * DSP0236, 9.1.3 Routing table
+ *
+ * The routing table for a bridge is used to look up the physical address and
+ * the bus (port) to which a packet for a given destination EID is delivered.
+ * Entries cover a range of EIDs, so that a single entry can route to a bridge
+ * that owns an EID pool.
+ */
+#define MCTP_ROUTE_MAX                  (64)
+#define MCTP_ROUTE_EID_MAX              (256)
+#define MCTP_ROUTE_NONE                 (0)
+
+enum mctp_route_type {
+	// The physical address is the endpoint itself.
+	MCTP_ROUTE_ENDPOINT = 0,
+	// The physical address is a bridge that owns the EID range.
+	MCTP_ROUTE_BRIDGE = 1,
+};
+
+struct mctp_route {
+	u8 eid_start;
+	u8 eid_end;
+	u8 type;
+	// Downstream segment of the adapter, 0 for a flat bus
+	u8 bus;
+	u8 phy_addr;
+	// Aardvark handle the segment is attached to
+	int handle;
+};
+
+const struct mctp_route *mctp_route_lookup(u8 eid);
+int mctp_route_add(u8 eid_start, u8 eid_end, int handle, u8 bus, u8 phy_addr,
+                   enum mctp_route_type type);
+int mctp_route_del(u8 eid_start, u8 eid_end);
+void mctp_route_show(void);
+int mctp_route_init(int handle);
+int mctp_route_deinit(void);
+int mctp_route_get_default_handle(void);
+
+#endif // ~ MCTP_ROUTE_H
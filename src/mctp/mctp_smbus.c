@@ -6,6 +6,7 @@
 #include "smbus.h"
 
 #include "mctp_smbus.h"
+#include "mctp_transport.h"
 
 static struct mctp_smbus_context mctp_smbus_ctx;
 
@@ -19,6 +20,16 @@ int mctp_smbus_get_handle(void)
 	return mctp_smbus_ctx.handle;
 }
 
+bool mctp_smbus_pec_enabled(void)
+{
+	return mctp_smbus_ctx.pec_enabled;
+}
+
+u8 mctp_smbus_get_peer_addr(void)
+{
+	return mctp_smbus_ctx.peer_slv_addr;
+}
+
 int mctp_smbus_check_packet(const union mctp_smbus_header *medi_head)
 {
 	if ((medi_head->src_slv_addr & 0x1) != MCTP_OVER_SMBUS) {
@@ -26,6 +37,13 @@ int mctp_smbus_check_packet(const union mctp_smbus_header *medi_head)
 		return -MCTP_SMBUS_ERR_INVLD_SUP;
 	}
 
+	/**
+	 * DSP0237, Source slave address
+	 *
+	 * The responder uses this address as the destination of the response.
+	 */
+	mctp_smbus_ctx.peer_slv_addr = medi_head->src_slv_addr >> 1;
+
 	// if (medi_head->src_slv_addr != (SMBUS_ADDR_IPMI_BMC << 1 | MCTP_OVER_SMBUS)) {
 	//      smbus_trace(WARN, "host is not a bmc controller\n");
 	// }
@@ -38,14 +56,18 @@ int mctp_smbus_check_packet(const union mctp_smbus_header *medi_head)
 	return MCTP_SUCCESS;
 }
 
-int mctp_smbus_transmit_packet(u8 dst_slv_addr, union mctp_smbus_packet *pkt, u8 tran_size, int verbose)
+int mctp_smbus_transmit_packet(int handle, u8 dst_slv_addr, union mctp_smbus_packet *pkt,
+                               u8 tran_size, int verbose)
 {
 	if (tran_size > MCTP_TRAN_UNIT_SIZE_MAX)
 		return -MCTP_SMBUS_ERR_UNSUP_TRAN_UNIT;
 
 	pkt->medi_head.src_slv_addr = mctp_smbus_ctx.src_slv_addr << 1 | MCTP_OVER_SMBUS;
 
-	int ret = smbus_block_write(mctp_smbus_ctx.handle, dst_slv_addr, SMBUS_CMD_CODE_MCTP,
+	if (!handle)
+		handle = mctp_smbus_ctx.handle;
+
+	int ret = smbus_block_write(handle, dst_slv_addr, SMBUS_CMD_CODE_MCTP,
 	                            sizeof(pkt->medi_head.src_slv_addr) + tran_size,
 	                            pkt->data + 3, mctp_smbus_ctx.pec_enabled, verbose);
 	if (ret)
@@ -54,6 +76,20 @@ int mctp_smbus_transmit_packet(u8 dst_slv_addr, union mctp_smbus_packet *pkt, u8
 	return ret;
 }
 
+int mctp_smbus_poll(int handle, int timeout_ms, slave_poll_callback callback, int verbose)
+{
+	if (!handle)
+		handle = mctp_smbus_ctx.handle;
+
+	return smbus_slave_poll(handle, timeout_ms, mctp_smbus_ctx.pec_enabled, callback, verbose);
+}
+
+const struct mctp_binding mctp_smbus_binding = {
+	.name = "smbus",
+	.transmit = mctp_smbus_transmit_packet,
+	.poll = mctp_smbus_poll,
+};
+
 int mctp_smbus_init(int handle, u8 src_slv_addr, bool pec_flag)
 {
 	memset(&mctp_smbus_ctx, 0, sizeof(mctp_smbus_ctx));
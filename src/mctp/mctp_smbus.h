@@ -66,12 +66,21 @@ union mctp_smbus_packet {
 struct mctp_smbus_context {
 	int handle;
 	u8 src_slv_addr;
+	// Slave address of the sender of the last received packet
+	u8 peer_slv_addr;
 	bool pec_enabled;
 };
 
+struct mctp_binding;
+extern const struct mctp_binding mctp_smbus_binding;
+
+int mctp_smbus_get_handle(void);
+bool mctp_smbus_pec_enabled(void);
+u8 mctp_smbus_get_peer_addr(void);
 int mctp_smbus_check_packet(const union mctp_smbus_header *medi_head);
-int mctp_smbus_transmit_packet(u8 dst_slv_addr, union mctp_smbus_packet *pkt,
+int mctp_smbus_transmit_packet(int handle, u8 dst_slv_addr, union mctp_smbus_packet *pkt,
                                u8 tran_size, int verbose);
+int mctp_smbus_poll(int handle, int timeout_ms, slave_poll_callback callback, int verbose);
 int mctp_smbus_init(int handle, u8 src_slv_addr, bool pec_flag);
 int mctp_smbus_deinit(void);
 
@@ -0,0 +1,237 @@
+#include "mctp.h"
+#include "mctp_smbus.h"
+#include "mctp_socket.h"
+#include "mctp_transport.h"
+
+#include "smbus.h"
+#include "utility.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+static struct mctp_socket_context mctp_sock_ctx = {
+	.fd = -1,
+	.listen_fd = -1,
+	.accept_ms = MCTP_SOCKET_CONNECT_MS,
+};
+
+#ifndef WIN32
+static int mctp_socket_accept(int timeout_ms)
+{
+	struct pollfd pfd = {
+		.fd = mctp_sock_ctx.listen_fd,
+		.events = POLLIN,
+	};
+
+	if (mctp_sock_ctx.fd >= 0)
+		return MCTP_SUCCESS;
+
+	if (mctp_sock_ctx.listen_fd < 0)
+		return -MCTP_ERROR;
+
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return -MCTP_TRAN_ERR_TRAN_PKT_TIMEOUT;
+
+	mctp_sock_ctx.fd = accept(mctp_sock_ctx.listen_fd, NULL, NULL);
+	if (mctp_sock_ctx.fd < 0) {
+		mctp_trace(ERROR, "accept (%d)\n", errno);
+		return -MCTP_ERROR;
+	}
+
+	mctp_trace(INFO, "peer connected on %s\n", mctp_sock_ctx.path);
+
+	return MCTP_SUCCESS;
+}
+#endif
+
+int mctp_socket_transmit_packet(int handle, u8 dst_slv_addr, union mctp_smbus_packet *pkt,
+                                u8 tran_size, int verbose)
+{
+#ifndef WIN32
+	int ret;
+	u16 len;
+
+	if (tran_size > MCTP_TRAN_UNIT_SIZE_MAX)
+		return -MCTP_SMBUS_ERR_UNSUP_TRAN_UNIT;
+
+	// A server with no requester connected gives up like a poll does.
+	ret = mctp_socket_accept(mctp_sock_ctx.accept_ms);
+	if (ret)
+		return ret;
+
+	pkt->medi_head.dev_slv_addr = dst_slv_addr << 1;
+	pkt->medi_head.cmd_code = SMBUS_CMD_CODE_MCTP;
+	pkt->medi_head.byte_cnt = sizeof(pkt->medi_head.src_slv_addr) + tran_size;
+	pkt->medi_head.src_slv_addr = mctp_sock_ctx.src_slv_addr << 1 | MCTP_OVER_SMBUS;
+	len = sizeof(pkt->medi_head) + tran_size;
+
+	if (verbose > 1)
+		print_buf(pkt->data, len, "[%s] tx (%d)", __func__, len);
+
+	if (send(mctp_sock_ctx.fd, pkt->data, len, 0) != len) {
+		mctp_trace(ERROR, "send (%d)\n", errno);
+		return -MCTP_ERROR;
+	}
+
+	return MCTP_SUCCESS;
+#else
+	return -MCTP_ERROR;
+#endif
+}
+
+/**
+ * Same contract as smbus_slave_poll: wait up to ten times timeout_ms for the
+ * first packet, a peer to connect included, then keep receiving until nothing
+ * arrives for timeout_ms. Returns -SMBUS_SLV_NO_AVAILABLE_DATA if nothing came
+ * and -MCTP_ERROR once the peer is gone.
+ */
+int mctp_socket_poll(int handle, int timeout_ms, slave_poll_callback callback, int verbose)
+{
+#ifndef WIN32
+	int ret, status;
+	union mctp_smbus_packet pkt;
+	struct pollfd pfd;
+	u64 start = time_us(), waited_ms;
+
+	mctp_sock_ctx.accept_ms = timeout_ms * 10;
+
+	ret = mctp_socket_accept(timeout_ms * 10);
+	if (ret == -MCTP_TRAN_ERR_TRAN_PKT_TIMEOUT)
+		ret = -SMBUS_SLV_NO_AVAILABLE_DATA;
+	if (ret)
+		return ret;
+
+	pfd.fd = mctp_sock_ctx.fd;
+	pfd.events = POLLIN;
+
+	waited_ms = (time_us() - start) / 1000;
+	if (waited_ms >= (u64)timeout_ms * 10 ||
+	    poll(&pfd, 1, timeout_ms * 10 - waited_ms) <= 0) {
+		if (verbose)
+			mctp_trace(INFO, "no data available\n");
+		return -SMBUS_SLV_NO_AVAILABLE_DATA;
+	}
+
+	do {
+		ssize_t len = recv(mctp_sock_ctx.fd, pkt.data, sizeof(pkt.data), 0);
+		if (len <= 0) {
+			mctp_trace(WARN, "peer disconnected (%d)\n", len ? errno : 0);
+			close(mctp_sock_ctx.fd);
+			mctp_sock_ctx.fd = -1;
+			return -MCTP_ERROR;
+		}
+
+		if (verbose > 1)
+			print_buf(pkt.data, len, "[%s] rx (%d)", __func__, (int)len);
+
+		if (callback) {
+			status = callback(pkt.data, len, verbose);
+			if (status && status != 0xFF)
+				mctp_trace(WARN, "callback (%d)\n", status);
+		}
+	} while (poll(&pfd, 1, timeout_ms) > 0);
+
+	return MCTP_SUCCESS;
+#else
+	return -MCTP_ERROR;
+#endif
+}
+
+const struct mctp_binding mctp_socket_binding = {
+	.name = "socket",
+	.transmit = mctp_socket_transmit_packet,
+	.poll = mctp_socket_poll,
+};
+
+/**
+ * A server binds path and takes the first peer that connects, a client connects
+ * to path. Either way the transport is switched over to this binding.
+ */
+int mctp_socket_init(const char *path, bool server, u8 src_slv_addr)
+{
+#ifndef WIN32
+	int fd;
+	struct sockaddr_un addr;
+
+	mctp_trace(INIT, "%s\n", __func__);
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		mctp_trace(ERROR, "socket path too long (%s)\n", path);
+		return -MCTP_ERROR;
+	}
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+		mctp_trace(ERROR, "socket (%d)\n", errno);
+		return -MCTP_ERROR;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (server) {
+		unlink(path);
+		if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1)) {
+			mctp_trace(ERROR, "bind %s (%d)\n", path, errno);
+			close(fd);
+			return -MCTP_ERROR;
+		}
+		mctp_sock_ctx.listen_fd = fd;
+	} else {
+		int waited = 0;
+
+		// A server started in the background may not be listening yet.
+		while (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			if ((errno != ENOENT && errno != ECONNREFUSED) || waited >= MCTP_SOCKET_CONNECT_MS) {
+				mctp_trace(ERROR, "connect %s (%d)\n", path, errno);
+				close(fd);
+				return -MCTP_ERROR;
+			}
+			usleep(MCTP_SOCKET_RETRY_MS * 1000);
+			waited += MCTP_SOCKET_RETRY_MS;
+		}
+		mctp_sock_ctx.fd = fd;
+	}
+
+	mctp_sock_ctx.server = server;
+	mctp_sock_ctx.src_slv_addr = src_slv_addr;
+	strcpy(mctp_sock_ctx.path, path);
+
+	mctp_transport_set_binding(&mctp_socket_binding);
+
+	return MCTP_SUCCESS;
+#else
+	mctp_trace(ERROR, "unix domain socket is not supported\n");
+	return -MCTP_ERROR;
+#endif
+}
+
+int mctp_socket_deinit(void)
+{
+#ifndef WIN32
+	if (mctp_sock_ctx.fd >= 0)
+		close(mctp_sock_ctx.fd);
+
+	if (mctp_sock_ctx.listen_fd >= 0) {
+		close(mctp_sock_ctx.listen_fd);
+		unlink(mctp_sock_ctx.path);
+	}
+#endif
+	mctp_sock_ctx.fd = -1;
+	mctp_sock_ctx.listen_fd = -1;
+
+	return MCTP_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#ifndef MCTP_SOCKET_H
+#define MCTP_SOCKET_H
+
+#include "mctp.h"
+#include "mctp_smbus.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#define MCTP_SOCKET_PATH_MAX            (108)
+// How long a client keeps trying to reach a server that is still starting up
+#define MCTP_SOCKET_CONNECT_MS          (2000)
+#define MCTP_SOCKET_RETRY_MS            (50)
+
+/**
+ * MCTP over a local SOCK_SEQPACKET socket.
+ *
+ * Each datagram carries one MCTP packet framed exactly as on SMBus (destination
+ * slave address, command code 0x0F, byte count, source slave address, MCTP
+ * transport header and payload) without the PEC, so the receive path is shared
+ * with the SMBus binding.
+ *
+ * The requester verbs run with -U are clients. The server side is the
+ * endpoint, e.g. nvme-emu run with -U.
+ */
+struct mctp_socket_context {
+	int fd;
+	int listen_fd;
+	bool server;
+	u8 src_slv_addr;
+	// How long a send waits for a peer, the first packet wait of the last poll
+	int accept_ms;
+	char path[MCTP_SOCKET_PATH_MAX];
+};
+
+extern const struct mctp_binding mctp_socket_binding;
+
+int mctp_socket_transmit_packet(int handle, u8 dst_slv_addr, union mctp_smbus_packet *pkt,
+                                u8 tran_size, int verbose);
+int mctp_socket_poll(int handle, int timeout_ms, slave_poll_callback callback, int verbose);
+int mctp_socket_init(const char *path, bool server, u8 src_slv_addr);
+int mctp_socket_deinit(void);
+
+#endif // ~ MCTP_SOCKET_H
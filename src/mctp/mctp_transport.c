@@ -9,29 +9,62 @@
 #include "mctp.h"
 #include "mctp_smbus.h"
 #include "mctp_transport.h"
+#include "mctp_route.h"
 
+#include "i2c_mux.h"
 #include "utility.h"
 #include "crc32.h"
 
 static struct mctp_transport_manager mctp_tran_ctx;
-static u8 *m_mctp_addr_map;
 
 u8 mctp_transport_search_addr(u8 eid, int verbose)
 {
+	const struct mctp_route *rt = mctp_route_lookup(eid);
+	u8 addr = rt ? rt->phy_addr : 0;
+
 	if (verbose > 1)
-		mctp_trace(INFO, "eid:%x, addr:%x\n", eid,  m_mctp_addr_map[eid]);
-	return m_mctp_addr_map[eid];
+		mctp_trace(INFO, "eid:%x, addr:%x\n", eid, addr);
+
+	return addr;
 }
 
+/**
+ * Install a route for a single EID on the bus of the default adapter, which is
+ * how an endpoint assigned by Set Endpoint ID is reached. The endpoint sits on
+ * the segment the muxes are switched to while it is assigned.
+ */
 void mctp_transport_update_addr(u8 addr, u8 eid)
 {
-	if (m_mctp_addr_map[eid]) {
-		mctp_trace(INFO, "addr %x exist\n", m_mctp_addr_map[eid]);
-	}
-	m_mctp_addr_map[eid] = addr;
+	int handle = mctp_route_get_default_handle();
+
+	mctp_route_add(eid, eid, handle, i2c_mux_current(handle), addr, MCTP_ROUTE_ENDPOINT);
+}
+
+u8 mctp_transport_get_owner_eid(void)
+{
+	return mctp_tran_ctx.owner_eid;
+}
+
+void mctp_transport_set_owner_eid(u8 eid)
+{
+	mctp_tran_ctx.owner_eid = eid;
+}
+
+u16 mctp_transport_get_max_msg_size(void)
+{
+	return mctp_tran_ctx.max_msg_size;
 }
 
-int mctp_transport_transmit_packet(u8 slv_addr, union mctp_smbus_packet *pkt,
+/**
+ * Source EID of the message being (or last) assembled. The value is latched
+ * from the start packet of the message.
+ */
+u8 mctp_transport_get_src_eid(void)
+{
+	return mctp_tran_ctx.tran_head.src_eid;
+}
+
+int mctp_transport_transmit_packet(int handle, u8 slv_addr, union mctp_smbus_packet *pkt,
                                    const void *payload, u8 tran_size, u8 retry,
                                    bool eom, int verbose)
 {
@@ -68,9 +101,9 @@ int mctp_transport_transmit_packet(u8 slv_addr, union mctp_smbus_packet *pkt,
 	if (verbose)
 		print_buf(&pkt->tran_head, tran_size, "[%s] mctp pkt: %d", __func__, tran_size);
 
-	ret = mctp_smbus_transmit_packet(slv_addr, pkt, tran_size, verbose);
+	ret = mctp_tran_ctx.binding->transmit(handle, slv_addr, pkt, tran_size, verbose);
 	if (ret)
-		mctp_trace(ERROR, "mctp_smbus_transmit_packet (%d)\n", ret);
+		mctp_trace(ERROR, "%s transmit (%d)\n", mctp_tran_ctx.binding->name, ret);
 
 	return ret;
 }
@@ -83,6 +116,26 @@ int mctp_transport_send_message(u8 slv_addr, u8 dst_eid, const void *msg, u16 ms
 	if (msg_size > MCTP_MSG_SIZE_MAX)
 		return -MCTP_TRAN_ERR_UNSUP_MSG_SIZE;
 
+	/**
+	 * A source endpoint is allowed to interleave packets from multiple
+	 * messages to the same destination endpoint concurrently, provided that
+	 * each of the messages has a unique message tag.
+	 */
+	if (tag_owner) {
+		int i;
+
+		msg_tag %= MCTP_MSG_TAG_MAX;
+		for (i = 0; i < MCTP_MSG_TAG_MAX; i++) {
+			if (!(mctp_tran_ctx.req_tags & BITLSHIFT(1, (msg_tag + i) % MCTP_MSG_TAG_MAX)))
+				break;
+		}
+		if (i == MCTP_MSG_TAG_MAX) {
+			mctp_trace(ERROR, "no free message tag (%02x)\n", mctp_tran_ctx.req_tags);
+			return -MCTP_TRAN_BUSY;
+		}
+		msg_tag = (msg_tag + i) % MCTP_MSG_TAG_MAX;
+	}
+
 	mctp_transport_drop_message(1);
 
 	union mctp_smbus_packet *pkt = malloc(sizeof(*pkt));
@@ -91,30 +144,40 @@ int mctp_transport_send_message(u8 slv_addr, u8 dst_eid, const void *msg, u16 ms
 		pkt->tran_head.value = 0;
 		pkt->tran_head.hdr_ver = MCTP_HEADER_VERSION;
 		pkt->tran_head.dst_eid = dst_eid;
-		/**
-		 * A source endpoint is allowed to interleave packets from multiple
-		 * messages to the same destination endpoint concurrently, provided that
-		 * each of the messages has a unique message tag.
-		 */
 		pkt->tran_head.msg_tag = msg_tag;
-		mctp_tran_ctx.req_sent = 1;
+		mctp_tran_ctx.req_tag = msg_tag;
 	} else {
-		// Copy tran_head info from last transaction.
+		// Answer the request last received, outstanding requests of our own stay.
 		pkt->tran_head.value = mctp_tran_ctx.tran_head.value;
 		pkt->tran_head.dst_eid = mctp_tran_ctx.tran_head.src_eid;
-		// pkt->tran_head.msg_tag = msg_tag;
-		mctp_tran_ctx.req_sent = 0;
 	}
 	pkt->tran_head.src_eid = mctp_tran_ctx.owner_eid;
 	pkt->tran_head.tag_owner = tag_owner;
 
-	if (dst_eid)
-		slv_addr = mctp_transport_search_addr(dst_eid, verbose);
+	/**
+	 * Resolve the route once per message. Without a route for the destination
+	 * EID, the caller's physical address on the default adapter is used, on
+	 * whichever segment the bus is switched to.
+	 */
+	int handle = mctp_route_get_default_handle();
+	const struct mctp_route *rt = dst_eid ? mctp_route_lookup(dst_eid) : NULL;
+	if (rt) {
+		handle = rt->handle;
+		slv_addr = rt->phy_addr;
+		if (i2c_mux_route(handle, rt->bus)) {
+			mctp_trace(ERROR, "no route to segment %d\n", rt->bus);
+			msg_size = 0;
+		}
+	}
+
+	if (verbose > 1)
+		mctp_trace(INFO, "eid:%x, handle:%d, seg:%d, addr:%x\n", dst_eid, handle,
+		           rt ? rt->bus : i2c_mux_current(handle), slv_addr);
 
 	u8 retry = 0;
 	while (msg_size) {
 		u8 tran_size = msg_size > mctp_tran_ctx.nego_size ? mctp_tran_ctx.nego_size : msg_size;
-		ret = mctp_transport_transmit_packet(slv_addr, pkt, msg, tran_size, retry,
+		ret = mctp_transport_transmit_packet(handle, slv_addr, pkt, msg, tran_size, retry,
 		                                     msg_size <= mctp_tran_ctx.nego_size,
 		                                     verbose);
 		if (ret) {
@@ -126,7 +189,10 @@ int mctp_transport_send_message(u8 slv_addr, u8 dst_eid, const void *msg, u16 ms
 		msg_size -= tran_size;
 	}
 
-	// wait response, keep req_sent set
+	// A request is awaited by its tag once it is out.
+	if (tag_owner && !ret)
+		mctp_tran_ctx.req_tags |= BITLSHIFT(1, msg_tag);
+
 	mctp_transport_drop_message(1);
 	free(pkt);
 
@@ -151,7 +217,33 @@ void mctp_transport_clear_state(u32 val)
 
 bool mctp_transport_req_sent(void)
 {
-	return mctp_tran_ctx.req_sent;
+	return mctp_tran_ctx.req_tags;
+}
+
+// Message tag the last request went out with, to expire it later.
+u8 mctp_transport_get_req_tag(void)
+{
+	return mctp_tran_ctx.req_tag;
+}
+
+bool mctp_transport_request_pending(u8 msg_tag)
+{
+	return mctp_tran_ctx.req_tags & BITLSHIFT(1, msg_tag % MCTP_MSG_TAG_MAX);
+}
+
+/**
+ * Forget the request sent with msg_tag whose response is no longer expected,
+ * so a late response to it is treated as an expired message tag.
+ */
+void mctp_transport_expire_request(u8 msg_tag)
+{
+	mctp_tran_ctx.req_tags &= ~BITLSHIFT(1, msg_tag % MCTP_MSG_TAG_MAX);
+}
+
+// The response received was not the last one for the request, e.g. an interim status.
+void mctp_transport_extend_request(void)
+{
+	mctp_tran_ctx.req_tags |= BITLSHIFT(1, mctp_tran_ctx.tran_head.msg_tag);
 }
 
 bool mctp_transport_ic_set(const union mctp_message *msg)
@@ -164,10 +256,12 @@ bool mctp_transport_som_received(void)
 	return mctp_tran_ctx.flag.som;
 }
 
+// A complete response settles the request of its tag.
 bool mctp_transport_eom_received(void)
 {
 	if (mctp_tran_ctx.flag.eom) {
-		mctp_tran_ctx.req_sent = 0;
+		if (!mctp_tran_ctx.tran_head.tag_owner)
+			mctp_tran_ctx.req_tags &= ~BITLSHIFT(1, mctp_tran_ctx.tran_head.msg_tag);
 		return true;
 	}
 	return false;
@@ -216,6 +310,17 @@ int mctp_transport_assemble_message(union mctp_message *msg, const union mctp_sm
 	return MCTP_SUCCESS;
 }
 
+void mctp_transport_set_binding(const struct mctp_binding *binding)
+{
+	mctp_trace(INIT, "binding: %s\n", binding->name);
+	mctp_tran_ctx.binding = binding;
+}
+
+const struct mctp_binding *mctp_transport_get_binding(void)
+{
+	return mctp_tran_ctx.binding;
+}
+
 int mctp_transport_check_packet(const union mctp_smbus_packet *pkt, int verbose)
 {
 	const union mctp_transport_header *tran_head = &pkt->tran_head;
@@ -324,11 +429,13 @@ int mctp_transport_check_packet(const union mctp_smbus_packet *pkt, int verbose)
 	 * TO bit values for messages that are not addressed to the bridge’s EID, or
 	 * to the bridge’s physical address if null-source or destination-EID
 	 * physical addressing is used.)
+	 *
+	 * Only responses are matched against the tags of our requests. A request
+	 * of the endpoint, e.g. an AEM, may arrive while one of ours is pending.
 	 */
-	if ((!tran_head->tag_owner && !mctp_tran_ctx.req_sent) ||
-	    (tran_head->tag_owner && mctp_tran_ctx.req_sent)) {
-		mctp_trace(ERROR, "bad, unexpected, or expired message tag (%d,%d)\n",
-		           tran_head->tag_owner, mctp_tran_ctx.req_sent);
+	if (!tran_head->tag_owner && !(mctp_tran_ctx.req_tags & BITLSHIFT(1, tran_head->msg_tag))) {
+		mctp_trace(ERROR, "bad, unexpected, or expired message tag (%d,%d,%02x)\n",
+		           tran_head->tag_owner, tran_head->msg_tag, mctp_tran_ctx.req_tags);
 		return -MCTP_TRAN_ERR_BAD_MSG_TAG;
 	}
 
@@ -337,7 +444,7 @@ int mctp_transport_check_packet(const union mctp_smbus_packet *pkt, int verbose)
 	 * (TO) and Message Tag bits remain the same for all packets from the
 	 * SOM through the EOM.
 	 */
-	if (!tran_head->som || mctp_tran_ctx.req_sent) {
+	if (!tran_head->som || mctp_tran_ctx.req_tags) {
 		if ((tran_head->tag_owner != mctp_tran_ctx.tran_head.tag_owner) ||
 		    (tran_head->msg_tag   != mctp_tran_ctx.tran_head.msg_tag)) {
 			mctp_trace(ERROR, "inconsistent message tag (%d,%d)(%d,%d)\n",
@@ -351,7 +458,7 @@ int mctp_transport_check_packet(const union mctp_smbus_packet *pkt, int verbose)
 	// If this packet is the last packet of a message
 	if (tran_head->eom) {
 		mctp_tran_ctx.plen = plen;
-		// mctp_tran_ctx.req_sent = 0;  // move to mctp_transport_eom_received
+		// The tag is released by mctp_transport_eom_received.
 		mctp_tran_ctx.flag.som = 0;
 		mctp_tran_ctx.flag.eom = 1;
 		mctp_tran_ctx.flag.pkt_tmr_en = 0;
@@ -395,12 +502,10 @@ int mctp_transport_init(u8 owner_eid, u8 tar_eid, u16 nego_size)
 	mctp_trace(INIT, "%s\n", __func__);
 	memset(&mctp_tran_ctx, 0, sizeof(mctp_tran_ctx));
 
-	m_mctp_addr_map = malloc(MCTP_ADDR_MAP_SIZE);
-	memset(m_mctp_addr_map, 0, MCTP_ADDR_MAP_SIZE);
-
 	mctp_tran_ctx.owner_eid = owner_eid;
 	mctp_tran_ctx.tar_eid = tar_eid;
 
+	mctp_tran_ctx.binding = &mctp_smbus_binding;
 	mctp_tran_ctx.nego_size = nego_size;
 	mctp_tran_ctx.max_msg_size = MCTP_MSG_SIZE_MAX;
 
@@ -416,7 +521,6 @@ int mctp_transport_init(u8 owner_eid, u8 tar_eid, u16 nego_size)
 int mctp_transport_deinit(void)
 {
 	mctp_trace(INIT, "%s\n", __func__);
-	free(m_mctp_addr_map);
 
 	return MCTP_SUCCESS;
 }
@@ -7,7 +7,20 @@
 #include "types.h"
 #include <stdbool.h>
 
-#define MCTP_ADDR_MAP_SIZE                              (256)
+/**
+ * DSP0236, 8.2 Physical medium / transport binding
+ *
+ * The transport layer hands complete MCTP packets to a binding, which frames
+ * them for its medium. The packet keeps the SMBus framing in front of the MCTP
+ * transport header, so a received packet is handled the same way whatever the
+ * medium is.
+ */
+struct mctp_binding {
+	const char *name;
+	int (*transmit)(int handle, u8 dst_slv_addr, union mctp_smbus_packet *pkt, u8 tran_size,
+	                int verbose);
+	int (*poll)(int handle, int timeout_ms, slave_poll_callback callback, int verbose);
+};
 
 union mctp_transport_status {
 	struct {
@@ -37,14 +50,24 @@ struct mctp_transport_manager {
 	u8 state;
 	u8 retry;
 	u8 pkt_seq;
-	u8 req_sent;
+	u8 req_tags;                    // Message tags awaiting a response, one bit per tag
+	u8 req_tag;                     // Tag of the last request sent
+	const struct mctp_binding *binding;
 };
 
 u8 mctp_transport_search_addr(u8 eid, int verbose);
 void mctp_transport_update_addr(u8 addr, u8 eid);
+u8 mctp_transport_get_owner_eid(void);
+void mctp_transport_set_owner_eid(u8 eid);
+u8 mctp_transport_get_src_eid(void);
+u16 mctp_transport_get_max_msg_size(void);
 u16 mctp_transport_get_message_size(const union mctp_message *msg);
 void mctp_transport_clear_state(dword val);
 bool mctp_transport_req_sent(void);
+u8 mctp_transport_get_req_tag(void);
+bool mctp_transport_request_pending(u8 msg_tag);
+void mctp_transport_expire_request(u8 msg_tag);
+void mctp_transport_extend_request(void);
 bool mctp_transport_ic_set(const union mctp_message *msg);
 bool mctp_transport_som_received(void);
 bool mctp_transport_eom_received(void);
@@ -55,6 +78,8 @@ int mctp_transport_assemble_message(union mctp_message *msg, const union mctp_sm
                                     int verbose);
 int mctp_transport_send_message(u8 slave_addr, u8 dst_eid, const void *msg,
                                 u16 msg_size, u8 msg_type, u8 tag_owner, int verbose);
+void mctp_transport_set_binding(const struct mctp_binding *binding);
+const struct mctp_binding *mctp_transport_get_binding(void);
 int mctp_transport_check_packet(const union mctp_smbus_packet *pkt, int verbose);
 int mctp_transport_init(u8 owner_eid, u8 tar_eid, u16 nego_size);
 int mctp_transport_deinit(void);
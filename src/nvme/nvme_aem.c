@@ -0,0 +1,258 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_aem.h"
+#include "mctp_transport.h"
+#include "mctp_message.h"
+#include "mctp_core.h"
+#include "utility.h"
+#include "libnvme_types.h"
+#include "libnvme_mi_mi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct nvme_aem_endpoint {
+	bool valid;                     // aemgn holds the generation of the last AEM
+	bool ack;                       // An acknowledge is still to be sent
+	bool ic;
+	uint8_t aemgn;
+};
+
+static struct {
+	nvme_aem_cb cb;
+	void *priv;
+	struct nvme_aem_endpoint ep[NVME_AEM_EID_MAX];
+} nvme_aem_ctx;
+
+void nvme_aem_register(nvme_aem_cb cb, void *priv)
+{
+	nvme_aem_ctx.cb = cb;
+	nvme_aem_ctx.priv = priv;
+}
+
+void nvme_aem_show(const struct nvme_aem_event *ev)
+{
+	printf("AEM EID %d AEMGN %d%s%s: AEOI 0x%02x AEOCIDI 0x%08x AESSI 0x%02x AEOSIL %d AEOVSIL %d\n",
+	       ev->eid, ev->aemgn, ev->sync ? " (sync)" : "", ev->overflow ? " (overflow)" : "",
+	       ev->aeoi, ev->aeocidi, ev->aessi, ev->aeosil, ev->aeovsil);
+}
+
+/**
+ * Walk the AE Occurrence List in buf and raise the callback for every
+ * occurrence. Occurrences have a variable length, so each one is located from
+ * the lengths in the one before it. Returns the number of occurrences.
+ */
+int nvme_aem_decode(uint8_t eid, const void *buf, uint32_t len, bool async)
+{
+	const struct nvme_mi_aem_occ_list_hdr *hdr = buf;
+	const uint8_t *p = buf;
+	struct nvme_aem_event ev;
+	uint32_t aeolli, total, offset;
+
+	if (len < sizeof(*hdr) || hdr->aeolhl < sizeof(*hdr) || hdr->aeolhl > len) {
+		nvme_trace(ERROR, "invalid ae occurrence list (%d)\n", len);
+		return -NVME_AEM_ERR_FORMAT;
+	}
+
+	aeolli = hdr->aeolli[0] | hdr->aeolli[1] << 8 | hdr->aeolli[2] << 16;
+	total = aeolli & NVME_AEM_AEOLTL_MASK;
+	if (total > len) {
+		nvme_trace(WARN, "ae occurrence list truncated (%d,%d)\n", total, len);
+		total = len;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.eid = eid;
+	ev.aemgn = hdr->aemti >> NVME_AEM_AEMGN_SHIFT;
+	ev.sync = !async;
+	ev.overflow = aeolli & NVME_AEM_AEOLO;
+
+	offset = hdr->aeolhl;
+	for (int i = 0; i < hdr->numaeo; i++) {
+		const struct nvme_mi_aem_occ_data *occ = (const void *)(p + offset);
+
+		if (offset + sizeof(*occ) > total || occ->aelhlen < sizeof(*occ) ||
+		    offset + occ->aelhlen + occ->aeosil + occ->aeovsil > total) {
+			nvme_trace(ERROR, "invalid ae occurrence %d at %d\n", i, offset);
+			return -NVME_AEM_ERR_FORMAT;
+		}
+
+		ev.aeoi = occ->aeoui.aeoi;
+		ev.aeocidi = occ->aeoui.aeocidi;
+		ev.aessi = occ->aeoui.aessi;
+		ev.aeosil = occ->aeosil;
+		ev.aeosi = occ->aeosil ? p + offset + occ->aelhlen : NULL;
+		ev.aeovsil = occ->aeovsil;
+		ev.aevsi = occ->aeovsil ? p + offset + occ->aelhlen + occ->aeosil : NULL;
+
+		if (nvme_aem_ctx.cb)
+			nvme_aem_ctx.cb(&ev, nvme_aem_ctx.priv);
+		else
+			nvme_aem_show(&ev);
+
+		offset += occ->aelhlen + occ->aeosil + occ->aeovsil;
+	}
+
+	return hdr->numaeo;
+}
+
+/**
+ * Handle an AEM received in slave mode. This runs from the receive path, so
+ * the acknowledge is only recorded here and sent by nvme_aem_ack(). A
+ * retransmitted AEM still has the generation number of the last one and is
+ * acknowledged again without reporting its occurrences twice.
+ */
+int nvme_aem_message_handle(const union nvme_mi_msg *msg, uint16_t size)
+{
+	const struct nvme_mi_aem_occ_list_hdr *hdr = (const void *)msg->msg_data;
+	uint8_t eid = mctp_transport_get_src_eid();
+	struct nvme_aem_endpoint *ep = &nvme_aem_ctx.ep[eid];
+	uint32_t len = size > sizeof(msg->nmh) ? size - sizeof(msg->nmh) : 0;
+	uint8_t aemgn;
+	int ret;
+
+	if (len < sizeof(*hdr)) {
+		nvme_trace(ERROR, "short aem from eid %d (%d)\n", eid, size);
+		return -NVME_AEM_ERR_FORMAT;
+	}
+
+	aemgn = hdr->aemti >> NVME_AEM_AEMGN_SHIFT;
+	if (ep->valid && ep->aemgn == aemgn && hdr->numaeo) {
+		nvme_trace(DEBUG, "aem %d from eid %d retransmitted\n", aemgn, eid);
+		ep->ack = true;
+		return NVME_AEM_SUCCESS;
+	}
+
+	ret = nvme_aem_decode(eid, hdr, len, true);
+	if (ret < 0)
+		return ret;
+
+	// An AEM without occurrences answers an acknowledge and is not acknowledged itself.
+	if (ret) {
+		ep->valid = true;
+		ep->aemgn = aemgn;
+		ep->ic = msg->nmh.ic;
+		ep->ack = true;
+	}
+
+	return NVME_AEM_SUCCESS;
+}
+
+/**
+ * Wait for the response to the acknowledge sent with msg_tag. Without one
+ * the tag is expired, as an outstanding request would have every later AEM
+ * rejected as a request of the endpoint.
+ */
+static void nvme_aem_wait_ack(struct aa_args *args, uint8_t eid, uint8_t msg_tag)
+{
+	uint64_t deadline = time_us() + NVME_AEM_ACK_TIMEOUT_MS * 1000ULL;
+
+	while (mctp_transport_request_pending(msg_tag) && time_us() < deadline)
+		mctp_poll(args->handle, NVME_AEM_ACK_POLL_MS, args->verbose);
+
+	if (mctp_transport_request_pending(msg_tag)) {
+		nvme_trace(WARN, "no response to aem ack from eid %d\n", eid);
+		mctp_transport_expire_request(msg_tag);
+	}
+}
+
+// Send the acknowledges recorded by nvme_aem_message_handle().
+int nvme_aem_ack(struct aa_args *args)
+{
+	union nvme_mi_msg *msg = NULL;
+	int ret, err = NVME_AEM_SUCCESS;
+
+	for (int eid = 0; eid < NVME_AEM_EID_MAX; eid++) {
+		struct nvme_aem_endpoint *ep = &nvme_aem_ctx.ep[eid];
+		uint16_t msg_size = sizeof(msg->nmh);
+
+		if (!ep->ack)
+			continue;
+
+		if (!msg) {
+			msg = malloc(sizeof(*msg));
+			if (!msg)
+				return -NVME_AEM_ERR_PARAM;
+		}
+		memset(msg, 0, sizeof(*msg));
+		ep->ack = false;
+
+		/**
+		 * NVMe-MI, 5.1.2 AEM Acknowledge
+		 *
+		 * The acknowledge is a Request Message with the Asynchronous Event
+		 * NMIMT and no data. The answer is an AEM with the occurrences that
+		 * were raised since, if any.
+		 */
+		msg->nmh.mt    = MCTP_MSG_TYPE_NVME_MM;
+		msg->nmh.ic    = ep->ic;
+		msg->nmh.nmimt = NVME_MI_MT_AE;
+		msg->nmh.ror   = ROR_REQ;
+
+		if (ep->ic)
+			msg_size = mctp_message_append_mic(msg, msg_size);
+
+		ret = mctp_transport_send_message(mctp_transport_search_addr(eid, args->verbose), eid,
+		                                  msg, msg_size, rand(), true, args->verbose);
+		if (ret) {
+			nvme_trace(ERROR, "aem ack to eid %d (%d)\n", eid, ret);
+			ep->ack = true;
+			err = ret;
+			continue;
+		}
+
+		nvme_aem_wait_ack(args, eid, mctp_transport_get_req_tag());
+	}
+
+	free(msg);
+
+	return err;
+}
+
+/**
+ * Wait up to timeout_ms for messages and acknowledge the AEMs among them.
+ * Returns what mctp_poll() returned.
+ */
+int nvme_aem_poll(struct aa_args *args, int timeout_ms)
+{
+	int ret = mctp_poll(args->handle, timeout_ms, args->verbose);
+
+	nvme_aem_ack(args);
+
+	return ret;
+}
+
+/**
+ * Enable or disable the events in aeid on the endpoint of args, for NVM
+ * Subsystem, Management Endpoint and Controller scope alike. AEMs are sent
+ * without delay and retransmitted after one second until acknowledged.
+ */
+int nvme_aem_enable(struct aa_args *args, const uint8_t *aeid, uint8_t num, bool enable)
+{
+	struct nmd0_config_ae ae = {
+		.encfa = enable,
+		.empfa = enable,
+		.envfa = enable,
+	};
+	union nmd1_config_ae delay = {
+		.aemd = 0,
+		.aerd = 10,
+	};
+	bool *aee;
+	int ret;
+
+	aee = malloc(num ? num : 1);
+	if (!aee)
+		return -NVME_AEM_ERR_PARAM;
+
+	for (int i = 0; i < num; i++)
+		aee[i] = enable;
+
+	ret = nvme_mi_mi_config_set_ae(args, ae, delay, aeid, aee, num);
+	free(aee);
+
+	nvme_aem_ack(args);
+
+	return ret;
+}
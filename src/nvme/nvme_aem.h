@@ -0,0 +1,60 @@
+#ifndef NVME_AEM_H
+#define NVME_AEM_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * NVMe-MI, 5.1.1 Asynchronous Event Messages
+ *
+ * Once enabled with Configuration Set, a Management Endpoint reports events
+ * in an AEM that carries an AE Occurrence List. The requester acknowledges
+ * each AEM; until then the AEM is retransmitted with the same generation
+ * number after the AEM Retry Delay.
+ */
+#define NVME_AEM_EID_MAX                (256)
+// AE Occurrence List Total Length (AEOLTL) in AEOLLI Bit[22:0]
+#define NVME_AEM_AEOLTL_MASK            (0x7FFFFF)
+// AE Occurrence List Overflow (AEOLO) in AEOLLI Bit[23]
+#define NVME_AEM_AEOLO                  (1 << 23)
+// AEM Generation Number (AEMGN) in AEMTI Bit[7:3]
+#define NVME_AEM_AEMGN_SHIFT            (3)
+// How long the response to an AEM Acknowledge is waited for
+#define NVME_AEM_ACK_TIMEOUT_MS         (1000)
+#define NVME_AEM_ACK_POLL_MS            (10)
+
+enum nvme_aem_error {
+	NVME_AEM_SUCCESS = 0,
+	NVME_AEM_ERR_PARAM,
+	NVME_AEM_ERR_FORMAT,
+};
+
+// One AE Occurrence, the info pointers are only valid during the callback.
+struct nvme_aem_event {
+	uint8_t eid;                    // Management Endpoint that reported the event
+	uint8_t aemgn;                  // AEM Generation Number
+	bool sync;                      // Reported in the response to Configuration Set
+	bool overflow;                  // Occurrences were lost before this AEM
+	uint8_t aeoi;                   // AE Occurrence ID (AEOI)
+	uint32_t aeocidi;               // AE Occurrence Controller/Namespace ID Info (AEOCIDI)
+	uint8_t aessi;                  // AE Occurrence Scope Specific Info (AESSI)
+	const uint8_t *aeosi;           // AE Occurrence Specific Info (AEOSI)
+	uint8_t aeosil;
+	const uint8_t *aevsi;           // AE Occurrence Vendor Specific Info (AEVSI)
+	uint8_t aeovsil;
+};
+
+typedef void (*nvme_aem_cb)(const struct nvme_aem_event *ev, void *priv);
+
+union nvme_mi_msg;
+
+void nvme_aem_register(nvme_aem_cb cb, void *priv);
+int nvme_aem_decode(uint8_t eid, const void *buf, uint32_t len, bool async);
+int nvme_aem_message_handle(const union nvme_mi_msg *msg, uint16_t size);
+int nvme_aem_ack(struct aa_args *args);
+int nvme_aem_poll(struct aa_args *args, int timeout_ms);
+int nvme_aem_enable(struct aa_args *args, const uint8_t *aeid, uint8_t num, bool enable);
+void nvme_aem_show(const struct nvme_aem_event *ev);
+
+#endif // NVME_AEM_H
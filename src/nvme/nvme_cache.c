@@ -0,0 +1,626 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_cache.h"
+#include "nvme_decode.h"
+#include "libnvme_types.h"
+#include "libnvme_mi_mi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+static const char *_type[NVME_CACHE_TYPE_MAX] = {
+	[NVME_CACHE_IDENTIFY_CTRL] = "Identify Controller",
+	[NVME_CACHE_SUBSYS_INFO] = "NVM Subsystem Information",
+	[NVME_CACHE_PORT_INFO] = "Port Information",
+	[NVME_CACHE_CTRL_LIST] = "Controller List",
+	[NVME_CACHE_CTRL_INFO] = "Controller Information",
+	[NVME_CACHE_OPT_CMD] = "Optionally Supported Command List",
+	[NVME_CACHE_VPD] = "VPD",
+	[NVME_CACHE_NS_INFO] = "Namespace Inventory",
+};
+
+static bool nvme_cache_valid(const struct nvme_cache *cache, const u8 *map, size_t size)
+{
+	const struct nvme_cache_hdr *hdr = (const void *)map;
+	const struct nvme_cache_entry *entry = (const void *)(hdr + 1);
+
+	if (size < sizeof(*hdr) || hdr->magic != NVME_CACHE_MAGIC ||
+	    hdr->version != NVME_CACHE_VERSION || hdr->size != size ||
+	    hdr->nentry > NVME_CACHE_ENTRY_MAX ||
+	    sizeof(*hdr) + hdr->nentry * sizeof(*entry) > size ||
+	    memcmp(hdr->udid, cache->udid, sizeof(cache->udid)))
+		return false;
+
+	for (int i = 0; i < hdr->nentry; i++)
+		if (entry[i].type >= NVME_CACHE_TYPE_MAX || entry[i].offset > size ||
+		    entry[i].len > size - entry[i].offset)
+			return false;
+
+	return true;
+}
+
+static void nvme_cache_unmap(struct nvme_cache *cache)
+{
+	if (!cache->map)
+		return;
+#ifndef WIN32
+	if (cache->mapped)
+		munmap((void *)cache->map, cache->map_size);
+	else
+#endif
+		free((void *)cache->map);
+	cache->map = NULL;
+	cache->map_size = 0;
+	cache->mapped = false;
+}
+
+static void nvme_cache_map(struct nvme_cache *cache)
+{
+	struct stat st;
+	int fd;
+
+	cache->stale = false;
+
+	fd = open(cache->path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return;
+	}
+
+	cache->map_size = st.st_size;
+#ifndef WIN32
+	cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cache->map != MAP_FAILED) {
+		cache->mapped = true;
+	} else
+#endif
+	{
+		// No mapping, read the whole file instead.
+		u8 *buf = malloc(cache->map_size);
+		size_t got = 0;
+
+		while (buf && got < cache->map_size) {
+			ssize_t n = read(fd, buf + got, cache->map_size - got);
+			if (n <= 0)
+				break;
+			got += n;
+		}
+		if (buf && got != cache->map_size) {
+			free(buf);
+			buf = NULL;
+		}
+		cache->map = buf;
+		cache->mapped = false;
+	}
+	close(fd);
+
+	if (cache->map && !nvme_cache_valid(cache, cache->map, cache->map_size)) {
+		nvme_trace(WARN, "ignore invalid cache %s\n", cache->path);
+		nvme_cache_unmap(cache);
+	}
+}
+
+// Name the file after the space padded Serial Number, for a drive without a UDID.
+static void nvme_cache_name(struct nvme_cache *cache, const char *sn)
+{
+	char *p = cache->path + strlen(cache->path);
+	int n = sizeof(((struct nvme_cache_hdr *)0)->sn);
+
+	while (n && sn[n - 1] == ' ')
+		n--;
+
+	p += sprintf(p, "sn-");
+	for (int i = 0; i < n; i++)
+		*p++ = isalnum((unsigned char)sn[i]) || sn[i] == '-' ? sn[i] : '_';
+	strcpy(p, ".nmic");
+
+	cache->named = true;
+}
+
+/**
+ * The file of a drive with a UDID is mapped here. An all-zero UDID names
+ * nothing, that file is found once nvme_cache_check has read the Serial Number.
+ */
+int nvme_cache_open(struct nvme_cache *cache, const char *dir, const u8 *udid)
+{
+	static const u8 zero[16];
+	int len;
+
+	memset(cache, 0, sizeof(*cache));
+	memcpy(cache->udid, udid, sizeof(cache->udid));
+
+	// Either name is at most as long as the UDID in hex.
+	len = snprintf(cache->path, sizeof(cache->path), "%s/", dir);
+	if (len + 2 * sizeof(cache->udid) + strlen(".nmic") >= sizeof(cache->path)) {
+		nvme_trace(ERROR, "cache path too long\n");
+		return -NVME_CACHE_ERR_PARAM;
+	}
+
+	if (!memcmp(udid, zero, sizeof(zero)))
+		return NVME_CACHE_SUCCESS;
+
+	for (int i = 0; i < sizeof(cache->udid); i++)
+		len += sprintf(cache->path + len, "%02x", udid[i]);
+	strcat(cache->path, ".nmic");
+	cache->named = true;
+
+	nvme_cache_map(cache);
+
+	return NVME_CACHE_SUCCESS;
+}
+
+void nvme_cache_close(struct nvme_cache *cache)
+{
+	nvme_cache_unmap(cache);
+	free(cache->buf);
+	cache->buf = NULL;
+	cache->buf_len = 0;
+	cache->npend = 0;
+}
+
+// Entries read in this run shadow the ones of the file.
+const void *nvme_cache_get(const struct nvme_cache *cache, enum nvme_cache_type type, u16 id,
+                           u32 *len)
+{
+	const struct nvme_cache_hdr *hdr = (const void *)cache->map;
+	const struct nvme_cache_entry *entry;
+
+	for (int i = cache->npend - 1; i >= 0; i--) {
+		if (cache->pend[i].type == type && cache->pend[i].id == id) {
+			*len = cache->pend[i].len;
+			return cache->buf + cache->pend[i].offset;
+		}
+	}
+
+	if (!cache->map || cache->stale)
+		return NULL;
+
+	entry = (const void *)(hdr + 1);
+	for (int i = 0; i < hdr->nentry; i++) {
+		if (entry[i].type == type && entry[i].id == id) {
+			*len = entry[i].len;
+			return cache->map + entry[i].offset;
+		}
+	}
+
+	return NULL;
+}
+
+int nvme_cache_put(struct nvme_cache *cache, enum nvme_cache_type type, u16 id, const void *buf,
+                   u32 len)
+{
+	struct nvme_cache_entry *entry;
+	u8 *p;
+
+	if (type >= NVME_CACHE_TYPE_MAX)
+		return -NVME_CACHE_ERR_PARAM;
+
+	if (cache->npend >= NVME_CACHE_ENTRY_MAX)
+		return -NVME_CACHE_ERR_FULL;
+
+	p = realloc(cache->buf, cache->buf_len + len);
+	if (!p && len)
+		return -NVME_CACHE_ERR_IO;
+	cache->buf = p;
+
+	entry = &cache->pend[cache->npend++];
+	entry->type = type;
+	entry->rsvd = 0;
+	entry->id = id;
+	entry->offset = cache->buf_len;
+	entry->len = len;
+
+	memcpy(cache->buf + cache->buf_len, buf, len);
+	cache->buf_len += len;
+
+	return NVME_CACHE_SUCCESS;
+}
+
+// Serial Number and Firmware Revision as they are stored in Identify Controller.
+static void nvme_cache_get_sn_fr(const struct nvme_cache *cache, char *sn, char *fr)
+{
+	const struct nvme_id_ctrl *id;
+	u32 len;
+
+	memset(sn, ' ', sizeof(((struct nvme_cache_hdr *)0)->sn));
+	memset(fr, ' ', sizeof(((struct nvme_cache_hdr *)0)->fr));
+
+	id = nvme_cache_get(cache, NVME_CACHE_IDENTIFY_CTRL, 0, &len);
+	if (!id || len < sizeof(*id))
+		return;
+
+	memcpy(sn, id->sn, sizeof(id->sn));
+	memcpy(fr, id->fr, sizeof(id->fr));
+}
+
+/**
+ * Whether the mapped file was written for the drive with this space padded
+ * Serial Number and Firmware Revision.
+ */
+bool nvme_cache_match(const struct nvme_cache *cache, const char *sn, const char *fr)
+{
+	const struct nvme_cache_hdr *hdr = (const void *)cache->map;
+
+	if (!hdr || cache->stale)
+		return false;
+
+	return !memcmp(hdr->sn, sn, sizeof(hdr->sn)) && !memcmp(hdr->fr, fr, sizeof(hdr->fr));
+}
+
+void nvme_cache_invalidate(struct nvme_cache *cache)
+{
+	cache->stale = true;
+	cache->npend = 0;
+	cache->buf_len = 0;
+	if (cache->named)
+		remove(cache->path);
+}
+
+/**
+ * Write the live entries to a temporary file and move it over the cache, so
+ * a reader never maps a partly written file. The new file is mapped again.
+ */
+int nvme_cache_commit(struct nvme_cache *cache)
+{
+	const struct nvme_cache_hdr *old = (const void *)cache->map;
+	const struct nvme_cache_entry *old_entry;
+	struct nvme_cache_entry entry[NVME_CACHE_ENTRY_MAX];
+	const u8 *src[NVME_CACHE_ENTRY_MAX];
+	struct nvme_cache_hdr hdr;
+	char tmp[sizeof(cache->path) + 4];
+	u32 offset, n = 0;
+	FILE *fp;
+	int ret = NVME_CACHE_SUCCESS;
+
+	if (!cache->named) {
+		if (!nvme_cache_get(cache, NVME_CACHE_IDENTIFY_CTRL, 0, &offset))
+			return -NVME_CACHE_ERR_PARAM;
+		nvme_cache_get_sn_fr(cache, hdr.sn, hdr.fr);
+		nvme_cache_name(cache, hdr.sn);
+	}
+
+	for (int i = 0; i < cache->npend; i++) {
+		u32 len;
+		const void *p = nvme_cache_get(cache, cache->pend[i].type, cache->pend[i].id, &len);
+		// Only the last entry of a type and id is kept.
+		if (p != cache->buf + cache->pend[i].offset)
+			continue;
+		entry[n] = cache->pend[i];
+		src[n++] = p;
+	}
+
+	if (old && !cache->stale) {
+		old_entry = (const void *)(old + 1);
+		for (int i = 0; i < old->nentry && n < NVME_CACHE_ENTRY_MAX; i++) {
+			u32 len;
+			const void *p = nvme_cache_get(cache, old_entry[i].type, old_entry[i].id, &len);
+			if (p != cache->map + old_entry[i].offset)
+				continue;
+			entry[n] = old_entry[i];
+			src[n++] = p;
+		}
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = NVME_CACHE_MAGIC;
+	hdr.version = NVME_CACHE_VERSION;
+	hdr.nentry = n;
+	memcpy(hdr.udid, cache->udid, sizeof(hdr.udid));
+	nvme_cache_get_sn_fr(cache, hdr.sn, hdr.fr);
+
+	offset = sizeof(hdr) + n * sizeof(entry[0]);
+	for (int i = 0; i < n; i++) {
+		entry[i].offset = offset;
+		offset += entry[i].len;
+	}
+	hdr.size = offset;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", cache->path);
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", tmp);
+		return -NVME_CACHE_ERR_IO;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    (n && fwrite(entry, sizeof(entry[0]), n, fp) != n))
+		ret = -NVME_CACHE_ERR_IO;
+	for (int i = 0; !ret && i < n; i++)
+		if (entry[i].len && fwrite(src[i], entry[i].len, 1, fp) != 1)
+			ret = -NVME_CACHE_ERR_IO;
+
+	if (fclose(fp))
+		ret = -NVME_CACHE_ERR_IO;
+
+	if (ret) {
+		nvme_trace(ERROR, "write %s\n", tmp);
+		remove(tmp);
+		return ret;
+	}
+
+#ifdef WIN32
+	remove(cache->path);
+#endif
+	nvme_cache_unmap(cache);
+	if (rename(tmp, cache->path)) {
+		nvme_trace(ERROR, "rename %s\n", tmp);
+		remove(tmp);
+		ret = -NVME_CACHE_ERR_IO;
+	}
+
+	cache->npend = 0;
+	cache->buf_len = 0;
+	nvme_cache_map(cache);
+
+	return ret;
+}
+
+// Read one item from the drive into buf, *len is how much of it is valid.
+static int nvme_cache_fetch(struct aa_args *args, struct nvme_cache *cache,
+                            enum nvme_cache_type type, u16 id, u8 *buf, u32 *len)
+{
+	struct nvme_mi_result res;
+	bool admin = type == NVME_CACHE_IDENTIFY_CTRL;
+	int ret;
+
+	if (admin)
+		nvme_cmd_set_data_buf(args->csi, buf, NVME_CACHE_DATA_MAX);
+	else
+		nvme_mi_set_data_buf(args->csi, buf, NVME_CACHE_DATA_MAX);
+
+	cache->reads++;
+
+	switch (type) {
+	case NVME_CACHE_IDENTIFY_CTRL:
+		ret = nvme_identify_ctrl(args);
+		break;
+	case NVME_CACHE_SUBSYS_INFO:
+		ret = nvme_mi_mi_data_read_nvm_subsys_info(args);
+		break;
+	case NVME_CACHE_PORT_INFO:
+		ret = nvme_mi_mi_data_read_port_info(args, id);
+		break;
+	case NVME_CACHE_CTRL_LIST:
+		ret = nvme_mi_mi_data_read_ctrl_list(args, 0);
+		break;
+	case NVME_CACHE_CTRL_INFO:
+		ret = nvme_mi_mi_data_read_ctrl_info(args, id);
+		break;
+	case NVME_CACHE_OPT_CMD:
+		ret = nvme_mi_mi_data_read_opt_cmd_support(args, id, 0);
+		break;
+	case NVME_CACHE_VPD:
+		ret = nvme_mi_mi_vpd_read(args, 0, NVME_CACHE_VPD_SIZE, buf);
+		break;
+	default:
+		ret = -NVME_CACHE_ERR_PARAM;
+		break;
+	}
+
+	if (!ret)
+		*len = admin ? nvme_cmd_get_data_len(args->csi) :
+		       type == NVME_CACHE_VPD ? NVME_CACHE_VPD_SIZE : nvme_mi_get_data_len(args->csi);
+
+	if (admin)
+		nvme_cmd_set_data_buf(args->csi, NULL, 0);
+	else
+		nvme_mi_set_data_buf(args->csi, NULL, 0);
+
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status || res.sf) {
+		nvme_trace(ERROR, "read %s %d: status %x, sf %x\n", _type[type], id, res.status, res.sf);
+		return -NVME_CACHE_ERR_STATUS;
+	}
+
+	return NVME_CACHE_SUCCESS;
+}
+
+// Read one item from the drive into buf and add it to the cache.
+static int nvme_cache_read(struct aa_args *args, struct nvme_cache *cache,
+                           enum nvme_cache_type type, u16 id, u8 *buf)
+{
+	u32 len = 0;
+	int ret = nvme_cache_fetch(args, cache, type, id, buf, &len);
+
+	return ret ? ret : nvme_cache_put(cache, type, id, buf, len);
+}
+
+/**
+ * NVMe-MI, 5.6 NVM Subsystem Health Status Poll
+ *
+ * Firmware Activated and Namespace Attribute Changed in the Composite
+ * Controller Status stay set until cleared with Configuration Set, so the
+ * cache is dropped when either is found set and both are cleared afterwards.
+ *
+ * A file named after the UDID belongs to that drive, so the poll is all a hit
+ * costs. Identify Controller is only read for a drive without a UDID, whose
+ * file is named after its Serial Number and dropped when the Firmware
+ * Revision differs from the one it was written for; a miss reads it with the
+ * rest of the fill.
+ */
+int nvme_cache_check(struct aa_args *args, struct nvme_cache *cache)
+{
+	struct aa_args check_args = *args;
+	struct nvme_mi_result res;
+	union comp_ctrl_sts ccs;
+	const struct nvme_id_ctrl *id;
+	u32 len = 0;
+	u8 *buf = NULL;
+	int ret;
+
+	check_args.async = false;
+
+	ret = nvme_mi_mi_subsystem_health_status_poll(&check_args, false);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(check_args.csi, &res);
+	if (res.status || res.type != NVME_RESULT_SUBSYS_HEALTH) {
+		nvme_trace(ERROR, "subsystem health: status %x\n", res.status);
+		return -NVME_CACHE_ERR_STATUS;
+	}
+	ccs.value = res.subsys_health.ccs;
+
+	if (!cache->named) {
+		buf = malloc(NVME_CACHE_DATA_MAX);
+		if (!buf)
+			return -NVME_CACHE_ERR_IO;
+
+		ret = nvme_cache_fetch(&check_args, cache, NVME_CACHE_IDENTIFY_CTRL, 0, buf, &len);
+		if (ret || len < sizeof(*id)) {
+			free(buf);
+			return ret ? ret : -NVME_CACHE_ERR_STATUS;
+		}
+		id = (const void *)buf;
+
+		nvme_cache_name(cache, id->sn);
+		nvme_cache_map(cache);
+		if (cache->map && !nvme_cache_match(cache, id->sn, id->fr)) {
+			nvme_trace(INFO, "drop cache %s (SN %.20s, FR %.8s)\n", cache->path, id->sn, id->fr);
+			nvme_cache_invalidate(cache);
+		}
+	}
+
+	if (cache->map && !cache->stale && (ccs.fa || ccs.nac)) {
+		nvme_trace(INFO, "drop cache %s (fa %d, nac %d)\n", cache->path, ccs.fa, ccs.nac);
+		nvme_cache_invalidate(cache);
+	}
+
+	// Keep what was read, the fill need not read it again.
+	if (buf) {
+		ret = nvme_cache_put(cache, NVME_CACHE_IDENTIFY_CTRL, 0, buf, len);
+		free(buf);
+	}
+
+	if (ret || (!ccs.fa && !ccs.nac))
+		return ret;
+
+	union nmd1_config_hsc hsc = {
+		.fa = ccs.fa,
+		.nac = ccs.nac,
+	};
+
+	return nvme_mi_mi_config_set_hsc(&check_args, hsc);
+}
+
+static const void *nvme_cache_need(struct aa_args *args, struct nvme_cache *cache,
+                                   enum nvme_cache_type type, u16 id, u8 *buf, u32 *len, int *ret)
+{
+	const void *p = nvme_cache_get(cache, type, id, len);
+
+	if (p || *ret)
+		return p;
+
+	*ret = nvme_cache_read(args, cache, type, id, buf);
+
+	return *ret ? NULL : nvme_cache_get(cache, type, id, len);
+}
+
+/**
+ * Read every item the cache does not hold yet. The ports come from the NVM
+ * Subsystem Information and the controllers from the Controller List, so
+ * these are resolved through the cache as well.
+ */
+int nvme_cache_fill(struct aa_args *args, struct nvme_cache *cache)
+{
+	struct aa_args fill_args = *args;
+	const struct nvme_mi_read_nvm_ss_info *ss;
+	const u8 *list;
+	u32 len;
+	u8 *buf;
+	int ret = NVME_CACHE_SUCCESS;
+
+	buf = malloc(NVME_CACHE_DATA_MAX);
+	if (!buf)
+		return -NVME_CACHE_ERR_IO;
+
+	fill_args.async = false;
+
+	nvme_cache_need(&fill_args, cache, NVME_CACHE_IDENTIFY_CTRL, 0, buf, &len, &ret);
+
+	ss = nvme_cache_need(&fill_args, cache, NVME_CACHE_SUBSYS_INFO, 0, buf, &len, &ret);
+	if (ss && len) {
+		// Number of Ports (NUMP) is 0's based.
+		u8 nump = ss->nump;
+
+		for (int i = 0; i <= nump; i++)
+			nvme_cache_need(&fill_args, cache, NVME_CACHE_PORT_INFO, i, buf, &len, &ret);
+	}
+
+	list = nvme_cache_need(&fill_args, cache, NVME_CACHE_CTRL_LIST, 0, buf, &len, &ret);
+	if (list && len >= 2) {
+		u16 num = list[0] | list[1] << 8;
+
+		for (int i = 0; i < num && i < NVME_CACHE_CTRL_MAX && 2 + 2 * i + 1 < len; i++) {
+			u16 ctrlid = list[2 + 2 * i] | list[3 + 2 * i] << 8;
+			u32 n;
+
+			nvme_cache_need(&fill_args, cache, NVME_CACHE_CTRL_INFO, ctrlid, buf, &n, &ret);
+			nvme_cache_need(&fill_args, cache, NVME_CACHE_OPT_CMD, ctrlid, buf, &n, &ret);
+			// The list is in the cache buffer, which reads may move.
+			list = nvme_cache_get(cache, NVME_CACHE_CTRL_LIST, 0, &len);
+		}
+	}
+
+	nvme_cache_need(&fill_args, cache, NVME_CACHE_VPD, 0, buf, &len, &ret);
+
+	free(buf);
+
+	return ret;
+}
+
+/**
+ * Check the health flags and the drive, read what is missing and store it.
+ * With a valid cache this costs an NVM Subsystem Health Status Poll and an
+ * Identify Controller.
+ */
+int nvme_cache_warm_start(struct aa_args *args, struct nvme_cache *cache)
+{
+	int ret;
+
+	ret = nvme_cache_check(args, cache);
+	if (ret)
+		nvme_trace(WARN, "cache check (%d)\n", ret);
+
+	ret = nvme_cache_fill(args, cache);
+	if (cache->npend) {
+		int err = nvme_cache_commit(cache);
+		if (!ret)
+			ret = err;
+	}
+
+	return ret;
+}
+
+void nvme_cache_show(const struct nvme_cache *cache)
+{
+	const struct nvme_cache_hdr *hdr = (const void *)cache->map;
+	const struct nvme_cache_entry *entry;
+
+	printf("Cache                       : %s\n", cache->path);
+	printf("Reads                       : %d\n", cache->reads);
+	if (!hdr || cache->stale)
+		return;
+
+	printf("SN                          : %.20s\n", hdr->sn);
+	printf("FR                          : %.8s\n", hdr->fr);
+	entry = (const void *)(hdr + 1);
+	for (int i = 0; i < hdr->nentry; i++)
+		printf("  %-34s %5d  %5d bytes\n", _type[entry[i].type], entry[i].id, entry[i].len);
+}
@@ -0,0 +1,98 @@
+#ifndef NVME_CACHE_H
+#define NVME_CACHE_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Data that only changes with a firmware activation or a namespace change is
+ * kept in one file per drive, named after its UDID or, without one (e.g. over
+ * a socket), after its Serial Number. The file is mapped and
+ * read in place; entries read from the drive are collected in memory and the
+ * file is rewritten as a whole by nvme_cache_commit().
+ */
+// "NMIC"
+#define NVME_CACHE_MAGIC                (0x43494D4E)
+#define NVME_CACHE_VERSION              (1)
+#define NVME_CACHE_ENTRY_MAX            (64)
+#define NVME_CACHE_CTRL_MAX             (8)
+#define NVME_CACHE_DATA_MAX             (4096)
+#define NVME_CACHE_VPD_SIZE             (256)
+
+enum nvme_cache_error {
+	NVME_CACHE_SUCCESS = 0,
+	NVME_CACHE_ERR_PARAM,
+	NVME_CACHE_ERR_IO,
+	NVME_CACHE_ERR_FULL,
+	NVME_CACHE_ERR_STATUS,
+};
+
+// Kind of a cached item, the id selects the port or controller where it applies.
+enum nvme_cache_type {
+	NVME_CACHE_IDENTIFY_CTRL = 0,   // Identify Controller
+	NVME_CACHE_SUBSYS_INFO,         // NVM Subsystem Information
+	NVME_CACHE_PORT_INFO,           // Port Information, id is the port
+	NVME_CACHE_CTRL_LIST,           // Controller List
+	NVME_CACHE_CTRL_INFO,           // Controller Information, id is the controller
+	NVME_CACHE_OPT_CMD,             // Optionally Supported Command List, id is the controller
+	NVME_CACHE_VPD,                 // FRU Information Device content
+	NVME_CACHE_NS_INFO,             // Namespace inventory, an array of struct nvme_ns_info
+	NVME_CACHE_TYPE_MAX,
+};
+
+#pragma pack(push, 1)
+
+struct nvme_cache_hdr {
+	u32 magic;
+	u16 version;
+	u16 nentry;
+	u8 udid[16];
+	char sn[20];                    // Serial Number of Identify Controller
+	char fr[8];                     // Firmware Revision of Identify Controller
+	u32 size;                       // File size
+};
+
+struct nvme_cache_entry {
+	u8 type;
+	u8 rsvd;
+	u16 id;
+	u32 offset;                     // From the start of the file
+	u32 len;
+};
+
+#pragma pack(pop)
+
+struct nvme_cache {
+	char path[256];                 // Only the directory until named
+	bool named;
+	u8 udid[16];
+	// Mapped file, ignored once stale is set
+	const u8 *map;
+	size_t map_size;
+	bool mapped;
+	bool stale;
+	// Entries read from the drive since the file was mapped
+	u8 *buf;
+	u32 buf_len;
+	u16 npend;
+	struct nvme_cache_entry pend[NVME_CACHE_ENTRY_MAX];
+	u32 reads;                      // Commands issued to fill the cache
+};
+
+int nvme_cache_open(struct nvme_cache *cache, const char *dir, const u8 *udid);
+void nvme_cache_close(struct nvme_cache *cache);
+const void *nvme_cache_get(const struct nvme_cache *cache, enum nvme_cache_type type, u16 id,
+                           u32 *len);
+int nvme_cache_put(struct nvme_cache *cache, enum nvme_cache_type type, u16 id, const void *buf,
+                   u32 len);
+bool nvme_cache_match(const struct nvme_cache *cache, const char *sn, const char *fr);
+void nvme_cache_invalidate(struct nvme_cache *cache);
+int nvme_cache_commit(struct nvme_cache *cache);
+int nvme_cache_check(struct aa_args *args, struct nvme_cache *cache);
+int nvme_cache_fill(struct aa_args *args, struct nvme_cache *cache);
+int nvme_cache_warm_start(struct aa_args *args, struct nvme_cache *cache);
+void nvme_cache_show(const struct nvme_cache *cache);
+
+#endif // NVME_CACHE_H
@@ -3,6 +3,8 @@
 #include "nvme_mi.h"
 #include "libnvme_types.h"
 #include "libnvme_mi_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_decode.h"
 
 #include "crc32.h"
 #include "utility.h"
@@ -16,10 +18,18 @@ struct nvme_cmd_context {
 	uint8_t lid;
 	uint8_t fid;
 	uint8_t sel;
+	uint8_t cns;
+	// Optional buffer the response data of the slot is copied to.
+	void *data;
+	uint32_t data_size;
+	uint32_t data_len;
 };
 
-struct nvme_cmd_context nvme_cmd_ctx = {
-	.opc = 0xFF
+// Indexed by the command slot (CSI) the admin command was submitted to.
+struct nvme_cmd_context nvme_cmd_ctx[NVME_MI_SLOT_MAX] = {
+	[0 ... NVME_MI_SLOT_MAX - 1] = {
+		.opc = 0xFF
+	}
 };
 
 const char *nvme_trace_header[TRACE_TYPE_MAX] =  {
@@ -246,8 +256,9 @@ void print_controller_metadata(struct nvme_host_metadata *metadata)
 		parsed_cnt++;
 	}
 }
-void nvme_show_get_features(uint32_t cqedw0, void *buf)
+void nvme_show_get_features(bool csi, uint32_t cqedw0, void *buf)
 {
+	const struct nvme_cmd_context *ctx = &nvme_cmd_ctx[csi];
 	const char *fid[256] = {
 		[NVME_FEAT_FID_TEMP_THRESH] = "Temperature Threshold",
 		[NVME_FEAT_FID_POWER_MGMT] = "Power Management",
@@ -255,16 +266,16 @@ void nvme_show_get_features(uint32_t cqedw0, void *buf)
 		[NVME_FEAT_FID_CTRL_METADATA] = "Controller Metadata",
 		[NVME_FEAT_FID_NS_METADATA]  = "Namespace Metadata",
 	};
-	printf("fid                         : %x (%s)\n", nvme_cmd_ctx.fid, fid[nvme_cmd_ctx.fid]);
+	printf("fid                         : %x (%s)\n", ctx->fid, fid[ctx->fid]);
 	const char *sel[8] = {
 		[NVME_GET_FEATURES_SEL_CURRENT]   = "Current",
 		[NVME_GET_FEATURES_SEL_DEFAULT]   = "Default",
 		[NVME_GET_FEATURES_SEL_SAVED]     = "Saved",
 		[NVME_GET_FEATURES_SEL_SUPPORTED] = "Supported Capabilities",
 	};
-	printf("sel                         : %x (%s)\n", nvme_cmd_ctx.sel, sel[nvme_cmd_ctx.sel]);
+	printf("sel                         : %x (%s)\n", ctx->sel, sel[ctx->sel]);
 
-	if (nvme_cmd_ctx.sel == NVME_GET_FEATURES_SEL_SUPPORTED) {
+	if (ctx->sel == NVME_GET_FEATURES_SEL_SUPPORTED) {
 		// static const char *select[] = {
 		// 	[0] = "Saveable ",
 		// 	[1] = "NS Specific ",
@@ -277,7 +288,7 @@ void nvme_show_get_features(uint32_t cqedw0, void *buf)
 		return;
 	}
 
-	switch (nvme_cmd_ctx.fid) {
+	switch (ctx->fid) {
 	case NVME_FEAT_FID_POWER_MGMT:
 		union power_mgmt_cqedw0 {
 			struct {
@@ -300,33 +311,98 @@ void nvme_show_get_features(uint32_t cqedw0, void *buf)
 	}
 }
 
-int nvme_get_nsid_log(struct aa_args *args, uint32_t nsid, enum nvme_cmd_get_log_lid lid, bool rae)
+// Decode the data of an admin command response, res_data starts at CQE Dword 0.
+int nvme_cmd_decode(bool csi, const void *res_data, uint16_t len, struct nvme_mi_result *res)
+{
+	struct nvme_cmd_context *ctx = &nvme_cmd_ctx[csi];
+	const struct nvme_mi_adm_res_dw *cqe = res_data;
+	const void *buf = (const uint8_t *)res_data + sizeof(*cqe);
+
+	if (len < sizeof(*cqe))
+		return -NVME_DECODE_ERR_SIZE;
+	len -= sizeof(*cqe);
+
+	res->cqedw0 = cqe->cqedw0;
+	res->sf = cqe->sf;
+
+	if (ctx->data) {
+		ctx->data_len = len > ctx->data_size ? ctx->data_size : len;
+		memcpy(ctx->data, buf, ctx->data_len);
+	}
+
+	switch (ctx->opc) {
+	case nvme_admin_get_log_page:
+		if (ctx->lid != NVME_LOG_LID_SMART)
+			break;
+		res->type = NVME_RESULT_SMART;
+		return nvme_decode_smart_log(buf, len, &res->smart);
+	case nvme_admin_identify:
+		// Other CNS values return their data raw through the data buffer.
+		if (ctx->cns != NVME_IDENTIFY_CNS_CTRL)
+			break;
+		res->type = NVME_RESULT_IDENTIFY;
+		return nvme_decode_identify(buf, len, &res->identify);
+	case nvme_admin_get_features:
+		res->type = NVME_RESULT_FEATURES;
+		return nvme_decode_features(ctx->fid, ctx->sel, cqe->cqedw0, &res->features);
+	default:
+		break;
+	}
+
+	return NVME_DECODE_SUCCESS;
+}
+
+void nvme_cmd_set_data_buf(bool csi, void *buf, uint32_t size)
+{
+	nvme_cmd_ctx[csi].data = buf;
+	nvme_cmd_ctx[csi].data_size = size;
+	nvme_cmd_ctx[csi].data_len = 0;
+}
+
+uint32_t nvme_cmd_get_data_len(bool csi)
+{
+	return nvme_cmd_ctx[csi].data_len;
+}
+
+/**
+ * Get Log Page of len bytes starting at byte offset lpo. Both must be a
+ * multiple of 4, NUMD is a 0's based dword count.
+ */
+int nvme_get_log_page(struct aa_args *args, uint32_t nsid, uint8_t lid, uint8_t lsp, uint16_t lsi,
+                      bool rae, uint64_t lpo, uint32_t len)
 {
 	union nvme_mi_msg *msg = malloc(sizeof(*msg));
 	memset(msg, 0, sizeof(*msg));
 	struct nvme_mi_adm_req_dw *req_data = (void *)msg->msg_data;
 
-	uint32_t numd = (sizeof(struct nvme_smart_log) >> 2) - 1;
+	uint32_t numd = (len >> 2) - 1;
 
 	req_data->opc                      = nvme_admin_get_log_page;
 	req_data->nsid                     = nsid;
 	req_data->get_log_page.cdw10.lid   = lid;
-	req_data->get_log_page.cdw10.lsp   = NVME_LOG_LSP_NONE;
+	req_data->get_log_page.cdw10.lsp   = lsp;
 	req_data->get_log_page.cdw10.rae   = rae;
 	req_data->get_log_page.cdw10.numdl = numd & 0xffff;
 	req_data->get_log_page.cdw11.numdu = numd >> 16;
-	req_data->get_log_page.cdw11.lsi   = NVME_LOG_LSI_NONE;
-	req_data->get_log_page.cdw12.lpol  = 0;
-	req_data->get_log_page.cdw13.lpou  = 0;
+	req_data->get_log_page.cdw11.lsi   = lsi;
+	req_data->get_log_page.cdw12.lpol  = lpo & 0xffffffff;
+	req_data->get_log_page.cdw13.lpou  = lpo >> 32;
 	req_data->get_log_page.cdw14.uuid  = NVME_UUID_NONE;
 
-	nvme_cmd_ctx.opc = req_data->opc;
-	nvme_cmd_ctx.lid = req_data->get_log_page.cdw10.lid;
+	int ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = req_data->opc;
+	nvme_cmd_ctx[args->csi].lid = req_data->get_log_page.cdw10.lid;
+	nvme_cmd_ctx[args->csi].data_len = 0;
 
 	// if (verbose)
 	//      print_buf(req_data, sizeof(*req_data), "req_data");
 
-	int ret = nvme_mi_send_admin_command(args, req_data->opc, msg, sizeof(*req_data));
+	ret = nvme_mi_send_admin_command(args, req_data->opc, msg, sizeof(*req_data));
 	if (ret < 0)
 		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
 
@@ -335,6 +411,12 @@ int nvme_get_nsid_log(struct aa_args *args, uint32_t nsid, enum nvme_cmd_get_log
 	return ret;
 }
 
+int nvme_get_nsid_log(struct aa_args *args, uint32_t nsid, enum nvme_cmd_get_log_lid lid, bool rae)
+{
+	return nvme_get_log_page(args, nsid, lid, NVME_LOG_LSP_NONE, NVME_LOG_LSI_NONE, rae, 0,
+	                         sizeof(struct nvme_smart_log));
+}
+
 int nvme_get_log_smart(struct aa_args *args, uint32_t nsid, bool rae)
 {
 	return nvme_get_nsid_log(args, nsid, NVME_LOG_LID_SMART, rae);
@@ -348,17 +430,25 @@ int nvme_identify_cns_nsid(struct aa_args *args, uint32_t nsid, uint8_t cns)
 
 	req_data->opc                       = nvme_admin_identify;
 	req_data->nsid                      = nsid;
-	req_data->identify.cdw10.cns        = NVME_IDENTIFY_CNS_CTRL;
+	req_data->identify.cdw10.cns        = cns;
 	req_data->identify.cdw10.cntid      = NVME_CNTLID_NONE;
 	req_data->identify.cdw11.nvmsetid   = NVME_CNSSPECID_NONE;
 	req_data->identify.cdw14.uuid_index = NVME_UUID_NONE;
 
-	nvme_cmd_ctx.opc = req_data->opc;
+	int ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = req_data->opc;
+	nvme_cmd_ctx[args->csi].cns = cns;
+	nvme_cmd_ctx[args->csi].data_len = 0;
 
 	// if (verbose)
 	//      print_buf(req_data, sizeof(*req_data), "req_data");
 
-	int ret = nvme_mi_send_admin_command(args, req_data->opc, msg, sizeof(*req_data));
+	ret = nvme_mi_send_admin_command(args, req_data->opc, msg, sizeof(*req_data));
 	if (ret < 0)
 		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
 
@@ -372,6 +462,17 @@ int nvme_identify_ctrl(struct aa_args *args)
 	return nvme_identify_cns_nsid(args, NVME_NSID_NONE, NVME_IDENTIFY_CNS_CTRL);
 }
 
+int nvme_identify_ns(struct aa_args *args, uint32_t nsid)
+{
+	return nvme_identify_cns_nsid(args, nsid, NVME_IDENTIFY_CNS_NS);
+}
+
+// Up to 1024 active NSIDs greater than nsid, in increasing order.
+int nvme_identify_active_ns_list(struct aa_args *args, uint32_t nsid)
+{
+	return nvme_identify_cns_nsid(args, nsid, NVME_IDENTIFY_CNS_NS_ACTIVE_LIST);
+}
+
 int nvme_get_features(struct aa_args *args, enum nvme_features_id fid,
                       enum nvme_get_features_sel sel, uint32_t cdw11)
 {
@@ -386,14 +487,21 @@ int nvme_get_features(struct aa_args *args, enum nvme_features_id fid,
 	adm_req_dw->get_feat.cdw11.value      = cdw11;
 	adm_req_dw->get_feat.cdw14.uuid_index = NVME_UUID_NONE;
 
-	nvme_cmd_ctx.opc = adm_req_dw->opc;
-	nvme_cmd_ctx.fid = fid;
-	nvme_cmd_ctx.sel = sel;
+	int ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = adm_req_dw->opc;
+	nvme_cmd_ctx[args->csi].fid = fid;
+	nvme_cmd_ctx[args->csi].sel = sel;
+	nvme_cmd_ctx[args->csi].data_len = 0;
 
 	if (args->verbose)
 		print_buf(adm_req_dw, sizeof(*adm_req_dw), "msg_data");
 
-	int ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, sizeof(*adm_req_dw));
+	ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, sizeof(*adm_req_dw));
 	if (ret < 0)
 		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
 
@@ -442,15 +550,21 @@ int nvme_set_features(struct aa_args *args, enum nvme_features_id fid,
 	adm_req_dw->set_feat.cdw11            = cdw11;
 	adm_req_dw->set_feat.cdw14.uuid_index = NVME_UUID_NONE;
 
-	nvme_cmd_ctx.opc = adm_req_dw->opc;
-	nvme_cmd_ctx.fid = fid;
+	int ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = adm_req_dw->opc;
+	nvme_cmd_ctx[args->csi].fid = fid;
 
 	memcpy(msg->msg_data + offset, req_data, dlen);
 
 	if (args->verbose)
 		print_buf(msg->msg_data, offset + dlen, "msg_data");
 
-	int ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, offset + dlen);
+	ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, offset + dlen);
 	if (ret < 0)
 		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
 
@@ -464,6 +578,82 @@ int nvme_set_features_temp_thresh(struct aa_args *args, uint32_t val, bool sv)
 	return nvme_set_features(args, NVME_FEAT_FID_TEMP_THRESH, val, sv, NULL, 0);
 }
 
+/**
+ * Firmware Image Download of len bytes of the image at byte offset. The piece
+ * is padded with zeros to a whole dword, DLEN tells the Management Endpoint how
+ * much Request Data follows.
+ */
+int nvme_fw_download(struct aa_args *args, uint32_t offset, const void *buf, uint32_t len)
+{
+	union nvme_mi_msg *msg;
+	struct nvme_mi_adm_req_dw *adm_req_dw;
+	uint32_t dlen = (len + 3) & ~3;
+	int ret;
+
+	if (!len || (offset & 3) ||
+	    dlen > sizeof(msg->raw_data) - sizeof(msg->nmh) - sizeof(*adm_req_dw) - 4) {
+		nvme_trace(ERROR, "invalid fw piece (%d,%d)\n", offset, len);
+		return -1;
+	}
+
+	msg = malloc(sizeof(*msg));
+	memset(msg, 0, sizeof(*msg));
+	adm_req_dw = (void *)msg->msg_data;
+
+	adm_req_dw->opc                  = nvme_admin_fw_download;
+	adm_req_dw->cflgs                = NVME_MI_ADM_CFLGS_DLENV | NVME_MI_ADM_CFLGS_DOFSTV;
+	adm_req_dw->dofst                = 0;
+	adm_req_dw->dlen                 = dlen;
+	adm_req_dw->fw_download.numd     = (dlen >> 2) - 1;
+	adm_req_dw->fw_download.ofst     = offset >> 2;
+
+	ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = adm_req_dw->opc;
+
+	memcpy(msg->msg_data + sizeof(*adm_req_dw), buf, len);
+
+	ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, sizeof(*adm_req_dw) + dlen);
+	if (ret < 0)
+		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
+
+int nvme_fw_commit(struct aa_args *args, uint8_t fs, enum nvme_fw_commit_ca ca, bool bpid)
+{
+	union nvme_mi_msg *msg = malloc(sizeof(*msg));
+	memset(msg, 0, sizeof(*msg));
+	struct nvme_mi_adm_req_dw *adm_req_dw = (void *)msg->msg_data;
+
+	adm_req_dw->opc                     = nvme_admin_fw_commit;
+	adm_req_dw->fw_commit.cdw10.fs      = fs;
+	adm_req_dw->fw_commit.cdw10.ca      = ca;
+	adm_req_dw->fw_commit.cdw10.bpid    = bpid;
+
+	int ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret) {
+		free(msg);
+		return ret;
+	}
+
+	nvme_cmd_ctx[args->csi].opc = adm_req_dw->opc;
+
+	ret = nvme_mi_send_admin_command(args, adm_req_dw->opc, msg, sizeof(*adm_req_dw));
+	if (ret < 0)
+		nvme_trace(ERROR, "nvme_mi_send_admin_command failed (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
+
 /* Define NVMe Controller Metadata Feature ID */
 #define NVME_FEAT_CTRL_METADATA 0x7E
 
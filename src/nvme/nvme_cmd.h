@@ -3,16 +3,29 @@
 
 #include "types.h"
 #include "libnvme_types.h"
+#include "nvme_decode.h"
 
 void nvme_show_log_page(const struct nvme_smart_log *smart_log);
 void nvme_show_identify(const struct nvme_id_ctrl *id_ctrl);
-void nvme_show_get_features(uint32_t cqedw0, void *buf);
+void nvme_show_get_features(bool csi, uint32_t cqedw0, void *buf);
+int nvme_cmd_decode(bool csi, const void *res_data, uint16_t len, struct nvme_mi_result *res);
 
+void nvme_cmd_set_data_buf(bool csi, void *buf, uint32_t size);
+uint32_t nvme_cmd_get_data_len(bool csi);
+int nvme_get_log_page(struct aa_args *args, uint32_t nsid, uint8_t lid, uint8_t lsp, uint16_t lsi,
+                      bool rae, uint64_t lpo, uint32_t len);
 int nvme_get_log_smart(struct aa_args *args, uint32_t nsid, bool rae);
+int nvme_identify_cns_nsid(struct aa_args *args, uint32_t nsid, uint8_t cns);
 int nvme_identify_ctrl(struct aa_args *args);
+int nvme_identify_ns(struct aa_args *args, uint32_t nsid);
+int nvme_identify_active_ns_list(struct aa_args *args, uint32_t nsid);
+int nvme_get_features(struct aa_args *args, enum nvme_features_id fid,
+                      enum nvme_get_features_sel sel, uint32_t cdw11);
 int nvme_get_features_power_mgmt(struct aa_args *args, enum nvme_get_features_sel sel);
 int nvme_get_features_temp_thresh(struct aa_args *args, enum nvme_get_features_sel sel);
 int nvme_set_features_temp_thresh(struct aa_args *args, uint32_t val, bool sv);
+int nvme_fw_download(struct aa_args *args, uint32_t offset, const void *buf, uint32_t len);
+int nvme_fw_commit(struct aa_args *args, uint8_t fs, enum nvme_fw_commit_ca ca, bool bpid);
 int test_set_feature_controller_metadata(struct aa_args *args);
 int test_set_feature_controller_metadata_2(struct aa_args *args);
 int test_set_feature_controller_metadata_3(struct aa_args *args);
@@ -0,0 +1,285 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_decode.h"
+#include "libnvme_types.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * The 128-bit counters of the SMART / Health Information log page are kept
+ * as 64-bit values, the upper half does not wrap in the lifetime of a drive.
+ */
+static u64 nvme_decode_u128(const u8 *val)
+{
+	u64 v;
+
+	memcpy(&v, val, sizeof(v));
+
+	return v;
+}
+
+// ASCII fields of Identify are space padded and not NUL terminated.
+static void nvme_decode_string(char *dst, const char *src, u16 size)
+{
+	memcpy(dst, src, size);
+	dst[size] = '\0';
+	while (size && (dst[size - 1] == ' ' || dst[size - 1] == '\0'))
+		dst[--size] = '\0';
+}
+
+int nvme_decode_subsys_info(const void *buf, u16 len, struct nvme_subsys_info *info)
+{
+	const struct nvme_mi_read_nvm_ss_info *ds = buf;
+
+	if (len < offsetof(struct nvme_mi_read_nvm_ss_info, rsvd3))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->nump = ds->nump;
+	info->mjr = ds->mjr;
+	info->mnr = ds->mnr;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_port_info(const void *buf, u16 len, u8 portid, struct nvme_port_info *info)
+{
+	const struct nvme_mi_read_port_info *ds = buf;
+
+	if (len < sizeof(*ds))
+		return -NVME_DECODE_ERR_SIZE;
+
+	memset(info, 0, sizeof(*info));
+	info->portid = portid;
+	info->portt = ds->portt;
+	info->mmctptus = ds->mmctptus;
+	info->meb = ds->meb;
+	if (ds->portt == PORT_TYPE_PCIE) {
+		info->pcie_mps = ds->pcie.mps;
+		info->pcie_sls = ds->pcie.sls;
+		info->pcie_cls = ds->pcie.cls;
+		info->pcie_mlw = ds->pcie.mlw;
+		info->pcie_nlw = ds->pcie.nlw;
+		info->pcie_pn = ds->pcie.pn;
+	} else if (ds->portt == PORT_TYPE_SMBUS) {
+		info->smb_vpd_addr = ds->smb.vpd_addr;
+		info->smb_mvpd_freq = ds->smb.mvpd_freq;
+		info->smb_mme_addr = ds->smb.mme_addr;
+		info->smb_mme_freq = ds->smb.mme_freq;
+		info->smb_nvmebm = ds->smb.nvmebm;
+	}
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_ctrl_list(const void *buf, u16 len, struct nvme_ctrl_list_info *info)
+{
+	const struct nvme_ctrl_list *ds = buf;
+	u16 num;
+
+	if (len < sizeof(ds->num))
+		return -NVME_DECODE_ERR_SIZE;
+
+	num = ds->num;
+	if (num > (len - sizeof(ds->num)) / sizeof(ds->identifier[0]))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->num = num;
+	if (num > NVME_DECODE_CTRL_LIST_MAX)
+		num = NVME_DECODE_CTRL_LIST_MAX;
+	memcpy(info->id, ds->identifier, num * sizeof(info->id[0]));
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_ctrl_info(const void *buf, u16 len, struct nvme_ctrl_info *info)
+{
+	const struct nvme_mi_read_ctrl_info *ds = buf;
+
+	if (len < offsetof(struct nvme_mi_read_ctrl_info, rsvd16))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->portid = ds->portid;
+	info->prii = ds->prii;
+	info->pri = ds->pri;
+	info->vid = ds->vid;
+	info->did = ds->did;
+	info->ssvid = ds->ssvid;
+	info->ssid = ds->ssid;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_subsys_health(const void *buf, u16 len, struct nvme_subsys_health *info)
+{
+	const struct nvme_mi_nvm_ss_health_status *ds = buf;
+
+	if (len < offsetof(struct nvme_mi_nvm_ss_health_status, rsvd8))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->nss = ds->nss;
+	info->sw = ds->sw;
+	info->ctemp = (s8)ds->ctemp;
+	info->pdlu = ds->pdlu;
+	info->ccs = ds->ccs;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_ctrl_health(const void *buf, u16 len, u8 rent, struct nvme_ctrl_health *info)
+{
+	const struct nvme_mi_ctrl_health_status *ds = buf;
+
+	memset(info, 0, sizeof(*info));
+	info->rent = rent;
+	if (!rent)
+		return NVME_DECODE_SUCCESS;
+
+	if (len < offsetof(struct nvme_mi_ctrl_health_status, rsvd9))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->ctlid = ds->ctlid;
+	info->csts = ds->csts;
+	info->ctemp = ds->ctemp;
+	info->pdlu = ds->pdlu;
+	info->spare = ds->spare;
+	info->cwarn = ds->cwarn;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_config(u8 cfg_id, u32 nmresp, struct nvme_config_info *info)
+{
+	info->cfg_id = cfg_id;
+	info->value = nmresp;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_identify(const void *buf, u16 len, struct nvme_identify_info *info)
+{
+	const struct nvme_id_ctrl *ds = buf;
+
+	if (len < offsetof(struct nvme_id_ctrl, oncs))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->vid = ds->vid;
+	info->ssvid = ds->ssvid;
+	nvme_decode_string(info->sn, ds->sn, sizeof(ds->sn));
+	nvme_decode_string(info->mn, ds->mn, sizeof(ds->mn));
+	nvme_decode_string(info->fr, ds->fr, sizeof(ds->fr));
+	info->mdts = ds->mdts;
+	info->cntlid = ds->cntlid;
+	info->ver = ds->ver;
+	info->oacs = ds->oacs;
+	info->frmw = ds->frmw;
+	info->lpa = ds->lpa;
+	info->elpe = ds->elpe;
+	info->npss = ds->npss;
+	info->wctemp = ds->wctemp;
+	info->cctemp = ds->cctemp;
+	info->nn = ds->nn;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_smart_log(const void *buf, u16 len, struct nvme_smart_info *info)
+{
+	const struct nvme_smart_log *ds = buf;
+
+	if (len < offsetof(struct nvme_smart_log, temp_sensor))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->critical_warning = ds->critical_warning;
+	info->temperature = ds->temperature[0] | ds->temperature[1] << 8;
+	info->avail_spare = ds->avail_spare;
+	info->spare_thresh = ds->spare_thresh;
+	info->percent_used = ds->percent_used;
+	info->data_units_read = nvme_decode_u128(ds->data_units_read);
+	info->data_units_written = nvme_decode_u128(ds->data_units_written);
+	info->host_reads = nvme_decode_u128(ds->host_reads);
+	info->host_writes = nvme_decode_u128(ds->host_writes);
+	info->ctrl_busy_time = nvme_decode_u128(ds->ctrl_busy_time);
+	info->power_cycles = nvme_decode_u128(ds->power_cycles);
+	info->power_on_hours = nvme_decode_u128(ds->power_on_hours);
+	info->unsafe_shutdowns = nvme_decode_u128(ds->unsafe_shutdowns);
+	info->media_errors = nvme_decode_u128(ds->media_errors);
+	info->num_err_log_entries = nvme_decode_u128(ds->num_err_log_entries);
+	info->warning_temp_time = ds->warning_temp_time;
+	info->critical_comp_time = ds->critical_comp_time;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_features(u8 fid, u8 sel, u32 cqedw0, struct nvme_features_info *info)
+{
+	info->fid = fid;
+	info->sel = sel;
+	info->cqedw0 = cqedw0;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_error_entry(const void *buf, u16 len, struct nvme_error_entry_info *info)
+{
+	const struct nvme_error_log_page *ds = buf;
+
+	if (len < sizeof(*ds))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->error_count = ds->error_count;
+	info->sqid = ds->sqid;
+	info->cmdid = ds->cmdid;
+	info->status_field = ds->status_field;
+	info->parm_error_location = ds->parm_error_location;
+	info->lba = ds->lba;
+	info->nsid = ds->nsid;
+	info->vs = ds->vs;
+	info->trtype = ds->trtype;
+	info->csi = ds->csi;
+	info->opcode = ds->opcode;
+	info->cs = ds->cs;
+	info->trtype_spec_info = ds->trtype_spec_info;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_decode_pel_event(const void *buf, u16 len, u64 offset, struct nvme_pel_event_info *info)
+{
+	const struct nvme_persistent_event_entry *ds = buf;
+
+	if (len < sizeof(*ds))
+		return -NVME_DECODE_ERR_SIZE;
+
+	info->offset = offset;
+	info->etype = ds->etype;
+	info->etype_rev = ds->etype_rev;
+	info->cntlid = ds->cntlid;
+	info->ets = ds->ets;
+	info->pelpid = ds->pelpid;
+	info->vsil = ds->vsil;
+	info->el = ds->el;
+
+	return NVME_DECODE_SUCCESS;
+}
+
+u16 nvme_result_size(u8 type)
+{
+	static const u16 size[NVME_RESULT_MAX] = {
+		[NVME_RESULT_NONE]          = 0,
+		[NVME_RESULT_SUBSYS_INFO]   = sizeof(struct nvme_subsys_info),
+		[NVME_RESULT_PORT_INFO]     = sizeof(struct nvme_port_info),
+		[NVME_RESULT_CTRL_LIST]     = sizeof(struct nvme_ctrl_list_info),
+		[NVME_RESULT_CTRL_INFO]     = sizeof(struct nvme_ctrl_info),
+		[NVME_RESULT_SUBSYS_HEALTH] = sizeof(struct nvme_subsys_health),
+		[NVME_RESULT_CTRL_HEALTH]   = sizeof(struct nvme_ctrl_health),
+		[NVME_RESULT_CONFIG]        = sizeof(struct nvme_config_info),
+		[NVME_RESULT_IDENTIFY]      = sizeof(struct nvme_identify_info),
+		[NVME_RESULT_SMART]         = sizeof(struct nvme_smart_info),
+		[NVME_RESULT_FEATURES]      = sizeof(struct nvme_features_info),
+		[NVME_RESULT_ERROR_ENTRY]   = sizeof(struct nvme_error_entry_info),
+		[NVME_RESULT_PEL_EVENT]     = sizeof(struct nvme_pel_event_info),
+	};
+
+	return type < NVME_RESULT_MAX ? size[type] : 0;
+}
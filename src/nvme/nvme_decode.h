@@ -0,0 +1,229 @@
+#ifndef NVME_DECODE_H
+#define NVME_DECODE_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NVME_DECODE_CTRL_LIST_MAX       (32)
+
+enum nvme_decode_error {
+	NVME_DECODE_SUCCESS = 0,
+	NVME_DECODE_ERR_SIZE,
+	NVME_DECODE_ERR_TYPE,
+};
+
+// Kind of the decoded data carried by a struct nvme_mi_result.
+enum nvme_result_type {
+	NVME_RESULT_NONE = 0,
+	NVME_RESULT_SUBSYS_INFO,
+	NVME_RESULT_PORT_INFO,
+	NVME_RESULT_CTRL_LIST,
+	NVME_RESULT_CTRL_INFO,
+	NVME_RESULT_SUBSYS_HEALTH,
+	NVME_RESULT_CTRL_HEALTH,
+	NVME_RESULT_CONFIG,
+	NVME_RESULT_IDENTIFY,
+	NVME_RESULT_SMART,
+	NVME_RESULT_FEATURES,
+	NVME_RESULT_ERROR_ENTRY,
+	NVME_RESULT_PEL_EVENT,
+	NVME_RESULT_MAX,
+};
+
+#pragma pack(push, 1)
+
+// Read NVMe-MI Data Structure - NVM Subsystem Information
+struct nvme_subsys_info {
+	u8 nump;
+	u8 mjr;
+	u8 mnr;
+};
+
+// Read NVMe-MI Data Structure - Port Information
+struct nvme_port_info {
+	u8 portid;
+	u8 portt;
+	u16 mmctptus;
+	u32 meb;
+	u8 pcie_mps;
+	u8 pcie_sls;
+	u8 pcie_cls;
+	u8 pcie_mlw;
+	u8 pcie_nlw;
+	u8 pcie_pn;
+	u8 smb_vpd_addr;
+	u8 smb_mvpd_freq;
+	u8 smb_mme_addr;
+	u8 smb_mme_freq;
+	u8 smb_nvmebm;
+};
+
+// Read NVMe-MI Data Structure - Controller List
+struct nvme_ctrl_list_info {
+	u16 num;
+	u16 id[NVME_DECODE_CTRL_LIST_MAX];
+};
+
+// Read NVMe-MI Data Structure - Controller Information
+struct nvme_ctrl_info {
+	u8 portid;
+	u8 prii;
+	u16 pri;
+	u16 vid;
+	u16 did;
+	u16 ssvid;
+	u16 ssid;
+};
+
+// NVM Subsystem Health Status Poll
+struct nvme_subsys_health {
+	u8 nss;
+	u8 sw;
+	s8 ctemp;
+	u8 pdlu;
+	u16 ccs;
+};
+
+// Controller Health Status Poll
+struct nvme_ctrl_health {
+	u8 rent;
+	u16 ctlid;
+	u16 csts;
+	u16 ctemp;
+	u8 pdlu;
+	u8 spare;
+	u8 cwarn;
+};
+
+// Configuration Get
+struct nvme_config_info {
+	u8 cfg_id;
+	u32 value;
+};
+
+// Identify Controller
+struct nvme_identify_info {
+	u16 vid;
+	u16 ssvid;
+	char sn[21];
+	char mn[41];
+	char fr[9];
+	u8 mdts;
+	u16 cntlid;
+	u32 ver;
+	u16 oacs;
+	u8 frmw;
+	u8 lpa;
+	u8 elpe;
+	u8 npss;
+	u16 wctemp;
+	u16 cctemp;
+	u32 nn;
+};
+
+// Get Log Page - SMART / Health Information
+struct nvme_smart_info {
+	u8 critical_warning;
+	u16 temperature;
+	u8 avail_spare;
+	u8 spare_thresh;
+	u8 percent_used;
+	u64 data_units_read;
+	u64 data_units_written;
+	u64 host_reads;
+	u64 host_writes;
+	u64 ctrl_busy_time;
+	u64 power_cycles;
+	u64 power_on_hours;
+	u64 unsafe_shutdowns;
+	u64 media_errors;
+	u64 num_err_log_entries;
+	u32 warning_temp_time;
+	u32 critical_comp_time;
+};
+
+// Get Features
+struct nvme_features_info {
+	u8 fid;
+	u8 sel;
+	u32 cqedw0;
+};
+
+// Get Log Page - Error Information, one entry
+struct nvme_error_entry_info {
+	u64 error_count;
+	u16 sqid;
+	u16 cmdid;
+	u16 status_field;
+	u16 parm_error_location;
+	u64 lba;
+	u32 nsid;
+	u8 vs;
+	u8 trtype;
+	u8 csi;
+	u8 opcode;
+	u64 cs;
+	u16 trtype_spec_info;
+};
+
+// Get Log Page - Persistent Event Log, header of one event
+struct nvme_pel_event_info {
+	u64 offset;                     // From the start of the log
+	u8 etype;
+	u8 etype_rev;
+	u16 cntlid;
+	u64 ets;
+	u16 pelpid;
+	u16 vsil;
+	u16 el;
+};
+
+/**
+ * Decoded response of one NVMe-MI request. The common part comes from the
+ * message header and the NVMe Management Response, the union holds the data
+ * selected by type.
+ */
+struct nvme_mi_result {
+	u8 type;
+	u8 csi;
+	u8 nmimt;
+	u8 opc;
+	u8 status;
+	u32 nmresp;
+	// Completion Queue Entry of an admin command
+	u32 cqedw0;
+	u16 sf;
+	union {
+		struct nvme_subsys_info subsys_info;
+		struct nvme_port_info port_info;
+		struct nvme_ctrl_list_info ctrl_list;
+		struct nvme_ctrl_info ctrl_info;
+		struct nvme_subsys_health subsys_health;
+		struct nvme_ctrl_health ctrl_health;
+		struct nvme_config_info config;
+		struct nvme_identify_info identify;
+		struct nvme_smart_info smart;
+		struct nvme_features_info features;
+		struct nvme_error_entry_info error_entry;
+		struct nvme_pel_event_info pel_event;
+	};
+};
+
+#pragma pack(pop)
+
+int nvme_decode_subsys_info(const void *buf, u16 len, struct nvme_subsys_info *info);
+int nvme_decode_port_info(const void *buf, u16 len, u8 portid, struct nvme_port_info *info);
+int nvme_decode_ctrl_list(const void *buf, u16 len, struct nvme_ctrl_list_info *info);
+int nvme_decode_ctrl_info(const void *buf, u16 len, struct nvme_ctrl_info *info);
+int nvme_decode_subsys_health(const void *buf, u16 len, struct nvme_subsys_health *info);
+int nvme_decode_ctrl_health(const void *buf, u16 len, u8 rent, struct nvme_ctrl_health *info);
+int nvme_decode_config(u8 cfg_id, u32 nmresp, struct nvme_config_info *info);
+int nvme_decode_identify(const void *buf, u16 len, struct nvme_identify_info *info);
+int nvme_decode_smart_log(const void *buf, u16 len, struct nvme_smart_info *info);
+int nvme_decode_features(u8 fid, u8 sel, u32 cqedw0, struct nvme_features_info *info);
+int nvme_decode_error_entry(const void *buf, u16 len, struct nvme_error_entry_info *info);
+int nvme_decode_pel_event(const void *buf, u16 len, u64 offset, struct nvme_pel_event_info *info);
+u16 nvme_result_size(u8 type);
+
+#endif // NVME_DECODE_H
@@ -0,0 +1,1075 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_emu.h"
+#include "mctp.h"
+#include "mctp_message.h"
+#include "mctp_smbus.h"
+#include "smbus.h"
+#include "crc8.h"
+#include "crc32.h"
+#include "utility.h"
+#include "libnvme_types.h"
+#include "libnvme_mi_mi.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NVME_EMU_KELVIN(c)              ((c) + 273)
+// NVMe-MI request header up to and including NMD1
+#define NVME_EMU_MI_REQ_SIZE            (offsetof(union nvme_mi_req_msg, req_data))
+// Request byte of NMD0 and NMD1, reported in Invalid Parameter responses
+#define NVME_EMU_NMD0_BYTE              (8)
+#define NVME_EMU_NMD1_BYTE              (12)
+// Health changes the controller health status poll can filter on
+#define NVME_EMU_CHANGED_MASK           (NVME_MI_CCS_CSTS | NVME_MI_CCS_CTEMP | NVME_MI_CCS_PDLU | \
+                                         NVME_MI_CCS_SPARE | NVME_MI_CCS_CCWARN)
+
+static const struct {
+	const char *name;
+	size_t offset;
+	uint8_t size;                   // 0 for a string
+} nvme_emu_key[] = {
+	{"vid",          offsetof(struct nvme_emu_model, vid),          2},
+	{"ssvid",        offsetof(struct nvme_emu_model, ssvid),        2},
+	{"did",          offsetof(struct nvme_emu_model, did),          2},
+	{"ssid",         offsetof(struct nvme_emu_model, ssid),         2},
+	{"sn",           offsetof(struct nvme_emu_model, sn),           0},
+	{"mn",           offsetof(struct nvme_emu_model, mn),           0},
+	{"fr",           offsetof(struct nvme_emu_model, fr),           0},
+	{"cntlid",       offsetof(struct nvme_emu_model, cntlid),       2},
+	{"nn",           offsetof(struct nvme_emu_model, nn),           4},
+	{"wctemp",       offsetof(struct nvme_emu_model, wctemp),       2},
+	{"cctemp",       offsetof(struct nvme_emu_model, cctemp),       2},
+	{"ctemp",        offsetof(struct nvme_emu_model, ctemp),        2},
+	{"pdlu",         offsetof(struct nvme_emu_model, pdlu),         1},
+	{"spare",        offsetof(struct nvme_emu_model, spare),        1},
+	{"spare_thresh", offsetof(struct nvme_emu_model, spare_thresh), 1},
+	{"cwarn",        offsetof(struct nvme_emu_model, cwarn),        1},
+	{"rdy",          offsetof(struct nvme_emu_model, rdy),          1},
+	{"poh",          offsetof(struct nvme_emu_model, poh),          8},
+	{"power_cycles", offsetof(struct nvme_emu_model, power_cycles), 8},
+	{"mtus_max",     offsetof(struct nvme_emu_model, mtus_max),     2},
+};
+
+#define NVME_EMU_KEY_NUM                (sizeof(nvme_emu_key) / sizeof(nvme_emu_key[0]))
+
+// The IDs of the QEMU NVMe controller, so that tools already know the drive.
+void nvme_emu_model_default(struct nvme_emu_model *model)
+{
+	memset(model, 0, sizeof(*model));
+	model->vid = 0x1b36;
+	model->ssvid = 0x1af4;
+	model->did = 0x0010;
+	model->ssid = 0x1100;
+	strcpy(model->sn, "EMU00000001");
+	strcpy(model->mn, "NVMe-MI Endpoint Emulator");
+	strcpy(model->fr, "1.0");
+	model->cntlid = 0;
+	model->nn = 1;
+	model->wctemp = 70;
+	model->cctemp = 85;
+	model->ctemp = 35;
+	model->pdlu = 3;
+	model->spare = 100;
+	model->spare_thresh = 10;
+	model->rdy = true;
+	model->poh = 1000;
+	model->power_cycles = 50;
+	model->mtus_max = NVME_EMU_MTUS_MAX;
+}
+
+/**
+ * Model file, one '<key> <value>' per line, '#' starts a comment. Keys left
+ * out keep their value, so a file only lists what differs from the default.
+ */
+int nvme_emu_model_load(struct nvme_emu_model *model, const char *path)
+{
+	char line[128], name[32], *p, *end;
+	int lineno = 0, ret = NVME_EMU_SUCCESS;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_EMU_ERR_PARAM;
+	}
+
+	while (!ret && fgets(line, sizeof(line), fp)) {
+		int i, n;
+
+		lineno++;
+		if (line[0] == '#' || sscanf(line, "%31s %n", name, &n) != 1)
+			continue;
+
+		for (i = 0; i < NVME_EMU_KEY_NUM; i++)
+			if (!strcmp(name, nvme_emu_key[i].name))
+				break;
+
+		p = line + n;
+		p[strcspn(p, "\r\n")] = 0;
+		if (i == NVME_EMU_KEY_NUM || !*p) {
+			ret = -NVME_EMU_ERR_SYNTAX;
+			continue;
+		}
+
+		void *field = (uint8_t *)model + nvme_emu_key[i].offset;
+		long long val;
+
+		switch (nvme_emu_key[i].size) {
+		case 0:
+			if (strlen(p) > NVME_EMU_MODEL_STR_MAX)
+				ret = -NVME_EMU_ERR_SYNTAX;
+			else
+				strcpy(field, p);
+			continue;
+		case 1:
+			val = strtoll(p, &end, 0);
+			*(uint8_t *)field = val;
+			break;
+		case 2:
+			val = strtoll(p, &end, 0);
+			*(uint16_t *)field = val;
+			break;
+		case 4:
+			val = strtoll(p, &end, 0);
+			*(uint32_t *)field = val;
+			break;
+		default:
+			val = strtoll(p, &end, 0);
+			*(uint64_t *)field = val;
+			break;
+		}
+		if (*end || (nvme_emu_key[i].size < 8 && (val < -0x8000 ||
+		             val >= 1LL << (nvme_emu_key[i].size * 8))))
+			ret = -NVME_EMU_ERR_SYNTAX;
+	}
+
+	fclose(fp);
+
+	if (ret)
+		nvme_trace(ERROR, "%s:%d: invalid model entry\n", path, lineno);
+	else if (model->mtus_max < MCTP_BASELINE_TRAN_UNIT_SIZE || model->mtus_max > NVME_EMU_MTUS_MAX)
+		ret = -NVME_EMU_ERR_PARAM;
+
+	return ret;
+}
+
+int nvme_emu_init(struct nvme_emu *emu, const struct nvme_emu_model *model, uint8_t own_addr,
+                  uint8_t eid, bool pec)
+{
+	if (own_addr > 0x7F || eid == EID_BROADCAST)
+		return -NVME_EMU_ERR_PARAM;
+
+	memset(emu, 0, sizeof(*emu));
+	memcpy(&emu->model, model, sizeof(*model));
+	emu->own_addr = own_addr;
+	emu->eid = eid;
+	emu->pec = pec;
+	emu->sif = NVME_MI_CONFIG_SMBUS_FREQ_100kHz;
+	emu->mtus = MCTP_BASELINE_TRAN_UNIT_SIZE;
+	emu->temp_thresh = model->wctemp;
+
+	// RFC4122 version 4, fixed for the life of the endpoint
+	for (int i = 0; i < sizeof(emu->uuid); i++)
+		emu->uuid[i] = rand();
+	emu->uuid[6] = (emu->uuid[6] & 0x0F) | 0x40;
+	emu->uuid[8] = (emu->uuid[8] & 0x3F) | 0x80;
+
+	return NVME_EMU_SUCCESS;
+}
+
+void nvme_emu_set_output(struct nvme_emu *emu, nvme_emu_output output, void *priv)
+{
+	emu->output = output;
+	emu->priv = priv;
+}
+
+/**
+ * Take a new model, e.g. a temperature step of a test, and flag the health
+ * fields that changed for the next health status polls.
+ */
+void nvme_emu_update(struct nvme_emu *emu, const struct nvme_emu_model *model)
+{
+	const struct nvme_emu_model *old = &emu->model;
+
+	if (model->rdy != old->rdy)
+		emu->changed |= NVME_MI_CCS_CSTS;
+	if (model->ctemp != old->ctemp)
+		emu->changed |= NVME_MI_CCS_CTEMP;
+	if (model->pdlu != old->pdlu)
+		emu->changed |= NVME_MI_CCS_PDLU;
+	if (model->spare != old->spare)
+		emu->changed |= NVME_MI_CCS_SPARE;
+	if (model->cwarn != old->cwarn)
+		emu->changed |= NVME_MI_CCS_CCWARN;
+
+	memcpy(&emu->model, model, sizeof(*model));
+}
+
+static void nvme_emu_invalid_param(union nvme_mi_res_msg *res, uint16_t byte, uint8_t bit)
+{
+	res->nmresp.value = 0;
+	res->nmresp.invld_para.status = NVME_MI_RESP_INVALID_PARAM;
+	res->nmresp.invld_para.lsbyte = byte;
+	res->nmresp.invld_para.lsbit = bit;
+}
+
+static void nvme_emu_pad(char *dst, const char *src, size_t size)
+{
+	size_t len = strlen(src);
+
+	memset(dst, ' ', size);
+	memcpy(dst, src, len < size ? len : size);
+}
+
+// DSP0236, 12 MCTP control messages
+static int nvme_emu_ctrl(struct nvme_emu *emu, const uint8_t *req, uint16_t req_size, uint8_t *resp,
+                         uint16_t *resp_size)
+{
+	const union mctp_ctrl_message *msg = (const void *)req;
+	union mctp_ctrl_message *res = (void *)resp;
+	const uint8_t *data = req + MCTP_CTRL_REQ_HEAD_SIZE;
+	uint16_t len = req_size - MCTP_CTRL_REQ_HEAD_SIZE;
+	uint16_t size = 0;
+	uint8_t cmpl_code = MCTP_CMPL_SUCCESS;
+
+	if (req_size < MCTP_CTRL_REQ_HEAD_SIZE || !msg->ctrl_msg_head.rq_bit)
+		return -NVME_EMU_ERR_SIZE;
+
+	switch (msg->ctrl_msg_head.cmd_code) {
+	case MCTP_CTRL_MSG_SET_EID: {
+		const union mctp_req_msg_set_eid *set = (const void *)data;
+		union mctp_resp_data_set_eid *r = (void *)res->msg_data;
+
+		if (len < sizeof(*set)) {
+			cmpl_code = MCTP_CMPL_ERR_INVLD_LEN;
+			break;
+		}
+		if ((set->oper != SET_EID && set->oper != FORCE_EID) || set->eid == EID_NULL_DST ||
+		    set->eid == EID_BROADCAST) {
+			cmpl_code = MCTP_CMPL_ERR_INVLD_DATA;
+			break;
+		}
+		emu->eid = set->eid;
+
+		memset(r, 0, sizeof(*r));
+		r->eid_assign_sts = EID_ASSIGN_ACCEPT;
+		r->eid_alloc_sts = EID_ALLOC_SIMPLE;
+		r->eid_setting = emu->eid;
+		size = sizeof(*r);
+		break;
+	}
+	case MCTP_CTRL_MSG_GET_EID: {
+		union mctp_resp_data_get_eid *r = (void *)res->msg_data;
+
+		memset(r, 0, sizeof(*r));
+		r->eid = emu->eid;
+		r->eid_type = EID_TYPE_DYNAMIC;
+		r->endpoint_type = ENDPOINT_TYPE_SIMPLE;
+		size = sizeof(*r);
+		break;
+	}
+	case MCTP_CTRL_MSG_GET_UUID:
+		memcpy(res->msg_data, emu->uuid, sizeof(emu->uuid));
+		size = sizeof(emu->uuid);
+		break;
+	case MCTP_CTRL_MSG_GET_VERSION: {
+		const union mctp_req_msg_get_version *get = (const void *)data;
+		union mctp_resp_data_get_version *r = (void *)res->msg_data;
+		uint32_t ver;
+
+		if (len < sizeof(*get)) {
+			cmpl_code = MCTP_CMPL_ERR_INVLD_LEN;
+			break;
+		}
+		if (get->msg_type == 0xFF || get->msg_type == MCTP_MSG_TYPE_CTRL) {
+			ver = MCTP_VERSION(1, 3, 1, 0);
+		} else if (get->msg_type == MCTP_MSG_TYPE_NVME_MM) {
+			ver = MCTP_VERSION(1, 0, 0, 0);
+		} else {
+			cmpl_code = MCTP_CMPL_MSG_TYPE_NOT_SUP;
+			break;
+		}
+		r->entry_cnt = 1;
+		r->entry[0][0] = ver >> 24;
+		r->entry[0][1] = ver >> 16;
+		r->entry[0][2] = ver >> 8;
+		r->entry[0][3] = ver;
+		size = 1 + 4;
+		break;
+	}
+	case MCTP_CTRL_MSG_GET_MSG_TYPE: {
+		union mctp_resp_data_get_msg_type *r = (void *)res->msg_data;
+
+		r->msg_type_cnt = 1;
+		r->msg_type[0] = MCTP_MSG_TYPE_NVME_MM;
+		size = 1 + 1;
+		break;
+	}
+	case MCTP_CTRL_MSG_GET_VENDOR_MSG: {
+		const union mctp_req_msg_get_vendor_msg *get = (const void *)data;
+		union mctp_resp_data_get_vendor_msg *r = (void *)res->msg_data;
+
+		if (len < sizeof(*get)) {
+			cmpl_code = MCTP_CMPL_ERR_INVLD_LEN;
+			break;
+		}
+		// One set, the PCI vendor ID of the drive with command set 0.
+		if (get->vid_set_sel != 0) {
+			cmpl_code = MCTP_CMPL_ERR_INVLD_DATA;
+			break;
+		}
+		r->vid_set_sel = MCTP_VENDOR_ID_SET_LAST;
+		r->vid_fmt = VENDOR_ID_FMT_PCI;
+		r->vid[0] = emu->model.vid >> 8;
+		r->vid[1] = emu->model.vid;
+		r->vid[2] = 0;
+		r->vid[3] = 0;
+		size = 2 + 4;
+		break;
+	}
+	default:
+		cmpl_code = MCTP_CMPL_ERR_UNSUP_CMD;
+		break;
+	}
+
+	if (cmpl_code != MCTP_CMPL_SUCCESS)
+		size = 0;
+
+	res->ctrl_msg_head.value = msg->ctrl_msg_head.value;
+	res->ctrl_msg_head.rq_bit = 0;
+	res->ctrl_msg_head.d_bit = 0;
+	res->ctrl_msg_head.cmpl_code = cmpl_code;
+	*resp_size = sizeof(res->ctrl_msg_head) + size;
+
+	return NVME_EMU_SUCCESS;
+}
+
+// NVMe-MI, 5.7 Read NVMe-MI Data Structure
+static uint16_t nvme_emu_data_read(struct nvme_emu *emu, const union nvme_mi_req_msg *req,
+                                   union nvme_mi_res_msg *res)
+{
+	const struct nmd0_rnmds *rnmds = &req->nmd0.rnmds;
+	const struct nvme_emu_model *model = &emu->model;
+	uint8_t *buf = res->res_data;
+	uint16_t len;
+
+	switch (rnmds->dtyp) {
+	case nvme_mi_dtyp_subsys_info: {
+		struct nvme_mi_read_nvm_ss_info *ds = (void *)buf;
+
+		memset(ds, 0, sizeof(*ds));
+		// Ports are 0's based: port 0 is PCIe, port 1 SMBus
+		ds->nump = NVME_MI_PORT_ID_SMBUS;
+		ds->mjr = 1;
+		ds->mnr = 2;
+		len = sizeof(*ds);
+		break;
+	}
+	case nvme_mi_dtyp_port_info: {
+		struct nvme_mi_read_port_info *ds = (void *)buf;
+
+		memset(ds, 0, sizeof(*ds));
+		ds->mmctptus = model->mtus_max;
+		if (rnmds->portid == NVME_MI_PORT_ID_PCIE) {
+			ds->portt = PORT_TYPE_PCIE;
+			ds->pcie.mps = 1;               // 256 bytes
+			ds->pcie.sls = 0x0F;            // 2.5 - 16 GT/s
+			ds->pcie.cls = 4;
+			ds->pcie.mlw = 4;
+			ds->pcie.nlw = 4;
+		} else if (rnmds->portid == NVME_MI_PORT_ID_SMBUS) {
+			ds->portt = PORT_TYPE_SMBUS;
+			ds->smb.mme_addr = emu->own_addr << 1;
+			ds->smb.mme_freq = NVME_MI_CONFIG_SMBUS_FREQ_400kHz;
+			ds->smb.nvmebm = 1;
+		} else {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE + 2, 0);
+			return 0;
+		}
+		len = sizeof(*ds);
+		break;
+	}
+	case nvme_mi_dtyp_ctrl_list: {
+		uint16_t *ds = (void *)buf;
+
+		// Controllers from CTRLID on, the emulated subsystem has one.
+		ds[0] = model->cntlid >= rnmds->ctrlid;
+		ds[1] = model->cntlid;
+		len = sizeof(*ds) * (1 + ds[0]);
+		break;
+	}
+	case nvme_mi_dtyp_ctrl_info: {
+		struct nvme_mi_read_ctrl_info *ds = (void *)buf;
+
+		if (rnmds->ctrlid != model->cntlid) {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE, 0);
+			return 0;
+		}
+		memset(ds, 0, sizeof(*ds));
+		ds->portid = NVME_MI_PORT_ID_PCIE;
+		ds->prii = 1;
+		ds->pri = 0x0100;               // Bus 1, device 0, function 0
+		ds->vid = model->vid;
+		ds->did = model->did;
+		ds->ssvid = model->ssvid;
+		ds->ssid = model->ssid;
+		len = sizeof(*ds);
+		break;
+	}
+	default:
+		nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE + 3, 0);
+		return 0;
+	}
+
+	res->nmresp.rnmds.resp_data_len = len;
+
+	return len;
+}
+
+// NVMe-MI, 5.6 NVM Subsystem Health Status Poll
+static uint16_t nvme_emu_subsys_health(struct nvme_emu *emu, const union nvme_mi_req_msg *req,
+                                       union nvme_mi_res_msg *res)
+{
+	const struct nvme_emu_model *model = &emu->model;
+	struct nvme_mi_nvm_ss_health_status *ds = (void *)res->res_data;
+	union nvm_subsys_sts nss = { .df = 1, .p0la = 1 };
+
+	memset(ds, 0, sizeof(*ds));
+	ds->nss = nss.value;
+	// Smart Warnings are active low
+	ds->sw = ~model->cwarn;
+	ds->ctemp = model->ctemp > 127 ? 127 : model->ctemp < -60 ? -60 : model->ctemp;
+	ds->pdlu = model->pdlu;
+	ds->ccs = emu->changed | (model->rdy ? NVME_MI_CCS_RDY : 0);
+
+	if (req->nmd1.nshsp.cs)
+		emu->changed = 0;
+
+	return sizeof(*ds);
+}
+
+// NVMe-MI, 5.3 Controller Health Status Poll
+static uint16_t nvme_emu_ctrl_health(struct nvme_emu *emu, const union nvme_mi_req_msg *req,
+                                     union nvme_mi_res_msg *res)
+{
+	const struct nvme_emu_model *model = &emu->model;
+	const struct nmd0_chsp *sel = &req->nmd0.chsp;
+	const struct nmd1_chsp *flt = &req->nmd1.chsp;
+	struct nvme_mi_ctrl_health_status *ds = (void *)res->res_data;
+	uint16_t mask = (flt->csts ? NVME_MI_CCS_CSTS : 0) | (flt->ctemp ? NVME_MI_CCS_CTEMP : 0) |
+	                (flt->pdlu ? NVME_MI_CCS_PDLU : 0) | (flt->spare ? NVME_MI_CCS_SPARE : 0) |
+	                (flt->cwarn ? NVME_MI_CCS_CCWARN : 0);
+
+	res->nmresp.chsp.rent = 0;
+	if (model->cntlid < sel->sctlid || !(sel->all || (emu->changed & mask)))
+		return 0;
+
+	memset(ds, 0, sizeof(*ds));
+	ds->ctlid = model->cntlid;
+	ds->csts = model->rdy;
+	ds->ctemp = NVME_EMU_KELVIN(model->ctemp);
+	ds->pdlu = model->pdlu;
+	ds->spare = model->spare;
+	ds->cwarn = model->cwarn;
+	res->nmresp.chsp.rent = 1;
+
+	if (flt->ccf)
+		emu->changed &= ~NVME_EMU_CHANGED_MASK;
+
+	return sizeof(*ds);
+}
+
+// NVMe-MI, 5.1 Configuration Set and 5.2 Configuration Get
+static void nvme_emu_config(struct nvme_emu *emu, const union nvme_mi_req_msg *req,
+                            union nvme_mi_res_msg *res, bool set)
+{
+	const union nmd0_config *cfg = &req->nmd0.cfg;
+	const union nmd1_config *val = &req->nmd1.cfg;
+
+	switch (cfg->cfg_id) {
+	case NVME_MI_CONFIG_SMBUS_FREQ:
+		if (cfg->port_id != NVME_MI_PORT_ID_SMBUS) {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE + 3, 0);
+			return;
+		}
+		if (!set) {
+			res->nmresp.nmresp = emu->sif;
+			return;
+		}
+		if (cfg->sif.sif < NVME_MI_CONFIG_SMBUS_FREQ_100kHz ||
+		    cfg->sif.sif > NVME_MI_CONFIG_SMBUS_FREQ_1MHz) {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE + 1, 0);
+			return;
+		}
+		emu->sif = cfg->sif.sif;
+		break;
+	case NVME_MI_CONFIG_HEALTH_STATUS_CHANGE:
+		// Write 1 to clear, the flags from NSSRO on sit one bit higher in CCS.
+		if (set)
+			emu->changed &= ~((val->hsc.value & 0x7) | (val->hsc.value & 0xFF8) << 1);
+		break;
+	case NVME_MI_CONFIG_MCTP_MTU:
+		if (cfg->port_id != NVME_MI_PORT_ID_SMBUS) {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE + 3, 0);
+			return;
+		}
+		if (!set) {
+			res->nmresp.nmresp = emu->mtus;
+			return;
+		}
+		if (val->mtus.mtus < MCTP_BASELINE_TRAN_UNIT_SIZE || val->mtus.mtus > emu->model.mtus_max) {
+			nvme_emu_invalid_param(res, NVME_EMU_NMD1_BYTE, 0);
+			return;
+		}
+		emu->mtus = val->mtus.mtus;
+		break;
+	default:
+		nvme_emu_invalid_param(res, NVME_EMU_NMD0_BYTE, 0);
+		break;
+	}
+}
+
+static uint16_t nvme_emu_mi(struct nvme_emu *emu, const union nvme_mi_req_msg *req, uint16_t req_size,
+                            union nvme_mi_res_msg *res)
+{
+	if (req_size < NVME_EMU_MI_REQ_SIZE) {
+		res->nmresp.status = NVME_MI_RESP_INVALID_CMD_SIZE;
+		return 0;
+	}
+
+	switch (req->opc) {
+	case nvme_mi_mi_opcode_mi_data_read:
+		return nvme_emu_data_read(emu, req, res);
+	case nvme_mi_mi_opcode_subsys_health_status_poll:
+		return nvme_emu_subsys_health(emu, req, res);
+	case nvme_mi_mi_opcode_controller_health_status_poll:
+		return nvme_emu_ctrl_health(emu, req, res);
+	case nvme_mi_mi_opcode_configuration_set:
+		nvme_emu_config(emu, req, res, true);
+		return 0;
+	case nvme_mi_mi_opcode_configuration_get:
+		nvme_emu_config(emu, req, res, false);
+		return 0;
+	default:
+		res->nmresp.status = NVME_MI_RESP_INVALID_OPCODE;
+		return 0;
+	}
+}
+
+static void nvme_emu_smart_log(const struct nvme_emu *emu, struct nvme_smart_log *log)
+{
+	const struct nvme_emu_model *model = &emu->model;
+	uint16_t temp = NVME_EMU_KELVIN(model->ctemp);
+
+	memset(log, 0, sizeof(*log));
+	log->critical_warning = model->cwarn;
+	log->temperature[0] = temp;
+	log->temperature[1] = temp >> 8;
+	log->avail_spare = model->spare;
+	log->spare_thresh = model->spare_thresh;
+	log->percent_used = model->pdlu;
+	memcpy(log->power_on_hours, &model->poh, sizeof(model->poh));
+	memcpy(log->power_cycles, &model->power_cycles, sizeof(model->power_cycles));
+	log->temp_sensor[0] = temp;
+}
+
+/**
+ * NVMe-MI, 6 NVM Express Admin Command Set
+ *
+ * The NVMe status goes to the completion queue entry, the response message
+ * status stays Success unless the request itself is malformed.
+ */
+static uint16_t nvme_emu_admin(struct nvme_emu *emu, const union nvme_mi_adm_req_msg *req,
+                               uint16_t req_size, union nvme_mi_res_msg *res)
+{
+	const struct nvme_mi_adm_req_dw *adm = &req->mi_adm;
+	const struct nvme_emu_model *model = &emu->model;
+	struct nvme_mi_adm_res_dw *cqe = (void *)res->res_data;
+	uint8_t *buf = res->res_data + sizeof(*cqe);
+	uint32_t len = 0, offset = 0;
+
+	if (req_size < sizeof(req->nmh) + sizeof(*adm)) {
+		res->nmresp.status = NVME_MI_RESP_INVALID_CMD_SIZE;
+		return 0;
+	}
+
+	memset(cqe, 0, sizeof(*cqe));
+
+	switch (adm->opc) {
+	case nvme_admin_identify: {
+		struct nvme_id_ctrl *id = (void *)buf;
+
+		if (adm->identify.cdw10.cns != NVME_IDENTIFY_CNS_CTRL) {
+			cqe->sf = NVME_SC_INVALID_FIELD;
+			break;
+		}
+		memset(id, 0, sizeof(*id));
+		id->vid = model->vid;
+		id->ssvid = model->ssvid;
+		nvme_emu_pad(id->sn, model->sn, sizeof(id->sn));
+		nvme_emu_pad(id->mn, model->mn, sizeof(id->mn));
+		nvme_emu_pad(id->fr, model->fr, sizeof(id->fr));
+		id->mdts = 5;
+		id->cntlid = model->cntlid;
+		id->ver = 0x00010400;
+		id->wctemp = NVME_EMU_KELVIN(model->wctemp);
+		id->cctemp = NVME_EMU_KELVIN(model->cctemp);
+		id->sqes = 0x66;
+		id->cqes = 0x44;
+		id->nn = model->nn;
+		len = sizeof(*id);
+		break;
+	}
+	case nvme_admin_get_log_page: {
+		const union nvme_mi_adm_get_log_page_dw *glp = &adm->get_log_page;
+		uint64_t lpo = glp->cdw12.lpol | (uint64_t)glp->cdw13.lpou << 32;
+		uint32_t numd = glp->cdw10.numdl | (uint32_t)glp->cdw11.numdu << 16;
+		struct nvme_smart_log log;
+
+		if (glp->cdw10.lid != NVME_LOG_LID_SMART) {
+			cqe->sf = NVME_SCT_CMD_SPECIFIC << NVME_SCT_SHIFT | NVME_SC_INVALID_LOG_PAGE;
+			break;
+		}
+		len = (numd + 1) * 4;
+		if (lpo > sizeof(log) || len > sizeof(log) - lpo) {
+			cqe->sf = NVME_SC_INVALID_FIELD;
+			len = 0;
+			break;
+		}
+		nvme_emu_smart_log(emu, &log);
+		memcpy(buf, (uint8_t *)&log + lpo, len);
+		break;
+	}
+	case nvme_admin_get_features:
+		if (adm->get_feat.cdw10.fid != NVME_FEAT_FID_TEMP_THRESH) {
+			cqe->sf = NVME_SC_INVALID_FIELD;
+			break;
+		}
+		cqe->cqedw0 = NVME_EMU_KELVIN(emu->temp_thresh);
+		break;
+	case nvme_admin_set_features:
+		// Only the Over Temperature Threshold of the composite temperature
+		if (adm->set_feat.cdw10.fid != NVME_FEAT_FID_TEMP_THRESH || adm->set_feat.cdw11 >> 16) {
+			cqe->sf = NVME_SC_INVALID_FIELD;
+			break;
+		}
+		emu->temp_thresh = (int)(adm->set_feat.cdw11 & 0xFFFF) - 273;
+		break;
+	default:
+		cqe->sf = NVME_SC_INVALID_OPCODE;
+		break;
+	}
+
+	// A part of the data may be asked for with DOFST and DLEN.
+	if (adm->cflgs & NVME_MI_ADM_CFLGS_DOFSTV)
+		offset = adm->dofst;
+	if (offset > len) {
+		nvme_emu_invalid_param(res, offsetof(struct nvme_mi_adm_req_dw, dofst) + 4, 0);
+		return 0;
+	}
+	len -= offset;
+	if ((adm->cflgs & NVME_MI_ADM_CFLGS_DLENV) && adm->dlen < len)
+		len = adm->dlen;
+	if (offset)
+		memmove(buf, buf + offset, len);
+
+	return sizeof(*cqe) + len;
+}
+
+// NVMe-MI, 4.2.1 Control Primitives
+static uint16_t nvme_emu_cp(struct nvme_emu *emu, const uint8_t *req, uint16_t req_size, uint8_t *resp)
+{
+	const struct nvme_mi_cp_req_msg *cp = (const void *)req;
+	struct nvme_mi_cp_res_msg *res = (void *)resp;
+
+	res->tag = cp->tag;
+	res->cpsr = 0;
+
+	if (req_size < offsetof(struct nvme_mi_cp_req_msg, mic)) {
+		res->status = NVME_MI_RESP_INVALID_CMD_SIZE;
+		return sizeof(*res);
+	}
+
+	/**
+	 * Requests are handled as they complete, so there is never a command
+	 * to pause or abort, and Get State finds both slots idle.
+	 */
+	switch (cp->cpo) {
+	case NVME_MI_CP_PAUSE:
+	case NVME_MI_CP_RESUME:
+	case NVME_MI_CP_ABORT:
+	case NVME_MI_CP_GET_STATE:
+		res->status = NVME_MI_RESP_SUCCESS;
+		break;
+	default:
+		res->status = NVME_MI_RESP_INVALID_OPCODE;
+		break;
+	}
+
+	return sizeof(*res);
+}
+
+static int nvme_emu_nvme_mi(struct nvme_emu *emu, const uint8_t *req, uint16_t req_size,
+                            uint8_t *resp, uint16_t *resp_size)
+{
+	const union nvme_mi_msg *msg = (const void *)req;
+	union nvme_mi_res_msg *res = (void *)resp;
+	uint16_t size;
+
+	if (req_size < sizeof(msg->nmh))
+		return -NVME_EMU_ERR_SIZE;
+
+	if (msg->nmh.ror != ROR_REQ)
+		return -NVME_EMU_ERR_PARAM;
+
+	res->nmh.value = msg->nmh.value;
+	res->nmh.ror = ROR_RESP;
+	res->nmh.meb = 0;
+	res->nmh.ciap = 0;
+	res->nmresp.value = 0;
+
+	switch (msg->nmh.nmimt) {
+	case NVME_MI_MT_CONTROL:
+		size = nvme_emu_cp(emu, req, req_size, resp);
+		break;
+	case NVME_MI_MT_MI:
+		size = sizeof(res->nmh) + sizeof(res->nmresp) +
+		       nvme_emu_mi(emu, (const void *)req, req_size, res);
+		break;
+	case NVME_MI_MT_ADMIN:
+		size = sizeof(res->nmh) + sizeof(res->nmresp) +
+		       nvme_emu_admin(emu, (const void *)req, req_size, res);
+		break;
+	default:
+		res->nmresp.status = NVME_MI_RESP_INVALID_OPCODE;
+		size = sizeof(res->nmh) + sizeof(res->nmresp);
+		break;
+	}
+
+	// An error response carries the status only.
+	if (msg->nmh.nmimt != NVME_MI_MT_CONTROL && res->nmresp.status != NVME_MI_RESP_SUCCESS)
+		size = sizeof(res->nmh) + sizeof(res->nmresp);
+
+	*resp_size = size;
+
+	return NVME_EMU_SUCCESS;
+}
+
+/**
+ * Handle one assembled request message and build its response. A zero
+ * resp_size or an error means the request is dropped without a response.
+ */
+int nvme_emu_handle(struct nvme_emu *emu, const uint8_t *req, uint16_t req_size, uint8_t *resp,
+                    uint16_t *resp_size)
+{
+	const union mctp_msg_header *head = (const void *)req;
+	int ret;
+
+	*resp_size = 0;
+	if (req_size < 1)
+		return -NVME_EMU_ERR_SIZE;
+
+	/**
+	 * NVMe-MI, 3.2.1.2 Message Integrity Check
+	 *
+	 * The requester sets IC on control messages too. A request with a bad
+	 * MIC is discarded without a response, the response of one with IC set
+	 * carries a MIC of its own.
+	 */
+	if (head->ic) {
+		uint32_t mic;
+
+		// A control request without data is 3 bytes ahead of the MIC.
+		if (req_size < MCTP_CTRL_REQ_HEAD_SIZE + sizeof(mic))
+			return -NVME_EMU_ERR_SIZE;
+		req_size -= sizeof(mic);
+		memcpy(&mic, req + req_size, sizeof(mic));
+		if (mic != ~crc32_le_generic(CRC_INIT, req, req_size, REVERSED_POLY_CRC32))
+			return -NVME_EMU_ERR_MIC;
+	}
+
+	switch (head->mt) {
+	case MCTP_MSG_TYPE_CTRL:
+		ret = nvme_emu_ctrl(emu, req, req_size, resp, resp_size);
+		break;
+	case MCTP_MSG_TYPE_NVME_MM:
+		ret = nvme_emu_nvme_mi(emu, req, req_size, resp, resp_size);
+		break;
+	default:
+		return -NVME_EMU_ERR_PARAM;
+	}
+
+	if (!ret && *resp_size && head->ic)
+		*resp_size = mctp_message_append_mic(resp, *resp_size);
+
+	return ret;
+}
+
+/**
+ * DSP0237 framing of one MCTP packet, as it is seen on the bus: the frame
+ * starts with the write address of dst_addr and ends with the PEC if pec.
+ */
+int nvme_emu_frame(uint8_t *frame, uint8_t dst_addr, uint8_t src_addr,
+                   union mctp_transport_header tran_head, const void *payload, uint8_t size,
+                   bool pec)
+{
+	int len = NVME_EMU_FRAME_HEAD + sizeof(tran_head) + size;
+
+	frame[0] = dst_addr << 1 | I2C_WRITE;
+	frame[1] = SMBUS_CMD_CODE_MCTP;
+	frame[2] = len - 3;
+	frame[3] = src_addr << 1 | MCTP_OVER_SMBUS;
+	memcpy(&frame[NVME_EMU_FRAME_HEAD], &tran_head, sizeof(tran_head));
+	memcpy(&frame[NVME_EMU_FRAME_HEAD + sizeof(tran_head)], payload, size);
+	if (pec) {
+		frame[len] = crc8(frame, len);
+		len++;
+	}
+
+	return len;
+}
+
+// Split the response into packets of the negotiated transmission unit.
+static int nvme_emu_transmit(struct nvme_emu *emu, const uint8_t *msg, uint16_t size)
+{
+	uint8_t frame[NVME_EMU_FRAME_MAX];
+	union mctp_transport_header tran_head = { .value = 0 };
+	uint16_t offset = 0;
+	uint8_t seq = 0;
+	int ret;
+
+	tran_head.hdr_ver = MCTP_HEADER_VERSION;
+	tran_head.dst_eid = emu->src_eid;
+	tran_head.src_eid = emu->eid;
+	tran_head.msg_tag = emu->msg_tag;
+	tran_head.tag_owner = 0;
+
+	while (offset < size) {
+		uint8_t n = size - offset > emu->mtus ? emu->mtus : size - offset;
+
+		tran_head.som = !offset;
+		tran_head.eom = offset + n == size;
+		tran_head.pkt_seq = seq++;
+
+		int len = nvme_emu_frame(frame, emu->peer_addr, emu->own_addr, tran_head, msg + offset, n,
+		                         emu->pec);
+		if (emu->output) {
+			ret = emu->output(emu->priv, emu->peer_addr, frame, len);
+			if (ret)
+				return ret;
+		}
+		emu->tx_pkts++;
+		offset += n;
+	}
+	emu->tx_msgs++;
+
+	return NVME_EMU_SUCCESS;
+}
+
+static int nvme_emu_drop(struct nvme_emu *emu, int ret)
+{
+	emu->drops++;
+	emu->som = false;
+
+	return ret;
+}
+
+/**
+ * Take one SMBus frame written to the endpoint, as the slave read it: the
+ * write address first and the PEC last if that is enabled. The response is
+ * handed to the output once the last packet of a request is in.
+ */
+int nvme_emu_receive(struct nvme_emu *emu, const uint8_t *frame, uint16_t len)
+{
+	const union mctp_smbus_packet *pkt = (const void *)frame;
+	const union mctp_transport_header *tran_head = &pkt->tran_head;
+	uint64_t start = time_us();
+	uint16_t size, resp_size;
+	int ret;
+
+	emu->rx_pkts++;
+
+	if (emu->pec) {
+		if (!len || crc8(frame, len))
+			return nvme_emu_drop(emu, -NVME_EMU_ERR_FRAME);
+		len--;
+	}
+
+	if (len < NVME_EMU_FRAME_HEAD + sizeof(*tran_head) ||
+	    pkt->medi_head.cmd_code != SMBUS_CMD_CODE_MCTP || pkt->medi_head.byte_cnt != len - 3 ||
+	    (pkt->medi_head.src_slv_addr & 0x1) != MCTP_OVER_SMBUS ||
+	    tran_head->hdr_ver != MCTP_HEADER_VERSION || !tran_head->tag_owner)
+		return nvme_emu_drop(emu, -NVME_EMU_ERR_FRAME);
+
+	if (tran_head->dst_eid != emu->eid && tran_head->dst_eid != EID_NULL_DST &&
+	    tran_head->dst_eid != EID_BROADCAST)
+		return nvme_emu_drop(emu, -NVME_EMU_ERR_PARAM);
+
+	size = len - NVME_EMU_FRAME_HEAD - sizeof(*tran_head);
+
+	// DSP0236, 8.8 Dropped packets
+	if (tran_head->som) {
+		emu->som = true;
+		emu->msg_size = 0;
+		emu->msg_tag = tran_head->msg_tag;
+		emu->src_eid = tran_head->src_eid;
+		emu->peer_addr = pkt->medi_head.src_slv_addr >> 1;
+	} else if (!emu->som || tran_head->msg_tag != emu->msg_tag ||
+	           tran_head->src_eid != emu->src_eid ||
+	           tran_head->pkt_seq != ((emu->pkt_seq + 1) & 0x3)) {
+		return nvme_emu_drop(emu, -NVME_EMU_ERR_SEQ);
+	}
+	emu->pkt_seq = tran_head->pkt_seq;
+
+	if (emu->msg_size + size > sizeof(emu->msg))
+		return nvme_emu_drop(emu, -NVME_EMU_ERR_SIZE);
+
+	memcpy(emu->msg + emu->msg_size, pkt->payload, size);
+	emu->msg_size += size;
+
+	if (!tran_head->eom) {
+		emu->busy_us += time_us() - start;
+		return NVME_EMU_SUCCESS;
+	}
+
+	emu->som = false;
+	emu->rx_msgs++;
+
+	ret = nvme_emu_handle(emu, emu->msg, emu->msg_size, emu->resp, &resp_size);
+	if (ret)
+		emu->drops++;
+	else if (resp_size)
+		ret = nvme_emu_transmit(emu, emu->resp, resp_size);
+
+	emu->busy_us += time_us() - start;
+
+	return ret;
+}
+
+struct nvme_emu_sink {
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t failed;
+};
+
+// Count the response frames, and the responses whose status is not Success.
+static int nvme_emu_bench_output(void *priv, uint8_t dst_addr, const uint8_t *frame, uint16_t len)
+{
+	const union mctp_smbus_packet *pkt = (const void *)frame;
+	const union nvme_mi_res_msg *res = (const void *)pkt->payload;
+	struct nvme_emu_sink *sink = priv;
+
+	sink->frames++;
+	sink->bytes += len;
+	if (pkt->tran_head.som && res->nmresp.status != NVME_MI_RESP_SUCCESS)
+		sink->failed++;
+
+	return 0;
+}
+
+// Requests of the bench, each one a single packet
+static const struct {
+	uint8_t nmimt;
+	uint8_t opc;
+	uint32_t nmd0;
+	uint32_t nmd1;
+} nvme_emu_bench_mix[] = {
+	{NVME_MI_MT_MI, nvme_mi_mi_opcode_subsys_health_status_poll, 0, 0},
+	{NVME_MI_MT_MI, nvme_mi_mi_opcode_controller_health_status_poll, 1U << 31, 0},
+	{NVME_MI_MT_MI, nvme_mi_mi_opcode_configuration_get,
+	 NVME_MI_PORT_ID_SMBUS << 24 | NVME_MI_CONFIG_MCTP_MTU, 0},
+	{NVME_MI_MT_ADMIN, nvme_admin_identify, NVME_IDENTIFY_CNS_CTRL, 0},
+	{NVME_MI_MT_ADMIN, nvme_admin_get_log_page,
+	 (sizeof(struct nvme_smart_log) / 4 - 1) << 16 | NVME_LOG_LID_SMART, 0},
+};
+
+#define NVME_EMU_MIX_NUM                (sizeof(nvme_emu_bench_mix) / sizeof(nvme_emu_bench_mix[0]))
+
+/**
+ * Feed the responder a mix of health polls, a configuration get, Identify
+ * and SMART requests, count times over, without any adapter. What is left is
+ * the cost of the emulator itself per request.
+ */
+int nvme_emu_bench(struct nvme_emu *emu, uint32_t count)
+{
+	uint8_t frame[NVME_EMU_MIX_NUM][NVME_EMU_FRAME_MAX];
+	int len[NVME_EMU_MIX_NUM];
+	struct nvme_emu_sink sink = { 0 };
+	const uint8_t host_addr = SMBUS_ADDR_IPMI_BMC, host_eid = 8;
+	uint64_t start;
+	int ret;
+
+	for (int i = 0; i < NVME_EMU_MIX_NUM; i++) {
+		union nvme_mi_adm_req_msg req;
+		union mctp_transport_header tran_head = { .value = 0 };
+		uint16_t size;
+
+		memset(&req, 0, sizeof(req.nmh) + sizeof(req.mi_adm));
+		req.nmh.mt = MCTP_MSG_TYPE_NVME_MM;
+		req.nmh.ic = 1;
+		req.nmh.csi = i & 1;
+		req.nmh.nmimt = nvme_emu_bench_mix[i].nmimt;
+		req.nmh.ror = ROR_REQ;
+		req.mi_adm.opc = nvme_emu_bench_mix[i].opc;
+		if (nvme_emu_bench_mix[i].nmimt == NVME_MI_MT_MI) {
+			req.mi_adm.sqedw1 = nvme_emu_bench_mix[i].nmd0;
+			req.mi_adm.sqedw2 = nvme_emu_bench_mix[i].nmd1;
+			size = NVME_EMU_MI_REQ_SIZE;
+		} else {
+			req.mi_adm.sqedw10 = nvme_emu_bench_mix[i].nmd0;
+			size = sizeof(req.nmh) + sizeof(req.mi_adm);
+		}
+		size = mctp_message_append_mic(&req, size);
+
+		tran_head.hdr_ver = MCTP_HEADER_VERSION;
+		tran_head.dst_eid = emu->eid;
+		tran_head.src_eid = host_eid;
+		tran_head.msg_tag = i;
+		tran_head.tag_owner = 1;
+		tran_head.som = 1;
+		tran_head.eom = 1;
+		len[i] = nvme_emu_frame(frame[i], emu->own_addr, host_addr, tran_head, &req, size,
+		                        emu->pec);
+	}
+
+	nvme_emu_set_output(emu, nvme_emu_bench_output, &sink);
+
+	start = time_us();
+	for (uint32_t n = 0; n < count; n++) {
+		for (int i = 0; i < NVME_EMU_MIX_NUM; i++) {
+			ret = nvme_emu_receive(emu, frame[i], len[i]);
+			if (ret) {
+				nvme_trace(ERROR, "nvme_emu_receive %d (%d)\n", i, ret);
+				return ret;
+			}
+		}
+	}
+	uint64_t elapsed = time_us() - start;
+	uint64_t reqs = (uint64_t)count * NVME_EMU_MIX_NUM;
+
+	printf("Requests                    : %llu\n", (unsigned long long)reqs);
+	printf("Response Frames             : %u (%u bytes)\n", sink.frames, sink.bytes);
+	printf("Failed                      : %u\n", sink.failed);
+	printf("Elapsed                     : %llu us\n", (unsigned long long)elapsed);
+	if (reqs && elapsed)
+		printf("Throughput                  : %llu requests/s, %.2f us per request\n",
+		       (unsigned long long)(reqs * 1000000 / elapsed), (double)elapsed / reqs);
+
+	return sink.failed ? -NVME_EMU_ERR_PARAM : NVME_EMU_SUCCESS;
+}
+
+void nvme_emu_show(const struct nvme_emu *emu)
+{
+	printf("Slave Address               : 0x%02x\n", emu->own_addr);
+	printf("Endpoint ID                 : 0x%02x\n", emu->eid);
+	printf("Transmission Unit Size      : %u\n", emu->mtus);
+	printf("Packets                     : rx %u, tx %u\n", emu->rx_pkts, emu->tx_pkts);
+	printf("Messages                    : rx %u, tx %u\n", emu->rx_msgs, emu->tx_msgs);
+	printf("Dropped                     : %u\n", emu->drops);
+	if (emu->rx_msgs)
+		printf("Responder Time              : %.2f us per request\n",
+		       (double)emu->busy_us / emu->rx_msgs);
+}
@@ -0,0 +1,118 @@
+#ifndef NVME_EMU_H
+#define NVME_EMU_H
+
+#include "aardvark.h"
+#include "types.h"
+#include "mctp.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// SMBus framing in front of the MCTP packet: address, command code, byte count, source address
+#define NVME_EMU_FRAME_HEAD             (4)
+#define NVME_EMU_FRAME_MAX              (NVME_EMU_FRAME_HEAD + 4 + 250 + 1)
+// Largest MCTP transmission unit of the SMBus binding
+#define NVME_EMU_MTUS_MAX               (250)
+#define NVME_EMU_MODEL_STR_MAX          (40)
+
+enum nvme_emu_error {
+	NVME_EMU_SUCCESS = 0,
+	NVME_EMU_ERR_PARAM,
+	NVME_EMU_ERR_SYNTAX,
+	NVME_EMU_ERR_FRAME,                 // Not an MCTP over SMBus packet, or a bad PEC
+	NVME_EMU_ERR_SEQ,                   // Packet out of sequence, the message is dropped
+	NVME_EMU_ERR_SIZE,
+	NVME_EMU_ERR_MIC,
+	NVME_EMU_ERR_IO,
+};
+
+/**
+ * What the emulated drive reports. Temperatures are in degrees Celsius, the
+ * structures that carry Kelvin get them converted.
+ */
+struct nvme_emu_model {
+	// Identify Controller, Controller Information
+	uint16_t vid;
+	uint16_t ssvid;
+	uint16_t did;
+	uint16_t ssid;
+	char sn[NVME_EMU_MODEL_STR_MAX + 1];
+	char mn[NVME_EMU_MODEL_STR_MAX + 1];
+	char fr[NVME_EMU_MODEL_STR_MAX + 1];
+	uint16_t cntlid;
+	uint32_t nn;
+	int16_t wctemp;
+	int16_t cctemp;
+	// Health, SMART / Health Information
+	int16_t ctemp;
+	uint8_t pdlu;
+	uint8_t spare;
+	uint8_t spare_thresh;
+	uint8_t cwarn;
+	bool rdy;
+	uint64_t poh;                   // Power On Hours
+	uint64_t power_cycles;
+	// Management Endpoint
+	uint16_t mtus_max;
+};
+
+/**
+ * Hands one SMBus frame of a response to the medium: dst_addr is the 7-bit
+ * address of the requester, the frame starts with it and ends with the PEC
+ * if that is enabled.
+ */
+typedef int (*nvme_emu_output)(void *priv, uint8_t dst_addr, const uint8_t *frame, uint16_t len);
+
+/**
+ * An NVMe-MI Management Endpoint on SMBus. Frames go in through
+ * nvme_emu_receive, response frames come out through the output callback, so
+ * the responder runs the same whether an adapter or a test feeds it.
+ */
+struct nvme_emu {
+	struct nvme_emu_model model;
+	uint8_t own_addr;
+	uint8_t eid;
+	bool pec;
+	nvme_emu_output output;
+	void *priv;
+	// Set by the requester
+	uint8_t sif;                    // SMBus/I2C Frequency
+	uint16_t mtus;                  // Transmission unit of the responses
+	int16_t temp_thresh;            // Over Temperature Threshold, Celsius
+	uint16_t changed;               // Health changes not cleared yet, NVME_MI_CCS_*
+	uint8_t uuid[16];
+	// Message being assembled
+	uint8_t msg[MCTP_MSG_SIZE_MAX];
+	uint16_t msg_size;
+	bool som;
+	uint8_t pkt_seq;
+	uint8_t msg_tag;
+	uint8_t src_eid;
+	uint8_t peer_addr;
+	uint8_t resp[MCTP_MSG_SIZE_MAX];
+	// Counters
+	uint32_t rx_pkts;
+	uint32_t tx_pkts;
+	uint32_t rx_msgs;
+	uint32_t tx_msgs;
+	uint32_t drops;
+	uint64_t busy_us;               // Spent assembling, handling and framing
+};
+
+void nvme_emu_model_default(struct nvme_emu_model *model);
+int nvme_emu_model_load(struct nvme_emu_model *model, const char *path);
+int nvme_emu_init(struct nvme_emu *emu, const struct nvme_emu_model *model, uint8_t own_addr,
+                  uint8_t eid, bool pec);
+void nvme_emu_set_output(struct nvme_emu *emu, nvme_emu_output output, void *priv);
+void nvme_emu_update(struct nvme_emu *emu, const struct nvme_emu_model *model);
+int nvme_emu_handle(struct nvme_emu *emu, const uint8_t *req, uint16_t req_size, uint8_t *resp,
+                    uint16_t *resp_size);
+int nvme_emu_frame(uint8_t *frame, uint8_t dst_addr, uint8_t src_addr,
+                   union mctp_transport_header tran_head, const void *payload, uint8_t size,
+                   bool pec);
+int nvme_emu_receive(struct nvme_emu *emu, const uint8_t *frame, uint16_t len);
+int nvme_emu_bench(struct nvme_emu *emu, uint32_t count);
+int nvme_emu_run(struct nvme_emu *emu, Aardvark handle, int idle_ms, int verbose);
+int nvme_emu_run_socket(struct nvme_emu *emu, const char *path, int idle_ms, int verbose);
+void nvme_emu_show(const struct nvme_emu *emu);
+
+#endif // NVME_EMU_H
@@ -0,0 +1,97 @@
+#include "nvme.h"
+#include "nvme_emu.h"
+
+#include "aardvark.h"
+#include "smbus.h"
+#include "utility.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct nvme_emu_smbus {
+	Aardvark handle;
+	bool pec;
+	int verbose;
+};
+
+/**
+ * Responses go out as master writes to the requester, the same way a
+ * Management Endpoint answers on SMBus. The PEC is added by the write.
+ */
+static int nvme_emu_smbus_output(void *priv, uint8_t dst_addr, const uint8_t *frame, uint16_t len)
+{
+	struct nvme_emu_smbus *ctx = priv;
+	int status;
+
+	if (ctx->verbose)
+		print_buf(frame, len, "[%s] tx (%d)", __func__, len);
+
+	status = smbus_block_write(ctx->handle, dst_addr, frame[1], frame[2], &frame[3], ctx->pec,
+	                           ctx->verbose);
+	if (status) {
+		nvme_trace(ERROR, "smbus_block_write 0x%02x (%d)\n", dst_addr, status);
+		return -NVME_EMU_ERR_IO;
+	}
+
+	return NVME_EMU_SUCCESS;
+}
+
+/**
+ * Answer the requests written to own_addr of the adapter until none has come
+ * for idle_ms, or forever if idle_ms is negative.
+ */
+int nvme_emu_run(struct nvme_emu *emu, Aardvark handle, int idle_ms, int verbose)
+{
+	struct nvme_emu_smbus ctx = { handle, emu->pec, verbose };
+	uint8_t buf[SMBUS_BUF_MAX + 1];
+	int status, idle = 0;
+
+	status = aa_i2c_slave_enable(handle, emu->own_addr, 0, 0);
+	if (status) {
+		nvme_trace(ERROR, "aa_i2c_slave_enable (%d)\n", status);
+		return -NVME_EMU_ERR_IO;
+	}
+
+	nvme_emu_set_output(emu, nvme_emu_smbus_output, &ctx);
+
+	while (idle_ms < 0 || idle < idle_ms) {
+		u16 num_read;
+		u8 slv_addr;
+
+		status = aa_async_poll(handle, 10);
+		if (status == AA_ASYNC_I2C_WRITE) {
+			u16 num_written;
+			aa_i2c_slave_write_stats_ext(handle, &num_written);
+			continue;
+		} else if (status != AA_ASYNC_I2C_READ) {
+			idle += 10;
+			continue;
+		}
+
+		status = aa_i2c_slave_read_ext(handle, &slv_addr, SMBUS_BUF_MAX, &buf[1], &num_read);
+		if (status) {
+			nvme_trace(ERROR, "aa_i2c_slave_read_ext (%d)\n", status);
+			continue;
+		}
+
+		buf[0] = slv_addr << 1 | I2C_WRITE;
+		++num_read;
+		idle = 0;
+
+		if (verbose)
+			print_buf(buf, num_read, "[%s] rx (%d)", __func__, num_read);
+
+		status = nvme_emu_receive(emu, buf, num_read);
+		if (status && verbose)
+			nvme_trace(WARN, "nvme_emu_receive (%d)\n", status);
+	}
+
+	aa_i2c_slave_disable(handle);
+	nvme_emu_set_output(emu, NULL, NULL);
+
+	return NVME_EMU_SUCCESS;
+}
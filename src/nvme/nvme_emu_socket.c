@@ -0,0 +1,94 @@
+#include "nvme.h"
+#include "nvme_emu.h"
+
+#include "mctp.h"
+#include "mctp_smbus.h"
+#include "mctp_socket.h"
+#include "mctp_transport.h"
+
+#include "utility.h"
+
+#include "types.h"
+#include <stdbool.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// mctp_socket_poll hands frames to a callback without a context of its own.
+static struct nvme_emu *nvme_emu_sock;
+
+/**
+ * The socket binding frames a packet as on SMBus but without the PEC, and
+ * fills in the SMBus header itself, so only the MCTP packet is handed over.
+ */
+static int nvme_emu_socket_output(void *priv, uint8_t dst_addr, const uint8_t *frame, uint16_t len)
+{
+	union mctp_smbus_packet pkt;
+	int verbose = *(int *)priv;
+	int ret;
+
+	memcpy(pkt.data, frame, len);
+	ret = mctp_socket_transmit_packet(0, dst_addr, &pkt, frame[2] - 1, verbose);
+	if (ret) {
+		nvme_trace(ERROR, "mctp_socket_transmit_packet (%d)\n", ret);
+		return -NVME_EMU_ERR_IO;
+	}
+
+	return NVME_EMU_SUCCESS;
+}
+
+static int nvme_emu_socket_receive(const void *buf, u32 len, int verbose)
+{
+	int ret = nvme_emu_receive(nvme_emu_sock, buf, len);
+
+	if (ret && verbose)
+		nvme_trace(WARN, "nvme_emu_receive (%d)\n", ret);
+
+	return ret ? 0xFF : 0;
+}
+
+/**
+ * Serve a local SOCK_SEQPACKET socket at path instead of an adapter, for
+ * requesters run with -U on the same host. A requester that goes away is
+ * replaced by the next one to connect. Returns once no request has come for
+ * idle_ms, or never if idle_ms is negative.
+ */
+int nvme_emu_run_socket(struct nvme_emu *emu, const char *path, int idle_ms, int verbose)
+{
+	const int step_ms = 100;
+	uint64_t last_us;
+	int ret, idle = 0;
+
+	if (emu->pec)
+		return -NVME_EMU_ERR_PARAM;
+
+	ret = mctp_socket_init(path, true, emu->own_addr);
+	if (ret) {
+		nvme_trace(ERROR, "mctp_socket_init (%d)\n", ret);
+		return -NVME_EMU_ERR_IO;
+	}
+
+	nvme_emu_sock = emu;
+	nvme_emu_set_output(emu, nvme_emu_socket_output, &verbose);
+
+	last_us = time_us();
+	while (idle_ms < 0 || idle < idle_ms) {
+		uint32_t rx = emu->rx_pkts;
+
+		// Waits up to ten steps for the first packet, so idle is taken from the clock.
+		ret = mctp_socket_poll(0, step_ms, nvme_emu_socket_receive, verbose);
+		if (ret == -MCTP_ERROR)
+			nvme_trace(INFO, "requester gone, waiting for the next one\n");
+
+		if (emu->rx_pkts != rx)
+			last_us = time_us();
+		idle = (time_us() - last_us) / 1000;
+	}
+
+	nvme_emu_set_output(emu, NULL, NULL);
+	mctp_socket_deinit();
+	nvme_emu_sock = NULL;
+
+	return NVME_EMU_SUCCESS;
+}
@@ -0,0 +1,368 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_log.h"
+#include "nvme_event.h"
+#include "nvme_decode.h"
+#include "nvme_format.h"
+#include "libnvme_types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int nvme_event_open(struct nvme_event_reader *er, const char *dir, const u8 *udid)
+{
+	struct nvme_event_cursor cur;
+	int len;
+	FILE *fp;
+
+	memset(er, 0, sizeof(*er));
+	er->cur.magic = NVME_EVENT_CURSOR_MAGIC;
+
+	len = snprintf(er->path, sizeof(er->path), "%s/", dir);
+	for (int i = 0; i < 16 && len < sizeof(er->path); i++)
+		len += snprintf(er->path + len, sizeof(er->path) - len, "%02x", udid[i]);
+	if (len + strlen(".nevc") >= sizeof(er->path)) {
+		nvme_trace(ERROR, "cursor path too long\n");
+		return -NVME_EVENT_ERR_PARAM;
+	}
+	strcat(er->path, ".nevc");
+
+	// No cursor yet, everything the logs hold is new.
+	fp = fopen(er->path, "rb");
+	if (!fp)
+		return NVME_EVENT_SUCCESS;
+
+	if (fread(&cur, sizeof(cur), 1, fp) == 1 && cur.magic == NVME_EVENT_CURSOR_MAGIC)
+		er->cur = cur;
+	else
+		nvme_trace(WARN, "ignore invalid cursor %s\n", er->path);
+	fclose(fp);
+
+	return NVME_EVENT_SUCCESS;
+}
+
+// The cursor is replaced as a whole so a crash leaves the old one.
+int nvme_event_save(const struct nvme_event_reader *er)
+{
+	char tmp[sizeof(er->path) + 4];
+	FILE *fp;
+	int ret = NVME_EVENT_SUCCESS;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", er->path);
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", tmp);
+		return -NVME_EVENT_ERR_IO;
+	}
+
+	if (fwrite(&er->cur, sizeof(er->cur), 1, fp) != 1)
+		ret = -NVME_EVENT_ERR_IO;
+	if (fclose(fp))
+		ret = -NVME_EVENT_ERR_IO;
+
+#ifdef WIN32
+	if (!ret)
+		remove(er->path);
+#endif
+	if (!ret && rename(tmp, er->path))
+		ret = -NVME_EVENT_ERR_IO;
+
+	if (ret) {
+		nvme_trace(ERROR, "write %s\n", er->path);
+		remove(tmp);
+	}
+
+	return ret;
+}
+
+// Buffer of nvme_event_read_log(), base is the log offset of buf[0].
+struct nvme_event_buf {
+	u8 *buf;
+	u64 base;
+};
+
+static int nvme_event_copy(const void *buf, uint32_t len, uint64_t offset, void *priv)
+{
+	struct nvme_event_buf *eb = priv;
+
+	memcpy(eb->buf + offset - eb->base, buf, len);
+
+	return 0;
+}
+
+/**
+ * Read len bytes of a log page at offset into buf. Get Log Page works on
+ * dwords, so the range is widened to dword boundaries and buf must have room
+ * for that; the returned pointer is where offset landed.
+ */
+static u8 *nvme_event_read_log(struct aa_args *args, struct nvme_event_reader *er, u8 lid, u8 lsp,
+                               u64 offset, u32 len, u8 *buf, int *ret)
+{
+	struct nvme_event_buf eb = {
+		.buf = buf,
+		.base = offset & ~3ULL,
+	};
+	struct nvme_log_stream ls = {
+		.nsid = NVME_NSID_ALL,
+		.lid = lid,
+		.lsp = lsp,
+		.lsi = NVME_LOG_LSI_NONE,
+		.rae = true,
+		.offset = eb.base,
+		.size = (offset + len + 3) & ~3ULL,
+		.fd = -1,
+		.cb = nvme_event_copy,
+		.priv = &eb,
+	};
+
+	*ret = nvme_log_stream_read(args, &ls);
+	if (*ret)
+		return NULL;
+
+	er->bytes += ls.size - eb.base;
+
+	return buf + (offset - eb.base);
+}
+
+static void nvme_event_emit(struct aa_args *args, struct nvme_event_reader *er,
+                            struct nvme_mi_result *res)
+{
+	res->csi = args->csi;
+	res->nmimt = NVME_MI_MT_ADMIN;
+	res->opc = nvme_admin_get_log_page;
+	nvme_format_result(stdout, res, nvme_format_get());
+	er->events++;
+}
+
+// ELPE of Identify Controller, read once and kept with the cursor.
+static int nvme_event_error_entries(struct aa_args *args, struct nvme_event_reader *er)
+{
+	struct aa_args id_args = *args;
+	struct nvme_mi_result res;
+	int ret;
+
+	if (er->cur.error_entries)
+		return NVME_EVENT_SUCCESS;
+
+	id_args.async = false;
+	ret = nvme_identify_ctrl(&id_args);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(id_args.csi, &res);
+	if (res.status || res.sf || res.type != NVME_RESULT_IDENTIFY) {
+		nvme_trace(ERROR, "identify controller: status %x, sf %x\n", res.status, res.sf);
+		return -NVME_EVENT_ERR_STATUS;
+	}
+
+	// Error Log Page Entries (ELPE) is 0's based.
+	er->cur.error_entries = res.identify.elpe + 1;
+
+	return NVME_EVENT_SUCCESS;
+}
+
+/**
+ * NVMe Base, 5.16.1.2 Error Information
+ *
+ * Entries are returned newest first and carry a unique, increasing Error
+ * Count, which is the cursor. A poll without new errors reads the newest
+ * entry only; otherwise the entries newer than the cursor are read and
+ * returned oldest first.
+ */
+int nvme_event_read_errors(struct aa_args *args, struct nvme_event_reader *er)
+{
+	struct nvme_mi_result res;
+	const u8 *entry;
+	u64 count, fresh;
+	u32 n;
+	u8 *buf;
+	int ret;
+
+	er->events = 0;
+	er->lost = 0;
+	er->bytes = 0;
+
+	ret = nvme_event_error_entries(args, er);
+	if (ret)
+		return ret;
+
+	buf = malloc(er->cur.error_entries * NVME_EVENT_ERROR_SIZE);
+	if (!buf)
+		return -NVME_EVENT_ERR_IO;
+
+	entry = nvme_event_read_log(args, er, NVME_LOG_LID_ERROR, NVME_LOG_LSP_NONE, 0,
+	                            NVME_EVENT_ERROR_SIZE, buf, &ret);
+	if (!entry)
+		goto out;
+
+	count = ((const struct nvme_error_log_page *)entry)->error_count;
+	if (!count || count == er->cur.error_count)
+		goto out;
+
+	// A smaller count means the drive was reset or replaced, start over.
+	fresh = count > er->cur.error_count ? count - er->cur.error_count : count;
+	n = fresh < er->cur.error_entries ? fresh : er->cur.error_entries;
+	if (fresh > n) {
+		er->lost = fresh - n;
+		nvme_trace(WARN, "%u error entries left the log unread\n", er->lost);
+	}
+
+	if (n > 1) {
+		entry = nvme_event_read_log(args, er, NVME_LOG_LID_ERROR, NVME_LOG_LSP_NONE, 0,
+		                            n * NVME_EVENT_ERROR_SIZE, buf, &ret);
+		if (!entry)
+			goto out;
+	}
+
+	for (int i = n - 1; i >= 0; i--) {
+		memset(&res, 0, sizeof(res));
+		res.type = NVME_RESULT_ERROR_ENTRY;
+		nvme_decode_error_entry(entry + i * NVME_EVENT_ERROR_SIZE, NVME_EVENT_ERROR_SIZE,
+		                        &res.error_entry);
+		// Unused entries have an Error Count of 0.
+		if (!res.error_entry.error_count ||
+		    (count > er->cur.error_count && res.error_entry.error_count <= er->cur.error_count))
+			continue;
+		nvme_event_emit(args, er, &res);
+	}
+
+	er->cur.error_count = count;
+	ret = nvme_event_save(er);
+
+out:
+	free(buf);
+
+	return ret;
+}
+
+/**
+ * NVMe Base, 5.16.1.14 Persistent Event Log
+ *
+ * The header is read establishing a reporting context, which freezes the log
+ * until it is released. An unchanged header costs nothing more. Otherwise
+ * the last returned event is checked to still be at its offset, with its
+ * timestamp, and reading continues after it; if the log moved, it is scanned
+ * from the start and events up to the stored timestamp are skipped.
+ */
+int nvme_event_read_pel(struct aa_args *args, struct nvme_event_reader *er)
+{
+	struct nvme_event_cursor *cur = &er->cur;
+	const struct nvme_persistent_event_log *hdr;
+	const struct nvme_persistent_event_entry *ev;
+	struct nvme_mi_result res;
+	u8 hbuf[NVME_EVENT_PEL_HDR_SIZE + 8];
+	u8 *buf = NULL;
+	const u8 *p;
+	u64 start, pos;
+	u16 gn;
+	u32 tnev;
+	u64 tll;
+	bool scan;
+	int ret, err;
+
+	er->events = 0;
+	er->lost = 0;
+	er->bytes = 0;
+
+	hdr = (const void *)nvme_event_read_log(args, er, NVME_LOG_LID_PERSISTENT_EVENT,
+	                                        NVME_PEVENT_LOG_EST_CTX_AND_READ, 0,
+	                                        NVME_EVENT_PEL_HDR_SIZE, hbuf, &ret);
+	if (!hdr)
+		return ret;
+
+	gn = hdr->gen_number;
+	tnev = hdr->tnev;
+	tll = hdr->tll;
+	if (tll < NVME_EVENT_PEL_HDR_SIZE) {
+		nvme_trace(ERROR, "persistent event log length %llu\n", (unsigned long long)tll);
+		ret = -NVME_EVENT_ERR_FORMAT;
+		goto release;
+	}
+
+	if (gn == cur->pel_gn && tnev == cur->pel_tnev && tll == cur->pel_tll && cur->pel_next)
+		goto release;
+
+	start = NVME_EVENT_PEL_HDR_SIZE;
+	scan = cur->pel_next != 0;
+	if (cur->pel_next && cur->pel_next <= tll) {
+		ev = (const void *)nvme_event_read_log(args, er, NVME_LOG_LID_PERSISTENT_EVENT,
+		                                       NVME_PEVENT_LOG_READ, cur->pel_last,
+		                                       sizeof(*ev), hbuf, &ret);
+		if (!ev)
+			goto release;
+		if (ev->ets == cur->pel_ets) {
+			start = cur->pel_next;
+			scan = false;
+		}
+	}
+
+	if (start < tll) {
+		buf = malloc(tll - start + 8);
+		if (!buf) {
+			ret = -NVME_EVENT_ERR_IO;
+			goto release;
+		}
+		p = nvme_event_read_log(args, er, NVME_LOG_LID_PERSISTENT_EVENT, NVME_PEVENT_LOG_READ,
+		                        start, tll - start, buf, &ret);
+		if (!p)
+			goto release;
+
+		for (pos = start; pos + sizeof(*ev) <= tll; ) {
+			u64 len;
+
+			ev = (const void *)(p + pos - start);
+			// Event Header Length does not count the first 3 bytes.
+			len = ev->ehl + 3 + ev->el;
+			if (len < sizeof(*ev) || pos + len > tll) {
+				nvme_trace(ERROR, "persistent event at %llu, length %llu\n",
+				           (unsigned long long)pos, (unsigned long long)len);
+				ret = -NVME_EVENT_ERR_FORMAT;
+				break;
+			}
+
+			if (!scan || ev->ets > cur->pel_ets) {
+				memset(&res, 0, sizeof(res));
+				res.type = NVME_RESULT_PEL_EVENT;
+				nvme_decode_pel_event(ev, len, pos, &res.pel_event);
+				nvme_event_emit(args, er, &res);
+				cur->pel_last = pos;
+				cur->pel_next = pos + len;
+				cur->pel_ets = ev->ets;
+			}
+			pos += len;
+		}
+	}
+
+	if (!ret) {
+		cur->pel_gn = gn;
+		cur->pel_tnev = tnev;
+		cur->pel_tll = tll;
+		// An empty log still counts as read.
+		if (!cur->pel_next)
+			cur->pel_next = NVME_EVENT_PEL_HDR_SIZE;
+		ret = nvme_event_save(er);
+	}
+
+release:
+	free(buf);
+	if (!nvme_event_read_log(args, er, NVME_LOG_LID_PERSISTENT_EVENT, NVME_PEVENT_LOG_RELEASE_CTX,
+	                         0, NVME_EVENT_PEL_HDR_SIZE, hbuf, &err))
+		nvme_trace(WARN, "release persistent event log context (%d)\n", err);
+
+	return ret;
+}
+
+void nvme_event_show(const struct nvme_event_reader *er)
+{
+	printf("Cursor                      : %s\n", er->path);
+	printf("Error Count                 : %llu\n", (unsigned long long)er->cur.error_count);
+	printf("PEL Generation              : %d\n", er->cur.pel_gn);
+	printf("PEL Events                  : %d\n", er->cur.pel_tnev);
+	printf("PEL Next Offset             : %llu\n", (unsigned long long)er->cur.pel_next);
+	printf("New Events                  : %d\n", er->events);
+	if (er->lost)
+		printf("Lost Errors                 : %d\n", er->lost);
+	printf("Bytes Read                  : %llu\n", (unsigned long long)er->bytes);
+}
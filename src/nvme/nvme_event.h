@@ -0,0 +1,61 @@
+#ifndef NVME_EVENT_H
+#define NVME_EVENT_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Readers of the Error Information and the Persistent Event log that only
+ * return what is new since the cursor of the drive. Events are decoded into
+ * struct nvme_mi_result and written through the selected output format.
+ */
+// "NEVC"
+#define NVME_EVENT_CURSOR_MAGIC         (0x4356454E)
+#define NVME_EVENT_ERROR_SIZE           (64)
+// The events follow a 512 byte header.
+#define NVME_EVENT_PEL_HDR_SIZE         (512)
+
+enum nvme_event_error {
+	NVME_EVENT_SUCCESS = 0,
+	NVME_EVENT_ERR_PARAM,
+	NVME_EVENT_ERR_STATUS,
+	NVME_EVENT_ERR_IO,
+	NVME_EVENT_ERR_FORMAT,
+};
+
+#pragma pack(push, 1)
+
+// Persisted per drive, named after its UDID.
+struct nvme_event_cursor {
+	u32 magic;
+	// Error Information
+	u64 error_count;                // Error Count of the newest entry returned
+	u16 error_entries;              // Entries the log holds, ELPE + 1
+	// Persistent Event Log
+	u16 pel_gn;                     // Generation Number
+	u32 pel_tnev;
+	u64 pel_tll;
+	u64 pel_last;                   // Offset of the last event returned, 0 for none
+	u64 pel_next;                   // Offset after it
+	u64 pel_ets;                    // Timestamp of the last event returned
+};
+
+#pragma pack(pop)
+
+struct nvme_event_reader {
+	char path[256];
+	struct nvme_event_cursor cur;
+	// Last read
+	uint32_t events;
+	uint32_t lost;                  // Error entries that left the log before they were read
+	uint64_t bytes;
+};
+
+int nvme_event_open(struct nvme_event_reader *er, const char *dir, const u8 *udid);
+int nvme_event_save(const struct nvme_event_reader *er);
+int nvme_event_read_errors(struct aa_args *args, struct nvme_event_reader *er);
+int nvme_event_read_pel(struct aa_args *args, struct nvme_event_reader *er);
+void nvme_event_show(const struct nvme_event_reader *er);
+
+#endif // NVME_EVENT_H
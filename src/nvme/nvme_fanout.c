@@ -0,0 +1,310 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_fanout.h"
+#include "nvme_format.h"
+#include "utility.h"
+#include "i2c_mux.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+int nvme_fanout_add_target(struct nvme_fanout *fo, int handle, uint8_t seg, uint8_t slv_addr,
+                           uint8_t eid)
+{
+	struct nvme_fanout_result *r;
+
+	if (fo->ntarget == NVME_FANOUT_TARGET_MAX)
+		return -NVME_FANOUT_ERR_PARAM;
+
+	r = &fo->result[fo->ntarget++];
+	memset(r, 0, sizeof(*r));
+	r->handle = handle;
+	r->seg = seg;
+	r->slv_addr = slv_addr;
+	r->eid = eid;
+
+	return NVME_FANOUT_SUCCESS;
+}
+
+// Targets of one adapter, in the rank order of their mux segments.
+struct nvme_fanout_bus {
+	int handle;
+	uint8_t n;
+	uint8_t target[NVME_FANOUT_TARGET_MAX];
+	pid_t pid;                      // Worker, -1 when run in this process
+	int fd;                         // Results of the worker
+	uint64_t elapsed_us;            // Once its targets are up
+};
+
+// Take the response outstanding on the slot of args for r.
+static void nvme_fanout_complete(struct aa_args *args, struct nvme_fanout_result *r, uint64_t start)
+{
+	r->ret = nvme_mi_wait_slot(args, args->csi);
+	if (!r->ret)
+		r->ret = nvme_mi_get_result(args->csi, &r->res);
+
+	// The response may have been handled while the other slot was waited for.
+	r->latency_us = (r->ret ? time_us() : nvme_mi_get_done_us(args->csi)) - start - r->issue_us;
+}
+
+/**
+ * Send the op to every target of the bus with both command slots in flight:
+ * the request to the next target goes out while the previous one is being
+ * processed, and responses of different endpoints are received as their
+ * packets arrive. Times are taken once the targets are up.
+ */
+static void nvme_fanout_run_bus(struct aa_args *args, struct nvme_fanout *fo,
+                                struct nvme_fanout_bus *bus)
+{
+	struct aa_args slot_args = *args;
+	struct nvme_fanout_result *pend[NVME_MI_SLOT_MAX] = {NULL};
+	struct nvme_script *script;
+	uint64_t start;
+	bool slot = args->csi;
+	int next = 0, seg = -1, ret;
+
+	for (int i = 0; i < bus->n; i++) {
+		struct nvme_fanout_result *r = &fo->result[bus->target[i]];
+
+		if (fo->open && fo->open(fo->priv, r))
+			r->ret = -NVME_FANOUT_ERR_IO;
+	}
+
+	// Scratch for the ops that move data through the script buffer.
+	script = calloc(1, sizeof(*script));
+	if (!script) {
+		for (int i = 0; i < bus->n; i++)
+			fo->result[bus->target[i]].ret = -NVME_FANOUT_ERR_IO;
+		return;
+	}
+
+	slot_args.handle = bus->handle;
+	slot_args.async = true;
+	start = time_us();
+
+	while (true) {
+		slot_args.csi = slot;
+
+		if (pend[slot]) {
+			nvme_fanout_complete(&slot_args, pend[slot], start);
+			pend[slot] = NULL;
+		}
+
+		// Targets that could not be brought up are not sent anything.
+		while (next < bus->n && fo->result[bus->target[next]].ret)
+			next++;
+
+		if (next < bus->n) {
+			struct nvme_fanout_result *r = &fo->result[bus->target[next++]];
+
+			/**
+			 * A response comes back over the segment of its request, so the
+			 * other slot is done before the muxes are switched.
+			 */
+			if (r->seg != seg && pend[!slot]) {
+				slot_args.csi = !slot;
+				nvme_fanout_complete(&slot_args, pend[!slot], start);
+				pend[!slot] = NULL;
+				slot_args.csi = slot;
+			}
+			seg = r->seg;
+
+			slot_args.slv_addr = r->slv_addr;
+			slot_args.dst_eid = r->eid;
+			memset(&r->res, 0, sizeof(r->res));
+			r->issue_us = time_us() - start;
+
+			ret = i2c_mux_route(bus->handle, r->seg);
+			if (!ret)
+				ret = fo->cmd->fn(&slot_args, script, fo->param);
+			if (ret) {
+				r->ret = ret;
+				r->latency_us = time_us() - start - r->issue_us;
+			} else if (fo->cmd->drain) {
+				// Done already, only its result is left to take.
+				nvme_fanout_complete(&slot_args, r, start);
+			} else {
+				pend[slot] = r;
+			}
+		} else if (!pend[!slot]) {
+			break;
+		}
+
+		slot = !slot;
+	}
+
+	bus->elapsed_us = time_us() - start;
+	free(script);
+}
+
+/**
+ * Run the bus in a worker process, which hands its results and elapsed time
+ * back through a pipe. Without a worker the bus is run here.
+ */
+static void nvme_fanout_start(struct aa_args *args, struct nvme_fanout *fo,
+                              struct nvme_fanout_bus *bus)
+{
+	int fd[2], ret = 0;
+
+	bus->pid = -1;
+	if (!pipe(fd)) {
+		bus->pid = fork();
+		if (bus->pid < 0) {
+			close(fd[0]);
+			close(fd[1]);
+		}
+	}
+	if (bus->pid < 0) {
+		nvme_trace(WARN, "no worker for adapter %d\n", bus->handle);
+		nvme_fanout_run_bus(args, fo, bus);
+		return;
+	}
+
+	if (!bus->pid) {
+		close(fd[0]);
+		nvme_fanout_run_bus(args, fo, bus);
+		for (int i = 0; !ret && i < bus->n; i++)
+			ret = fd_xfer(fd[1], &fo->result[bus->target[i]], sizeof(fo->result[0]), true);
+		if (!ret)
+			ret = fd_xfer(fd[1], &bus->elapsed_us, sizeof(bus->elapsed_us), true);
+		_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fd[1]);
+	bus->fd = fd[0];
+}
+
+// Collect the results of the worker of the bus, the ones it did not hand back fail.
+static void nvme_fanout_join(struct nvme_fanout *fo, struct nvme_fanout_bus *bus)
+{
+	int ret = 0;
+
+	if (bus->pid < 0)
+		return;
+
+	for (int i = 0; i < bus->n; i++) {
+		struct nvme_fanout_result *r = &fo->result[bus->target[i]];
+
+		if (!ret && fd_xfer(bus->fd, r, sizeof(*r), false))
+			ret = -NVME_FANOUT_ERR_IO;
+		if (ret) {
+			r->ret = ret;
+			r->latency_us = 0;
+		}
+	}
+	if (!ret && fd_xfer(bus->fd, &bus->elapsed_us, sizeof(bus->elapsed_us), false))
+		ret = -NVME_FANOUT_ERR_IO;
+	if (ret)
+		nvme_trace(ERROR, "worker of adapter %d (%d)\n", bus->handle, ret);
+
+	close(bus->fd);
+	waitpid(bus->pid, NULL, 0);
+}
+
+/**
+ * Send the op to every target. The targets of each adapter are run by a
+ * worker of their own, so the whole set takes about as long as the busiest
+ * adapter: its targets are still served two at a time, the two command slots
+ * of the bus. Nothing is printed while responses come in, nvme_fanout_show()
+ * prints them in submission order.
+ *
+ * Targets are visited in the rank order of their mux segments, so every mux
+ * is switched as few times as possible.
+ */
+int nvme_fanout_run(struct aa_args *args, struct nvme_fanout *fo)
+{
+	enum nvme_format_type fmt = nvme_format_get();
+	struct nvme_fanout_bus *bus;
+	int nbus = 0, i, j, k;
+
+	if (!fo->cmd || !fo->ntarget)
+		return -NVME_FANOUT_ERR_PARAM;
+
+	bus = calloc(fo->ntarget, sizeof(*bus));
+	if (!bus)
+		return -NVME_FANOUT_ERR_IO;
+
+	// Stable, targets of one segment keep their order.
+	for (i = 0; i < fo->ntarget; i++) {
+		struct nvme_fanout_result *r = &fo->result[i];
+		int rank;
+
+		for (j = 0; j < nbus && bus[j].handle != r->handle; j++)
+			;
+		if (j == nbus) {
+			bus[nbus].handle = r->handle;
+			bus[nbus++].pid = -1;
+		}
+
+		rank = i2c_mux_rank(r->handle, r->seg);
+		for (k = bus[j].n; k > 0 &&
+		     i2c_mux_rank(r->handle, fo->result[bus[j].target[k - 1]].seg) > rank; k--)
+			bus[j].target[k] = bus[j].target[k - 1];
+		bus[j].target[k] = i;
+		bus[j].n++;
+		r->ret = 0;
+	}
+
+	nvme_format_set(NVME_FORMAT_NONE);
+
+	if (nbus == 1) {
+		nvme_fanout_run_bus(args, fo, &bus[0]);
+	} else {
+		// Nothing buffered is written twice by the workers.
+		fflush(stdout);
+		fflush(stderr);
+		for (i = 0; i < nbus; i++)
+			nvme_fanout_start(args, fo, &bus[i]);
+		for (i = 0; i < nbus; i++)
+			nvme_fanout_join(fo, &bus[i]);
+	}
+
+	nvme_format_set(fmt);
+
+	fo->elapsed_us = 0;
+	for (i = 0; i < nbus; i++)
+		if (bus[i].elapsed_us > fo->elapsed_us)
+			fo->elapsed_us = bus[i].elapsed_us;
+	free(bus);
+
+	fo->failed = 0;
+	fo->sum_us = 0;
+	for (i = 0; i < fo->ntarget; i++) {
+		fo->sum_us += fo->result[i].latency_us;
+		if (fo->result[i].ret || fo->result[i].res.status)
+			fo->failed++;
+	}
+
+	return fo->failed ? -NVME_FANOUT_ERR_IO : NVME_FANOUT_SUCCESS;
+}
+
+void nvme_fanout_show(const struct nvme_fanout *fo)
+{
+	enum nvme_format_type fmt = nvme_format_get();
+
+	for (int i = 0; i < fo->ntarget; i++) {
+		const struct nvme_fanout_result *r = &fo->result[i];
+
+		// The target line tells which endpoint the result that follows is from.
+		if (fmt == NVME_FORMAT_TEXT)
+			printf("Target %d:%02x/%-3d issue %6d us latency %6d us status %x (%d)\n", r->seg,
+			       r->slv_addr, r->eid, r->issue_us, r->latency_us, r->res.status, r->ret);
+		else if (fmt == NVME_FORMAT_JSON)
+			printf("{\"segment\":%d,\"slv_addr\":%d,\"eid\":%d,\"issue_us\":%d,\"latency_us\":%d,"
+			       "\"ret\":%d}\n", r->seg, r->slv_addr, r->eid, r->issue_us, r->latency_us, r->ret);
+		if (!r->ret)
+			nvme_format_result(stdout, &r->res, fmt);
+	}
+
+	if (fmt != NVME_FORMAT_TEXT)
+		return;
+
+	printf("Command                     : %s\n", fo->cmd->name);
+	printf("Targets                     : %d\n", fo->ntarget);
+	printf("Failed                      : %d\n", fo->failed);
+	printf("Elapsed                     : %llu us\n", (unsigned long long)fo->elapsed_us);
+	printf("Serial Estimate             : %llu us\n", (unsigned long long)fo->sum_us);
+}
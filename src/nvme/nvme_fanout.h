@@ -0,0 +1,57 @@
+#ifndef NVME_FANOUT_H
+#define NVME_FANOUT_H
+
+#include "types.h"
+#include "nvme_decode.h"
+#include "nvme_script.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NVME_FANOUT_TARGET_MAX          (64)
+
+enum nvme_fanout_error {
+	NVME_FANOUT_SUCCESS = 0,
+	NVME_FANOUT_ERR_PARAM,
+	NVME_FANOUT_ERR_IO,
+};
+
+struct nvme_fanout_result {
+	int handle;                     // Adapter of the target
+	uint8_t seg;                    // Mux segment, see i2c_mux
+	uint8_t slv_addr;
+	uint8_t eid;
+	int ret;                        // Error sending or waiting, the response status is in res
+	struct nvme_mi_result res;
+	uint32_t issue_us;              // Since its adapter started, once the targets were up
+	uint32_t latency_us;            // From issue to response
+};
+
+/**
+ * One op of the script command set, sent to every target. Results are kept
+ * in submission order whatever order the responses arrive in, and the
+ * targets behind muxes are visited segment by segment.
+ *
+ * Each adapter is a bus of its own with at most two commands in flight, one
+ * per command slot. The MCTP stack serves a single adapter per process, so
+ * the targets of every adapter but a lone one are run by a worker process of
+ * their own, which first brings them up through open when it is set.
+ */
+struct nvme_fanout {
+	const struct nvme_script_cmd *cmd;
+	uint32_t param[NVME_SCRIPT_PARAM_MAX];
+	int (*open)(void *priv, const struct nvme_fanout_result *r);
+	void *priv;
+	uint8_t ntarget;
+	struct nvme_fanout_result result[NVME_FANOUT_TARGET_MAX];
+	// Last run
+	uint8_t failed;
+	uint64_t elapsed_us;            // Of the slowest adapter
+	uint64_t sum_us;                // Latencies added up, what a serial run would take
+};
+
+int nvme_fanout_add_target(struct nvme_fanout *fo, int handle, uint8_t seg, uint8_t slv_addr,
+                           uint8_t eid);
+int nvme_fanout_run(struct aa_args *args, struct nvme_fanout *fo);
+void nvme_fanout_show(const struct nvme_fanout *fo);
+
+#endif // NVME_FANOUT_H
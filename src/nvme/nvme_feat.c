@@ -0,0 +1,336 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_feat.h"
+#include "nvme_decode.h"
+#include "libnvme_types.h"
+#include "crc32.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Feature Identifiers of the NVMe Base and NVMe-MI specifications.
+const u8 nvme_feat_default_fid[] = {
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e,
+	0x1f, 0x20, 0x21, 0x78, 0x79, 0x7d, 0x7e, 0x7f, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85,
+};
+
+const u8 nvme_feat_default_nfid = sizeof(nvme_feat_default_fid);
+
+static const char *_fid[256] = {
+	[NVME_FEAT_FID_ARBITRATION] = "Arbitration",
+	[NVME_FEAT_FID_POWER_MGMT] = "Power Management",
+	[NVME_FEAT_FID_LBA_RANGE] = "LBA Range Type",
+	[NVME_FEAT_FID_TEMP_THRESH] = "Temperature Threshold",
+	[NVME_FEAT_FID_ERR_RECOVERY] = "Error Recovery",
+	[NVME_FEAT_FID_VOLATILE_WC] = "Volatile Write Cache",
+	[NVME_FEAT_FID_NUM_QUEUES] = "Number of Queues",
+	[NVME_FEAT_FID_IRQ_COALESCE] = "Interrupt Coalescing",
+	[NVME_FEAT_FID_IRQ_CONFIG] = "Interrupt Vector Configuration",
+	[NVME_FEAT_FID_WRITE_ATOMIC] = "Write Atomicity Normal",
+	[NVME_FEAT_FID_ASYNC_EVENT] = "Asynchronous Event Configuration",
+	[NVME_FEAT_FID_AUTO_PST] = "Autonomous Power State Transition",
+	[NVME_FEAT_FID_HOST_MEM_BUF] = "Host Memory Buffer",
+	[NVME_FEAT_FID_TIMESTAMP] = "Timestamp",
+	[NVME_FEAT_FID_KATO] = "Keep Alive Timer",
+	[NVME_FEAT_FID_HCTM] = "Host Controlled Thermal Management",
+	[NVME_FEAT_FID_NOPSC] = "Non-Operational Power State Config",
+	[NVME_FEAT_FID_RRL] = "Read Recovery Level Config",
+	[NVME_FEAT_FID_PLM_CONFIG] = "Predictable Latency Mode Config",
+	[NVME_FEAT_FID_PLM_WINDOW] = "Predictable Latency Mode Window",
+	[NVME_FEAT_FID_LBA_STS_INTERVAL] = "LBA Status Information Attributes",
+	[NVME_FEAT_FID_HOST_BEHAVIOR] = "Host Behavior Support",
+	[NVME_FEAT_FID_SANITIZE] = "Sanitize Config",
+	[NVME_FEAT_FID_ENDURANCE_EVT_CFG] = "Endurance Group Event Configuration",
+	[NVME_FEAT_FID_IOCS_PROFILE] = "I/O Command Set Profile",
+	[NVME_FEAT_FID_SPINUP_CONTROL] = "Spinup Control",
+	[NVME_FEAT_FID_EMB_MGMT_CTRL_ADDR] = "Embedded Management Controller Address",
+	[NVME_FEAT_FID_HOST_MGMT_AGENT_ADDR] = "Host Management Agent Address",
+	[NVME_FEAT_FID_ENH_CTRL_METADATA] = "Enhanced Controller Metadata",
+	[NVME_FEAT_FID_CTRL_METADATA] = "Controller Metadata",
+	[NVME_FEAT_FID_NS_METADATA] = "Namespace Metadata",
+	[NVME_FEAT_FID_SW_PROGRESS] = "Software Progress Marker",
+	[NVME_FEAT_FID_HOST_ID] = "Host Identifier",
+	[NVME_FEAT_FID_RESV_MASK] = "Reservation Notification Mask",
+	[NVME_FEAT_FID_RESV_PERSIST] = "Reservation Persistence",
+	[NVME_FEAT_FID_WRITE_PROTECT] = "Namespace Write Protection Config",
+};
+
+static const char *_sel[NVME_FEAT_SEL_NUM] = {
+	[NVME_GET_FEATURES_SEL_CURRENT] = "current",
+	[NVME_GET_FEATURES_SEL_DEFAULT] = "default",
+	[NVME_GET_FEATURES_SEL_SAVED] = "saved",
+};
+
+static const char *nvme_feat_name(u8 fid)
+{
+	return _fid[fid] ? _fid[fid] : "";
+}
+
+// Get Features queued for a snapshot, feat indexes snap->feat.
+struct nvme_feat_item {
+	u8 feat;
+	u8 sel;
+};
+
+static void nvme_feat_complete(struct aa_args *args, struct nvme_feat_snapshot *snap,
+                               const struct nvme_feat_item *item, const u8 *buf,
+                               struct nvme_feat_item *queue, u16 *tail)
+{
+	struct nvme_feat_entry *feat = &snap->feat[item->feat];
+	struct nvme_mi_result res;
+	u32 len;
+
+	if (nvme_mi_wait_slot(args, args->csi))
+		return;
+
+	nvme_mi_get_result(args->csi, &res);
+	// A FID without Supported Capabilities is not implemented, others may reject a SEL.
+	if (res.status || res.sf)
+		return;
+
+	feat->valid |= 1 << item->sel;
+
+	if (item->sel == NVME_GET_FEATURES_SEL_SUPPORTED) {
+		feat->cap = res.cqedw0 & 0x7;
+		for (u8 sel = 0; sel < NVME_FEAT_SEL_NUM; sel++) {
+			// Saved values only exist for a saveable feature.
+			if (sel == NVME_GET_FEATURES_SEL_SAVED && !(feat->cap & 0x1))
+				continue;
+			queue[*tail].feat = item->feat;
+			queue[(*tail)++].sel = sel;
+		}
+		return;
+	}
+
+	feat->value[item->sel] = res.cqedw0;
+	len = nvme_cmd_get_data_len(args->csi);
+	if (len)
+		feat->crc[item->sel] = ~crc32_le_generic(CRC_INIT, buf, len, REVERSED_POLY_CRC32);
+}
+
+/**
+ * Query the Supported Capabilities (SEL 3) of every FID, then the current,
+ * default and, for a saveable feature, the saved value of the ones that
+ * answered. Commands alternate between both command slots and the values of
+ * a FID are queued as soon as its capabilities are known.
+ */
+int nvme_feat_snapshot(struct aa_args *args, struct nvme_feat_snapshot *snap, const u8 *fid,
+                       u8 nfid)
+{
+	struct aa_args slot_args = *args;
+	struct nvme_feat_item queue[NVME_FEAT_MAX * (NVME_FEAT_SEL_NUM + 1)];
+	struct nvme_feat_item pend[NVME_MI_SLOT_MAX];
+	bool busy[NVME_MI_SLOT_MAX] = {false};
+	u8 *buf[NVME_MI_SLOT_MAX];
+	u16 head = 0, tail = 0, n = 0;
+	uint64_t start = time_us();
+	bool slot = args->csi;
+
+	if (!nfid || nfid > NVME_FEAT_MAX)
+		return -NVME_FEAT_ERR_PARAM;
+
+	memset(snap->feat, 0, sizeof(snap->feat));
+	snap->cmds = 0;
+	for (u8 i = 0; i < nfid; i++) {
+		snap->feat[i].fid = fid[i];
+		queue[tail].feat = i;
+		queue[tail++].sel = NVME_GET_FEATURES_SEL_SUPPORTED;
+	}
+
+	buf[0] = malloc(NVME_FEAT_DATA_SIZE * NVME_MI_SLOT_MAX);
+	if (!buf[0])
+		return -NVME_FEAT_ERR_IO;
+
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++) {
+		buf[i] = buf[0] + i * NVME_FEAT_DATA_SIZE;
+		nvme_cmd_set_data_buf(i, buf[i], NVME_FEAT_DATA_SIZE);
+	}
+
+	slot_args.async = true;
+
+	while (true) {
+		slot_args.csi = slot;
+
+		// The older of the two outstanding commands is always on this slot.
+		if (busy[slot]) {
+			nvme_feat_complete(&slot_args, snap, &pend[slot], buf[slot], queue, &tail);
+			busy[slot] = false;
+		}
+
+		if (head < tail) {
+			pend[slot] = queue[head++];
+			snap->cmds++;
+			busy[slot] = !nvme_get_features(&slot_args, snap->feat[pend[slot].feat].fid,
+			                                pend[slot].sel, 0);
+		} else if (!busy[!slot]) {
+			break;
+		}
+
+		slot = !slot;
+	}
+
+	nvme_mi_wait(&slot_args);
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++)
+		nvme_cmd_set_data_buf(i, NULL, 0);
+	free(buf[0]);
+
+	// Keep the features that reported their capabilities.
+	for (u8 i = 0; i < nfid; i++)
+		if (snap->feat[i].valid & 1 << NVME_GET_FEATURES_SEL_SUPPORTED)
+			snap->feat[n++] = snap->feat[i];
+
+	snap->hdr.magic = NVME_FEAT_MAGIC;
+	snap->hdr.version = NVME_FEAT_VERSION;
+	snap->hdr.nfeat = n;
+	snap->hdr.time = time(NULL);
+	snap->elapsed_us = time_us() - start;
+
+	return NVME_FEAT_SUCCESS;
+}
+
+// The snapshot is replaced as a whole so a crash leaves the old one.
+int nvme_feat_save(const char *path, const struct nvme_feat_snapshot *snap)
+{
+	char tmp[256];
+	FILE *fp;
+	int ret = NVME_FEAT_SUCCESS;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp))
+		return -NVME_FEAT_ERR_PARAM;
+
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", tmp);
+		return -NVME_FEAT_ERR_IO;
+	}
+
+	if (fwrite(&snap->hdr, sizeof(snap->hdr), 1, fp) != 1 ||
+	    (snap->hdr.nfeat &&
+	     fwrite(snap->feat, sizeof(snap->feat[0]), snap->hdr.nfeat, fp) != snap->hdr.nfeat))
+		ret = -NVME_FEAT_ERR_IO;
+	if (fclose(fp))
+		ret = -NVME_FEAT_ERR_IO;
+
+#ifdef WIN32
+	if (!ret)
+		remove(path);
+#endif
+	if (!ret && rename(tmp, path))
+		ret = -NVME_FEAT_ERR_IO;
+
+	if (ret) {
+		nvme_trace(ERROR, "write %s\n", path);
+		remove(tmp);
+	}
+
+	return ret;
+}
+
+int nvme_feat_load(const char *path, struct nvme_feat_snapshot *snap)
+{
+	FILE *fp = fopen(path, "rb");
+	int ret = NVME_FEAT_SUCCESS;
+
+	if (!fp)
+		return -NVME_FEAT_ERR_IO;
+
+	memset(snap, 0, sizeof(*snap));
+	if (fread(&snap->hdr, sizeof(snap->hdr), 1, fp) != 1 || snap->hdr.magic != NVME_FEAT_MAGIC ||
+	    snap->hdr.version != NVME_FEAT_VERSION || snap->hdr.nfeat > NVME_FEAT_MAX ||
+	    (snap->hdr.nfeat &&
+	     fread(snap->feat, sizeof(snap->feat[0]), snap->hdr.nfeat, fp) != snap->hdr.nfeat)) {
+		nvme_trace(ERROR, "invalid snapshot %s\n", path);
+		ret = -NVME_FEAT_ERR_FORMAT;
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+static const struct nvme_feat_entry *nvme_feat_find(const struct nvme_feat_snapshot *snap, u8 fid)
+{
+	for (int i = 0; i < snap->hdr.nfeat; i++)
+		if (snap->feat[i].fid == fid)
+			return &snap->feat[i];
+
+	return NULL;
+}
+
+/**
+ * Print every difference of snap against base, one per line, and return
+ * how many there are. A value is compared when both snapshots hold it.
+ */
+int nvme_feat_diff(FILE *fp, const struct nvme_feat_snapshot *base,
+                   const struct nvme_feat_snapshot *snap)
+{
+	int ndiff = 0;
+
+	for (int i = 0; i < base->hdr.nfeat; i++) {
+		const struct nvme_feat_entry *b = &base->feat[i];
+		const struct nvme_feat_entry *s = nvme_feat_find(snap, b->fid);
+
+		if (!s) {
+			fprintf(fp, "  fid %02x %-38s: missing\n", b->fid, nvme_feat_name(b->fid));
+			ndiff++;
+			continue;
+		}
+
+		if (s->cap != b->cap) {
+			fprintf(fp, "  fid %02x %-38s: capabilities %x -> %x\n", b->fid,
+			        nvme_feat_name(b->fid), b->cap, s->cap);
+			ndiff++;
+		}
+
+		for (int sel = 0; sel < NVME_FEAT_SEL_NUM; sel++) {
+			if (!(b->valid & s->valid & 1 << sel))
+				continue;
+			if (s->value[sel] != b->value[sel]) {
+				fprintf(fp, "  fid %02x %-38s: %-7s %08x -> %08x\n", b->fid,
+				        nvme_feat_name(b->fid), _sel[sel], b->value[sel], s->value[sel]);
+				ndiff++;
+			}
+			if (s->crc[sel] != b->crc[sel]) {
+				fprintf(fp, "  fid %02x %-38s: %-7s data differs\n", b->fid,
+				        nvme_feat_name(b->fid), _sel[sel]);
+				ndiff++;
+			}
+		}
+	}
+
+	for (int i = 0; i < snap->hdr.nfeat; i++) {
+		if (nvme_feat_find(base, snap->feat[i].fid))
+			continue;
+		fprintf(fp, "  fid %02x %-38s: not in baseline\n", snap->feat[i].fid,
+		        nvme_feat_name(snap->feat[i].fid));
+		ndiff++;
+	}
+
+	return ndiff;
+}
+
+void nvme_feat_show(const struct nvme_feat_snapshot *snap)
+{
+	printf("Features                    : %d\n", snap->hdr.nfeat);
+	printf("Commands                    : %d\n", snap->cmds);
+	printf("Elapsed                     : %llu ms\n", (unsigned long long)snap->elapsed_us / 1000);
+	printf("  %-3s %-38s %-4s %-8s %-8s %-8s\n", "fid", "name", "cap", "current", "default",
+	       "saved");
+	for (int i = 0; i < snap->hdr.nfeat; i++) {
+		const struct nvme_feat_entry *f = &snap->feat[i];
+
+		printf("  %02x  %-38s %c%c%c ", f->fid, nvme_feat_name(f->fid), f->cap & 0x1 ? 'S' : '-',
+		       f->cap & 0x2 ? 'N' : '-', f->cap & 0x4 ? 'C' : '-');
+		for (int sel = 0; sel < NVME_FEAT_SEL_NUM; sel++) {
+			if (f->valid & 1 << sel)
+				printf(" %08x%s", f->value[sel], f->crc[sel] ? "+" : " ");
+			else
+				printf(" %-8s ", "-");
+		}
+		printf("\n");
+	}
+}
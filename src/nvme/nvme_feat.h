@@ -0,0 +1,65 @@
+#ifndef NVME_FEAT_H
+#define NVME_FEAT_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// "NFSN"
+#define NVME_FEAT_MAGIC                 (0x4E53464E)
+#define NVME_FEAT_VERSION               (1)
+#define NVME_FEAT_MAX                   (64)
+#define NVME_FEAT_DRIVE_MAX             (16)
+// Current, Default and Saved
+#define NVME_FEAT_SEL_NUM               (3)
+#define NVME_FEAT_DATA_SIZE             (4096)
+
+enum nvme_feat_error {
+	NVME_FEAT_SUCCESS = 0,
+	NVME_FEAT_ERR_PARAM,
+	NVME_FEAT_ERR_IO,
+	NVME_FEAT_ERR_FORMAT,
+};
+
+#pragma pack(push, 1)
+
+struct nvme_feat_entry {
+	u8 fid;
+	u8 cap;                         // Supported Capabilities: saveable, ns specific, changeable
+	u8 valid;                       // Bit n is set when SEL n was read
+	u8 rsvd;
+	u32 value[NVME_FEAT_SEL_NUM];   // CQE Dword 0
+	u32 crc[NVME_FEAT_SEL_NUM];     // CRC-32 of the returned data, 0 without data
+};
+
+struct nvme_feat_hdr {
+	u32 magic;
+	u16 version;
+	u16 nfeat;
+	u8 udid[16];
+	u64 time;                       // Seconds since the epoch
+};
+
+#pragma pack(pop)
+
+struct nvme_feat_snapshot {
+	struct nvme_feat_hdr hdr;
+	struct nvme_feat_entry feat[NVME_FEAT_MAX];
+	// Last snapshot
+	uint32_t cmds;
+	uint64_t elapsed_us;
+};
+
+extern const u8 nvme_feat_default_fid[];
+extern const u8 nvme_feat_default_nfid;
+
+int nvme_feat_snapshot(struct aa_args *args, struct nvme_feat_snapshot *snap, const u8 *fid,
+                       u8 nfid);
+int nvme_feat_save(const char *path, const struct nvme_feat_snapshot *snap);
+int nvme_feat_load(const char *path, struct nvme_feat_snapshot *snap);
+int nvme_feat_diff(FILE *fp, const struct nvme_feat_snapshot *base,
+                   const struct nvme_feat_snapshot *snap);
+void nvme_feat_show(const struct nvme_feat_snapshot *snap);
+
+#endif // NVME_FEAT_H
@@ -0,0 +1,367 @@
+#include "nvme.h"
+#include "nvme_decode.h"
+#include "nvme_format.h"
+
+#include <stddef.h>
+#include <string.h>
+
+enum nvme_field_kind {
+	NVME_FIELD_UINT,
+	NVME_FIELD_SINT,
+	NVME_FIELD_HEX,
+	NVME_FIELD_STR,
+	NVME_FIELD_LIST,                // u16 array, count taken from the field before
+};
+
+struct nvme_field {
+	const char *name;
+	u16 offset;
+	u16 size;
+	u8 kind;
+};
+
+#define NVME_FIELD(type, member, kind) \
+	{ #member, offsetof(type, member), sizeof(((type *)0)->member), kind }
+
+#define NVME_FIELD_END  { NULL, 0, 0, 0 }
+
+static const struct nvme_field nvme_subsys_info_fields[] = {
+	NVME_FIELD(struct nvme_subsys_info, nump, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_subsys_info, mjr, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_subsys_info, mnr, NVME_FIELD_UINT),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_port_info_fields[] = {
+	NVME_FIELD(struct nvme_port_info, portid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, portt, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, mmctptus, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, meb, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, pcie_mps, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, pcie_sls, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_port_info, pcie_cls, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, pcie_mlw, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, pcie_nlw, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, pcie_pn, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, smb_vpd_addr, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_port_info, smb_mvpd_freq, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, smb_mme_addr, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_port_info, smb_mme_freq, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_port_info, smb_nvmebm, NVME_FIELD_UINT),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_ctrl_list_fields[] = {
+	NVME_FIELD(struct nvme_ctrl_list_info, num, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_list_info, id, NVME_FIELD_LIST),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_ctrl_info_fields[] = {
+	NVME_FIELD(struct nvme_ctrl_info, portid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_info, prii, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_info, pri, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_ctrl_info, vid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_ctrl_info, did, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_ctrl_info, ssvid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_ctrl_info, ssid, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_subsys_health_fields[] = {
+	NVME_FIELD(struct nvme_subsys_health, nss, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_subsys_health, sw, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_subsys_health, ctemp, NVME_FIELD_SINT),
+	NVME_FIELD(struct nvme_subsys_health, pdlu, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_subsys_health, ccs, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_ctrl_health_fields[] = {
+	NVME_FIELD(struct nvme_ctrl_health, rent, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_health, ctlid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_health, csts, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_ctrl_health, ctemp, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_health, pdlu, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_health, spare, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_ctrl_health, cwarn, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_config_fields[] = {
+	NVME_FIELD(struct nvme_config_info, cfg_id, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_config_info, value, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_identify_fields[] = {
+	NVME_FIELD(struct nvme_identify_info, vid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, ssvid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, sn, NVME_FIELD_STR),
+	NVME_FIELD(struct nvme_identify_info, mn, NVME_FIELD_STR),
+	NVME_FIELD(struct nvme_identify_info, fr, NVME_FIELD_STR),
+	NVME_FIELD(struct nvme_identify_info, mdts, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, cntlid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, ver, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, oacs, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, frmw, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, lpa, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_identify_info, elpe, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, npss, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, wctemp, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, cctemp, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_identify_info, nn, NVME_FIELD_UINT),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_smart_fields[] = {
+	NVME_FIELD(struct nvme_smart_info, critical_warning, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_smart_info, temperature, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, avail_spare, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, spare_thresh, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, percent_used, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, data_units_read, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, data_units_written, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, host_reads, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, host_writes, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, ctrl_busy_time, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, power_cycles, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, power_on_hours, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, unsafe_shutdowns, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, media_errors, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, num_err_log_entries, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, warning_temp_time, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_smart_info, critical_comp_time, NVME_FIELD_UINT),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_features_fields[] = {
+	NVME_FIELD(struct nvme_features_info, fid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_features_info, sel, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_features_info, cqedw0, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_error_entry_fields[] = {
+	NVME_FIELD(struct nvme_error_entry_info, error_count, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, sqid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, cmdid, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, status_field, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, parm_error_location, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, lba, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, nsid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, vs, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, trtype, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, csi, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_error_entry_info, opcode, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, cs, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_error_entry_info, trtype_spec_info, NVME_FIELD_HEX),
+	NVME_FIELD_END
+};
+
+static const struct nvme_field nvme_pel_event_fields[] = {
+	NVME_FIELD(struct nvme_pel_event_info, offset, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_pel_event_info, etype, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_pel_event_info, etype_rev, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_pel_event_info, cntlid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_pel_event_info, ets, NVME_FIELD_HEX),
+	NVME_FIELD(struct nvme_pel_event_info, pelpid, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_pel_event_info, vsil, NVME_FIELD_UINT),
+	NVME_FIELD(struct nvme_pel_event_info, el, NVME_FIELD_UINT),
+	NVME_FIELD_END
+};
+
+static const struct {
+	const char *name;
+	const struct nvme_field *fields;
+} nvme_result_desc[NVME_RESULT_MAX] = {
+	[NVME_RESULT_NONE]          = { "none",          NULL },
+	[NVME_RESULT_SUBSYS_INFO]   = { "subsys_info",   nvme_subsys_info_fields },
+	[NVME_RESULT_PORT_INFO]     = { "port_info",     nvme_port_info_fields },
+	[NVME_RESULT_CTRL_LIST]     = { "ctrl_list",     nvme_ctrl_list_fields },
+	[NVME_RESULT_CTRL_INFO]     = { "ctrl_info",     nvme_ctrl_info_fields },
+	[NVME_RESULT_SUBSYS_HEALTH] = { "subsys_health", nvme_subsys_health_fields },
+	[NVME_RESULT_CTRL_HEALTH]   = { "ctrl_health",   nvme_ctrl_health_fields },
+	[NVME_RESULT_CONFIG]        = { "config",        nvme_config_fields },
+	[NVME_RESULT_IDENTIFY]      = { "identify",      nvme_identify_fields },
+	[NVME_RESULT_SMART]         = { "smart",         nvme_smart_fields },
+	[NVME_RESULT_FEATURES]      = { "features",      nvme_features_fields },
+	[NVME_RESULT_ERROR_ENTRY]   = { "error_entry",   nvme_error_entry_fields },
+	[NVME_RESULT_PEL_EVENT]     = { "pel_event",     nvme_pel_event_fields },
+};
+
+static const char *nvme_format_name[NVME_FORMAT_MAX] = {
+	[NVME_FORMAT_NONE]   = "none",
+	[NVME_FORMAT_TEXT]   = "text",
+	[NVME_FORMAT_JSON]   = "json",
+	[NVME_FORMAT_BINARY] = "binary",
+};
+
+static enum nvme_format_type nvme_format_cur = NVME_FORMAT_TEXT;
+
+void nvme_format_set(enum nvme_format_type fmt)
+{
+	if (fmt < NVME_FORMAT_MAX)
+		nvme_format_cur = fmt;
+}
+
+enum nvme_format_type nvme_format_get(void)
+{
+	return nvme_format_cur;
+}
+
+int nvme_format_parse(const char *name)
+{
+	for (int i = 0; i < NVME_FORMAT_MAX; i++) {
+		if (!strcmp(name, nvme_format_name[i]))
+			return i;
+	}
+
+	// Accept the short form "bin" as well.
+	if (!strcmp(name, "bin"))
+		return NVME_FORMAT_BINARY;
+
+	return -1;
+}
+
+static u64 nvme_field_uint(const void *base, const struct nvme_field *f)
+{
+	u64 v = 0;
+
+	// Little-endian host, the low bytes come first.
+	memcpy(&v, (const u8 *)base + f->offset, f->size > sizeof(v) ? sizeof(v) : f->size);
+
+	return v;
+}
+
+static s64 nvme_field_sint(const void *base, const struct nvme_field *f)
+{
+	u64 v = nvme_field_uint(base, f);
+	u8 shift = 64 - f->size * 8;
+
+	return (s64)(v << shift) >> shift;
+}
+
+static void nvme_format_json_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(fp, "\\%c", *str);
+		else if ((u8)*str < 0x20 || (u8)*str > 0x7e)
+			fprintf(fp, "\\u%04x", (u8)*str);
+		else
+			fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static void nvme_format_fields(FILE *fp, const void *base, const struct nvme_field *fields,
+                               bool json)
+{
+	u64 cnt = 0;
+
+	for (const struct nvme_field *f = fields; f->name; f++) {
+		if (json)
+			fprintf(fp, ",\"%s\":", f->name);
+		else
+			fprintf(fp, "%-28s: ", f->name);
+
+		switch (f->kind) {
+		case NVME_FIELD_UINT:
+			cnt = nvme_field_uint(base, f);
+			fprintf(fp, "%llu", (unsigned long long)cnt);
+			break;
+		case NVME_FIELD_SINT:
+			fprintf(fp, "%lld", (long long)nvme_field_sint(base, f));
+			break;
+		case NVME_FIELD_HEX:
+			if (json)
+				fprintf(fp, "%llu", (unsigned long long)nvme_field_uint(base, f));
+			else
+				fprintf(fp, "0x%llx", (unsigned long long)nvme_field_uint(base, f));
+			break;
+		case NVME_FIELD_STR:
+			if (json)
+				nvme_format_json_string(fp, (const char *)base + f->offset);
+			else
+				fprintf(fp, "%s", (const char *)base + f->offset);
+			break;
+		case NVME_FIELD_LIST: {
+			const u16 *list = (const void *)((const u8 *)base + f->offset);
+			u64 max = f->size / sizeof(*list);
+
+			if (cnt > max)
+				cnt = max;
+			if (json)
+				fputc('[', fp);
+			for (u64 i = 0; i < cnt; i++) {
+				if (json)
+					fprintf(fp, "%s%u", i ? "," : "", list[i]);
+				else
+					fprintf(fp, "%s0x%04x", i ? " " : "", list[i]);
+			}
+			if (json)
+				fputc(']', fp);
+			break;
+		}
+		}
+
+		if (!json)
+			fputc('\n', fp);
+	}
+}
+
+int nvme_format_result(FILE *fp, const struct nvme_mi_result *res, enum nvme_format_type fmt)
+{
+	const char *name = res->type < NVME_RESULT_MAX ? nvme_result_desc[res->type].name : "none";
+	const struct nvme_field *fields = res->type < NVME_RESULT_MAX ?
+	                                  nvme_result_desc[res->type].fields : NULL;
+
+	switch (fmt) {
+	case NVME_FORMAT_NONE:
+		break;
+	case NVME_FORMAT_TEXT:
+		fprintf(fp, "%-28s: %s\n", "result", name);
+		fprintf(fp, "%-28s: %d\n", "csi", res->csi);
+		fprintf(fp, "%-28s: %d\n", "nmimt", res->nmimt);
+		fprintf(fp, "%-28s: 0x%02x\n", "opc", res->opc);
+		fprintf(fp, "%-28s: %d\n", "status", res->status);
+		fprintf(fp, "%-28s: 0x%x\n", "nmresp", res->nmresp);
+		if (fields && !res->status)
+			nvme_format_fields(fp, &res->subsys_info, fields, false);
+		break;
+	case NVME_FORMAT_JSON:
+		fprintf(fp, "{\"result\":\"%s\",\"csi\":%d,\"nmimt\":%d,\"opc\":%d,\"status\":%d,\"nmresp\":%u",
+		        name, res->csi, res->nmimt, res->opc, res->status, res->nmresp);
+		if (fields && !res->status)
+			nvme_format_fields(fp, &res->subsys_info, fields, true);
+		fprintf(fp, "}\n");
+		break;
+	case NVME_FORMAT_BINARY: {
+		struct nvme_format_record rec = {
+			.magic = NVME_FORMAT_RECORD_MAGIC,
+			.type = res->type,
+			.csi = res->csi,
+			.nmimt = res->nmimt,
+			.opc = res->opc,
+			.status = res->status,
+			.nmresp = res->nmresp,
+			.size = res->status ? 0 : nvme_result_size(res->type),
+		};
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1 ||
+		    (rec.size && fwrite(&res->subsys_info, rec.size, 1, fp) != 1)) {
+			nvme_trace(ERROR, "write binary record\n");
+			return -1;
+		}
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	fflush(fp);
+
+	return 0;
+}
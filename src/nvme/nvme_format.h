@@ -0,0 +1,42 @@
+#ifndef NVME_FORMAT_H
+#define NVME_FORMAT_H
+
+#include "nvme_decode.h"
+
+#include "types.h"
+#include <stdio.h>
+
+enum nvme_format_type {
+	NVME_FORMAT_NONE = 0,           // Decode only, nothing is printed
+	NVME_FORMAT_TEXT,               // Field dump as printed so far
+	NVME_FORMAT_JSON,               // One JSON object per line
+	NVME_FORMAT_BINARY,             // struct nvme_format_record + decoded data
+	NVME_FORMAT_MAX,
+};
+
+// "NVMR"
+#define NVME_FORMAT_RECORD_MAGIC        (0x524D564E)
+
+#pragma pack(push, 1)
+
+// Header of a compact binary record, followed by size bytes of decoded data.
+struct nvme_format_record {
+	u32 magic;
+	u8 type;
+	u8 csi;
+	u8 nmimt;
+	u8 opc;
+	u8 status;
+	u8 rsvd[3];
+	u32 nmresp;
+	u16 size;
+};
+
+#pragma pack(pop)
+
+void nvme_format_set(enum nvme_format_type fmt);
+enum nvme_format_type nvme_format_get(void);
+int nvme_format_parse(const char *name);
+int nvme_format_result(FILE *fp, const struct nvme_mi_result *res, enum nvme_format_type fmt);
+
+#endif // NVME_FORMAT_H
@@ -0,0 +1,365 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_fw.h"
+#include "nvme_decode.h"
+#include "mctp_transport.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+struct nvme_fw_image {
+	const uint8_t *data;
+	uint32_t size;
+	uint64_t mtime;
+	bool mapped;
+};
+
+uint32_t nvme_fw_chunk_size(bool ic)
+{
+	// The piece follows NMH and the admin request dwords, the MIC comes last.
+	uint32_t overhead = sizeof(union nvme_mi_msg_header) + sizeof(struct nvme_mi_adm_req_dw) +
+	                    (ic ? 4 : 0);
+	uint32_t max = mctp_transport_get_max_msg_size();
+	uint32_t chunk = max > overhead ? max - overhead : 0;
+
+	if (chunk > 4096)
+		chunk = 4096;
+
+	// NUMD and OFST of Firmware Image Download are in dwords.
+	return chunk & ~3;
+}
+
+static int nvme_fw_image_open(const char *path, struct nvme_fw_image *img)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		nvme_trace(ERROR, "open %s\n", path);
+		return -NVME_FW_ERR_IMAGE;
+	}
+
+	if (fstat(fd, &st) || !st.st_size || st.st_size > UINT32_MAX) {
+		nvme_trace(ERROR, "invalid image %s\n", path);
+		close(fd);
+		return -NVME_FW_ERR_IMAGE;
+	}
+
+	img->size = st.st_size;
+	img->mtime = st.st_mtime;
+
+#ifndef WIN32
+	img->data = mmap(NULL, img->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (img->data != MAP_FAILED) {
+		// Pages are read ahead of the download as it walks the image.
+		madvise((void *)img->data, img->size, MADV_SEQUENTIAL);
+		img->mapped = true;
+		close(fd);
+		return NVME_FW_SUCCESS;
+	}
+#endif
+
+	// No mapping, read the whole image instead.
+	uint8_t *buf = malloc(img->size);
+	uint32_t got = 0;
+
+	while (buf && got < img->size) {
+		ssize_t n = read(fd, buf + got, img->size - got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	close(fd);
+
+	if (!buf || got != img->size) {
+		nvme_trace(ERROR, "read %s\n", path);
+		free(buf);
+		return -NVME_FW_ERR_IMAGE;
+	}
+
+	img->data = buf;
+	img->mapped = false;
+
+	return NVME_FW_SUCCESS;
+}
+
+static void nvme_fw_image_close(struct nvme_fw_image *img)
+{
+#ifndef WIN32
+	if (img->mapped) {
+		munmap((void *)img->data, img->size);
+		return;
+	}
+#endif
+	free((void *)img->data);
+}
+
+// Ask for the pages of the next piece while the current one is on the wire.
+static void nvme_fw_prefetch(const struct nvme_fw_image *img, uint32_t offset, uint32_t len)
+{
+#ifndef WIN32
+	long page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)(img->data + offset) & ~(page - 1);
+
+	if (img->mapped)
+		madvise((void *)start, (uintptr_t)(img->data + offset + len) - start, MADV_WILLNEED);
+#endif
+}
+
+static uint32_t nvme_fw_ckpt_load(const struct nvme_fw_update *fw, const struct nvme_fw_image *img)
+{
+	struct nvme_fw_ckpt ckpt;
+	uint32_t offset = 0;
+	FILE *fp;
+
+	if (!fw->ckpt_path)
+		return 0;
+
+	fp = fopen(fw->ckpt_path, "rb");
+	if (!fp)
+		return 0;
+
+	if (fread(&ckpt, sizeof(ckpt), 1, fp) == 1 && ckpt.magic == NVME_FW_CKPT_MAGIC &&
+	    ckpt.size == img->size && ckpt.mtime == img->mtime &&
+	    !memcmp(ckpt.sn, fw->sn, sizeof(ckpt.sn)) && ckpt.offset < img->size &&
+	    !(ckpt.offset & 3))
+		offset = ckpt.offset;
+
+	fclose(fp);
+
+	return offset;
+}
+
+static void nvme_fw_ckpt_save(const struct nvme_fw_update *fw, const struct nvme_fw_image *img)
+{
+	struct nvme_fw_ckpt ckpt = {
+		.magic = NVME_FW_CKPT_MAGIC,
+		.size = img->size,
+		.mtime = img->mtime,
+		.offset = fw->offset,
+	};
+	FILE *fp;
+
+	if (!fw->ckpt_path)
+		return;
+
+	memcpy(ckpt.sn, fw->sn, sizeof(ckpt.sn));
+
+	fp = fopen(fw->ckpt_path, "wb");
+	if (!fp)
+		return;
+
+	fwrite(&ckpt, sizeof(ckpt), 1, fp);
+	fclose(fp);
+}
+
+// Serial Number of the drive, so a checkpoint is only resumed on the drive it was written for.
+static int nvme_fw_identify(struct aa_args *args, struct nvme_fw_update *fw)
+{
+	struct aa_args id_args = *args;
+	struct nvme_mi_result res;
+	struct nvme_id_ctrl *id;
+	int ret;
+
+	id = malloc(sizeof(*id));
+	if (!id)
+		return -NVME_FW_ERR_IO;
+
+	id_args.async = false;
+	nvme_cmd_set_data_buf(id_args.csi, id, sizeof(*id));
+	ret = nvme_identify_ctrl(&id_args);
+	if (!ret && nvme_cmd_get_data_len(id_args.csi) < sizeof(*id))
+		ret = -NVME_FW_ERR_IO;
+	nvme_cmd_set_data_buf(id_args.csi, NULL, 0);
+
+	if (!ret) {
+		nvme_mi_get_result(id_args.csi, &res);
+		if (res.status || res.sf) {
+			nvme_trace(ERROR, "identify controller: status %x, sf %x\n", res.status, res.sf);
+			ret = -NVME_FW_ERR_STATUS;
+		}
+	}
+
+	if (!ret)
+		memcpy(fw->sn, id->sn, sizeof(fw->sn));
+	free(id);
+
+	return ret;
+}
+
+// Wait for the admin command on the slot of args and check its completion.
+static int nvme_fw_check(struct aa_args *args, const char *what, uint32_t offset)
+{
+	struct nvme_mi_result res;
+	int ret;
+
+	ret = nvme_mi_wait_slot(args, args->csi);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status || res.sf) {
+		nvme_trace(ERROR, "%s at %d: status %x, sf %x\n", what, offset, res.status, res.sf);
+		return -NVME_FW_ERR_STATUS;
+	}
+
+	return NVME_FW_SUCCESS;
+}
+
+static int nvme_fw_commit_check(struct aa_args *args, const struct nvme_fw_update *fw)
+{
+	struct nvme_mi_result res;
+	int ret;
+
+	ret = nvme_fw_commit(args, fw->slot, fw->action, fw->bpid);
+	if (!ret)
+		ret = nvme_mi_wait_slot(args, args->csi);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status) {
+		nvme_trace(ERROR, "firmware commit: status %x\n", res.status);
+		return -NVME_FW_ERR_STATUS;
+	}
+
+	/**
+	 * NVMe Base, Firmware Commit command specific status values
+	 *
+	 * The image is committed but only runs after the reset reported here.
+	 */
+	switch (res.sf) {
+	case 0:
+		break;
+	case NVME_SCT_CMD_SPECIFIC << NVME_SCT_SHIFT | NVME_SC_FW_NEEDS_CONV_RESET:
+		nvme_trace(INFO, "firmware activation requires conventional reset\n");
+		break;
+	case NVME_SCT_CMD_SPECIFIC << NVME_SCT_SHIFT | NVME_SC_FW_NEEDS_SUBSYS_RESET:
+		nvme_trace(INFO, "firmware activation requires nvm subsystem reset\n");
+		break;
+	case NVME_SCT_CMD_SPECIFIC << NVME_SCT_SHIFT | NVME_SC_FW_NEEDS_RESET:
+		nvme_trace(INFO, "firmware activation requires controller level reset\n");
+		break;
+	default:
+		nvme_trace(ERROR, "firmware commit: sf %x\n", res.sf);
+		return -NVME_FW_ERR_STATUS;
+	}
+
+	return NVME_FW_SUCCESS;
+}
+
+/**
+ * Download the image in pieces and commit it.
+ *
+ * Pieces go out in image order, alternating both command slots, so one piece
+ * is on the wire while the completion of the other is checked and the pages
+ * of the next one are requested. The older piece is always on the slot about
+ * to be reused, so the acknowledged offset advances in image order and a
+ * resumed download restarts exactly where the controller stopped confirming
+ * data.
+ */
+int nvme_fw_update(struct aa_args *args, struct nvme_fw_update *fw)
+{
+	struct aa_args fw_args = *args;
+	struct nvme_fw_image img;
+	struct {
+		uint32_t offset;
+		uint32_t len;
+	} piece[NVME_MI_SLOT_MAX];
+	uint32_t chunk = fw->chunk ? fw->chunk & ~3 : nvme_fw_chunk_size(args->ic);
+	uint32_t sent, first;
+	uint64_t start;
+	bool slot = args->csi;
+	int ret;
+
+	if (!chunk || chunk > nvme_fw_chunk_size(args->ic)) {
+		nvme_trace(ERROR, "invalid chunk size %d\n", chunk);
+		return -NVME_FW_ERR_PARAM;
+	}
+
+	memset(fw->sn, ' ', sizeof(fw->sn));
+	if (fw->ckpt_path) {
+		ret = nvme_fw_identify(args, fw);
+		if (ret)
+			return ret;
+	}
+
+	ret = nvme_fw_image_open(fw->path, &img);
+	if (ret)
+		return ret;
+
+	fw->size = img.size;
+	fw->offset = nvme_fw_ckpt_load(fw, &img);
+	if (fw->offset)
+		nvme_trace(INFO, "resume download at %d of %d\n", fw->offset, fw->size);
+
+	memset(piece, 0, sizeof(piece));
+	fw_args.async = true;
+	first = sent = fw->offset;
+	start = time_us();
+
+	while (fw->offset < img.size) {
+		fw_args.csi = slot;
+
+		if (piece[slot].len) {
+			ret = nvme_fw_check(&fw_args, "firmware download", piece[slot].offset);
+			if (ret)
+				break;
+			fw->offset = piece[slot].offset + piece[slot].len;
+			piece[slot].len = 0;
+			nvme_fw_ckpt_save(fw, &img);
+		}
+
+		if (sent < img.size) {
+			uint32_t len = img.size - sent > chunk ? chunk : img.size - sent;
+
+			ret = nvme_fw_download(&fw_args, sent, img.data + sent, len);
+			if (ret)
+				break;
+			piece[slot].offset = sent;
+			piece[slot].len = len;
+			sent += len;
+
+			if (sent < img.size)
+				nvme_fw_prefetch(&img, sent, img.size - sent > chunk ? chunk : img.size - sent);
+		}
+
+		slot = !slot;
+	}
+
+	// Drain the other slot after an error, its result no longer matters.
+	if (ret)
+		nvme_mi_wait(&fw_args);
+
+	fw->elapsed_us = time_us() - start;
+	fw->throughput = fw->elapsed_us ? (uint64_t)(fw->offset - first) * 1000000 / fw->elapsed_us : 0;
+	nvme_fw_image_close(&img);
+
+	if (ret)
+		return ret;
+
+	nvme_trace(INFO, "downloaded %d bytes in %llu ms (%d B/s)\n", fw->offset - first,
+	           (unsigned long long)fw->elapsed_us / 1000, fw->throughput);
+
+	fw_args.async = false;
+	fw_args.csi = args->csi;
+	ret = nvme_fw_commit_check(&fw_args, fw);
+	if (ret)
+		return ret;
+
+	if (fw->ckpt_path)
+		remove(fw->ckpt_path);
+
+	return NVME_FW_SUCCESS;
+}
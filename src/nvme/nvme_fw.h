@@ -0,0 +1,50 @@
+#ifndef NVME_FW_H
+#define NVME_FW_H
+
+#include "types.h"
+#include "libnvme_types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// "NFWC"
+#define NVME_FW_CKPT_MAGIC              (0x4357464E)
+
+enum nvme_fw_error {
+	NVME_FW_SUCCESS = 0,
+	NVME_FW_ERR_PARAM,
+	NVME_FW_ERR_IMAGE,
+	NVME_FW_ERR_STATUS,
+	NVME_FW_ERR_IO,
+};
+
+struct nvme_fw_update {
+	const char *path;               // Firmware image file
+	uint32_t chunk;                 // Bytes per download, 0 selects the largest that fits
+	uint8_t slot;                   // Firmware Slot (FS) of the commit
+	enum nvme_fw_commit_ca action;  // Commit Action (CA)
+	bool bpid;                      // Boot Partition ID for the boot partition actions
+	const char *ckpt_path;          // Checkpoint file for resume, NULL disables it
+	// Filled in by nvme_fw_update()
+	char sn[20];                    // Serial Number of the drive, space padded
+	uint32_t size;                  // Image size
+	uint32_t offset;                // Last acknowledged offset
+	uint64_t elapsed_us;            // Time spent downloading
+	uint32_t throughput;            // Download throughput in bytes per second
+};
+
+/**
+ * Checkpoint of an interrupted download. The image is identified by its size
+ * and mtime, the drive by the Serial Number of Identify Controller.
+ */
+struct nvme_fw_ckpt {
+	u32 magic;
+	u32 size;
+	u64 mtime;
+	char sn[20];
+	u32 offset;
+};
+
+uint32_t nvme_fw_chunk_size(bool ic);
+int nvme_fw_update(struct aa_args *args, struct nvme_fw_update *fw);
+
+#endif // NVME_FW_H
@@ -0,0 +1,217 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_log.h"
+#include "nvme_decode.h"
+#include "mctp_transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+uint32_t nvme_log_chunk_size(bool ic)
+{
+	// Every response carries the NMH, the NVMe Management Response, CQE DW0/1/3 and the MIC.
+	uint32_t overhead = sizeof(union nvme_mi_msg_header) + sizeof(union nvme_mi_resp) +
+	                    sizeof(struct nvme_mi_adm_res_dw) + (ic ? 4 : 0);
+	uint32_t max = mctp_transport_get_max_msg_size();
+	uint32_t chunk = max > overhead ? max - overhead : 0;
+
+	if (chunk > NVME_LOG_CHUNK_MAX)
+		chunk = NVME_LOG_CHUNK_MAX;
+
+	// The log page offset and NUMD are in dwords.
+	return chunk & ~3;
+}
+
+static bool nvme_log_ckpt_match(const struct nvme_log_stream *ls, const struct nvme_log_ckpt *ckpt)
+{
+	return ckpt->magic == NVME_LOG_CKPT_MAGIC && ckpt->nsid == ls->nsid &&
+	       ckpt->lid == ls->lid && ckpt->lsp == ls->lsp && ckpt->lsi == ls->lsi &&
+	       ckpt->size == ls->size && ckpt->offset <= ls->size && !(ckpt->offset & 3);
+}
+
+static void nvme_log_ckpt_load(struct nvme_log_stream *ls)
+{
+	struct nvme_log_ckpt ckpt;
+	FILE *fp;
+
+	if (!ls->ckpt_path)
+		return;
+
+	fp = fopen(ls->ckpt_path, "rb");
+	if (!fp)
+		return;
+
+	if (fread(&ckpt, sizeof(ckpt), 1, fp) == 1 && nvme_log_ckpt_match(ls, &ckpt)) {
+		nvme_trace(INFO, "resume log %x at offset %llu\n", ls->lid,
+		           (unsigned long long)ckpt.offset);
+		ls->offset = ckpt.offset;
+	}
+
+	fclose(fp);
+}
+
+static int nvme_log_ckpt_save(const struct nvme_log_stream *ls)
+{
+	struct nvme_log_ckpt ckpt = {
+		.magic = NVME_LOG_CKPT_MAGIC,
+		.nsid = ls->nsid,
+		.lid = ls->lid,
+		.lsp = ls->lsp,
+		.lsi = ls->lsi,
+		.size = ls->size,
+		.offset = ls->offset,
+	};
+	FILE *fp;
+
+	if (!ls->ckpt_path)
+		return NVME_LOG_SUCCESS;
+
+	fp = fopen(ls->ckpt_path, "wb");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", ls->ckpt_path);
+		return -NVME_LOG_ERR_IO;
+	}
+
+	fwrite(&ckpt, sizeof(ckpt), 1, fp);
+	fclose(fp);
+
+	return NVME_LOG_SUCCESS;
+}
+
+static int nvme_log_write_fd(int fd, const uint8_t *buf, uint32_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n <= 0) {
+			nvme_trace(ERROR, "write log chunk (%d)\n", (int)n);
+			return -NVME_LOG_ERR_IO;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return NVME_LOG_SUCCESS;
+}
+
+// Wait for the chunk outstanding on a slot and hand it to the sinks.
+static int nvme_log_stream_complete(struct aa_args *args, struct nvme_log_stream *ls,
+                                    const uint8_t *buf, uint32_t len)
+{
+	struct nvme_mi_result res;
+	int ret;
+
+	ret = nvme_mi_wait_slot(args, args->csi);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status || res.sf) {
+		nvme_trace(ERROR, "get log page %x at %llu: status %x, sf %x\n", ls->lid,
+		           (unsigned long long)ls->offset, res.status, res.sf);
+		return -NVME_LOG_ERR_STATUS;
+	}
+
+	if (nvme_cmd_get_data_len(args->csi) < len) {
+		nvme_trace(ERROR, "short log chunk at %llu (%d,%d)\n", (unsigned long long)ls->offset,
+		           nvme_cmd_get_data_len(args->csi), len);
+		return -NVME_LOG_ERR_SHORT;
+	}
+
+	if (ls->fd >= 0) {
+		ret = nvme_log_write_fd(ls->fd, buf, len);
+		if (ret)
+			return ret;
+	}
+
+	if (ls->cb) {
+		ret = ls->cb(buf, len, ls->offset, ls->priv);
+		if (ret)
+			return ret;
+	}
+
+	ls->offset += len;
+
+	return nvme_log_ckpt_save(ls);
+}
+
+/**
+ * Read a log page of ls->size bytes in chunks with increasing Log Page Offset.
+ * Commands alternate between both command slots so the next chunk is already
+ * requested while the current one is being transferred. Chunks are delivered
+ * strictly in log order and the checkpoint only advances past delivered data.
+ */
+int nvme_log_stream_read(struct aa_args *args, struct nvme_log_stream *ls)
+{
+	struct aa_args slot_args = *args;
+	uint8_t *buf[NVME_MI_SLOT_MAX];
+	uint32_t pending[NVME_MI_SLOT_MAX] = {0};
+	uint32_t chunk = ls->chunk ? ls->chunk & ~3 : nvme_log_chunk_size(args->ic);
+	uint64_t next;
+	bool slot = args->csi;
+	int ret = NVME_LOG_SUCCESS;
+
+	if (!chunk || !ls->size || (ls->size & 3) || (ls->offset & 3)) {
+		nvme_trace(ERROR, "invalid log stream (size %llu, offset %llu, chunk %d)\n",
+		           (unsigned long long)ls->size, (unsigned long long)ls->offset, chunk);
+		return -NVME_LOG_ERR_PARAM;
+	}
+
+	if (chunk > NVME_LOG_CHUNK_MAX)
+		chunk = NVME_LOG_CHUNK_MAX;
+
+	nvme_log_ckpt_load(ls);
+	if (ls->fd >= 0 && ls->offset && lseek(ls->fd, ls->offset, SEEK_SET) < 0)
+		nvme_trace(WARN, "fd is not seekable, resumed data is appended\n");
+
+	buf[0] = malloc(chunk * NVME_MI_SLOT_MAX);
+	if (!buf[0]) {
+		nvme_trace(ERROR, "malloc\n");
+		return -NVME_LOG_ERR_IO;
+	}
+
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++) {
+		buf[i] = buf[0] + i * chunk;
+		nvme_cmd_set_data_buf(i, buf[i], chunk);
+	}
+
+	slot_args.async = true;
+	next = ls->offset;
+
+	while (ls->offset < ls->size) {
+		slot_args.csi = slot;
+
+		// The older of the two outstanding chunks is always on this slot.
+		if (pending[slot]) {
+			ret = nvme_log_stream_complete(&slot_args, ls, buf[slot], pending[slot]);
+			pending[slot] = 0;
+			if (ret)
+				break;
+		}
+
+		if (next < ls->size) {
+			uint32_t len = ls->size - next > chunk ? chunk : ls->size - next;
+
+			ret = nvme_get_log_page(&slot_args, ls->nsid, ls->lid, ls->lsp, ls->lsi, ls->rae,
+			                        next, len);
+			if (ret)
+				break;
+			pending[slot] = len;
+			next += len;
+		}
+
+		slot = !slot;
+	}
+
+	nvme_mi_wait(&slot_args);
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++)
+		nvme_cmd_set_data_buf(i, NULL, 0);
+	free(buf[0]);
+
+	if (!ret && ls->ckpt_path)
+		remove(ls->ckpt_path);
+
+	return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef NVME_LOG_H
+#define NVME_LOG_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * NVMe-MI, 6 NVM Express Admin Command Set
+ *
+ * The Response Data of an NVMe Admin Command is limited to 4 KiB, so a log
+ * page larger than that is read with several Get Log Page commands.
+ */
+#define NVME_LOG_CHUNK_MAX              (4096)
+// "NLCK"
+#define NVME_LOG_CKPT_MAGIC             (0x4B434C4E)
+
+enum nvme_log_error {
+	NVME_LOG_SUCCESS = 0,
+	NVME_LOG_ERR_PARAM,
+	NVME_LOG_ERR_STATUS,
+	NVME_LOG_ERR_SHORT,
+	NVME_LOG_ERR_IO,
+};
+
+// Called for each chunk in log order. A non-zero return stops the download.
+typedef int (*nvme_log_chunk_cb)(const void *buf, uint32_t len, uint64_t offset, void *priv);
+
+struct nvme_log_stream {
+	uint32_t nsid;
+	uint8_t lid;
+	uint8_t lsp;
+	uint16_t lsi;
+	bool rae;
+	uint64_t size;                  // Bytes of the log page to read
+	uint64_t offset;                // Next offset to read, updated as chunks arrive
+	uint32_t chunk;                 // Bytes per command, 0 selects the largest that fits
+	int fd;                         // Chunks are written to fd if it is not negative
+	nvme_log_chunk_cb cb;
+	void *priv;
+	const char *ckpt_path;          // Checkpoint file for resume, NULL disables it
+};
+
+struct nvme_log_ckpt {
+	u32 magic;
+	u32 nsid;
+	u8 lid;
+	u8 lsp;
+	u16 lsi;
+	u64 size;
+	u64 offset;
+};
+
+uint32_t nvme_log_chunk_size(bool ic);
+int nvme_log_stream_read(struct aa_args *args, struct nvme_log_stream *ls);
+
+#endif // NVME_LOG_H
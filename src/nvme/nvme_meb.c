@@ -0,0 +1,304 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_meb.h"
+#include "nvme_decode.h"
+#include "mctp_transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t nvme_meb_chunk_size(bool ic, bool write)
+{
+	/**
+	 * MEB Write carries the data after NMH, OPC, NMD0 and NMD1, MEB Read
+	 * returns it after NMH and the NVMe Management Response.
+	 */
+	uint32_t overhead = write ? sizeof(union nvme_mi_req_dw) :
+	                    sizeof(union nvme_mi_msg_header) + sizeof(union nvme_mi_resp);
+	uint32_t max = mctp_transport_get_max_msg_size();
+	uint32_t chunk;
+
+	overhead += ic ? 4 : 0;
+	chunk = max > overhead ? max - overhead : 0;
+
+	return chunk > NVME_MEB_CHUNK_MAX ? NVME_MEB_CHUNK_MAX : chunk;
+}
+
+// Wait for the chunk outstanding on the slot of args and check its status.
+static int nvme_meb_complete(struct aa_args *args, struct nvme_meb_stream *ms, uint8_t *buf,
+                             uint32_t len)
+{
+	struct nvme_mi_result res;
+	int ret;
+
+	ret = nvme_mi_wait_slot(args, args->csi);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status) {
+		nvme_trace(ERROR, "meb %s at %d: status %x\n", ms->write ? "write" : "read", ms->offset,
+		           res.status);
+		return -NVME_MEB_ERR_STATUS;
+	}
+
+	if (!ms->write) {
+		if (nvme_mi_get_data_len(args->csi) < len) {
+			nvme_trace(ERROR, "short meb read at %d (%d,%d)\n", ms->offset,
+			           nvme_mi_get_data_len(args->csi), len);
+			return -NVME_MEB_ERR_SHORT;
+		}
+
+		if (ms->cb) {
+			ret = ms->cb(buf, len, ms->offset, ms->priv);
+			if (ret)
+				return ret;
+		}
+	}
+
+	ms->offset += len;
+
+	return NVME_MEB_SUCCESS;
+}
+
+/**
+ * Move ms->size - ms->offset bytes between the host and the MEB. Commands
+ * alternate between both command slots, so one chunk is in flight while the
+ * other one is completed; the reader callback still sees chunks in order.
+ */
+int nvme_meb_stream(struct aa_args *args, struct nvme_meb_stream *ms)
+{
+	struct aa_args slot_args = *args;
+	uint8_t *buf[NVME_MI_SLOT_MAX];
+	uint32_t pending[NVME_MI_SLOT_MAX] = {0};
+	uint32_t chunk = ms->chunk ? ms->chunk : nvme_meb_chunk_size(args->ic, ms->write);
+	uint32_t next;
+	bool slot = args->csi;
+	int ret = NVME_MEB_SUCCESS;
+
+	if (!chunk || ms->offset > ms->size) {
+		nvme_trace(ERROR, "invalid meb stream (offset %d, size %d, chunk %d)\n", ms->offset,
+		           ms->size, chunk);
+		return -NVME_MEB_ERR_PARAM;
+	}
+
+	if (chunk > nvme_meb_chunk_size(args->ic, ms->write))
+		chunk = nvme_meb_chunk_size(args->ic, ms->write);
+
+	buf[0] = malloc(chunk * NVME_MI_SLOT_MAX);
+	if (!buf[0]) {
+		nvme_trace(ERROR, "malloc\n");
+		return -NVME_MEB_ERR_PARAM;
+	}
+
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++) {
+		buf[i] = buf[0] + i * chunk;
+		if (!ms->write)
+			nvme_mi_set_data_buf(i, buf[i], chunk);
+	}
+
+	slot_args.async = true;
+	next = ms->offset;
+
+	while (ms->offset < ms->size) {
+		slot_args.csi = slot;
+
+		// The older of the two outstanding chunks is always on this slot.
+		if (pending[slot]) {
+			ret = nvme_meb_complete(&slot_args, ms, buf[slot], pending[slot]);
+			pending[slot] = 0;
+			if (ret)
+				break;
+		}
+
+		if (next < ms->size) {
+			uint32_t len = ms->size - next > chunk ? chunk : ms->size - next;
+
+			if (ms->write) {
+				ret = ms->cb ? ms->cb(buf[slot], len, next, ms->priv) : -NVME_MEB_ERR_PARAM;
+				if (!ret)
+					ret = nvme_mi_mi_meb_write(&slot_args, next, len, buf[slot]);
+			} else {
+				ret = nvme_mi_mi_meb_read(&slot_args, next, len);
+			}
+			if (ret)
+				break;
+			pending[slot] = len;
+			next += len;
+		}
+
+		slot = !slot;
+	}
+
+	nvme_mi_wait(&slot_args);
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++)
+		nvme_mi_set_data_buf(i, NULL, 0);
+	free(buf[0]);
+
+	return ret;
+}
+
+// Host buffer of nvme_meb_read()/nvme_meb_write(), base is the MEB offset of buf[0].
+struct nvme_meb_host_buf {
+	uint8_t *buf;
+	uint32_t base;
+};
+
+static int nvme_meb_copy_out(void *buf, uint32_t len, uint32_t offset, void *priv)
+{
+	struct nvme_meb_host_buf *hb = priv;
+
+	memcpy(buf, hb->buf + offset - hb->base, len);
+
+	return 0;
+}
+
+static int nvme_meb_copy_in(void *buf, uint32_t len, uint32_t offset, void *priv)
+{
+	struct nvme_meb_host_buf *hb = priv;
+
+	memcpy(hb->buf + offset - hb->base, buf, len);
+
+	return 0;
+}
+
+int nvme_meb_read(struct aa_args *args, uint32_t dofst, uint32_t len, void *buf)
+{
+	struct nvme_meb_host_buf hb = {
+		.buf = buf,
+		.base = dofst,
+	};
+	struct nvme_meb_stream ms = {
+		.offset = dofst,
+		.size = dofst + len,
+		.cb = nvme_meb_copy_in,
+		.priv = &hb,
+	};
+
+	return nvme_meb_stream(args, &ms);
+}
+
+int nvme_meb_write(struct aa_args *args, uint32_t dofst, uint32_t len, const void *buf)
+{
+	struct nvme_meb_host_buf hb = {
+		.buf = (uint8_t *)buf,
+		.base = dofst,
+	};
+	struct nvme_meb_stream ms = {
+		.offset = dofst,
+		.size = dofst + len,
+		.write = true,
+		.cb = nvme_meb_copy_out,
+		.priv = &hb,
+	};
+
+	return nvme_meb_stream(args, &ms);
+}
+
+// Submit a command with the MEB bit set and wait for its completion.
+static int nvme_meb_cmd(struct aa_args *args, nvme_meb_cmd_fn fn, void *priv)
+{
+	struct aa_args meb_args = *args;
+	struct nvme_mi_result res;
+	int ret;
+
+	meb_args.meb = true;
+	meb_args.async = false;
+
+	ret = fn(&meb_args, priv);
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(args->csi, &res);
+	if (res.status || res.sf) {
+		nvme_trace(ERROR, "meb command %x: status %x, sf %x\n", res.opc, res.status, res.sf);
+		return -NVME_MEB_ERR_STATUS;
+	}
+
+	return NVME_MEB_SUCCESS;
+}
+
+/**
+ * Run a command that returns its data in the MEB, then read len bytes of it
+ * from the start of the buffer.
+ */
+int nvme_meb_cmd_to_host(struct aa_args *args, nvme_meb_cmd_fn fn, void *priv, void *buf, uint32_t len)
+{
+	int ret = nvme_meb_cmd(args, fn, priv);
+
+	if (ret)
+		return ret;
+
+	return nvme_meb_read(args, 0, len, buf);
+}
+
+struct nvme_meb_log {
+	uint8_t lid;
+	uint32_t len;
+};
+
+static int nvme_meb_log_cmd(struct aa_args *args, void *priv)
+{
+	const struct nvme_meb_log *log = priv;
+
+	return nvme_get_log_page(args, NVME_NSID_ALL, log->lid, NVME_LOG_LSP_NONE, NVME_LOG_LSI_NONE,
+	                         false, 0, log->len);
+}
+
+/**
+ * Get Log Page with the log data returned in the MEB instead of the response,
+ * so a log larger than one NVMe-MI Message takes a single admin command.
+ */
+int nvme_meb_get_log_page(struct aa_args *args, uint8_t lid, void *buf, uint32_t len)
+{
+	struct nvme_meb_log log = {
+		.lid = lid,
+		.len = len,
+	};
+
+	// NUMD is a dword count.
+	if (!len || (len & 3))
+		return -NVME_MEB_ERR_PARAM;
+
+	return nvme_meb_cmd_to_host(args, nvme_meb_log_cmd, &log, buf, len);
+}
+
+int nvme_meb_load_file(const char *path, uint8_t *buf, uint32_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_MEB_ERR_IO;
+	}
+
+	*size = fread(buf, 1, NVME_MEB_SIZE_MAX, fp);
+	if (!feof(fp)) {
+		nvme_trace(ERROR, "%s is larger than %d bytes\n", path, NVME_MEB_SIZE_MAX);
+		fclose(fp);
+		return -NVME_MEB_ERR_PARAM;
+	}
+	fclose(fp);
+
+	return *size ? NVME_MEB_SUCCESS : -NVME_MEB_ERR_PARAM;
+}
+
+int nvme_meb_save_file(const char *path, const uint8_t *buf, uint32_t size)
+{
+	FILE *fp = fopen(path, "wb");
+	int ret = NVME_MEB_SUCCESS;
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_MEB_ERR_IO;
+	}
+
+	if (fwrite(buf, 1, size, fp) != size)
+		ret = -NVME_MEB_ERR_IO;
+	if (fclose(fp))
+		ret = -NVME_MEB_ERR_IO;
+
+	return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef NVME_MEB_H
+#define NVME_MEB_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * NVMe-MI, 3.3 Management Endpoint Buffer
+ *
+ * The Management Endpoint Buffer (MEB) is accessed with the MEB Read and MEB
+ * Write commands in pieces that fit a single NVMe-MI Message, and holds the
+ * data of commands submitted with the MEB bit set.
+ */
+#define NVME_MEB_CHUNK_MAX              (4096)
+// Largest transfer of a file to or from the MEB
+#define NVME_MEB_SIZE_MAX               (1024 * 1024)
+
+enum nvme_meb_error {
+	NVME_MEB_SUCCESS = 0,
+	NVME_MEB_ERR_PARAM,
+	NVME_MEB_ERR_STATUS,
+	NVME_MEB_ERR_SHORT,
+	NVME_MEB_ERR_IO,
+};
+
+/**
+ * Called for each chunk in buffer order. A reader hands the data read from the
+ * MEB, a writer fills buf with the data to write. A non-zero return stops the
+ * transfer.
+ */
+typedef int (*nvme_meb_chunk_cb)(void *buf, uint32_t len, uint32_t offset, void *priv);
+
+// Submits one command with args->meb set, e.g. a wrapper around nvme_get_log_page().
+typedef int (*nvme_meb_cmd_fn)(struct aa_args *args, void *priv);
+
+struct nvme_meb_stream {
+	uint32_t offset;                // Next MEB offset, updated as chunks complete
+	uint32_t size;                  // End of the transfer in the MEB
+	uint32_t chunk;                 // Bytes per command, 0 selects the largest that fits
+	bool write;
+	nvme_meb_chunk_cb cb;
+	void *priv;
+};
+
+uint32_t nvme_meb_chunk_size(bool ic, bool write);
+int nvme_meb_stream(struct aa_args *args, struct nvme_meb_stream *ms);
+int nvme_meb_read(struct aa_args *args, uint32_t dofst, uint32_t len, void *buf);
+int nvme_meb_write(struct aa_args *args, uint32_t dofst, uint32_t len, const void *buf);
+int nvme_meb_cmd_to_host(struct aa_args *args, nvme_meb_cmd_fn fn, void *priv, void *buf, uint32_t len);
+int nvme_meb_get_log_page(struct aa_args *args, uint8_t lid, void *buf, uint32_t len);
+int nvme_meb_load_file(const char *path, uint8_t *buf, uint32_t *size);
+int nvme_meb_save_file(const char *path, const uint8_t *buf, uint32_t size);
+
+#endif // NVME_MEB_H
@@ -8,7 +8,13 @@
 #include "libnvme_types.h"
 #include "libnvme_mi_mi.h"
 #include "nvme_cmd.h"
+#include "nvme_decode.h"
+#include "nvme_format.h"
+#include "nvme_aem.h"
+#include "nvme_vpd.h"
+#include "smbus.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -17,13 +23,21 @@ struct nvme_mi_context {
 	union nvme_mi_resp nmresp;
 	uint8_t opc;
 	bool req_sent;
+	uint8_t msg_tag;                // MCTP message tag of the outstanding request
 	enum nvme_mi_config_id cfg_id;
 	enum nvme_mi_dtyp dtyp;
 	uint8_t portid;
 	uint8_t ctrlid;
-	uint8_t vpd[256];
 	uint16_t dofst;
 	uint16_t dlen;
+	uint64_t deadline_us;           // The request is aborted when this passes
+	uint8_t replays;                // Replays of the response requested so far
+	uint64_t done_us;               // When the final response arrived
+	// Optional buffer the response data of a MEB, VPD or data structure read is copied to.
+	void *data;
+	uint32_t data_size;
+	uint32_t data_len;
+	struct nvme_mi_result result;
 };
 
 static const char *_nmimt[NVNE_MI_MT_MAX] = {
@@ -102,27 +116,364 @@ const char *_mi_opc [256] = {
 	[nvme_mi_mi_opcode_shutdown] = "Shutdown",
 };
 
-struct nvme_mi_context nvme_mi_ctx = {
-	.nmimt = NVNE_MI_MT_MAX,
-	.opc = 0xFF,
-	.req_sent = 0
+static const char *_mt[256] = {
+	[MCTP_MSG_TYPE_CTRL] = "MCTP Control",
+	[MCTP_MSG_TYPE_PLDM] = "PLDM",
+	[MCTP_MSG_TYPE_NCSI] = "NC-SI over MCTP",
+	[MCTP_MSG_TYPE_ETHERNET] = "Ethernet",
+	[MCTP_MSG_TYPE_NVME_MM] = "NVMe MM",
+	[MCTP_MSG_TYPE_SPDM] = "SPDM",
+	[MCTP_MSG_TYPE_SECURED] = "Secured Messages",
+	[MCTP_MSG_TYPE_CXL_FX_API] = "CXL FM API",
+	[MCTP_MSG_TYPE_CXL_CCI] = "CXL CCI",
+	[MCTP_MSG_TYPE_CXL_VENDOR_PCI] = "Vendor Defined - PCI",
+	[MCTP_MSG_TYPE_CXL_VENDOR_IANA] = "Vendor Defined - IANA",
 };
 
-int nvme_mi_send_control_primitive()
+static const char *_ror[ROR_MAX] = {
+	"Request",
+	"Response"
+};
+
+static const char *_status[256] = {
+	[NVME_MI_RESP_SUCCESS] = "Success",
+	[NVME_MI_RESP_MPR] = "More Processing Required",
+	[NVME_MI_RESP_INTERNAL_ERR] = "Internal Error",
+	[NVME_MI_RESP_INVALID_OPCODE] = "Invalid command opcode",
+	[NVME_MI_RESP_INVALID_PARAM] = "Invalid command parameter",
+	[NVME_MI_RESP_INVALID_CMD_SIZE] = "Invalid command size",
+	[NVME_MI_RESP_INVALID_INPUT_SIZE] = "Invalid command input data size",
+	[NVME_MI_RESP_ACCESS_DENIED] = "Access Denied",
+	[NVME_MI_RESP_VPD_UPDATES_EXCEEDED] = "More VPD updates than allowed",
+	[NVME_MI_RESP_PCIE_INACCESSIBLE] = "PCIe functionality currently unavailable",
+	[NVME_MI_RESP_MEB_SANITIZED] = "MEB has been cleared due to sanitize",
+	[NVME_MI_RESP_ENC_SERV_FAILURE] = "Enclosure services process failed",
+	[NVME_MI_RESP_ENC_SERV_XFER_FAILURE] = "Transfer with enclosure services failed",
+	[NVME_MI_RESP_ENC_FAILURE] = "Unreoverable enclosure failure",
+	[NVME_MI_RESP_ENC_XFER_REFUSED] = "Enclosure services transfer refused",
+	[NVME_MI_RESP_ENC_FUNC_UNSUP] = "Unsupported enclosure services function",
+	[NVME_MI_RESP_ENC_SERV_UNAVAIL] = "Enclosure services unavailable",
+	[NVME_MI_RESP_ENC_DEGRADED] = "Noncritical failure detected by enc. services",
+	[NVME_MI_RESP_SANITIZE_IN_PROGRESS] = "Command prohibited during sanitize",
+};
+
+
+/**
+ * NVMe-MI, 3.2.1 Command Slots
+ *
+ * Each Management Endpoint has two Command Slots. The Command Slot Identifier
+ * (CSI) in the NVMe-MI Message header identifies the slot a Request Message
+ * is submitted to, and the Response Message carries the same CSI. A request
+ * can therefore be outstanding on each slot at the same time, so the request
+ * context is kept per slot and the response is matched by its CSI.
+ */
+struct nvme_mi_context nvme_mi_ctx[NVME_MI_SLOT_MAX] = {
+	[0 ... NVME_MI_SLOT_MAX - 1] = {
+		.nmimt = NVNE_MI_MT_MAX,
+		.opc = 0xFF,
+		.req_sent = 0
+	}
+};
+
+static const char *_cpo[NVME_MI_CP_MAX] = {
+	[NVME_MI_CP_PAUSE] = "Pause",
+	[NVME_MI_CP_RESUME] = "Resume",
+	[NVME_MI_CP_ABORT] = "Abort",
+	[NVME_MI_CP_GET_STATE] = "Get State",
+	[NVME_MI_CP_REPLAY] = "Replay",
+};
+
+/**
+ * NVMe-MI, 4.2.1 Control Primitives
+ *
+ * Control Primitives are not submitted to a Command Slot; the Management
+ * Endpoint processes them even while both slots are busy. They are therefore
+ * tracked apart from the slot contexts, one at a time, and matched by tag.
+ */
+static struct {
+	bool sent;
+	uint8_t tag;
+	uint8_t msg_tag;
+	uint8_t status;
+	uint16_t cpsr;
+} nvme_mi_cp_ctx;
+
+static uint32_t nvme_mi_deadline_ms = NVME_MI_DEADLINE_MS;
+
+void nvme_mi_set_deadline(uint32_t ms)
 {
-	// return mctp_transport_send_message(slv_addr, dst_eid, msg, msg_size, rand(), true);
+	nvme_mi_deadline_ms = ms ? ms : NVME_MI_DEADLINE_MS;
+}
+
+int nvme_mi_send_control_primitive(struct aa_args *args, enum nvme_mi_cp_opcode cpo, uint16_t cpsp,
+                                   struct nvme_mi_cp_result *res)
+{
+	struct nvme_mi_cp_req_msg msg;
+	uint16_t msg_size = offsetof(struct nvme_mi_cp_req_msg, mic);
+	uint64_t start = time_us(), deadline = start + NVME_MI_CP_TIMEOUT_MS * 1000ULL;
+	int ret;
+
+	if (cpo >= NVME_MI_CP_MAX)
+		return -NVME_MI_CP_ERR_PARAM;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nmh.mt    = MCTP_MSG_TYPE_NVME_MM;
+	msg.nmh.ic    = args->ic;
+	// Abort, Get State and Replay apply to the Command Slot selected by CSI.
+	msg.nmh.csi   = args->csi;
+	msg.nmh.nmimt = NVME_MI_MT_CONTROL;
+	msg.nmh.ror   = ROR_REQ;
+	msg.cpo       = cpo;
+	msg.tag       = ++nvme_mi_cp_ctx.tag;
+	msg.cpsp      = cpsp;
+
+	if (args->ic)
+		msg_size = mctp_message_append_mic(&msg, msg_size);
+
+	nvme_mi_cp_ctx.sent = true;
+	ret = mctp_transport_send_message(args->slv_addr, args->dst_eid, &msg, msg_size, rand(), true,
+	                                  args->verbose);
+	if (ret) {
+		nvme_trace(ERROR, "control primitive %s (%d)\n", _cpo[cpo], ret);
+		nvme_mi_cp_ctx.sent = false;
+		return ret;
+	}
+	nvme_mi_cp_ctx.msg_tag = mctp_transport_get_req_tag();
+
+	while (nvme_mi_cp_ctx.sent && time_us() < deadline)
+		mctp_poll(args->handle, NVME_MI_CP_POLL_MS, args->verbose);
+
+	if (nvme_mi_cp_ctx.sent) {
+		nvme_trace(ERROR, "no response to control primitive %s\n", _cpo[cpo]);
+		nvme_mi_cp_ctx.sent = false;
+		mctp_transport_expire_request(nvme_mi_cp_ctx.msg_tag);
+		return -NVME_MI_CP_ERR_TIMEOUT;
+	}
+
+	if (res) {
+		res->status = nvme_mi_cp_ctx.status;
+		res->cpsr = nvme_mi_cp_ctx.cpsr;
+		res->elapsed_us = time_us() - start;
+	}
+
+	if (nvme_mi_cp_ctx.status) {
+		nvme_trace(ERROR, "control primitive %s: status %x\n", _cpo[cpo], nvme_mi_cp_ctx.status);
+		return -NVME_MI_CP_ERR_STATUS;
+	}
+
+	return NVME_MI_CP_SUCCESS;
+}
+
+static int nvme_mi_cp_message_handle(const union nvme_mi_msg *msg, uint16_t size)
+{
+	const struct nvme_mi_cp_res_msg *res = (const void *)msg;
+
+	if (size < sizeof(*res) || !nvme_mi_cp_ctx.sent || res->tag != nvme_mi_cp_ctx.tag) {
+		nvme_trace(WARN, "unexpected control primitive response (%d)\n", size);
+		return 0;
+	}
+
+	nvme_mi_cp_ctx.status = res->status;
+	nvme_mi_cp_ctx.cpsr = res->cpsr;
+	nvme_mi_cp_ctx.sent = false;
+
+	return 0xFF;
+}
+
+// Pause the Management Endpoint, it stops transmitting responses until Resume.
+int nvme_mi_cp_pause(struct aa_args *args)
+{
+	return nvme_mi_send_control_primitive(args, NVME_MI_CP_PAUSE, 0, NULL);
+}
+
+int nvme_mi_cp_resume(struct aa_args *args)
+{
+	return nvme_mi_send_control_primitive(args, NVME_MI_CP_RESUME, 0, NULL);
+}
+
+/**
+ * Abort the command on a slot. The Management Endpoint drops it and does not
+ * send its response, so the slot is released here as well.
+ */
+int nvme_mi_cp_abort(struct aa_args *args, bool csi)
+{
+	struct aa_args cp_args = *args;
+	struct nvme_mi_context *ctx = &nvme_mi_ctx[csi];
+	int ret;
+
+	cp_args.csi = csi;
+	ret = nvme_mi_send_control_primitive(&cp_args, NVME_MI_CP_ABORT, 0, NULL);
+
+	if (ctx->req_sent) {
+		ctx->req_sent = 0;
+		ctx->opc = 0xFF;
+		mctp_transport_expire_request(ctx->msg_tag);
+	}
+
+	return ret;
+}
+
+// Get State, with cesf the error flags are cleared once they have been reported.
+int nvme_mi_cp_get_state(struct aa_args *args, bool csi, bool cesf, union nvme_mi_cp_state *state)
+{
+	struct aa_args cp_args = *args;
+	struct nvme_mi_cp_result res;
+	int ret;
+
+	cp_args.csi = csi;
+	ret = nvme_mi_send_control_primitive(&cp_args, NVME_MI_CP_GET_STATE, cesf, &res);
+	if (!ret && state)
+		state->value = res.cpsr;
+
+	return ret;
+}
+
+/**
+ * Ask for the response on a slot again, starting at packet rro of the
+ * Response Message. The partly assembled message is dropped first.
+ */
+int nvme_mi_cp_replay(struct aa_args *args, bool csi, uint8_t rro)
+{
+	struct aa_args cp_args = *args;
+
+	cp_args.csi = csi;
+	mctp_transport_drop_message(1);
+
+	return nvme_mi_send_control_primitive(&cp_args, NVME_MI_CP_REPLAY, rro, NULL);
+}
+
+void nvme_mi_cp_show(enum nvme_mi_cp_opcode cpo, const struct nvme_mi_cp_result *res)
+{
+	union nvme_mi_cp_state state = {.value = res->cpsr};
+	static const char *_ssta[4] = {"Idle", "Receive", "Process", "Transmit"};
+
+	printf("Control Primitive           : %s\n", cpo < NVME_MI_CP_MAX ? _cpo[cpo] : "Reserved");
+	printf("Status                      : 0x%02x (%s)\n", res->status,
+	       _status[res->status] ? _status[res->status] : "Reserved");
+	printf("CPSR                        : 0x%04x\n", res->cpsr);
+	printf("Elapsed                     : %d us\n", res->elapsed_us);
+
+	if (cpo != NVME_MI_CP_GET_STATE)
+		return;
+
+	printf("  Slot Servicing State      : %s\n", _ssta[state.ssta]);
+	printf("  Pause Flag                : %d\n", state.pflg);
+	printf("  Bad Message Integrity     : %d\n", state.bmic);
+	printf("  Bad Packet                : %d\n", state.bpopl);
+	printf("  Timeout Waiting Packet    : %d\n", state.twfp);
+	printf("  Unsupported Tran Unit     : %d\n", state.utu);
+}
+
+/**
+ * Poll the Management Endpoint until the request outstanding on a slot has
+ * been answered or its deadline, extended by More Processing Required, has
+ * passed. Responses for the other slot that arrive meanwhile are handled and
+ * complete that slot as well.
+ */
+int nvme_mi_wait_slot(struct aa_args *args, bool csi)
+{
+	struct nvme_mi_context *ctx = &nvme_mi_ctx[csi];
+	int timeout = args->timeout == -2 ? 1000 : args->timeout;
+	int ret = 0;
+
+	while (ctx->req_sent) {
+		uint64_t now = time_us();
+		int window = timeout;
+
+		/**
+		 * The binding waits up to ten windows for the first packet, so the
+		 * window is narrowed to keep that wait within the deadline.
+		 */
+		if (now < ctx->deadline_us && (ctx->deadline_us - now) / 10000 < (uint64_t)window)
+			window = (ctx->deadline_us - now) / 10000 + 1;
+
+		ret = mctp_poll(args->handle, window, args->verbose);
+		if (!ctx->req_sent)
+			break;
+
+		// Nothing arrived in this window, which is not an error by itself.
+		if (ret == -SMBUS_SLV_NO_AVAILABLE_DATA)
+			ret = 0;
+
+		/**
+		 * A packet of the response failed its PEC and the message cannot be
+		 * assembled; Replay has it sent again instead of re-running the command.
+		 */
+		if (ret == -SMBUS_PEC_ERR && ctx->replays < NVME_MI_REPLAY_MAX) {
+			struct aa_args cp_args = *args;
+
+			ctx->replays++;
+			cp_args.csi = csi;
+			nvme_trace(WARN, "pec error on slot %d, replay %d\n", csi, ctx->replays);
+			if (!nvme_mi_cp_replay(&cp_args, csi, 0))
+				continue;
+		}
+
+		if (ret < 0 || time_us() >= ctx->deadline_us) {
+			nvme_trace(ERROR, "no response on slot %d (%d)\n", csi, ret);
+			// Free the slot on the endpoint too, so the next request is not refused.
+			nvme_mi_cp_abort(args, csi);
+			return ret < 0 ? ret : -NVME_MI_CP_ERR_TIMEOUT;
+		}
+	}
+
 	return 0;
 }
 
+/**
+ * Wait until the slot selected by args->csi is free and return its context in
+ * ctx, so the caller can record the request parameters needed to decode its
+ * response. Fails if the request still outstanding on the slot could not be
+ * completed, which leaves the slot to that request.
+ */
+int nvme_mi_acquire_slot(struct aa_args *args, struct nvme_mi_context **ctx)
+{
+	int ret = 0;
+
+	if (nvme_mi_ctx[args->csi].req_sent)
+		ret = nvme_mi_wait_slot(args, args->csi);
+
+	if (ctx)
+		*ctx = &nvme_mi_ctx[args->csi];
+
+	return ret;
+}
+
+int nvme_mi_wait(struct aa_args *args)
+{
+	int ret, err = 0;
+
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++) {
+		ret = nvme_mi_wait_slot(args, i);
+		if (ret)
+			err = ret;
+	}
+
+	return err;
+}
+
 int nvme_mi_send_command_message(struct aa_args *args, uint8_t opc, enum nvme_mi_message_type nmimt,
                                  union nvme_mi_msg *msg, size_t req_size)
 {
+	struct nvme_mi_context *ctx = &nvme_mi_ctx[args->csi];
 	int ret;
 
+	/**
+	 * The requester shall not submit a new Request Message on a Command Slot
+	 * while a previous request on that slot is still being processed.
+	 */
+	if (ctx->req_sent) {
+		ret = nvme_mi_wait_slot(args, args->csi);
+		if (ret)
+			return ret;
+	}
+
 	// TBD
-	nvme_mi_ctx.nmimt = nmimt;
-	nvme_mi_ctx.opc = opc;
-	nvme_mi_ctx.req_sent = 1;
+	ctx->nmimt = nmimt;
+	ctx->opc = opc;
+	ctx->req_sent = 1;
+	ctx->replays = 0;
+	ctx->deadline_us = time_us() + nvme_mi_deadline_ms * 1000ULL;
 
 	memset(msg, 0, sizeof(msg->nmh));
 	uint16_t msg_size = sizeof(msg->nmh) + req_size;
@@ -134,7 +485,14 @@ int nvme_mi_send_command_message(struct aa_args *args, uint8_t opc, enum nvme_mi
 	msg->nmh.rsvd1 = 0;
 	msg->nmh.nmimt = nmimt;
 	msg->nmh.ror   = ROR_REQ;
-	msg->nmh.meb   = 0;
+	/**
+	 * NVMe-MI, 3.1.1 NVMe-MI Message Header
+	 *
+	 * If the MEB bit is set to '1' in a Request Message, the data for the
+	 * command is transferred through the Management Endpoint Buffer instead
+	 * of the Request or Response Message.
+	 */
+	msg->nmh.meb   = args->meb;
 	msg->nmh.ciap  = 0;
 	msg->nmh.rsvd2 = 0;
 
@@ -151,15 +509,19 @@ int nvme_mi_send_command_message(struct aa_args *args, uint8_t opc, enum nvme_mi
 	                                   rand(), true, args->verbose);
 	if (ret) {
 		nvme_trace(ERROR, "mctp_transport_send_message (%d)\n", ret);
+		ctx->req_sent = 0;
 		return ret;
 	}
+	ctx->msg_tag = mctp_transport_get_req_tag();
 
 #if (!CONFIG_AA_MULTI_THREAD)
-	int timeout = args->timeout == -2 ? 1000 : args->timeout;
-	ret = smbus_slave_poll(args->handle, timeout, args->pec, mctp_receive_packet_handle,
-	                       args->verbose);
-	if (ret && ret != 0xFF)
-		nvme_trace(ERROR, "smbus_slave_poll (%d)\n", ret);
+	// Leave the slot outstanding, the next request goes to the other slot.
+	if (args->async)
+		return 0;
+
+	ret = nvme_mi_wait_slot(args, args->csi);
+	if (ret)
+		nvme_trace(ERROR, "nvme_mi_wait_slot (%d)\n", ret);
 #endif
 
 	return ret;
@@ -182,9 +544,9 @@ int nvme_mi_request_message_handle(const union nvme_mi_res_msg *msg, uint16_t si
 	return 0;
 }
 
-void nvme_mi_show_mi_data_read(void *buf)
+void nvme_mi_show_mi_data_read(const struct nvme_mi_context *ctx, void *buf)
 {
-	switch (nvme_mi_ctx.dtyp) {
+	switch (ctx->dtyp) {
 	case nvme_mi_dtyp_subsys_info:
 		struct nvme_mi_read_nvm_ss_info *nvm_subsys_info = buf;
 		printf("NUMP                        : 0x%02x\n", nvm_subsys_info->nump);
@@ -366,9 +728,9 @@ char *nvme_mi_show_error_response(uint8_t opc, union nvme_mi_resp nmresp)
 	}
 }
 
-void nvme_mi_show_configuration_get(union nvme_mi_resp nmresp)
+void nvme_mi_show_configuration_get(const struct nvme_mi_context *ctx, union nvme_mi_resp nmresp)
 {
-	switch (nvme_mi_ctx.cfg_id) {
+	switch (ctx->cfg_id) {
 	case NVME_MI_CONFIG_SMBUS_FREQ:
 		static const char *i2c_freq[16] = {
 			[0] = "SMBus is not supported or is disabled",
@@ -390,118 +752,43 @@ void nvme_mi_show_configuration_get(union nvme_mi_resp nmresp)
 	}
 }
 
-void nvme_mi_show_vpd_read(void *buf, uint16_t size)
+void nvme_mi_show_vpd_read(const struct nvme_mi_context *ctx, void *buf, uint16_t size)
 {
-	struct nvme_mi_vpd_hdr *vpd_hdr = buf;
-	printf("Common Header\n");
-	printf("  IPMIVER                   : %d\n", vpd_hdr->ipmiver);
-	printf("  IUAOFF                    : %d\n", vpd_hdr->iuaoff << 3);
-	printf("  CIAOFF                    : %d\n", vpd_hdr->ciaoff << 3);
-	printf("  BIAOFF                    : %d\n", vpd_hdr->biaoff << 3);
-	printf("  PIAOFF                    : %d\n", vpd_hdr->piaoff << 3);
-	printf("  MRIOFF                    : %d\n", vpd_hdr->mrioff << 3);
-	printf("  CHCHK                     : %d\n", vpd_hdr->chchk);
-
-	// TBD
-	if (vpd_hdr->iuaoff) {
-
-	}
-
-	if (vpd_hdr->ciaoff) {
-
-	}
-
-	if (vpd_hdr->biaoff) {
-
-	}
-
-	if (vpd_hdr->piaoff) {
-
-	}
-
-	if (vpd_hdr->mrioff) {
-		static const char *_type[256] = {
-			[0xB] = "NVMe Record Type ID",
-			[0xC] = "NVMe PCIe Port Record Type ID",
-			[0xD] = "Topology Record Type ID",
-		};
-		struct nvme_mi_vpd_mr_common *vpd_mr = buf + (vpd_hdr->mrioff << 3);
-		printf("NVMe MultiRecord Area\n");
-		printf("  Type                      : %d (%s)\n", vpd_mr->type, _type[vpd_mr->type]);
-		printf("  Record Format             : %d\n", vpd_mr->rf);
-		printf("  Record Length             : %d\n", vpd_mr->rlen);
-		printf("  Record Checksum           : %d\n", vpd_mr->rchksum);
-		printf("  Header Checksum           : %d\n", vpd_mr->hchksum);
-		printf("  NMRAVN                    : %d\n", vpd_mr->nmra.nmravn);
-		printf("  Form Factor               : %d\n", vpd_mr->nmra.ff);
-
-		vpd_mr = (void *)vpd_mr + 5 + sizeof(struct nvme_mi_vpd_mra);
-		printf("NVMe PCIe Port MultiRecord Area\n");
-		printf("  Type                      : %d (%s)\n", vpd_mr->type, _type[vpd_mr->type]);
-		printf("  Record Format             : %d\n", vpd_mr->rf);
-		printf("  Record Length             : %d\n", vpd_mr->rlen);
-		printf("  Record Checksum           : %d\n", vpd_mr->rchksum);
-		printf("  Header Checksum           : %d\n", vpd_mr->hchksum);
-		printf("  NPPMRAVN                  : %d\n", vpd_mr->ppmra.nppmravn);
-		printf("  PCIe Port Number          : %d\n", vpd_mr->ppmra.pn);
-		printf("  Port Information          : %d\n", vpd_mr->ppmra.ppi);
-		printf("  PCIe Link Speed           : %d\n", vpd_mr->ppmra.ls);
-		printf("  PCIe Maximum Link Width   : %x\n", vpd_mr->ppmra.mlw);
-		printf("  MCTP Support              : %d\n", vpd_mr->ppmra.mctp);
-		printf("  Ref Clk Capability        : %d\n", vpd_mr->ppmra.refccap);
-		printf("  Port Identifier           : %d\n", vpd_mr->ppmra.pi);
-
-		vpd_mr = (void *)vpd_mr + 5 + sizeof(struct nvme_mi_vpd_ppmra);
-		printf("Topology MultiRecord Area\n");
-		printf("  Type                      : %d (%s)\n", vpd_mr->type, _type[vpd_mr->type]);
-		printf("  Record Format             : %d\n", vpd_mr->rf);
-		printf("  Record Length             : %d\n", vpd_mr->rlen);
-		printf("  Record Checksum           : %d\n", vpd_mr->rchksum);
-		printf("  Header Checksum           : %d\n", vpd_mr->hchksum);
-		printf("  Version Number            : %d\n", vpd_mr->tmra.vn);
-		printf("  Element Count (N)         : %d\n", vpd_mr->tmra.ec);
+	// Areas can only be located from the Common Header at offset 0.
+	if (!ctx->dofst) {
+		struct nvme_vpd *vpd = malloc(sizeof(*vpd));
+
+		if (vpd) {
+			memset(vpd, 0, sizeof(*vpd));
+			vpd->size = size > sizeof(vpd->data) ? sizeof(vpd->data) : size;
+			memcpy(vpd->data, buf, vpd->size);
+			nvme_vpd_parse(vpd);
+			nvme_vpd_show(vpd);
+			free(vpd);
+		}
 	}
 
-	// TBD
 	print_buf(buf, size, "VPD Read");
-	if (size != nvme_mi_ctx.dlen)
-		nvme_trace(WARN, "dlen mismatch: size(%d) != dlen(%d)\n", size, nvme_mi_ctx.dlen);
-	memcpy(nvme_mi_ctx.vpd + nvme_mi_ctx.dofst, buf, size);
+	if (size != ctx->dlen)
+		nvme_trace(WARN, "dlen mismatch: size(%d) != dlen(%d)\n", size, ctx->dlen);
 }
 
-int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t size)
+static void nvme_mi_show_response(struct nvme_mi_context *ctx, const union nvme_mi_res_msg *res_msg,
+                                  uint16_t size)
 {
-	if (!nvme_mi_ctx.req_sent)
-		return 0;
-
 	if (size < 256) {
-		print_buf(msg, size, "Response Message");
+		print_buf(res_msg, size, "Response Message");
 	}
-	nvme_mi_ctx.req_sent = 0;
 
-	const union nvme_mi_res_msg *res_msg = msg;
 	printf("Message Size                : %d\n", size);
-	const char *mt[256] = {
-		[MCTP_MSG_TYPE_CTRL] = "MCTP Control",
-		[MCTP_MSG_TYPE_PLDM] = "PLDM",
-		[MCTP_MSG_TYPE_NCSI] = "NC-SI over MCTP",
-		[MCTP_MSG_TYPE_ETHERNET] = "Ethernet",
-		[MCTP_MSG_TYPE_NVME_MM] = "NVMe MM",
-		[MCTP_MSG_TYPE_SPDM] = "SPDM",
-		[MCTP_MSG_TYPE_SECURED] = "Secured Messages",
-		[MCTP_MSG_TYPE_CXL_FX_API] = "CXL FM API",
-		[MCTP_MSG_TYPE_CXL_CCI] = "CXL CCI",
-		[MCTP_MSG_TYPE_CXL_VENDOR_PCI] = "Vendor Defined - PCI",
-		[MCTP_MSG_TYPE_CXL_VENDOR_IANA] = "Vendor Defined - IANA",
-	};
-	printf("Message Type                : %d (%s)\n", res_msg->nmh.mt, mt[res_msg->nmh.mt]);
+	printf("Message Type                : %d (%s)\n", res_msg->nmh.mt, _mt[res_msg->nmh.mt]);
 	printf("Integrity Check             : %d\n", res_msg->nmh.ic);
 	printf("CSI                         : %d\n", res_msg->nmh.csi);
 	printf("NVMe-MI Message Type        : %d (%s)\n", res_msg->nmh.nmimt, _nmimt[res_msg->nmh.nmimt]);
 	switch (res_msg->nmh.nmimt) {
 	case NVME_MI_MT_MI: {
-		printf("Opcode                      : %02Xh (%s)\n", nvme_mi_ctx.opc, _mi_opc[nvme_mi_ctx.opc]);
-		if (nvme_mi_ctx.opc == nvme_mi_mi_opcode_configuration_set || nvme_mi_ctx.opc == nvme_mi_mi_opcode_configuration_get) {
+		printf("Opcode                      : %02Xh (%s)\n", ctx->opc, _mi_opc[ctx->opc]);
+		if (ctx->opc == nvme_mi_mi_opcode_configuration_set || ctx->opc == nvme_mi_mi_opcode_configuration_get) {
 			static const char *cfg_id[256] = {
 				[0] = "Reserved",
 				[NVME_MI_CONFIG_SMBUS_FREQ] = "SMBus/I2C Frequency",
@@ -510,9 +797,9 @@ int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t s
 				[0x04 ... 0xBF] = "Reserved",
 				[0xC0 ... 0xFF] = "Vendor Specific"
 			};
-			printf("  Configuration Identifier  : %02Xh (%s)\n", nvme_mi_ctx.cfg_id, cfg_id[nvme_mi_ctx.cfg_id]);
+			printf("  Configuration Identifier  : %02Xh (%s)\n", ctx->cfg_id, cfg_id[ctx->cfg_id]);
 		}
-		if (nvme_mi_ctx.opc == nvme_mi_mi_opcode_mi_data_read) {
+		if (ctx->opc == nvme_mi_mi_opcode_mi_data_read) {
 			static const char *dtyp[256] = {
 				[nvme_mi_dtyp_subsys_info] = "NVM Subsystem Information",
 				[nvme_mi_dtyp_port_info] = "Port Information",
@@ -522,68 +809,40 @@ int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t s
 				[nvme_mi_dtyp_meb_support] = "Management Endpoint Buffer Command Support List",
 				[0x06 ... 0xFF] = "Reserved"
 			};
-			printf("  Data Structure Type       : %02Xh (%s)\n", nvme_mi_ctx.dtyp, dtyp[nvme_mi_ctx.dtyp]);
-			if (nvme_mi_ctx.dtyp == nvme_mi_dtyp_port_info) {
-				printf("  Port Identifier           : %d\n", nvme_mi_ctx.portid);
+			printf("  Data Structure Type       : %02Xh (%s)\n", ctx->dtyp, dtyp[ctx->dtyp]);
+			if (ctx->dtyp == nvme_mi_dtyp_port_info) {
+				printf("  Port Identifier           : %d\n", ctx->portid);
 			}
-			if (nvme_mi_ctx.dtyp == nvme_mi_dtyp_ctrl_list) {
-				printf("  Controller Identifier     : %d\n", nvme_mi_ctx.ctrlid);
+			if (ctx->dtyp == nvme_mi_dtyp_ctrl_list) {
+				printf("  Controller Identifier     : %d\n", ctx->ctrlid);
 			}
 		}
 	}
 	break;
 	case NVME_MI_MT_ADMIN: {
-		printf("Opcode                      : %02Xh (%s)\n", nvme_mi_ctx.opc, _adm_opc[nvme_mi_ctx.opc]);
+		printf("Opcode                      : %02Xh (%s)\n", ctx->opc, _adm_opc[ctx->opc]);
 	}
 	break;
 	default:
 		break;
 	}
-	const char *ror[ROR_MAX] = {
-		"Request",
-		"Response"
-	};
-	printf("Request or Response         : %d (%s)\n", res_msg->nmh.ror, ror[res_msg->nmh.ror]);
+	printf("Request or Response         : %d (%s)\n", res_msg->nmh.ror, _ror[res_msg->nmh.ror]);
 	printf("MEB                         : %d\n", res_msg->nmh.meb);
 	printf("CIAP                        : %d\n", res_msg->nmh.ciap);
-	const char *status[256] = {
-		[NVME_MI_RESP_SUCCESS] = "Success",
-		[NVME_MI_RESP_MPR] = "More Processing Required",
-		[NVME_MI_RESP_INTERNAL_ERR] = "Internal Error",
-		[NVME_MI_RESP_INVALID_OPCODE] = "Invalid command opcode",
-		[NVME_MI_RESP_INVALID_PARAM] = "Invalid command parameter",
-		[NVME_MI_RESP_INVALID_CMD_SIZE] = "Invalid command size",
-		[NVME_MI_RESP_INVALID_INPUT_SIZE] = "Invalid command input data size",
-		[NVME_MI_RESP_ACCESS_DENIED] = "Access Denied",
-		[NVME_MI_RESP_VPD_UPDATES_EXCEEDED] = "More VPD updates than allowed",
-		[NVME_MI_RESP_PCIE_INACCESSIBLE] = "PCIe functionality currently unavailable",
-		[NVME_MI_RESP_MEB_SANITIZED] = "MEB has been cleared due to sanitize",
-		[NVME_MI_RESP_ENC_SERV_FAILURE] = "Enclosure services process failed",
-		[NVME_MI_RESP_ENC_SERV_XFER_FAILURE] = "Transfer with enclosure services failed",
-		[NVME_MI_RESP_ENC_FAILURE] = "Unreoverable enclosure failure",
-		[NVME_MI_RESP_ENC_XFER_REFUSED] = "Enclosure services transfer refused",
-		[NVME_MI_RESP_ENC_FUNC_UNSUP] = "Unsupported enclosure services function",
-		[NVME_MI_RESP_ENC_SERV_UNAVAIL] = "Enclosure services unavailable",
-		[NVME_MI_RESP_ENC_DEGRADED] = "Noncritical failure detected by enc. services",
-		[NVME_MI_RESP_SANITIZE_IN_PROGRESS] = "Command prohibited during sanitize",
-	};
-	printf("Status                      : %d (%s)\n", res_msg->nmresp.status, status[res_msg->nmresp.status]);
+	printf("Status                      : %d (%s)\n", res_msg->nmresp.status, _status[res_msg->nmresp.status]);
 	printf("NVMe Management Response    : 0x%x\n", res_msg->nmresp.nmresp);
 
-	switch (nvme_mi_ctx.nmimt) {
+	switch (ctx->nmimt) {
 	case NVME_MI_MT_MI: {
-		if (res_msg->nmresp.status) {
-			nvme_mi_ctx.nmresp.status = res_msg->nmresp.status;
+		if (res_msg->nmresp.status)
 			break;
-		}
-		nvme_mi_ctx.nmresp.status = NVME_MI_RESP_SUCCESS;
 
 		void *buf = (void *)res_msg->res_data;
-		switch (nvme_mi_ctx.opc) {
+		switch (ctx->opc) {
 		case nvme_mi_mi_opcode_mi_data_read:
 			printf("  Response Data Length: %d\n", res_msg->nmresp.rnmds.resp_data_len);
 			printf("  Status: %d\n", res_msg->nmresp.rnmds.status);
-			nvme_mi_show_mi_data_read(buf);
+			nvme_mi_show_mi_data_read(ctx, buf);
 			break;
 		case nvme_mi_mi_opcode_subsys_health_status_poll:
 			nvme_mi_show_subsystem_health_status(buf);
@@ -598,10 +857,13 @@ int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t s
 			nvme_mi_show_configuration_set(res_msg->nmresp);
 			break;
 		case nvme_mi_mi_opcode_configuration_get:
-			nvme_mi_show_configuration_get(res_msg->nmresp);
+			nvme_mi_show_configuration_get(ctx, res_msg->nmresp);
 			break;
 		case nvme_mi_mi_opcode_vpd_read:
-			nvme_mi_show_vpd_read(buf, size - sizeof(res_msg->nmh) - sizeof(res_msg->nmresp));
+			nvme_mi_show_vpd_read(ctx, buf, size - sizeof(res_msg->nmh) - sizeof(res_msg->nmresp));
+			break;
+		case nvme_mi_mi_opcode_meb_read:
+			printf("  Data Length               : %d\n", ctx->data_len);
 			break;
 		}
 	}
@@ -613,38 +875,184 @@ int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t s
 		printf("CQE Dword 1                 : %08x\n", res_data->cqedw1);
 		printf("CQE Dword 3                 : %08x\n", res_data->cqedw3);
 		void *buf = (void *)res_msg->res_data + sizeof(struct nvme_mi_adm_res_dw);
-		switch (nvme_mi_ctx.opc) {
+		switch (ctx->opc) {
 		case nvme_admin_get_log_page:
-			nvme_show_log_page(buf);
+			if (ctx->result.type == NVME_RESULT_SMART)
+				nvme_show_log_page(buf);
 			break;
 		case nvme_admin_identify:
-			nvme_show_identify(buf);
+			if (ctx->result.type == NVME_RESULT_IDENTIFY)
+				nvme_show_identify(buf);
 			break;
 		case nvme_admin_get_features:
-			nvme_show_get_features(res_data->cqedw0, buf);
+			nvme_show_get_features(res_msg->nmh.csi, res_data->cqedw0, buf);
 			break;
 		case nvme_admin_set_features:
+		case nvme_admin_fw_download:
+		case nvme_admin_fw_commit:
 			break;
 		default:
-			nvme_trace(WARN, "unknown mi opc: %d\n", nvme_mi_ctx.opc);
+			nvme_trace(WARN, "unknown mi opc: %d\n", ctx->opc);
 			break;
 		}
 	}
 	break;
 
 	default:
-		printf("unsupported nmimt: %d\n", nvme_mi_ctx.nmimt);
+		printf("unsupported nmimt: %d\n", ctx->nmimt);
 		break;
 	}
 
 	if (res_msg->nmresp.status == NVME_MI_RESP_INVALID_PARAM) {
-		printf("Invalid Parameter           : \033[7m%s\033[0m\n", nvme_mi_show_error_response(nvme_mi_ctx.opc, res_msg->nmresp));
+		printf("Invalid Parameter           : \033[7m%s\033[0m\n", nvme_mi_show_error_response(ctx->opc, res_msg->nmresp));
 		printf("  Status                    : %d\n", res_msg->nmresp.invld_para.status);
 		printf("  lsbyte                    : %d\n", res_msg->nmresp.invld_para.lsbyte);
 		printf("  lsbit                     : %d\n", res_msg->nmresp.invld_para.lsbit);
 	}
+}
+
 
-	nvme_mi_ctx.opc = 0xFF;
+/**
+ * Fill the result of the slot from the response. Nothing is printed here, the
+ * result is rendered afterwards in the selected output format.
+ */
+static void nvme_mi_decode_response(struct nvme_mi_context *ctx, const union nvme_mi_res_msg *res_msg,
+                                    uint16_t size)
+{
+	struct nvme_mi_result *res = &ctx->result;
+	const void *buf = res_msg->res_data;
+	uint16_t len = size - sizeof(res_msg->nmh) - sizeof(res_msg->nmresp);
+	int ret = NVME_DECODE_SUCCESS;
+
+	memset(res, 0, sizeof(*res));
+	res->type = NVME_RESULT_NONE;
+	res->csi = res_msg->nmh.csi;
+	res->nmimt = ctx->nmimt;
+	res->opc = ctx->opc;
+	res->status = res_msg->nmresp.status;
+	res->nmresp = res_msg->nmresp.nmresp;
+	ctx->nmresp.status = res_msg->nmresp.status;
+
+	if (res->status)
+		return;
+
+	switch (ctx->nmimt) {
+	case NVME_MI_MT_MI:
+		// Raw response data for callers that keep it, e.g. MEB Read or a cache.
+		if (ctx->data && (ctx->opc == nvme_mi_mi_opcode_mi_data_read ||
+		                  ctx->opc == nvme_mi_mi_opcode_vpd_read ||
+		                  ctx->opc == nvme_mi_mi_opcode_meb_read)) {
+			ctx->data_len = len > ctx->data_size ? ctx->data_size : len;
+			memcpy(ctx->data, buf, ctx->data_len);
+		}
+
+		switch (ctx->opc) {
+		case nvme_mi_mi_opcode_mi_data_read:
+			switch (ctx->dtyp) {
+			case nvme_mi_dtyp_subsys_info:
+				res->type = NVME_RESULT_SUBSYS_INFO;
+				ret = nvme_decode_subsys_info(buf, len, &res->subsys_info);
+				break;
+			case nvme_mi_dtyp_port_info:
+				res->type = NVME_RESULT_PORT_INFO;
+				ret = nvme_decode_port_info(buf, len, ctx->portid, &res->port_info);
+				break;
+			case nvme_mi_dtyp_ctrl_list:
+				res->type = NVME_RESULT_CTRL_LIST;
+				ret = nvme_decode_ctrl_list(buf, len, &res->ctrl_list);
+				break;
+			case nvme_mi_dtyp_ctrl_info:
+				res->type = NVME_RESULT_CTRL_INFO;
+				ret = nvme_decode_ctrl_info(buf, len, &res->ctrl_info);
+				break;
+			default:
+				break;
+			}
+			break;
+		case nvme_mi_mi_opcode_subsys_health_status_poll:
+			res->type = NVME_RESULT_SUBSYS_HEALTH;
+			ret = nvme_decode_subsys_health(buf, len, &res->subsys_health);
+			break;
+		case nvme_mi_mi_opcode_controller_health_status_poll:
+			res->type = NVME_RESULT_CTRL_HEALTH;
+			ret = nvme_decode_ctrl_health(buf, len, res_msg->nmresp.chsp.rent, &res->ctrl_health);
+			break;
+		case nvme_mi_mi_opcode_configuration_get:
+			res->type = NVME_RESULT_CONFIG;
+			ret = nvme_decode_config(ctx->cfg_id, res->nmresp, &res->config);
+			break;
+		case nvme_mi_mi_opcode_configuration_set:
+			if (ctx->cfg_id == NVME_MI_CONFIG_AE)
+				nvme_aem_decode(mctp_transport_get_src_eid(), buf, len, false);
+			break;
+		}
+		break;
+	case NVME_MI_MT_ADMIN:
+		ret = nvme_cmd_decode(res->csi, buf, len, res);
+		break;
+	default:
+		break;
+	}
+
+	if (ret) {
+		nvme_trace(WARN, "decode result %d (%d)\n", res->type, ret);
+		res->type = NVME_RESULT_NONE;
+	}
+}
+
+int nvme_mi_get_result(bool csi, struct nvme_mi_result *res)
+{
+	const struct nvme_mi_context *ctx = &nvme_mi_ctx[csi];
+
+	if (ctx->req_sent)
+		return -NVME_DECODE_ERR_TYPE;
+
+	memcpy(res, &ctx->result, sizeof(*res));
+
+	return NVME_DECODE_SUCCESS;
+}
+
+int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t size)
+{
+	const union nvme_mi_res_msg *res_msg = msg;
+	struct nvme_mi_context *ctx = &nvme_mi_ctx[res_msg->nmh.csi];
+	enum nvme_format_type fmt = nvme_format_get();
+
+	// Too short for the Response Message Status, the request times out instead.
+	if (size < sizeof(res_msg->nmh) + sizeof(res_msg->nmresp)) {
+		nvme_trace(WARN, "short response (%d) on slot %d\n", size, res_msg->nmh.csi);
+		return 0;
+	}
+
+	if (!ctx->req_sent) {
+		nvme_trace(WARN, "no request outstanding on slot %d\n", res_msg->nmh.csi);
+		return 0;
+	}
+
+	/**
+	 * NVMe-MI, 4.1.2 Response Message Status
+	 *
+	 * More Processing Required: the final response follows within the More
+	 * Processing Required Time (MPRT, in 100 ms units), the request stays
+	 * outstanding until then.
+	 */
+	if (res_msg->nmresp.status == NVME_MI_RESP_MPR) {
+		uint32_t mprt = res_msg->nmresp.nmresp & 0xFFFF;
+		ctx->deadline_us = time_us() + (mprt ? mprt * 100000ULL : nvme_mi_deadline_ms * 1000ULL);
+		mctp_transport_extend_request();
+		return 0;
+	}
+	ctx->req_sent = 0;
+	ctx->done_us = time_us();
+
+	nvme_mi_decode_response(ctx, res_msg, size);
+
+	if (fmt == NVME_FORMAT_TEXT)
+		nvme_mi_show_response(ctx, res_msg, size);
+	else
+		nvme_format_result(stdout, &ctx->result, fmt);
+
+	ctx->opc = 0xFF;
 
 	return 0xFF; // End of Command for T3
 }
@@ -652,6 +1060,19 @@ int nvme_mi_response_message_handle(const union nvme_mi_res_msg *msg, uint16_t s
 int nvme_mi_message_handle(const union nvme_mi_msg *msg, uint16_t size)
 {
 	int ret;
+
+	/**
+	 * NVMe-MI, 5.1.1 Asynchronous Event Messages
+	 *
+	 * AEMs are sent by the Management Endpoint on its own, they do not
+	 * answer a request on a Command Slot and must not complete one.
+	 */
+	if (msg->nmh.nmimt == NVME_MI_MT_AE && msg->nmh.ror == ROR_RESP)
+		return nvme_aem_message_handle(msg, size);
+
+	if (msg->nmh.nmimt == NVME_MI_MT_CONTROL && msg->nmh.ror == ROR_RESP)
+		return nvme_mi_cp_message_handle(msg, size);
+
 	if (msg->nmh.ror == ROR_REQ) {
 		ret = nvme_mi_request_message_handle((void *)msg, size);
 	} else {
@@ -661,8 +1082,12 @@ int nvme_mi_message_handle(const union nvme_mi_msg *msg, uint16_t size)
 	return ret;
 }
 
-void nvme_mi_print_msg_header(const union nvme_mi_req_msg *req_msg)
+// Only with -V, stdout carries the text, JSON or session records.
+static void nvme_mi_print_msg_header(const struct aa_args *args, const union nvme_mi_req_msg *req_msg)
 {
+	if (!args->verbose)
+		return;
+
 	printf("\033[30;43mopc : 0x%08x\033[0m\n", req_msg->opc);
 	printf("\033[30;43mnmd0: 0x%08x\033[0m\n", req_msg->nmd0.value);
 	printf("\033[30;43mnmd1: 0x%08x\033[0m\n", req_msg->nmd1.value);
@@ -677,7 +1102,7 @@ int nvme_mi_mi_data_read(struct aa_args *args, union nvme_mi_nmd0 nmd0, union nv
 	req_msg->opc  = nvme_mi_mi_opcode_mi_data_read;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
 	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
@@ -699,7 +1124,12 @@ int nvme_mi_mi_data_read_nvm_subsys_info(struct aa_args *args)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.dtyp = nmd0.rnmds.dtyp;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->dtyp = nmd0.rnmds.dtyp;
 
 	return nvme_mi_mi_data_read(args, nmd0, nmd1);
 }
@@ -715,8 +1145,13 @@ int nvme_mi_mi_data_read_port_info(struct aa_args *args, uint8_t portid)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.dtyp = nmd0.rnmds.dtyp;
-	nvme_mi_ctx.portid = portid;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->dtyp = nmd0.rnmds.dtyp;
+	ctx->portid = portid;
 
 	return nvme_mi_mi_data_read(args, nmd0, nmd1);
 }
@@ -731,8 +1166,13 @@ int nvme_mi_mi_data_read_ctrl_list(struct aa_args *args, uint8_t ctrlid)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.dtyp = nmd0.rnmds.dtyp;
-	nvme_mi_ctx.ctrlid = ctrlid;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->dtyp = nmd0.rnmds.dtyp;
+	ctx->ctrlid = ctrlid;
 
 	return nvme_mi_mi_data_read(args, nmd0, nmd1);
 }
@@ -747,8 +1187,13 @@ int nvme_mi_mi_data_read_ctrl_info(struct aa_args *args, uint8_t ctrlid)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.dtyp = nmd0.rnmds.dtyp;
-	nvme_mi_ctx.ctrlid = ctrlid;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->dtyp = nmd0.rnmds.dtyp;
+	ctx->ctrlid = ctrlid;
 
 	return nvme_mi_mi_data_read(args, nmd0, nmd1);
 }
@@ -763,8 +1208,13 @@ int nvme_mi_mi_data_read_opt_cmd_support(struct aa_args *args, uint8_t ctrlid, u
 		.rnmds.iocsi = iocsi,
 	};
 
-	nvme_mi_ctx.dtyp = nmd0.rnmds.dtyp;
-	nvme_mi_ctx.ctrlid = ctrlid;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->dtyp = nmd0.rnmds.dtyp;
+	ctx->ctrlid = ctrlid;
 
 	return nvme_mi_mi_data_read(args, nmd0, nmd1);
 }
@@ -784,7 +1234,7 @@ int nvme_mi_mi_subsystem_health_status_poll(struct aa_args *args, bool cs)
 	req_msg->opc  = nvme_mi_mi_opcode_subsys_health_status_poll;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
 	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
@@ -795,6 +1245,13 @@ int nvme_mi_mi_subsystem_health_status_poll(struct aa_args *args, bool cs)
 	return ret;
 }
 
+/**
+ * NVMe-MI, 5.12 VPD Read
+ *
+ * Read dlen bytes of VPD starting at dofst and wait for the response. With buf
+ * the data is copied there, otherwise to the buffer set with
+ * nvme_mi_set_data_buf() for the slot.
+ */
 int nvme_mi_mi_vpd_read(struct aa_args *args, uint16_t dofst, uint16_t dlen, void *buf)
 {
 	union nvme_mi_nmd0 nmd0 = {
@@ -803,9 +1260,23 @@ int nvme_mi_mi_vpd_read(struct aa_args *args, uint16_t dofst, uint16_t dlen, voi
 	union nvme_mi_nmd1 nmd1 = {
 		.vpdr.dlen = dlen,
 	};
-	memset(nvme_mi_ctx.vpd, 0, sizeof(nvme_mi_ctx.vpd));
-	nvme_mi_ctx.dofst = dofst;
-	nvme_mi_ctx.dlen = dlen;
+	struct nvme_mi_context *ctx;
+	void *data;
+	uint32_t data_size;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	data = ctx->data;
+	data_size = ctx->data_size;
+
+	ctx->dofst = dofst;
+	ctx->dlen = dlen;
+	ctx->data_len = 0;
+	if (buf) {
+		ctx->data = buf;
+		ctx->data_size = dlen;
+	}
 	union nvme_mi_msg *msg = malloc(sizeof(*msg));
 	memset(msg, 0, sizeof(*msg));
 	union nvme_mi_req_msg *req_msg = (void *)msg;
@@ -813,14 +1284,23 @@ int nvme_mi_mi_vpd_read(struct aa_args *args, uint16_t dofst, uint16_t dlen, voi
 	req_msg->opc  = nvme_mi_mi_opcode_vpd_read;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
-	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
+	ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
 		nvme_trace(ERROR, "nvme_mi_mi_vpd_read failed (%d)\n", ret);
 
-	if (!nvme_mi_ctx.nmresp.status && buf)
-		memcpy(buf, nvme_mi_ctx.vpd + dofst, dlen);
+	// The data is only valid once the slot has been answered.
+	if (!ret)
+		ret = nvme_mi_wait_slot(args, args->csi);
+
+	if (!ret && !ctx->nmresp.status && ctx->data && ctx->data_len < dlen)
+		nvme_trace(ERROR, "short vpd read at %d (%d,%d)\n", dofst, ctx->data_len, dlen);
+
+	if (buf) {
+		ctx->data = data;
+		ctx->data_size = data_size;
+	}
 
 	free(msg);
 
@@ -878,7 +1358,7 @@ int nvme_mi_mi_controller_health_status_poll(struct aa_args *args, bool ccf)
 	req_msg->opc  = nvme_mi_mi_opcode_controller_health_status_poll;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
 	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
@@ -898,7 +1378,7 @@ int nvme_mi_mi_config_get(struct aa_args *args, union nvme_mi_nmd0 nmd0, union n
 	req_msg->opc = nvme_mi_mi_opcode_configuration_get;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
 	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
@@ -920,7 +1400,12 @@ int nvme_mi_mi_config_get_sif(struct aa_args *args)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_get(args, nmd0, nmd1);
 }
@@ -935,7 +1420,12 @@ int nvme_mi_mi_config_get_hsc(struct aa_args *args)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_get(args, nmd0, nmd1);
 }
@@ -951,7 +1441,12 @@ int nvme_mi_mi_config_get_mtus(struct aa_args *args)
 		.value = 0,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_get(args, nmd0, nmd1);
 }
@@ -966,7 +1461,7 @@ int nvme_mi_mi_config_set(struct aa_args *args, union nvme_mi_nmd0 nmd0, union n
 	req_msg->opc = nvme_mi_mi_opcode_configuration_set;
 	req_msg->nmd0 = nmd0;
 	req_msg->nmd1 = nmd1;
-	nvme_mi_print_msg_header(req_msg);
+	nvme_mi_print_msg_header(args, req_msg);
 
 	int ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
 	if (ret < 0)
@@ -989,7 +1484,12 @@ int nvme_mi_mi_config_set_sif(struct aa_args *args, uint8_t port_id, uint8_t fre
 		.cfg.value = 0,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_set(args, nmd0, nmd1);
 }
@@ -1004,7 +1504,12 @@ int nvme_mi_mi_config_set_hsc(struct aa_args *args, union nmd1_config_hsc hsc)
 		.cfg.value = hsc.value,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_set(args, nmd0, nmd1);
 }
@@ -1020,7 +1525,182 @@ int nvme_mi_mi_config_set_mtus(struct aa_args *args, uint8_t port_id, union nmd1
 		.cfg.mtus.mtus = mtus.value,
 	};
 
-	nvme_mi_ctx.cfg_id = nmd0.cfg.cfg_id;
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = nmd0.cfg.cfg_id;
 
 	return nvme_mi_mi_config_set(args, nmd0, nmd1);
 }
+
+/**
+ * Configuration Set - Asynchronous Event (Configuration Identifier 04h)
+ *
+ * The Request Data is an AE Enable List with one item per event identifier.
+ * The response carries a synchronous AEM with the currently active events,
+ * which is handed to the AEM handler like an unsolicited one.
+ */
+int nvme_mi_mi_config_set_ae(struct aa_args *args, struct nmd0_config_ae ae, union nmd1_config_ae delay,
+                             const uint8_t *aeid, const bool *aee, uint8_t num)
+{
+	union nvme_mi_nmd0 nmd0 = {
+		.cfg.ae = ae,
+	};
+	union nvme_mi_nmd1 nmd1 = {
+		.cfg.ae = delay,
+	};
+	struct nvme_mi_aem_enable_list_header *hdr;
+	struct nvme_mi_aem_enable_item *item;
+	union nvme_mi_req_msg *req_msg;
+	union nvme_mi_msg *msg;
+	uint16_t len = sizeof(*hdr) + num * sizeof(*item);
+	int ret;
+
+	nmd0.cfg.ae.cfg_id = NVME_MI_CONFIG_AE;
+
+	struct nvme_mi_context *ctx;
+
+	ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->cfg_id = NVME_MI_CONFIG_AE;
+
+	msg = malloc(sizeof(*msg));
+	memset(msg, 0, sizeof(*msg));
+	req_msg = (void *)msg;
+
+	req_msg->opc  = nvme_mi_mi_opcode_configuration_set;
+	req_msg->nmd0 = nmd0;
+	req_msg->nmd1 = nmd1;
+
+	hdr = (void *)req_msg->req_data;
+	hdr->numaee = num;
+	hdr->aeelver = 0;
+	hdr->aeetl = len;
+	hdr->aeelhl = sizeof(*hdr);
+
+	item = (void *)(hdr + 1);
+	for (int i = 0; i < num; i++, item++) {
+		item->aeel = sizeof(*item);
+		// Bit[7:0] AE Enable Identifier (AEEID), Bit[15] AE Enable (AEE)
+		item->aeei = aeid[i] | (aee[i] ? 1 << 15 : 0);
+	}
+	nvme_mi_print_msg_header(args, req_msg);
+
+	ret = nvme_mi_send_mi_command(args, req_msg->opc, msg, len + sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
+	if (ret < 0)
+		nvme_trace(ERROR, "nvme_mi_send_mi_command failed (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
+
+void nvme_mi_set_data_buf(bool csi, void *buf, uint32_t size)
+{
+	nvme_mi_ctx[csi].data = buf;
+	nvme_mi_ctx[csi].data_size = size;
+	nvme_mi_ctx[csi].data_len = 0;
+}
+
+uint32_t nvme_mi_get_data_len(bool csi)
+{
+	return nvme_mi_ctx[csi].data_len;
+}
+
+uint64_t nvme_mi_get_done_us(bool csi)
+{
+	return nvme_mi_ctx[csi].done_us;
+}
+
+/**
+ * NVMe-MI, 5.6 Management Endpoint Buffer Read
+ *
+ * Read dlen bytes of the Management Endpoint Buffer starting at dofst. The
+ * data is copied to the buffer set with nvme_mi_set_data_buf() for the slot.
+ */
+int nvme_mi_mi_meb_read(struct aa_args *args, uint32_t dofst, uint32_t dlen)
+{
+	struct aa_args meb_args = *args;
+	union nvme_mi_nmd0 nmd0 = {
+		.meb.dofst = dofst,
+	};
+	union nvme_mi_nmd1 nmd1 = {
+		.meb.dlen = dlen,
+	};
+	struct nvme_mi_context *ctx;
+	int ret = nvme_mi_acquire_slot(args, &ctx);
+	if (ret)
+		return ret;
+
+	ctx->data_len = 0;
+	// The MEB commands move the buffer content themselves.
+	meb_args.meb = false;
+
+	union nvme_mi_msg *msg = malloc(sizeof(*msg));
+	memset(msg, 0, sizeof(*msg));
+	union nvme_mi_req_msg *req_msg = (void *)msg;
+
+	req_msg->opc  = nvme_mi_mi_opcode_meb_read;
+	req_msg->nmd0 = nmd0;
+	req_msg->nmd1 = nmd1;
+
+	ret = nvme_mi_send_mi_command(&meb_args, req_msg->opc, msg, sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
+	if (ret < 0)
+		nvme_trace(ERROR, "nvme_mi_mi_meb_read failed (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
+
+/**
+ * NVMe-MI, 5.7 Management Endpoint Buffer Write
+ *
+ * Write dlen bytes of buf to the Management Endpoint Buffer at dofst. dlen is
+ * limited by the Request Message, larger transfers are split by the caller.
+ */
+int nvme_mi_mi_meb_write(struct aa_args *args, uint32_t dofst, uint32_t dlen, const void *buf)
+{
+	struct aa_args meb_args = *args;
+	union nvme_mi_nmd0 nmd0 = {
+		.meb.dofst = dofst,
+	};
+	union nvme_mi_nmd1 nmd1 = {
+		.meb.dlen = dlen,
+	};
+	union nvme_mi_msg *msg;
+	union nvme_mi_req_msg *req_msg;
+	int ret;
+
+	if (dlen > sizeof(req_msg->raw_data) - sizeof(union nvme_mi_req_dw) - 4) {
+		nvme_trace(ERROR, "meb write too long (%d)\n", dlen);
+		return -1;
+	}
+
+	ret = nvme_mi_acquire_slot(args, NULL);
+	if (ret)
+		return ret;
+
+	meb_args.meb = false;
+
+	msg = malloc(sizeof(*msg));
+	memset(msg, 0, sizeof(*msg));
+	req_msg = (void *)msg;
+
+	req_msg->opc  = nvme_mi_mi_opcode_meb_write;
+	req_msg->nmd0 = nmd0;
+	req_msg->nmd1 = nmd1;
+	memcpy(req_msg->req_data, buf, dlen);
+
+	ret = nvme_mi_send_mi_command(&meb_args, req_msg->opc, msg, dlen + sizeof(union nvme_mi_req_dw) - sizeof(union nvme_mi_msg_header));
+	if (ret < 0)
+		nvme_trace(ERROR, "nvme_mi_mi_meb_write failed (%d)\n", ret);
+
+	free(msg);
+
+	return ret;
+}
@@ -27,6 +27,20 @@
  */
 #define NVME_MI_MSG_SIZE                (4096 + 128)
 
+// Command Slot 0 and 1, selected by the CSI bit of the message header.
+#define NVME_MI_SLOT_MAX                (2)
+
+// A request without a response by then is aborted, unless More Processing Required extends it.
+#define NVME_MI_DEADLINE_MS             (3000)
+/**
+ * Control Primitives are handled by the Management Endpoint ahead of any
+ * command, so their response is waited for in short polls with a tight bound.
+ */
+#define NVME_MI_CP_TIMEOUT_MS           (50)
+#define NVME_MI_CP_POLL_MS              (2)
+// Replays of one response lost to a PEC error before the request is aborted
+#define NVME_MI_REPLAY_MAX              (3)
+
 // // NVMe-MI Message Type (NMIMT)
 // enum nvme_mi_msg_type {
 //      NMIMT_CTRLP = 0,                    // Control Primitive
@@ -54,6 +68,25 @@ enum nvme_mi_port_type {
 	PORT_TYPE_SMBUS,
 };
 
+/**
+ * NVMe-MI, 4.2.1 Control Primitives
+ */
+enum nvme_mi_cp_opcode {
+	NVME_MI_CP_PAUSE = 0,
+	NVME_MI_CP_RESUME = 1,
+	NVME_MI_CP_ABORT = 2,
+	NVME_MI_CP_GET_STATE = 3,
+	NVME_MI_CP_REPLAY = 4,
+	NVME_MI_CP_MAX,
+};
+
+enum nvme_mi_cp_error {
+	NVME_MI_CP_SUCCESS = 0,
+	NVME_MI_CP_ERR_TIMEOUT,
+	NVME_MI_CP_ERR_STATUS,
+	NVME_MI_CP_ERR_PARAM,
+};
+
 enum nvme_mi_msg_ror {
 	ROR_REQ = 0,
 	ROR_RESP = 1,
@@ -118,6 +151,21 @@ struct nmd0_config_mtus {
 	uint32_t port_id : 8;           // Bit[31:24] Port Identifier
 };
 
+/**
+ * Configuration Set, Asynchronous Event - NVMe Management Dword 0
+ *
+ * The enable flags apply to all Asynchronous Events that are reported with
+ * the AE Enable List in the Request Data.
+ */
+struct nmd0_config_ae {
+	uint32_t cfg_id  : 8;           // Bit[7:0] Configuration Identifier
+	uint32_t rsvd    : 16;          // Bit[23:8] Reserved
+	uint32_t encfa   : 1;           // Bit[24] Enable NVMe Controller Function Events (ENCFA)
+	uint32_t empfa   : 1;           // Bit[25] Enable Management Endpoint Events (EMPFA)
+	uint32_t envfa   : 1;           // Bit[26] Enable NVM Subsystem Events (ENVFA)
+	uint32_t rsvd2   : 5;           // Bit[31:27] Reserved
+};
+
 // Configuration Set/Get – NVMe Management Dword 0
 union nmd0_config {
 	struct {
@@ -128,6 +176,7 @@ union nmd0_config {
 	struct nmd0_config_sif sif;     // SMBus/I2C Frequency
 	struct nmd0_config_hsc hsc;     // Health Status Change
 	struct nmd0_config_mtus mtus;   // MCTP Transmission Unit Size
+	struct nmd0_config_ae ae;       // Asynchronous Event
 	uint32_t value;
 };
 
@@ -137,6 +186,11 @@ struct nmd0_vpdr {
 	uint32_t rsvd  : 16;            // Bit[31:16] Data Length (DLEN)
 };
 
+// Management Endpoint Buffer Read/Write - NVMe Management Dword 0
+struct nmd0_meb {
+	uint32_t dofst;                 // Bit[31:0] Data Offset (DOFST)
+};
+
 // Reset - NVMe Management Dword 0
 struct nmd0_rst {
 	uint32_t rsvd       : 24;       // Bit[23:0] Reserved
@@ -157,6 +211,7 @@ union nvme_mi_nmd0 {
 	struct nmd0_chsp chsp;          // Controller Health Status Poll – NVMe Management Dword 0
 	union nmd0_config cfg;          // Configuration Set/Get – NVMe Management Dword 0
 	struct nmd0_vpdr vpdr;          // VPD Read – NVMe Management Dword 0
+	struct nmd0_meb meb;            // MEB Read/Write – NVMe Management Dword 0
 	struct nmd0_rst rst;            // Reset – NVMe Management Dword 0
 	struct nmd0_sh sh;              // Shutdown – NVMe Management Dword 0
 	uint32_t value;
@@ -218,11 +273,22 @@ union nmd1_config_mtus {
 	uint32_t value;
 };
 
+// Configuration Set, Asynchronous Event – NVMe Management Dword 1
+union nmd1_config_ae {
+	struct {
+		uint32_t aemd : 8;      // Bit[7:0] AEM Delay (AEMD), in seconds
+		uint32_t aerd : 8;      // Bit[15:8] AEM Retry Delay (AERD), in 100 ms
+		uint32_t rsvd : 16;     // Bit[31:16] Reserved
+	};
+	uint32_t value;
+};
+
 // Configuration Set/Get – NVMe Management Dword 0
 union nmd1_config {
 	struct nmd1_config_sif sif;     // SMBus/I2C Frequency
 	union nmd1_config_hsc hsc;      // Health Status Change
 	union nmd1_config_mtus mtus;    // MCTP Transmission Unit Size
+	union nmd1_config_ae ae;        // Asynchronous Event
 	uint32_t value;
 };
 
@@ -232,6 +298,11 @@ struct nmd1_vpdr {
 	uint32_t rsvd : 16;             // Bit[31:16] Data Offset (DOFST)
 };
 
+// Management Endpoint Buffer Read/Write - NVMe Management Dword 1
+struct nmd1_meb {
+	uint32_t dlen;                  // Bit[31:0] Data Length (DLEN)
+};
+
 /**
  * NVMe Management Dword 1 (NMD1) - Command Dword 13 (CDW13)
  */
@@ -241,6 +312,7 @@ union nvme_mi_nmd1 {
 	struct nmd1_chsp chsp;          // Controller Health Status Poll
 	union nmd1_config cfg;          // Configuration Set/Get
 	struct nmd1_vpdr vpdr;          // VPD Read
+	struct nmd1_meb meb;            // MEB Read/Write
 	uint32_t value;
 };
 
@@ -520,6 +592,42 @@ union nvme_mi_adm_set_features {
 	uint8_t raw_data[20];
 };
 
+// Firmware Image Download – Command Dword 10/11
+union nvme_mi_adm_fw_download {
+	struct {
+		uint32_t numd;          // Number of Dwords (NUMD), 0's based
+		uint32_t ofst;          // Offset (OFST) in dwords
+	};
+	uint8_t raw_data[20];
+};
+
+// Firmware Commit – Command Dword 10
+union fw_commit_cdw10 {
+	struct {
+		uint32_t fs   : 3;      // Bit[2:0] Firmware Slot (FS)
+		uint32_t ca   : 3;      // Bit[5:3] Commit Action (CA)
+		uint32_t rsvd : 25;     // Bit[30:6] Reserved
+		uint32_t bpid : 1;      // Bit[31] Boot Partition ID (BPID)
+	};
+	uint32_t value;
+};
+
+union nvme_mi_adm_fw_commit {
+	struct {
+		union fw_commit_cdw10 cdw10;    // Firmware Commit – Command Dword 10
+	};
+	uint8_t raw_data[20];
+};
+
+/**
+ * NVMe-MI, 6 NVM Express Admin Command Set, Command Flags (CFLGS)
+ *
+ * Data Length Valid and Data Offset Valid select whether DLEN and DOFST of the
+ * request are used.
+ */
+#define NVME_MI_ADM_CFLGS_DLENV         (1 << 0)
+#define NVME_MI_ADM_CFLGS_DOFSTV        (1 << 1)
+
 /**
  * NVMe Admin Command Request Format (without MCTP Message Header, Request Data,
  * and MIC)
@@ -563,6 +671,8 @@ struct nvme_mi_adm_req_dw {
 		union nvme_mi_adm_identify identify;
 		union nvme_mi_adm_get_features get_feat;
 		union nvme_mi_adm_set_features set_feat;
+		union nvme_mi_adm_fw_download fw_download;
+		union nvme_mi_adm_fw_commit fw_commit;
 		struct {
 			uint32_t sqedw10;
 			uint32_t sqedw11;
@@ -723,10 +833,64 @@ union chscf {
 	uint16_t value;
 };
 
+// Control Primitive Request and Response Message, the MIC follows when IC is set.
+struct nvme_mi_cp_req_msg {
+	union nvme_mi_msg_header nmh;
+	uint8_t cpo;                    // Control Primitive Opcode (CPO)
+	uint8_t tag;                    // Opaque value returned in the response
+	uint16_t cpsp;                  // Control Primitive Specific Parameter (CPSP)
+	uint32_t mic;
+};
+
+struct nvme_mi_cp_res_msg {
+	union nvme_mi_msg_header nmh;
+	uint8_t status;
+	uint8_t tag;
+	uint16_t cpsr;                  // Control Primitive Specific Response (CPSR)
+};
+
+// Get State - Control Primitive Specific Response
+union nvme_mi_cp_state {
+	struct {
+		uint16_t ssta  : 2;     // Bit[1:0]   Slot Command Servicing State (SSTA)
+		uint16_t rsvd1 : 1;     // Bit[2]     Reserved
+		uint16_t pflg  : 1;     // Bit[3]     Pause Flag (PFLG)
+		uint16_t rsvd2 : 4;     // Bit[7:4]   Reserved
+		uint16_t bmic  : 1;     // Bit[8]     Bad Message Integrity Check (BMIC)
+		uint16_t bpopl : 1;     // Bit[9]     Bad Packet or Other Physical Layer (BPOPL)
+		uint16_t twfp  : 1;     // Bit[10]    Timeout Waiting for a Packet (TWFP)
+		uint16_t utu   : 1;     // Bit[11]    Unsupported Transmission Unit (UTU)
+		uint16_t rsvd3 : 4;     // Bit[15:12] Reserved
+	};
+	uint16_t value;
+};
+
 #pragma pack(pop)
 
+struct nvme_mi_cp_result {
+	uint8_t status;
+	uint16_t cpsr;
+	uint32_t elapsed_us;
+};
+
+struct nvme_mi_context;
+struct nvme_mi_result;
+
 int nvme_mi_send_admin_command(struct aa_args *args, uint8_t opc, union nvme_mi_msg *msg,
                                size_t req_size);
+int nvme_mi_acquire_slot(struct aa_args *args, struct nvme_mi_context **ctx);
+int nvme_mi_wait_slot(struct aa_args *args, bool csi);
+void nvme_mi_set_deadline(uint32_t ms);
+int nvme_mi_send_control_primitive(struct aa_args *args, enum nvme_mi_cp_opcode cpo, uint16_t cpsp,
+                                   struct nvme_mi_cp_result *res);
+int nvme_mi_cp_pause(struct aa_args *args);
+int nvme_mi_cp_resume(struct aa_args *args);
+int nvme_mi_cp_abort(struct aa_args *args, bool csi);
+int nvme_mi_cp_get_state(struct aa_args *args, bool csi, bool cesf, union nvme_mi_cp_state *state);
+int nvme_mi_cp_replay(struct aa_args *args, bool csi, uint8_t rro);
+void nvme_mi_cp_show(enum nvme_mi_cp_opcode cpo, const struct nvme_mi_cp_result *res);
+int nvme_mi_wait(struct aa_args *args);
+int nvme_mi_get_result(bool csi, struct nvme_mi_result *res);
 int nvme_mi_message_handle(const union nvme_mi_msg *msg, uint16_t size);
 int nvme_mi_mi_subsystem_health_status_poll(struct aa_args *args, bool cs);
 int nvme_mi_mi_controller_health_status_poll(struct aa_args *args, bool ccf);
@@ -738,6 +902,8 @@ int nvme_mi_mi_config_set(struct aa_args *args, union nvme_mi_nmd0 nmd0, union n
 int nvme_mi_mi_config_set_sif(struct aa_args *args, uint8_t port_id, uint8_t freq_sel);
 int nvme_mi_mi_config_set_hsc(struct aa_args *args, union nmd1_config_hsc hsc);
 int nvme_mi_mi_config_set_mtus(struct aa_args *args, uint8_t port_id, union nmd1_config_mtus mtus);
+int nvme_mi_mi_config_set_ae(struct aa_args *args, struct nmd0_config_ae ae, union nmd1_config_ae delay,
+                             const uint8_t *aeid, const bool *aee, uint8_t num);
 int nvme_mi_mi_data_read_nvm_subsys_info(struct aa_args *args);
 int nvme_mi_mi_data_read_port_info(struct aa_args *args, uint8_t portid);
 int nvme_mi_mi_data_read_ctrl_list(struct aa_args *args, uint8_t ctrlid);
@@ -745,5 +911,10 @@ int nvme_mi_mi_data_read_ctrl_info(struct aa_args *args, uint8_t ctrlid);
 int nvme_mi_mi_data_read_opt_cmd_support(struct aa_args *args, uint8_t ctrlid, uint8_t iocsi);
 int nvme_mi_mi_vpd_read(struct aa_args *args, uint16_t dofst, uint16_t dlen, void *buf);
 int nvme_mi_mi_vpd_write(struct aa_args *args, uint16_t dofst, uint16_t dlen, void *buf);
+void nvme_mi_set_data_buf(bool csi, void *buf, uint32_t size);
+uint32_t nvme_mi_get_data_len(bool csi);
+uint64_t nvme_mi_get_done_us(bool csi);
+int nvme_mi_mi_meb_read(struct aa_args *args, uint32_t dofst, uint32_t dlen);
+int nvme_mi_mi_meb_write(struct aa_args *args, uint32_t dofst, uint32_t dlen, const void *buf);
 
 #endif // NVME_MI_H
\ No newline at end of file
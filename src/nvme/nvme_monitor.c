@@ -0,0 +1,421 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_monitor.h"
+#include "nvme_decode.h"
+#include "nvme_aem.h"
+#include "libnvme_types.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+static const char *_cmd[NVME_MONITOR_CMD_MAX] = {
+	[NVME_MONITOR_SUBSYS_HEALTH] = "subsys-health",
+	[NVME_MONITOR_CTRL_HEALTH] = "ctrl-health",
+	[NVME_MONITOR_SMART] = "smart",
+	[NVME_MONITOR_TEMP_THRESH] = "temp-thresh",
+};
+
+static void nvme_monitor_sleep_us(uint64_t us)
+{
+#ifdef WIN32
+	Sleep(us / 1000);
+#else
+	usleep(us);
+#endif
+}
+
+int nvme_monitor_init(struct nvme_monitor *mon, uint8_t budget)
+{
+	if (!budget || budget > 100)
+		return -NVME_MONITOR_ERR_PARAM;
+
+	memset(mon, 0, sizeof(*mon));
+	mon->budget = budget;
+	for (int i = 0; i < NVME_MONITOR_CMD_MAX; i++)
+		mon->cost_us[i] = NVME_MONITOR_COST_INIT_US;
+
+	return NVME_MONITOR_SUCCESS;
+}
+
+static struct nvme_monitor_drive *nvme_monitor_get_drive(struct nvme_monitor *mon, uint8_t slv_addr,
+                                                         uint8_t eid)
+{
+	struct nvme_monitor_drive *drive;
+
+	for (int i = 0; i < mon->ndrive; i++) {
+		drive = &mon->drive[i];
+		if (drive->slv_addr == slv_addr && drive->eid == eid)
+			return drive;
+	}
+
+	if (mon->ndrive >= NVME_MONITOR_DRIVE_MAX)
+		return NULL;
+
+	drive = &mon->drive[mon->ndrive++];
+	memset(drive, 0, sizeof(*drive));
+	drive->slv_addr = slv_addr;
+	drive->eid = eid;
+
+	return drive;
+}
+
+int nvme_monitor_add_task(struct nvme_monitor *mon, uint8_t slv_addr, uint8_t eid,
+                          enum nvme_monitor_cmd cmd, uint32_t period_ms, uint8_t prio,
+                          bool on_change)
+{
+	struct nvme_monitor_drive *drive;
+	struct nvme_monitor_task *task;
+
+	if (cmd >= NVME_MONITOR_CMD_MAX || !period_ms)
+		return -NVME_MONITOR_ERR_PARAM;
+
+	drive = nvme_monitor_get_drive(mon, slv_addr, eid);
+	if (!drive || drive->ntask >= NVME_MONITOR_TASK_MAX) {
+		nvme_trace(ERROR, "too many monitor tasks\n");
+		return -NVME_MONITOR_ERR_PLAN;
+	}
+
+	task = &drive->task[drive->ntask++];
+	memset(task, 0, sizeof(*task));
+	task->cmd = cmd;
+	task->period_ms = period_ms;
+	task->prio = prio;
+	task->on_change = on_change;
+
+	return NVME_MONITOR_SUCCESS;
+}
+
+/**
+ * Plan file, one statement per line, '#' starts a comment:
+ *   budget <percent>
+ *   aem <aeid>...
+ *   drive <slv_addr> <eid>
+ *   <command> <period_ms> <prio> [change]
+ * Commands belong to the drive above them.
+ */
+int nvme_monitor_load_plan(struct nvme_monitor *mon, const char *path)
+{
+	char line[128], name[32], opt[16];
+	int slv_addr = -1, eid = -1, lineno = 0;
+	FILE *fp;
+	int ret = NVME_MONITOR_SUCCESS;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_MONITOR_ERR_PLAN;
+	}
+
+	while (!ret && fgets(line, sizeof(line), fp)) {
+		unsigned int a, prio;
+		int addr, id, cmd, n;
+
+		lineno++;
+		if (line[0] == '#' || sscanf(line, "%31s", name) != 1)
+			continue;
+
+		if (!strcmp(name, "budget")) {
+			if (sscanf(line, "%*s %u", &a) != 1 || !a || a > 100)
+				ret = -NVME_MONITOR_ERR_PLAN;
+			else
+				mon->budget = a;
+			continue;
+		}
+
+		if (!strcmp(name, "aem")) {
+			char *p = strstr(line, "aem") + strlen("aem");
+			char *end;
+
+			mon->naeid = 0;
+			while (mon->naeid < NVME_MONITOR_AEID_MAX) {
+				unsigned long id = strtoul(p, &end, 0);
+				if (end == p)
+					break;
+				if (id > 0xFF) {
+					ret = -NVME_MONITOR_ERR_PLAN;
+					break;
+				}
+				mon->aeid[mon->naeid++] = id;
+				p = end;
+			}
+			if (!mon->naeid)
+				ret = -NVME_MONITOR_ERR_PLAN;
+			continue;
+		}
+
+		if (!strcmp(name, "drive")) {
+			if (sscanf(line, "%*s %i %i", &addr, &id) != 2 || addr < 0 || addr > 0x7F ||
+			    id < 0 || id > 0xFF) {
+				ret = -NVME_MONITOR_ERR_PLAN;
+				continue;
+			}
+			slv_addr = addr;
+			eid = id;
+			continue;
+		}
+
+		for (cmd = 0; cmd < NVME_MONITOR_CMD_MAX; cmd++)
+			if (!strcmp(name, _cmd[cmd]))
+				break;
+
+		n = sscanf(line, "%*s %u %u %15s", &a, &prio, opt);
+		if (cmd == NVME_MONITOR_CMD_MAX || slv_addr < 0 || n < 2 || prio > 0xFF ||
+		    (n == 3 && strcmp(opt, "change"))) {
+			ret = -NVME_MONITOR_ERR_PLAN;
+			continue;
+		}
+
+		ret = nvme_monitor_add_task(mon, slv_addr, eid, cmd, a, prio, n == 3);
+	}
+
+	fclose(fp);
+
+	if (ret)
+		nvme_trace(ERROR, "%s:%d: invalid plan entry\n", path, lineno);
+
+	return ret;
+}
+
+/**
+ * Estimated bus load of the plan in percent, with on_change tasks counted as
+ * if they always ran.
+ */
+uint32_t nvme_monitor_load_pct(const struct nvme_monitor *mon)
+{
+	uint64_t load = 0;
+
+	for (int i = 0; i < mon->ndrive; i++) {
+		const struct nvme_monitor_drive *drive = &mon->drive[i];
+		for (int j = 0; j < drive->ntask; j++) {
+			const struct nvme_monitor_task *task = &drive->task[j];
+			load += (uint64_t)mon->cost_us[task->cmd] * 10000 / (task->period_ms * 1000ULL);
+		}
+	}
+
+	return load / 100;
+}
+
+static int nvme_monitor_issue(struct aa_args *args, enum nvme_monitor_cmd cmd)
+{
+	switch (cmd) {
+	case NVME_MONITOR_SUBSYS_HEALTH:
+		return nvme_mi_mi_subsystem_health_status_poll(args, false);
+	case NVME_MONITOR_CTRL_HEALTH:
+		/**
+		 * NVMe-MI, 5.3 Controller Health Status Poll
+		 *
+		 * With Report All cleared only controllers whose Controller Health
+		 * Status Changed Flags are set are reported, and Clear Changed Flags
+		 * clears them, so each poll returns what changed since the last one.
+		 */
+		return nvme_mi_mi_controller_health_status_poll(args, true);
+	case NVME_MONITOR_SMART:
+		return nvme_get_log_smart(args, NVME_NSID_ALL, false);
+	case NVME_MONITOR_TEMP_THRESH:
+		return nvme_get_features_temp_thresh(args, NVME_GET_FEATURES_SEL_CURRENT);
+	default:
+		return -NVME_MONITOR_ERR_PARAM;
+	}
+}
+
+// Earliest deadline first, priority breaks ties.
+static struct nvme_monitor_task *nvme_monitor_next(struct nvme_monitor *mon,
+                                                   struct nvme_monitor_drive **drive)
+{
+	struct nvme_monitor_task *next = NULL;
+
+	for (int i = 0; i < mon->ndrive; i++) {
+		for (int j = 0; j < mon->drive[i].ntask; j++) {
+			struct nvme_monitor_task *task = &mon->drive[i].task[j];
+			if (!next || task->deadline_us < next->deadline_us ||
+			    (task->deadline_us == next->deadline_us && task->prio < next->prio)) {
+				next = task;
+				*drive = &mon->drive[i];
+			}
+		}
+	}
+
+	return next;
+}
+
+// An AE Occurrence marks its drive as changed, so its on_change tasks run next.
+static void nvme_monitor_aem(const struct nvme_aem_event *ev, void *priv)
+{
+	struct nvme_monitor *mon = priv;
+
+	for (int i = 0; i < mon->ndrive; i++) {
+		if (mon->drive[i].eid != ev->eid)
+			continue;
+		mon->drive[i].change_us = time_us();
+		mon->drive[i].events++;
+	}
+}
+
+// Wait for the next deadline, taking AEMs in meanwhile if they are enabled.
+static void nvme_monitor_wait(struct aa_args *args, const struct nvme_monitor *mon, uint64_t us)
+{
+	if (!mon->naeid) {
+		nvme_monitor_sleep_us(us);
+		return;
+	}
+
+	nvme_aem_poll(args, us < 1000 ? 1 : us / 1000);
+}
+
+static void nvme_monitor_aem_enable(struct aa_args *args, struct nvme_monitor *mon)
+{
+	nvme_aem_register(nvme_monitor_aem, mon);
+
+	for (int i = 0; i < mon->ndrive; i++) {
+		args->slv_addr = mon->drive[i].slv_addr;
+		args->dst_eid = mon->drive[i].eid;
+		if (nvme_aem_enable(args, mon->aeid, mon->naeid, true))
+			nvme_trace(WARN, "aem not enabled on %02x/%d, polling only\n", args->slv_addr,
+			           args->dst_eid);
+	}
+}
+
+/**
+ * Run the plan for duration_ms, or forever if it is 0.
+ *
+ * First deadlines are staggered across one period so the drives are not
+ * polled all at once. After every command the bus is left idle long enough
+ * that the measured busy time stays within the budget; tasks that fall behind
+ * are pushed back instead of being run in a burst.
+ *
+ * With Asynchronous Events enabled the idle time is spent receiving AEMs, and
+ * an event runs the on_change tasks of its drive at their next deadline. The
+ * forced run every NVME_MONITOR_CHANGE_SKIP periods is the safety poll for
+ * events that got lost.
+ */
+int nvme_monitor_run(struct aa_args *args, struct nvme_monitor *mon, uint32_t duration_ms)
+{
+	struct aa_args drive_args = *args;
+	uint32_t ntask = 0, idx = 0;
+	uint64_t now, ready, end, wait;
+
+	for (int i = 0; i < mon->ndrive; i++)
+		ntask += mon->drive[i].ntask;
+
+	if (!ntask)
+		return -NVME_MONITOR_ERR_PLAN;
+
+	if (nvme_monitor_load_pct(mon) > mon->budget)
+		nvme_trace(WARN, "plan needs about %d%% of the bus, budget is %d%%\n",
+		           nvme_monitor_load_pct(mon), mon->budget);
+
+	mon->start_us = ready = time_us();
+	end = mon->start_us + duration_ms * 1000ULL;
+	mon->busy_us = 0;
+	for (int i = 0; i < mon->ndrive; i++) {
+		// Nothing is known of the drive yet, so its on_change tasks are due too.
+		mon->drive[i].change_us = mon->start_us;
+		for (int j = 0; j < mon->drive[i].ntask; j++, idx++) {
+			struct nvme_monitor_task *task = &mon->drive[i].task[j];
+			task->deadline_us = mon->start_us + task->period_ms * 1000ULL * idx / ntask;
+			task->last_us = 0;
+		}
+	}
+
+	drive_args.async = false;
+	if (mon->naeid)
+		nvme_monitor_aem_enable(&drive_args, mon);
+
+	while (1) {
+		struct nvme_monitor_drive *drive;
+		struct nvme_monitor_task *task = nvme_monitor_next(mon, &drive);
+		struct nvme_mi_result res;
+		uint64_t start, dur;
+		int ret;
+
+		now = time_us();
+		if (duration_ms && now >= end)
+			break;
+
+		if (task->deadline_us < ready)
+			task->deadline_us = ready;
+		if (task->deadline_us > now) {
+			// Never wait past the end of the run.
+			wait = duration_ms && end < task->deadline_us ? end : task->deadline_us;
+			nvme_monitor_wait(&drive_args, mon, wait - now);
+			continue;
+		}
+
+		if (task->on_change && task->last_us >= drive->change_us) {
+			task->skips++;
+			if (task->skips % NVME_MONITOR_CHANGE_SKIP) {
+				task->deadline_us += task->period_ms * 1000ULL;
+				continue;
+			}
+		}
+
+		drive_args.slv_addr = drive->slv_addr;
+		drive_args.dst_eid = drive->eid;
+
+		start = time_us();
+		ret = nvme_monitor_issue(&drive_args, task->cmd);
+		now = time_us();
+		dur = now - start;
+
+		if (mon->naeid)
+			nvme_aem_ack(&drive_args);
+
+		mon->busy_us += dur;
+		mon->cost_us[task->cmd] = (mon->cost_us[task->cmd] * 3 + dur) / 4;
+
+		if (now - task->deadline_us > task->period_ms * 1000ULL)
+			task->late++;
+		task->last_us = now;
+		task->runs++;
+		task->deadline_us += task->period_ms * 1000ULL;
+
+		// Hold the next command back so busy time stays within the budget.
+		ready = now + dur * (100 - mon->budget) / mon->budget;
+
+		if (ret || nvme_mi_get_result(drive_args.csi, &res)) {
+			task->errors++;
+			nvme_trace(WARN, "%s on %02x/%d (%d)\n", _cmd[task->cmd], drive->slv_addr, drive->eid,
+			           ret);
+			continue;
+		}
+
+		if (task->cmd == NVME_MONITOR_CTRL_HEALTH && !res.status &&
+		    res.type == NVME_RESULT_CTRL_HEALTH && res.ctrl_health.rent)
+			drive->change_us = now;
+
+		if (mon->cb)
+			mon->cb(drive, task, &res, mon->priv);
+	}
+
+	if (mon->naeid)
+		nvme_aem_register(NULL, NULL);
+
+	return NVME_MONITOR_SUCCESS;
+}
+
+void nvme_monitor_show(const struct nvme_monitor *mon)
+{
+	uint64_t elapsed = time_us() - mon->start_us;
+
+	printf("Budget                      : %d %%\n", mon->budget);
+	printf("Bus Utilisation             : %d %%\n",
+	       elapsed ? (int)(mon->busy_us * 100 / elapsed) : 0);
+	printf("Estimated Load              : %d %%\n", nvme_monitor_load_pct(mon));
+	for (int i = 0; i < mon->ndrive; i++) {
+		const struct nvme_monitor_drive *drive = &mon->drive[i];
+		printf("Drive %02x EID %d, %d events\n", drive->slv_addr, drive->eid, drive->events);
+		for (int j = 0; j < drive->ntask; j++) {
+			const struct nvme_monitor_task *task = &drive->task[j];
+			printf("  %-14s %6d ms  runs %6d  skips %6d  late %6d  errors %6d\n",
+			       _cmd[task->cmd], task->period_ms, task->runs, task->skips, task->late,
+			       task->errors);
+		}
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef NVME_MONITOR_H
+#define NVME_MONITOR_H
+
+#include "types.h"
+#include "nvme_decode.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NVME_MONITOR_DRIVE_MAX          (64)
+#define NVME_MONITOR_TASK_MAX           (8)
+// Bus time is assumed to be this much until a command kind has been measured.
+#define NVME_MONITOR_COST_INIT_US       (20000)
+// An on_change task still runs after this many periods without a change.
+#define NVME_MONITOR_CHANGE_SKIP        (10)
+#define NVME_MONITOR_AEID_MAX           (16)
+
+enum nvme_monitor_error {
+	NVME_MONITOR_SUCCESS = 0,
+	NVME_MONITOR_ERR_PARAM,
+	NVME_MONITOR_ERR_PLAN,
+	NVME_MONITOR_ERR_BUDGET,
+};
+
+// Commands a plan can schedule.
+enum nvme_monitor_cmd {
+	NVME_MONITOR_SUBSYS_HEALTH = 0, // NVM Subsystem Health Status Poll
+	NVME_MONITOR_CTRL_HEALTH,       // Controller Health Status Poll, Clear Changed Flags
+	NVME_MONITOR_SMART,             // Get Log Page - SMART / Health Information
+	NVME_MONITOR_TEMP_THRESH,       // Get Features - Temperature Threshold
+	NVME_MONITOR_CMD_MAX,
+};
+
+struct nvme_monitor_task {
+	enum nvme_monitor_cmd cmd;
+	uint32_t period_ms;
+	uint8_t prio;                   // Lower runs first when deadlines tie
+	// Only run after a health change or an AEM was reported for the drive
+	bool on_change;
+	uint64_t deadline_us;
+	uint64_t last_us;
+	uint32_t runs;
+	uint32_t skips;
+	uint32_t errors;
+	uint32_t late;
+};
+
+struct nvme_monitor_drive {
+	uint8_t slv_addr;
+	uint8_t eid;
+	uint64_t change_us;             // Last health change or AEM of the drive
+	uint32_t events;                // AE Occurrences received
+	uint8_t ntask;
+	struct nvme_monitor_task task[NVME_MONITOR_TASK_MAX];
+};
+
+// Called with the decoded result of every scheduled command.
+typedef void (*nvme_monitor_cb)(const struct nvme_monitor_drive *drive,
+                                const struct nvme_monitor_task *task,
+                                const struct nvme_mi_result *res, void *priv);
+
+struct nvme_monitor {
+	uint8_t budget;                 // Share of bus time in percent the monitor may use
+	uint8_t ndrive;
+	struct nvme_monitor_drive drive[NVME_MONITOR_DRIVE_MAX];
+	nvme_monitor_cb cb;
+	void *priv;
+	// Measured bus time per command kind, moving average in microseconds
+	uint32_t cost_us[NVME_MONITOR_CMD_MAX];
+	uint64_t busy_us;
+	uint64_t start_us;
+	// Asynchronous Events enabled on every drive, none keeps the monitor polling only
+	uint8_t naeid;
+	uint8_t aeid[NVME_MONITOR_AEID_MAX];
+};
+
+int nvme_monitor_init(struct nvme_monitor *mon, uint8_t budget);
+int nvme_monitor_add_task(struct nvme_monitor *mon, uint8_t slv_addr, uint8_t eid,
+                          enum nvme_monitor_cmd cmd, uint32_t period_ms, uint8_t prio,
+                          bool on_change);
+int nvme_monitor_load_plan(struct nvme_monitor *mon, const char *path);
+uint32_t nvme_monitor_load_pct(const struct nvme_monitor *mon);
+int nvme_monitor_run(struct aa_args *args, struct nvme_monitor *mon, uint32_t duration_ms);
+void nvme_monitor_show(const struct nvme_monitor *mon);
+
+#endif // NVME_MONITOR_H
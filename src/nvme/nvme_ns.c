@@ -0,0 +1,541 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_ns.h"
+#include "nvme_cache.h"
+#include "nvme_decode.h"
+#include "libnvme_types.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Command outstanding on a slot.
+struct nvme_ns_pending {
+	struct nvme_ns_drive *drive;
+	uint32_t index;                 // Namespace of drive->ns for an Identify Namespace
+	bool list;
+};
+
+// Drives of one adapter.
+struct nvme_ns_bus {
+	int handle;
+	pid_t pid;                      // Worker, -1 when run in this process
+	int fd;                         // Results of the worker
+	uint64_t elapsed_us;            // Once its drives are up
+};
+
+int nvme_ns_add_drive(struct nvme_ns_inventory *inv, int handle, uint8_t slv_addr, uint8_t eid)
+{
+	struct nvme_ns_drive *drive;
+
+	if (inv->ndrive >= NVME_NS_DRIVE_MAX) {
+		nvme_trace(ERROR, "too many drives (%d)\n", inv->ndrive);
+		return -NVME_NS_ERR_PARAM;
+	}
+
+	drive = &inv->drive[inv->ndrive++];
+	memset(drive, 0, sizeof(*drive));
+	drive->handle = handle;
+	drive->slv_addr = slv_addr;
+	drive->eid = eid;
+
+	return NVME_NS_SUCCESS;
+}
+
+// Bring up the drive and open its cache, which is named after the UDID.
+static int nvme_ns_open(struct nvme_ns_inventory *inv, struct nvme_ns_drive *drive)
+{
+	u8 udid[sizeof(drive->cache.udid)] = {0};
+	int ret;
+
+	if (inv->open && inv->open(inv->priv, drive, udid)) {
+		nvme_trace(ERROR, "drive %02x/%d not up\n", drive->slv_addr, drive->eid);
+		return -NVME_NS_ERR_IO;
+	}
+
+	ret = nvme_cache_open(&drive->cache, inv->dir, udid);
+
+	return ret ? -NVME_NS_ERR_PARAM : NVME_NS_SUCCESS;
+}
+
+static void nvme_ns_set_target(struct aa_args *args, const struct nvme_ns_drive *drive)
+{
+	args->slv_addr = drive->slv_addr;
+	args->dst_eid = drive->eid;
+}
+
+/**
+ * Refresh the cache of a drive. The health poll drops it on Namespace
+ * Attribute Changed, so an inventory found in it is current.
+ */
+static void nvme_ns_load(struct aa_args *args, struct nvme_ns_drive *drive)
+{
+	const struct nvme_ns_info *ns;
+	u32 len;
+	int ret;
+
+	// The cache is optional, only the inventory itself fails a drive.
+	ret = nvme_cache_warm_start(args, &drive->cache);
+	if (ret)
+		nvme_trace(WARN, "cache of %02x/%d (%d)\n", drive->slv_addr, drive->eid, ret);
+
+	ns = nvme_cache_get(&drive->cache, NVME_CACHE_NS_INFO, 0, &len);
+	if (!ns || len % sizeof(*ns))
+		return;
+
+	drive->ns = malloc(len ? len : 1);
+	if (!drive->ns) {
+		drive->ret = -NVME_NS_ERR_IO;
+		return;
+	}
+
+	memcpy(drive->ns, ns, len);
+	drive->nns = len / sizeof(*ns);
+	drive->next = drive->nns;
+	drive->listed = true;
+	drive->cached = true;
+}
+
+// Next drive of the adapter with a command to issue, round robin from *cursor.
+static struct nvme_ns_drive *nvme_ns_next(struct nvme_ns_inventory *inv, int handle,
+                                          uint8_t *cursor)
+{
+	for (int i = 0; i < inv->ndrive; i++) {
+		struct nvme_ns_drive *drive = &inv->drive[(*cursor + i) % inv->ndrive];
+
+		if (drive->handle != handle || drive->ret || drive->busy)
+			continue;
+		if (!drive->listed || drive->next < drive->nns) {
+			*cursor = (*cursor + i + 1) % inv->ndrive;
+			return drive;
+		}
+	}
+
+	return NULL;
+}
+
+static int nvme_ns_issue(struct aa_args *args, struct nvme_ns_drive *drive,
+                         struct nvme_ns_pending *pend)
+{
+	nvme_ns_set_target(args, drive);
+	pend->drive = drive;
+	drive->cmds++;
+
+	if (!drive->listed) {
+		pend->list = true;
+		drive->busy = true;
+		return nvme_identify_active_ns_list(args, drive->list_nsid);
+	}
+
+	pend->list = false;
+	pend->index = drive->next++;
+
+	return nvme_identify_ns(args, drive->ns[pend->index].nsid);
+}
+
+static int nvme_ns_add_list(struct nvme_ns_drive *drive, const u8 *buf, uint32_t len)
+{
+	uint32_t n = len / 4;
+	uint32_t i;
+	struct nvme_ns_info *ns;
+
+	if (!n)
+		return -NVME_NS_ERR_SHORT;
+
+	ns = realloc(drive->ns, (drive->nns + n + 1) * sizeof(*ns));
+	if (!ns)
+		return -NVME_NS_ERR_IO;
+	drive->ns = ns;
+
+	for (i = 0; i < n; i++) {
+		u32 nsid = buf[4 * i] | buf[4 * i + 1] << 8 | buf[4 * i + 2] << 16 |
+		           (u32)buf[4 * i + 3] << 24;
+
+		// The list ends with the first unused entry.
+		if (!nsid)
+			break;
+		if (nsid <= drive->list_nsid) {
+			nvme_trace(ERROR, "active namespace list out of order (%d)\n", nsid);
+			return -NVME_NS_ERR_STATUS;
+		}
+
+		memset(&ns[drive->nns], 0, sizeof(*ns));
+		ns[drive->nns++].nsid = nsid;
+		drive->list_nsid = nsid;
+	}
+
+	/**
+	 * A list without an unused entry goes on after its last NSID, which also
+	 * picks up the rest of a response the transport cut short.
+	 */
+	drive->listed = i < n;
+
+	return NVME_NS_SUCCESS;
+}
+
+static int nvme_ns_add_identify(struct nvme_ns_info *ns, const u8 *buf, uint32_t len)
+{
+	const struct nvme_id_ns *id = (const void *)buf;
+	uint8_t lbaf;
+
+	if (len < offsetof(struct nvme_id_ns, lbaf))
+		return -NVME_NS_ERR_SHORT;
+
+	lbaf = (id->flbas & NVME_NS_FLBAS_LOWER_MASK) |
+	       ((id->flbas & NVME_NS_FLBAS_HIGHER_MASK) >> 1);
+	if (len < offsetof(struct nvme_id_ns, lbaf) + (lbaf + 1) * sizeof(id->lbaf[0]))
+		return -NVME_NS_ERR_SHORT;
+
+	ns->nsze = id->nsze;
+	ns->ncap = id->ncap;
+	ns->nuse = id->nuse;
+	ns->nsfeat = id->nsfeat;
+	ns->nlbaf = id->nlbaf;
+	ns->flbas = id->flbas;
+	ns->lbaf = lbaf;
+	ns->lbads = id->lbaf[lbaf].ds;
+	ns->rp = id->lbaf[lbaf].rp;
+	ns->ms = id->lbaf[lbaf].ms;
+	ns->dps = id->dps;
+
+	return NVME_NS_SUCCESS;
+}
+
+// Wait for the command outstanding on the slot of args and add its data to the drive.
+static void nvme_ns_complete(struct aa_args *args, struct nvme_ns_pending *pend, const u8 *buf)
+{
+	struct nvme_ns_drive *drive = pend->drive;
+	struct nvme_mi_result res;
+	int ret;
+
+	nvme_ns_set_target(args, drive);
+	pend->drive = NULL;
+	drive->busy = false;
+
+	ret = nvme_mi_wait_slot(args, args->csi);
+	if (!ret) {
+		nvme_mi_get_result(args->csi, &res);
+		if (res.status || res.sf) {
+			nvme_trace(ERROR, "identify %s of %02x/%d: status %x, sf %x\n",
+			           pend->list ? "active ns list" : "ns", drive->slv_addr, drive->eid,
+			           res.status, res.sf);
+			ret = -NVME_NS_ERR_STATUS;
+		}
+	}
+
+	if (!ret && pend->list)
+		ret = nvme_ns_add_list(drive, buf, nvme_cmd_get_data_len(args->csi));
+	else if (!ret)
+		ret = nvme_ns_add_identify(&drive->ns[pend->index], buf,
+		                           nvme_cmd_get_data_len(args->csi));
+
+	// A failing drive stops, the others go on.
+	if (ret && !drive->ret) {
+		nvme_trace(ERROR, "inventory of %02x/%d (%d)\n", drive->slv_addr, drive->eid, ret);
+		drive->ret = ret;
+	}
+}
+
+/**
+ * Take the namespace inventory of the drives of one adapter.
+ *
+ * Drives whose cache already holds one only cost the health poll of the cache
+ * check. For the others, the active namespace list and then one Identify
+ * Namespace per NSID are issued round robin over the drives, alternating both
+ * command slots, so one command is on the wire while the other completes and
+ * no drive waits for the inventory of another.
+ */
+static void nvme_ns_run_bus(struct aa_args *args, struct nvme_ns_inventory *inv,
+                            struct nvme_ns_bus *bus)
+{
+	struct aa_args slot_args = *args;
+	struct nvme_ns_pending pend[NVME_MI_SLOT_MAX];
+	u8 *buf[NVME_MI_SLOT_MAX];
+	uint8_t cursor = 0;
+	uint64_t start;
+	bool slot = args->csi;
+
+	for (int i = 0; i < inv->ndrive; i++)
+		if (inv->drive[i].handle == bus->handle)
+			inv->drive[i].ret = nvme_ns_open(inv, &inv->drive[i]);
+
+	start = time_us();
+	slot_args.handle = bus->handle;
+	slot_args.async = false;
+	for (int i = 0; i < inv->ndrive; i++) {
+		if (inv->drive[i].handle != bus->handle || inv->drive[i].ret)
+			continue;
+		nvme_ns_set_target(&slot_args, &inv->drive[i]);
+		nvme_ns_load(&slot_args, &inv->drive[i]);
+	}
+
+	buf[0] = malloc(NVME_NS_DATA_SIZE * NVME_MI_SLOT_MAX);
+	if (!buf[0]) {
+		nvme_trace(ERROR, "malloc\n");
+		for (int i = 0; i < inv->ndrive; i++)
+			if (inv->drive[i].handle == bus->handle && !inv->drive[i].ret)
+				inv->drive[i].ret = -NVME_NS_ERR_IO;
+		return;
+	}
+
+	memset(pend, 0, sizeof(pend));
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++) {
+		buf[i] = buf[0] + i * NVME_NS_DATA_SIZE;
+		nvme_cmd_set_data_buf(i, buf[i], NVME_NS_DATA_SIZE);
+	}
+
+	slot_args.async = true;
+
+	while (true) {
+		struct nvme_ns_drive *drive;
+
+		slot_args.csi = slot;
+
+		// The older of the two outstanding commands is always on this slot.
+		if (pend[slot].drive)
+			nvme_ns_complete(&slot_args, &pend[slot], buf[slot]);
+
+		drive = nvme_ns_next(inv, bus->handle, &cursor);
+		if (!drive && !pend[!slot].drive)
+			break;
+
+		if (drive && nvme_ns_issue(&slot_args, drive, &pend[slot])) {
+			nvme_trace(ERROR, "identify on %02x/%d\n", drive->slv_addr, drive->eid);
+			drive->ret = -NVME_NS_ERR_IO;
+			drive->busy = false;
+			pend[slot].drive = NULL;
+		}
+
+		slot = !slot;
+	}
+
+	nvme_mi_wait(&slot_args);
+	for (int i = 0; i < NVME_MI_SLOT_MAX; i++)
+		nvme_cmd_set_data_buf(i, NULL, 0);
+	free(buf[0]);
+
+	for (int i = 0; i < inv->ndrive; i++) {
+		struct nvme_ns_drive *drive = &inv->drive[i];
+
+		if (drive->handle != bus->handle || drive->ret || drive->cached)
+			continue;
+
+		if (nvme_cache_put(&drive->cache, NVME_CACHE_NS_INFO, 0, drive->ns,
+		                   drive->nns * sizeof(*drive->ns)) ||
+		    nvme_cache_commit(&drive->cache))
+			nvme_trace(WARN, "inventory of %02x/%d not cached\n", drive->slv_addr, drive->eid);
+	}
+
+	bus->elapsed_us = time_us() - start;
+}
+
+/**
+ * Run the bus in a worker process, which hands the drives of the adapter,
+ * their namespaces and its elapsed time back through a pipe. Without a worker
+ * the bus is run here.
+ */
+static void nvme_ns_start(struct aa_args *args, struct nvme_ns_inventory *inv,
+                          struct nvme_ns_bus *bus)
+{
+	int fd[2], ret = 0;
+
+	bus->pid = -1;
+	if (!pipe(fd)) {
+		bus->pid = fork();
+		if (bus->pid < 0) {
+			close(fd[0]);
+			close(fd[1]);
+		}
+	}
+	if (bus->pid < 0) {
+		nvme_trace(WARN, "no worker for adapter %d\n", bus->handle);
+		nvme_ns_run_bus(args, inv, bus);
+		return;
+	}
+
+	if (!bus->pid) {
+		close(fd[0]);
+		nvme_ns_run_bus(args, inv, bus);
+		for (int i = 0; !ret && i < inv->ndrive; i++) {
+			struct nvme_ns_drive *drive = &inv->drive[i];
+
+			if (drive->handle != bus->handle)
+				continue;
+			ret = fd_xfer(fd[1], drive, sizeof(*drive), true);
+			if (!ret && drive->nns)
+				ret = fd_xfer(fd[1], drive->ns, drive->nns * sizeof(*drive->ns), true);
+		}
+		if (!ret)
+			ret = fd_xfer(fd[1], &bus->elapsed_us, sizeof(bus->elapsed_us), true);
+		_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fd[1]);
+	bus->fd = fd[0];
+}
+
+// Collect the drives of the worker of the bus, the ones it did not hand back fail.
+static void nvme_ns_join(struct nvme_ns_inventory *inv, struct nvme_ns_bus *bus)
+{
+	int ret = 0;
+
+	if (bus->pid < 0)
+		return;
+
+	for (int i = 0; i < inv->ndrive; i++) {
+		struct nvme_ns_drive *drive = &inv->drive[i], got;
+
+		if (drive->handle != bus->handle)
+			continue;
+
+		if (!ret && fd_xfer(bus->fd, &got, sizeof(got), false))
+			ret = -NVME_NS_ERR_IO;
+		if (!ret) {
+			// The cache and the namespaces of the worker are not this process's.
+			got.cache = drive->cache;
+			got.ns = NULL;
+			*drive = got;
+		}
+		if (!ret && drive->nns) {
+			drive->ns = malloc(drive->nns * sizeof(*drive->ns));
+			if (!drive->ns ||
+			    fd_xfer(bus->fd, drive->ns, drive->nns * sizeof(*drive->ns), false))
+				ret = -NVME_NS_ERR_IO;
+		}
+		if (ret) {
+			drive->ret = ret;
+			drive->nns = 0;
+		}
+	}
+	if (!ret && fd_xfer(bus->fd, &bus->elapsed_us, sizeof(bus->elapsed_us), false))
+		ret = -NVME_NS_ERR_IO;
+	if (ret)
+		nvme_trace(ERROR, "worker of adapter %d (%d)\n", bus->handle, ret);
+
+	close(bus->fd);
+	waitpid(bus->pid, NULL, 0);
+}
+
+/**
+ * Take the namespace inventory of every drive. The drives of each adapter are
+ * run by a worker of their own, so the adapters work in parallel and the
+ * whole set takes about as long as the busiest one.
+ */
+int nvme_ns_run(struct aa_args *args, struct nvme_ns_inventory *inv)
+{
+	struct nvme_ns_bus bus[NVME_NS_DRIVE_MAX];
+	int nbus = 0, i, j, ret = NVME_NS_SUCCESS;
+
+	if (!inv->ndrive)
+		return -NVME_NS_ERR_PARAM;
+
+	for (i = 0; i < inv->ndrive; i++) {
+		for (j = 0; j < nbus && bus[j].handle != inv->drive[i].handle; j++)
+			;
+		if (j == nbus) {
+			memset(&bus[nbus], 0, sizeof(bus[0]));
+			bus[nbus].handle = inv->drive[i].handle;
+			bus[nbus++].pid = -1;
+		}
+	}
+
+	if (nbus == 1) {
+		nvme_ns_run_bus(args, inv, &bus[0]);
+	} else {
+		// Nothing buffered is written twice by the workers.
+		fflush(stdout);
+		fflush(stderr);
+		for (i = 0; i < nbus; i++)
+			nvme_ns_start(args, inv, &bus[i]);
+		for (i = 0; i < nbus; i++)
+			nvme_ns_join(inv, &bus[i]);
+	}
+
+	inv->elapsed_us = 0;
+	for (i = 0; i < nbus; i++)
+		if (bus[i].elapsed_us > inv->elapsed_us)
+			inv->elapsed_us = bus[i].elapsed_us;
+
+	for (i = 0; i < inv->ndrive; i++)
+		if (inv->drive[i].ret)
+			ret = inv->drive[i].ret;
+
+	return ret;
+}
+
+static void nvme_ns_show_size(uint64_t blocks, uint8_t lbads)
+{
+	static const char *unit[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+	// Decimal units as on the drive label, lbads is at most 63.
+	double size = lbads < 64 ? (double)blocks * (1ULL << lbads) : 0;
+	int i = 0;
+
+	while (size >= 1000 && i < sizeof(unit) / sizeof(unit[0]) - 1) {
+		size /= 1000;
+		i++;
+	}
+
+	printf("  %7.2f %-2s", size, unit[i]);
+}
+
+void nvme_ns_show(const struct nvme_ns_inventory *inv)
+{
+	for (int i = 0; i < inv->ndrive; i++) {
+		const struct nvme_ns_drive *drive = &inv->drive[i];
+		uint64_t total = 0, used = 0;
+
+		printf("Drive                       : %02x/%d%s\n", drive->slv_addr, drive->eid,
+		       drive->cached ? " (cached)" : "");
+		if (drive->ret)
+			printf("Error                       : %d\n", drive->ret);
+		printf("Namespaces                  : %d\n", drive->nns);
+		printf("Commands                    : %d\n", drive->cmds);
+		if (!drive->nns)
+			continue;
+
+		printf("  %-10s%12s%12s%12s %5s  %s\n", "NSID", "Size", "Capacity", "Used", "Use%",
+		       "LBA Format");
+		for (int j = 0; j < drive->nns; j++) {
+			const struct nvme_ns_info *ns = &drive->ns[j];
+
+			printf("  %-10u", ns->nsid);
+			if (j >= drive->next && !drive->cached) {
+				printf(" not identified\n");
+				continue;
+			}
+			nvme_ns_show_size(ns->nsze, ns->lbads);
+			nvme_ns_show_size(ns->ncap, ns->lbads);
+			nvme_ns_show_size(ns->nuse, ns->lbads);
+			printf(" %5.1f  %d: %d+%d%s\n", ns->ncap ? 100.0 * ns->nuse / ns->ncap : 0.0, ns->lbaf,
+			       ns->lbads < 32 ? 1U << ns->lbads : 0, ns->ms,
+			       ns->ms && (ns->flbas & NVME_NS_FLBAS_META_EXT) ? " extended" : "");
+
+			if (ns->lbads < 64) {
+				total += ns->ncap << ns->lbads;
+				used += ns->nuse << ns->lbads;
+			}
+		}
+		printf("  %-10s", "Total");
+		printf("%12s", "");
+		nvme_ns_show_size(total, 0);
+		nvme_ns_show_size(used, 0);
+		printf(" %5.1f\n", total ? 100.0 * used / total : 0.0);
+	}
+
+	printf("Elapsed                     : %llu ms\n", (unsigned long long)inv->elapsed_us / 1000);
+}
+
+void nvme_ns_free(struct nvme_ns_inventory *inv)
+{
+	for (int i = 0; i < inv->ndrive; i++) {
+		free(inv->drive[i].ns);
+		inv->drive[i].ns = NULL;
+		nvme_cache_close(&inv->drive[i].cache);
+	}
+	inv->ndrive = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef NVME_NS_H
+#define NVME_NS_H
+
+#include "types.h"
+#include "nvme_cache.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NVME_NS_DRIVE_MAX               (16)
+/**
+ * NVMe Base, 5.17.2.3 Active Namespace ID list
+ *
+ * One Identify with CNS 02h returns up to 1024 NSIDs greater than the NSID
+ * of the command, a list without an unused entry is continued from its last
+ * NSID.
+ */
+#define NVME_NS_DATA_SIZE               (4096)
+
+enum nvme_ns_error {
+	NVME_NS_SUCCESS = 0,
+	NVME_NS_ERR_PARAM,
+	NVME_NS_ERR_STATUS,
+	NVME_NS_ERR_SHORT,
+	NVME_NS_ERR_IO,
+};
+
+#pragma pack(push, 1)
+
+// One namespace as it is kept in the cache.
+struct nvme_ns_info {
+	u32 nsid;
+	u64 nsze;                       // Namespace Size in logical blocks
+	u64 ncap;                       // Namespace Capacity in logical blocks
+	u64 nuse;                       // Namespace Utilization in logical blocks
+	u8 nsfeat;
+	u8 nlbaf;                       // Number of LBA Formats, 0's based
+	u8 flbas;                       // Formatted LBA Size
+	u8 lbaf;                        // Index of the LBA Format in use
+	u8 lbads;                       // LBA Data Size as a power of two
+	u8 rp;                          // Relative Performance
+	u16 ms;                         // Metadata Size
+	u8 dps;
+	u8 rsvd[3];
+};
+
+#pragma pack(pop)
+
+struct nvme_ns_drive {
+	int handle;                     // Adapter of the drive
+	uint8_t slv_addr;
+	uint8_t eid;
+	struct nvme_cache cache;
+	// Active namespaces, identified up to next
+	uint32_t nns;
+	struct nvme_ns_info *ns;
+	uint32_t next;
+	uint32_t list_nsid;             // NSID the next active list starts after
+	bool listed;                    // The active list is complete
+	bool busy;                      // An active list is in flight
+	bool cached;                    // The inventory came from the cache
+	uint32_t cmds;
+	int ret;
+};
+
+/**
+ * The drives of each adapter share its bus, with at most two commands in
+ * flight. The MCTP stack serves a single adapter per process, so the drives
+ * of every adapter but a lone one are run by a worker process of their own,
+ * which first brings them up through open and gets the UDID that names their
+ * cache.
+ */
+struct nvme_ns_inventory {
+	const char *dir;                // Of the drive caches
+	int (*open)(void *priv, const struct nvme_ns_drive *drive, u8 *udid);
+	void *priv;
+	uint8_t ndrive;
+	struct nvme_ns_drive drive[NVME_NS_DRIVE_MAX];
+	uint64_t elapsed_us;            // Of the slowest adapter
+};
+
+int nvme_ns_add_drive(struct nvme_ns_inventory *inv, int handle, uint8_t slv_addr, uint8_t eid);
+int nvme_ns_run(struct aa_args *args, struct nvme_ns_inventory *inv);
+void nvme_ns_show(const struct nvme_ns_inventory *inv);
+void nvme_ns_free(struct nvme_ns_inventory *inv);
+
+#endif // NVME_NS_H
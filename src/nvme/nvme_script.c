@@ -0,0 +1,683 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_cmd.h"
+#include "nvme_script.h"
+#include "nvme_decode.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef WIN32
+#include <windows.h>
+#endif
+
+/**
+ * The sequence test-mctp used to run: every command once per second, with
+ * consecutive commands on alternating slots.
+ */
+const char *nvme_script_default =
+	"repeat 0\n"
+	"interval 1000\n"
+	"report 10\n"
+	"pipeline 1\n"
+	"set-temp-thresh 0x137\n"
+	"get-temp-thresh 0\n"
+	"get-power-mgmt 0\n"
+	"identify-ctrl\n"
+	"smart 1\n"
+	"subsys-health 1\n"
+	"ctrl-health 1\n"
+	"set-temp-thresh 0x189\n"
+	"get-temp-thresh 0\n"
+	"smart 1\n"
+	"subsys-health 1\n"
+	"ctrl-health 1\n"
+	"config-get 0 0\n"
+	"config-set 0 0\n"
+	"config-get-sif\n"
+	"config-get-mtus\n"
+	"config-get-hsc\n"
+	"config-set-sif 1 1\n"
+	"config-set-sif 0 0\n"
+	"config-set-hsc 0xffffffff\n"
+	"config-set-mtus 1 0xffffffff\n"
+	"config-set-mtus 0 0xffffffff\n"
+	"subsys-info\n"
+	"port-info 0\n"
+	"port-info 1\n"
+	"ctrl-list 0\n"
+	"ctrl-list 1\n"
+	"ctrl-info 1\n"
+	"ctrl-info 0\n"
+	"opt-cmd 0 0\n"
+	"opt-cmd 1 0\n"
+	"opt-cmd 0 1\n"
+	"opt-cmd 1 1\n"
+	"vpd-read 0 256\n"
+	"vpd-read 1 256\n"
+	"vpd-read 0 257\n"
+	"vpd-write 0 128\n"
+	"vpd-write 128 128\n"
+	"vpd-read 0 256\n"
+	"set-temp-thresh 0x189\n"
+	"set-ctrl-metadata 1\n"
+	"set-ctrl-metadata 2\n"
+	"get-ctrl-metadata 0\n"
+	"set-ctrl-metadata 3\n"
+	"get-ctrl-metadata 0\n"
+	"set-ctrl-metadata 1\n"
+	"get-ctrl-metadata 0\n"
+	"set-ctrl-metadata 3\n"
+	"get-ctrl-metadata 0\n"
+	"set-ctrl-metadata 2\n"
+	"get-ctrl-metadata 0\n"
+	"get-ctrl-metadata 1\n"
+	"get-ctrl-metadata 1\n"
+	"get-ctrl-metadata 2\n"
+	"get-ctrl-metadata 2 1\n"
+	"get-enh-ctrl-metadata 3\n"
+	"get-ctrl-metadata 3\n"
+	"get-ns-metadata 3\n"
+	"get-ctrl-metadata 0\n"
+	"wait\n";
+
+static void nvme_script_sleep_ms(uint32_t ms)
+{
+#ifdef WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+static int nvme_script_set_temp_thresh(struct aa_args *args, struct nvme_script *script,
+                                       const uint32_t *param)
+{
+	return nvme_set_features_temp_thresh(args, param[0], param[1]);
+}
+
+static int nvme_script_get_temp_thresh(struct aa_args *args, struct nvme_script *script,
+                                       const uint32_t *param)
+{
+	return nvme_get_features_temp_thresh(args, param[0]);
+}
+
+static int nvme_script_get_power_mgmt(struct aa_args *args, struct nvme_script *script,
+                                      const uint32_t *param)
+{
+	return nvme_get_features_power_mgmt(args, param[0]);
+}
+
+static int nvme_script_identify_ctrl(struct aa_args *args, struct nvme_script *script,
+                                     const uint32_t *param)
+{
+	return nvme_identify_ctrl(args);
+}
+
+static int nvme_script_smart(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	return nvme_get_log_smart(args, NVME_NSID_ALL, param[0]);
+}
+
+static int nvme_script_subsys_health(struct aa_args *args, struct nvme_script *script,
+                                     const uint32_t *param)
+{
+	return nvme_mi_mi_subsystem_health_status_poll(args, param[0]);
+}
+
+static int nvme_script_ctrl_health(struct aa_args *args, struct nvme_script *script,
+                                   const uint32_t *param)
+{
+	return nvme_mi_mi_controller_health_status_poll(args, param[0]);
+}
+
+static int nvme_script_config_get(struct aa_args *args, struct nvme_script *script,
+                                  const uint32_t *param)
+{
+	union nvme_mi_nmd0 nmd0 = {.value = param[0]};
+	union nvme_mi_nmd1 nmd1 = {.value = param[1]};
+
+	return nvme_mi_mi_config_get(args, nmd0, nmd1);
+}
+
+static int nvme_script_config_set(struct aa_args *args, struct nvme_script *script,
+                                  const uint32_t *param)
+{
+	union nvme_mi_nmd0 nmd0 = {.value = param[0]};
+	union nvme_mi_nmd1 nmd1 = {.value = param[1]};
+
+	return nvme_mi_mi_config_set(args, nmd0, nmd1);
+}
+
+static int nvme_script_config_get_sif(struct aa_args *args, struct nvme_script *script,
+                                      const uint32_t *param)
+{
+	return nvme_mi_mi_config_get_sif(args);
+}
+
+static int nvme_script_config_get_mtus(struct aa_args *args, struct nvme_script *script,
+                                       const uint32_t *param)
+{
+	return nvme_mi_mi_config_get_mtus(args);
+}
+
+static int nvme_script_config_get_hsc(struct aa_args *args, struct nvme_script *script,
+                                      const uint32_t *param)
+{
+	return nvme_mi_mi_config_get_hsc(args);
+}
+
+static int nvme_script_config_set_sif(struct aa_args *args, struct nvme_script *script,
+                                      const uint32_t *param)
+{
+	return nvme_mi_mi_config_set_sif(args, param[0], param[1]);
+}
+
+static int nvme_script_config_set_hsc(struct aa_args *args, struct nvme_script *script,
+                                      const uint32_t *param)
+{
+	union nmd1_config_hsc hsc = {.value = param[0]};
+
+	return nvme_mi_mi_config_set_hsc(args, hsc);
+}
+
+static int nvme_script_config_set_mtus(struct aa_args *args, struct nvme_script *script,
+                                       const uint32_t *param)
+{
+	union nmd1_config_mtus mtus = {.value = param[1]};
+
+	return nvme_mi_mi_config_set_mtus(args, param[0], mtus);
+}
+
+static int nvme_script_subsys_info(struct aa_args *args, struct nvme_script *script,
+                                   const uint32_t *param)
+{
+	return nvme_mi_mi_data_read_nvm_subsys_info(args);
+}
+
+static int nvme_script_port_info(struct aa_args *args, struct nvme_script *script,
+                                 const uint32_t *param)
+{
+	return nvme_mi_mi_data_read_port_info(args, param[0]);
+}
+
+static int nvme_script_ctrl_list(struct aa_args *args, struct nvme_script *script,
+                                 const uint32_t *param)
+{
+	return nvme_mi_mi_data_read_ctrl_list(args, param[0]);
+}
+
+static int nvme_script_ctrl_info(struct aa_args *args, struct nvme_script *script,
+                                 const uint32_t *param)
+{
+	return nvme_mi_mi_data_read_ctrl_info(args, param[0]);
+}
+
+static int nvme_script_opt_cmd(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	return nvme_mi_mi_data_read_opt_cmd_support(args, param[0], param[1]);
+}
+
+static int nvme_script_vpd_read(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	return nvme_mi_mi_vpd_read(args, param[0], param[1], script->buf + param[0]);
+}
+
+static int nvme_script_vpd_write(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	return nvme_mi_mi_vpd_write(args, param[0], param[1], script->buf + param[0]);
+}
+
+static int nvme_script_set_ctrl_metadata(struct aa_args *args, struct nvme_script *script,
+                                         const uint32_t *param)
+{
+	switch (param[0]) {
+	case 1:
+		return test_set_feature_controller_metadata(args);
+	case 2:
+		return test_set_feature_controller_metadata_2(args);
+	default:
+		return test_set_feature_controller_metadata_3(args);
+	}
+}
+
+static int nvme_script_get_ctrl_metadata(struct aa_args *args, struct nvme_script *script,
+                                         const uint32_t *param)
+{
+	return nvme_get_feature_controller_metadata(args, param[0], param[1]);
+}
+
+static int nvme_script_get_enh_ctrl_metadata(struct aa_args *args, struct nvme_script *script,
+                                             const uint32_t *param)
+{
+	return nvme_get_feature_enhanced_controller_metadata(args, param[0], param[1]);
+}
+
+static int nvme_script_get_ns_metadata(struct aa_args *args, struct nvme_script *script,
+                                       const uint32_t *param)
+{
+	return nvme_get_feature_namespace_metadata(args, param[0], param[1]);
+}
+
+static int nvme_script_wait(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	return NVME_SCRIPT_SUCCESS;
+}
+
+static int nvme_script_sleep(struct aa_args *args, struct nvme_script *script, const uint32_t *param)
+{
+	nvme_script_sleep_ms(param[0]);
+
+	return NVME_SCRIPT_SUCCESS;
+}
+
+static const struct nvme_script_cmd _cmd[] = {
+	{"set-temp-thresh",       1, 2, false, nvme_script_set_temp_thresh},
+	{"get-temp-thresh",       1, 1, false, nvme_script_get_temp_thresh},
+	{"get-power-mgmt",        1, 1, false, nvme_script_get_power_mgmt},
+	{"identify-ctrl",         0, 0, false, nvme_script_identify_ctrl},
+	{"smart",                 1, 1, false, nvme_script_smart},
+	{"subsys-health",         1, 1, false, nvme_script_subsys_health},
+	{"ctrl-health",           1, 1, false, nvme_script_ctrl_health},
+	{"config-get",            2, 2, false, nvme_script_config_get},
+	{"config-set",            2, 2, false, nvme_script_config_set},
+	{"config-get-sif",        0, 0, false, nvme_script_config_get_sif},
+	{"config-get-mtus",       0, 0, false, nvme_script_config_get_mtus},
+	{"config-get-hsc",        0, 0, false, nvme_script_config_get_hsc},
+	{"config-set-sif",        2, 2, false, nvme_script_config_set_sif},
+	{"config-set-hsc",        1, 1, false, nvme_script_config_set_hsc},
+	{"config-set-mtus",       2, 2, false, nvme_script_config_set_mtus},
+	{"subsys-info",           0, 0, false, nvme_script_subsys_info},
+	{"port-info",             1, 1, false, nvme_script_port_info},
+	{"ctrl-list",             1, 1, false, nvme_script_ctrl_list},
+	{"ctrl-info",             1, 1, false, nvme_script_ctrl_info},
+	{"opt-cmd",               2, 2, false, nvme_script_opt_cmd},
+	// The VPD commands move data through script->buf, they wait for their response.
+	{"vpd-read",              2, 2, true,  nvme_script_vpd_read},
+	{"vpd-write",             2, 2, true,  nvme_script_vpd_write},
+	{"set-ctrl-metadata",     1, 1, false, nvme_script_set_ctrl_metadata},
+	{"get-ctrl-metadata",     1, 2, false, nvme_script_get_ctrl_metadata},
+	{"get-enh-ctrl-metadata", 1, 2, false, nvme_script_get_enh_ctrl_metadata},
+	{"get-ns-metadata",       1, 2, false, nvme_script_get_ns_metadata},
+	{"wait",                  0, 0, true,  nvme_script_wait},
+	{"sleep",                 1, 1, true,  nvme_script_sleep},
+};
+
+const struct nvme_script_cmd *nvme_script_find(const char *name)
+{
+	for (int i = 0; i < sizeof(_cmd) / sizeof(_cmd[0]); i++)
+		if (!strcmp(name, _cmd[i].name))
+			return &_cmd[i];
+
+	return NULL;
+}
+
+static int nvme_script_parse_params(char *p, uint32_t *param, int max)
+{
+	char *tok, *end;
+	int n = 0;
+
+	while ((tok = strtok(p, " \t\r\n"))) {
+		p = NULL;
+		if (n == max)
+			return -1;
+		param[n++] = strtoul(tok, &end, 0);
+		if (*end)
+			return -1;
+	}
+
+	return n;
+}
+
+// Directives set up the run, every other line becomes an op.
+static int nvme_script_compile_line(struct nvme_script *script, char *line, uint16_t lineno)
+{
+	const struct nvme_script_cmd *cmd;
+	uint32_t param[NVME_SCRIPT_PARAM_MAX];
+	char *name = strtok(line, " \t\r\n");
+	int n;
+
+	if (!name || name[0] == '#')
+		return NVME_SCRIPT_SUCCESS;
+
+	n = nvme_script_parse_params(NULL, param, NVME_SCRIPT_PARAM_MAX);
+	if (n < 0)
+		return -NVME_SCRIPT_ERR_SYNTAX;
+
+	if (!strcmp(name, "repeat") || !strcmp(name, "interval") || !strcmp(name, "report") ||
+	    !strcmp(name, "pipeline")) {
+		if (n != 1)
+			return -NVME_SCRIPT_ERR_SYNTAX;
+		if (!strcmp(name, "repeat"))
+			script->repeat = param[0];
+		else if (!strcmp(name, "interval"))
+			script->interval_ms = param[0];
+		else if (!strcmp(name, "report"))
+			script->report = param[0];
+		else
+			script->pipeline = param[0];
+		return NVME_SCRIPT_SUCCESS;
+	}
+
+	if (!strcmp(name, "target")) {
+		if (n != 2 || param[0] > 0x7F || param[1] > 0xFF ||
+		    script->ntarget >= NVME_SCRIPT_TARGET_MAX)
+			return -NVME_SCRIPT_ERR_SYNTAX;
+		script->target[script->ntarget].slv_addr = param[0];
+		script->target[script->ntarget].eid = param[1];
+		script->ntarget++;
+		return NVME_SCRIPT_SUCCESS;
+	}
+
+	cmd = nvme_script_find(name);
+	if (!cmd || n < cmd->min || n > cmd->max || script->nop >= NVME_SCRIPT_OP_MAX)
+		return -NVME_SCRIPT_ERR_SYNTAX;
+
+	if ((cmd->fn == nvme_script_vpd_read || cmd->fn == nvme_script_vpd_write) &&
+	    (param[0] > NVME_SCRIPT_BUF_SIZE || param[1] > NVME_SCRIPT_BUF_SIZE - param[0]))
+		return -NVME_SCRIPT_ERR_SYNTAX;
+
+	struct nvme_script_op *op = &script->op[script->nop++];
+	memset(op, 0, sizeof(*op));
+	op->cmd = cmd;
+	op->line = lineno;
+	memcpy(op->param, param, n * sizeof(param[0]));
+
+	return NVME_SCRIPT_SUCCESS;
+}
+
+/**
+ * Compile a script, one command or directive per line:
+ *   repeat <rounds>       0 runs forever
+ *   interval <ms>         pause between rounds
+ *   report <rounds>       print the statistics every this many rounds
+ *   pipeline <0|1>        keep one command in flight on each command slot
+ *   target <addr> <eid>   run the ops against this endpoint, may be repeated
+ *   <command> [params]
+ * Parameters are numbers in any base strtoul() accepts.
+ */
+int nvme_script_compile(struct nvme_script *script, const char *text, const char *name)
+{
+	char line[256];
+	uint16_t lineno = 0;
+	int ret;
+
+	memset(script, 0, sizeof(*script));
+	script->repeat = 1;
+
+	while (*text) {
+		const char *eol = strchr(text, '\n');
+		size_t len = eol ? eol - text : strlen(text);
+
+		lineno++;
+		if (len >= sizeof(line)) {
+			nvme_trace(ERROR, "%s:%d: line too long\n", name, lineno);
+			return -NVME_SCRIPT_ERR_SYNTAX;
+		}
+		memcpy(line, text, len);
+		line[len] = 0;
+		text += eol ? len + 1 : len;
+
+		ret = nvme_script_compile_line(script, line, lineno);
+		if (ret) {
+			nvme_trace(ERROR, "%s:%d: invalid script line\n", name, lineno);
+			return ret;
+		}
+	}
+
+	if (!script->nop) {
+		nvme_trace(ERROR, "%s: no commands\n", name);
+		return -NVME_SCRIPT_ERR_SYNTAX;
+	}
+
+	for (int i = 0; i < script->nop; i++) {
+		script->op[i].sample = malloc(NVME_SCRIPT_SAMPLE_MAX * sizeof(uint32_t));
+		if (!script->op[i].sample) {
+			nvme_script_free(script);
+			return -NVME_SCRIPT_ERR_IO;
+		}
+	}
+
+	return NVME_SCRIPT_SUCCESS;
+}
+
+int nvme_script_load(struct nvme_script *script, const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	char *text;
+	long size;
+	int ret;
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_SCRIPT_ERR_IO;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	text = size >= 0 ? malloc(size + 1) : NULL;
+	if (!text || fread(text, 1, size, fp) != size) {
+		nvme_trace(ERROR, "read %s\n", path);
+		free(text);
+		fclose(fp);
+		return -NVME_SCRIPT_ERR_IO;
+	}
+	text[size] = 0;
+	fclose(fp);
+
+	ret = nvme_script_compile(script, text, path);
+	free(text);
+
+	return ret;
+}
+
+void nvme_script_free(struct nvme_script *script)
+{
+	for (int i = 0; i < script->nop; i++) {
+		free(script->op[i].sample);
+		script->op[i].sample = NULL;
+	}
+}
+
+/**
+ * Account the op outstanding on the slot of args: wait for its response, take
+ * the latency from issue to completion and count a failed command or a
+ * non-zero status as an error.
+ */
+static void nvme_script_complete(struct aa_args *args, struct nvme_script_op *op, uint64_t start,
+                                 int ret)
+{
+	struct nvme_mi_result res;
+	uint32_t us;
+
+	if (!ret)
+		ret = nvme_mi_wait_slot(args, args->csi);
+	us = time_us() - start;
+
+	if (!ret && op->cmd->fn != nvme_script_wait && op->cmd->fn != nvme_script_sleep) {
+		ret = nvme_mi_get_result(args->csi, &res);
+		if (!ret && (res.status || res.sf))
+			ret = res.status ? res.status : res.sf;
+	}
+
+	op->runs++;
+	op->total_us += us;
+	op->sample[op->nsample++ % NVME_SCRIPT_SAMPLE_MAX] = us;
+	if (ret) {
+		op->errors++;
+		nvme_trace(WARN, "line %d %s (%d)\n", op->line, op->cmd->name, ret);
+	}
+}
+
+static void nvme_script_run_ops(struct aa_args *args, struct nvme_script *script)
+{
+	struct nvme_script_op *pending[NVME_MI_SLOT_MAX] = {NULL};
+	uint64_t start[NVME_MI_SLOT_MAX] = {0};
+	bool slot = args->csi;
+
+	for (int i = 0; i < script->nop; i++) {
+		struct nvme_script_op *op = &script->op[i];
+		int ret;
+
+		if (op->cmd->drain) {
+			for (int j = 0; j < NVME_MI_SLOT_MAX; j++) {
+				args->csi = j;
+				if (pending[j])
+					nvme_script_complete(args, pending[j], start[j], 0);
+				pending[j] = NULL;
+			}
+		}
+
+		args->csi = slot;
+		if (pending[slot]) {
+			nvme_script_complete(args, pending[slot], start[slot], 0);
+			pending[slot] = NULL;
+		}
+
+		start[slot] = time_us();
+		ret = op->cmd->fn(args, script, op->param);
+
+		// A command that failed to go out has nothing to wait for.
+		if (ret || !args->async || op->cmd->drain)
+			nvme_script_complete(args, op, start[slot], ret);
+		else
+			pending[slot] = op;
+
+		if (script->pipeline)
+			slot = !slot;
+	}
+
+	for (int j = 0; j < NVME_MI_SLOT_MAX; j++) {
+		args->csi = j;
+		if (pending[j])
+			nvme_script_complete(args, pending[j], start[j], 0);
+	}
+}
+
+/**
+ * Run the compiled ops script->repeat times against every target. With
+ * pipeline consecutive ops go out on alternating command slots and each op is
+ * completed when its slot is needed again, otherwise each op completes
+ * before the next one is sent.
+ */
+int nvme_script_run(struct aa_args *args, struct nvme_script *script)
+{
+	struct aa_args run_args = *args;
+	struct nvme_script_target self = {
+		.slv_addr = args->slv_addr,
+		.eid = args->dst_eid,
+	};
+	const struct nvme_script_target *target = script->ntarget ? script->target : &self;
+	uint8_t ntarget = script->ntarget ? script->ntarget : 1;
+	uint64_t begin = time_us();
+
+	if (!script->nop)
+		return -NVME_SCRIPT_ERR_PARAM;
+
+	run_args.async = script->pipeline;
+
+	for (script->rounds = 0; !script->repeat || script->rounds < script->repeat;) {
+		for (int i = 0; i < ntarget; i++) {
+			run_args.slv_addr = target[i].slv_addr;
+			run_args.dst_eid = target[i].eid;
+			nvme_script_run_ops(&run_args, script);
+		}
+
+		script->rounds++;
+		script->elapsed_us = time_us() - begin;
+		if (!script->quiet)
+			printf("Round #%d done\n", script->rounds);
+
+		if (script->report && !(script->rounds % script->report))
+			nvme_script_show(script);
+
+		if (script->interval_ms && (!script->repeat || script->rounds < script->repeat))
+			nvme_script_sleep_ms(script->interval_ms);
+	}
+
+	return NVME_SCRIPT_SUCCESS;
+}
+
+static int nvme_script_cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Latency percentiles of an op in microseconds: p50, p90, p99 and max.
+static void nvme_script_percentiles(const struct nvme_script_op *op, uint32_t *pct)
+{
+	uint32_t n = op->nsample < NVME_SCRIPT_SAMPLE_MAX ? op->nsample : NVME_SCRIPT_SAMPLE_MAX;
+	uint32_t *sorted;
+
+	memset(pct, 0, 4 * sizeof(*pct));
+	if (!n)
+		return;
+
+	sorted = malloc(n * sizeof(*sorted));
+	if (!sorted)
+		return;
+
+	memcpy(sorted, op->sample, n * sizeof(*sorted));
+	qsort(sorted, n, sizeof(*sorted), nvme_script_cmp_u32);
+
+	pct[0] = sorted[(n - 1) * 50 / 100];
+	pct[1] = sorted[(n - 1) * 90 / 100];
+	pct[2] = sorted[(n - 1) * 99 / 100];
+	pct[3] = sorted[n - 1];
+
+	free(sorted);
+}
+
+void nvme_script_show(const struct nvme_script *script)
+{
+	uint32_t runs = 0, errors = 0;
+
+	printf("Rounds                      : %d\n", script->rounds);
+	printf("Elapsed                     : %llu ms\n", (unsigned long long)script->elapsed_us / 1000);
+	printf("%5s %-22s %8s %8s %9s %9s %9s %9s %9s\n", "line", "command", "runs", "errors",
+	       "mean(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+
+	for (int i = 0; i < script->nop; i++) {
+		const struct nvme_script_op *op = &script->op[i];
+		uint32_t pct[4];
+
+		nvme_script_percentiles(op, pct);
+		printf("%5d %-22s %8d %8d %9llu %9d %9d %9d %9d\n", op->line, op->cmd->name, op->runs,
+		       op->errors, op->runs ? (unsigned long long)(op->total_us / op->runs) : 0ULL,
+		       pct[0], pct[1], pct[2], pct[3]);
+		runs += op->runs;
+		errors += op->errors;
+	}
+
+	printf("Total                       : %d runs, %d errors\n", runs, errors);
+}
+
+// The statistics as CSV, one row per op, for comparing runs.
+int nvme_script_save_report(const struct nvme_script *script, const char *path)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_SCRIPT_ERR_IO;
+	}
+
+	fprintf(fp, "line,command,runs,errors,mean_us,p50_us,p90_us,p99_us,max_us\n");
+	for (int i = 0; i < script->nop; i++) {
+		const struct nvme_script_op *op = &script->op[i];
+		uint32_t pct[4];
+
+		nvme_script_percentiles(op, pct);
+		fprintf(fp, "%d,%s,%d,%d,%llu,%d,%d,%d,%d\n", op->line, op->cmd->name, op->runs,
+		        op->errors, op->runs ? (unsigned long long)(op->total_us / op->runs) : 0ULL,
+		        pct[0], pct[1], pct[2], pct[3]);
+	}
+
+	return fclose(fp) ? -NVME_SCRIPT_ERR_IO : NVME_SCRIPT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#ifndef NVME_SCRIPT_H
+#define NVME_SCRIPT_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NVME_SCRIPT_OP_MAX              (256)
+#define NVME_SCRIPT_PARAM_MAX           (3)
+#define NVME_SCRIPT_TARGET_MAX          (16)
+/**
+ * Latency samples kept per op. A longer run keeps the most recent ones, so
+ * the percentiles of a soak describe its end rather than its warm-up.
+ */
+#define NVME_SCRIPT_SAMPLE_MAX          (1 << 16)
+#define NVME_SCRIPT_BUF_SIZE            (4096)
+
+enum nvme_script_error {
+	NVME_SCRIPT_SUCCESS = 0,
+	NVME_SCRIPT_ERR_PARAM,
+	NVME_SCRIPT_ERR_SYNTAX,
+	NVME_SCRIPT_ERR_IO,
+};
+
+struct nvme_script;
+
+typedef int (*nvme_script_fn)(struct aa_args *args, struct nvme_script *script, const uint32_t *param);
+
+struct nvme_script_cmd {
+	const char *name;
+	uint8_t min;                    // Parameters required
+	uint8_t max;                    // Parameters accepted
+	bool drain;                     // Completes the outstanding commands before it runs
+	nvme_script_fn fn;
+};
+
+// One compiled script line.
+struct nvme_script_op {
+	const struct nvme_script_cmd *cmd;
+	uint32_t param[NVME_SCRIPT_PARAM_MAX];
+	uint16_t line;
+	uint32_t runs;
+	uint32_t errors;
+	uint64_t total_us;
+	uint32_t nsample;               // Samples taken, the buffer wraps at NVME_SCRIPT_SAMPLE_MAX
+	uint32_t *sample;
+};
+
+struct nvme_script_target {
+	uint8_t slv_addr;
+	uint8_t eid;
+};
+
+struct nvme_script {
+	uint16_t nop;
+	struct nvme_script_op op[NVME_SCRIPT_OP_MAX];
+	uint8_t ntarget;                // None runs the ops against the endpoint of args
+	struct nvme_script_target target[NVME_SCRIPT_TARGET_MAX];
+	uint32_t repeat;                // Rounds to run, 0 runs forever
+	uint32_t interval_ms;           // Pause between rounds
+	uint32_t report;                // Print the statistics every this many rounds
+	bool pipeline;                  // Alternate command slots, one command in flight per slot
+	bool quiet;                     // No progress lines, only what the commands print
+	uint32_t rounds;
+	uint64_t elapsed_us;
+	// Data of vpd-read, source of vpd-write
+	uint8_t buf[NVME_SCRIPT_BUF_SIZE];
+};
+
+extern const char *nvme_script_default;
+
+const struct nvme_script_cmd *nvme_script_find(const char *name);
+int nvme_script_compile(struct nvme_script *script, const char *text, const char *name);
+int nvme_script_load(struct nvme_script *script, const char *path);
+int nvme_script_run(struct aa_args *args, struct nvme_script *script);
+void nvme_script_show(const struct nvme_script *script);
+int nvme_script_save_report(const struct nvme_script *script, const char *path);
+void nvme_script_free(struct nvme_script *script);
+
+#endif // NVME_SCRIPT_H
@@ -0,0 +1,288 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_log.h"
+#include "nvme_telemetry.h"
+#include "libnvme_types.h"
+#include "utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static FILE *nvme_telemetry_fopen(const char *path, const char *ext)
+{
+	char name[256];
+	FILE *fp;
+
+	if (snprintf(name, sizeof(name), "%s%s", path, ext) >= sizeof(name)) {
+		nvme_trace(ERROR, "store path too long\n");
+		return NULL;
+	}
+
+	// Keep what is there, create the file otherwise.
+	fp = fopen(name, "r+b");
+	if (!fp)
+		fp = fopen(name, "w+b");
+	if (!fp)
+		nvme_trace(ERROR, "fopen %s\n", name);
+
+	return fp;
+}
+
+/**
+ * The index is replayed to find the end of the stored data and how far the
+ * last generation was collected. A record cut short by a crash is dropped
+ * and overwritten by the next one, as is data appended without its record.
+ */
+int nvme_telemetry_open(struct nvme_telemetry *tl, const char *path, uint8_t lid)
+{
+	struct nvme_telemetry_idx rec;
+
+	if (lid != NVME_LOG_LID_TELEMETRY_HOST && lid != NVME_LOG_LID_TELEMETRY_CTRL)
+		return -NVME_TELEMETRY_ERR_PARAM;
+
+	memset(tl, 0, sizeof(*tl));
+	tl->lid = lid;
+	tl->max_area = NVME_TELEMETRY_DA_3;
+
+	tl->data = nvme_telemetry_fopen(path, ".tld");
+	tl->idx = nvme_telemetry_fopen(path, ".tlx");
+	if (!tl->data || !tl->idx) {
+		nvme_telemetry_close(tl);
+		return -NVME_TELEMETRY_ERR_IO;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, tl->idx) == 1) {
+		if (rec.magic != NVME_TELEMETRY_IDX_MAGIC || rec.lid != lid) {
+			nvme_trace(WARN, "index of %s ends at record %d\n", path, tl->nrec);
+			break;
+		}
+
+		tl->nrec++;
+		tl->data_end = rec.offset + (uint64_t)rec.nblock * NVME_TELEMETRY_BLOCK_SIZE;
+
+		if (!tl->have || rec.dgn != tl->dgn) {
+			tl->have = true;
+			tl->dgn = rec.dgn;
+			tl->last_block = 0;
+		}
+		if (rec.area && rec.first + rec.nblock - 1 > tl->last_block)
+			tl->last_block = rec.first + rec.nblock - 1;
+	}
+
+	return NVME_TELEMETRY_SUCCESS;
+}
+
+void nvme_telemetry_close(struct nvme_telemetry *tl)
+{
+	if (tl->data)
+		fclose(tl->data);
+	if (tl->idx)
+		fclose(tl->idx);
+	tl->data = NULL;
+	tl->idx = NULL;
+}
+
+static int nvme_telemetry_copy(const void *buf, uint32_t len, uint64_t offset, void *priv)
+{
+	memcpy(priv, buf, len);
+
+	return 0;
+}
+
+static int nvme_telemetry_append(const void *buf, uint32_t len, uint64_t offset, void *priv)
+{
+	struct nvme_telemetry *tl = priv;
+
+	if (fwrite(buf, len, 1, tl->data) != 1) {
+		nvme_trace(ERROR, "write telemetry data\n");
+		return -NVME_TELEMETRY_ERR_IO;
+	}
+
+	return 0;
+}
+
+static int nvme_telemetry_read(struct aa_args *args, struct nvme_telemetry *tl, uint8_t lsp,
+                               uint32_t first, uint32_t nblock, nvme_log_chunk_cb cb, void *priv)
+{
+	struct nvme_log_stream ls = {
+		.nsid = NVME_NSID_NONE,
+		.lid = tl->lid,
+		.lsp = lsp,
+		.lsi = NVME_LOG_LSI_NONE,
+		// Keep a Controller-Initiated capture latched, the host releases it.
+		.rae = true,
+		.offset = (uint64_t)first * NVME_TELEMETRY_BLOCK_SIZE,
+		.size = (uint64_t)(first + nblock) * NVME_TELEMETRY_BLOCK_SIZE,
+		.fd = -1,
+		.cb = cb,
+		.priv = priv,
+	};
+
+	return nvme_log_stream_read(args, &ls);
+}
+
+static uint8_t nvme_telemetry_dgn(const struct nvme_telemetry *tl,
+                                  const struct nvme_telemetry_log *hdr)
+{
+	return tl->lid == NVME_LOG_LID_TELEMETRY_HOST ? hdr->hostdgn : hdr->ctrldgn;
+}
+
+static int nvme_telemetry_index(struct nvme_telemetry *tl, uint8_t dgn, uint8_t area,
+                                uint32_t first, uint32_t nblock, uint64_t offset)
+{
+	struct nvme_telemetry_idx rec = {
+		.magic = NVME_TELEMETRY_IDX_MAGIC,
+		.lid = tl->lid,
+		.dgn = dgn,
+		.area = area,
+		.first = first,
+		.nblock = nblock,
+		.offset = offset,
+		.time = time(NULL),
+	};
+
+	if (fseek(tl->idx, (long)tl->nrec * sizeof(rec), SEEK_SET) ||
+	    fwrite(&rec, sizeof(rec), 1, tl->idx) != 1) {
+		nvme_trace(ERROR, "write telemetry index\n");
+		return -NVME_TELEMETRY_ERR_IO;
+	}
+	tl->nrec++;
+
+	return NVME_TELEMETRY_SUCCESS;
+}
+
+/**
+ * Read the header and fetch only the blocks that are not stored yet: all
+ * areas up to max_area of a new generation, or the blocks an area grew by
+ * within the stored one. The header is read again at the end; if the
+ * generation changed meanwhile the fetched blocks are not indexed.
+ */
+int nvme_telemetry_collect(struct aa_args *args, struct nvme_telemetry *tl)
+{
+	struct nvme_telemetry_log *hdr, *check;
+	uint32_t dalb[NVME_TELEMETRY_AREA_MAX + 1];
+	uint32_t have, lo, hi;
+	uint64_t start = time_us();
+	uint64_t offset[NVME_TELEMETRY_AREA_MAX + 1];
+	uint8_t lsp, dgn;
+	bool same;
+	int ret;
+
+	if (!tl->max_area || tl->max_area > NVME_TELEMETRY_AREA_MAX)
+		return -NVME_TELEMETRY_ERR_PARAM;
+
+	tl->new_blocks = 0;
+	tl->skip_blocks = 0;
+
+	hdr = malloc(2 * NVME_TELEMETRY_BLOCK_SIZE);
+	if (!hdr)
+		return -NVME_TELEMETRY_ERR_IO;
+	check = (void *)((u8 *)hdr + NVME_TELEMETRY_BLOCK_SIZE);
+
+	lsp = tl->lid == NVME_LOG_LID_TELEMETRY_HOST && tl->create ? NVME_LOG_TELEM_HOST_LSP_CREATE :
+	      NVME_LOG_TELEM_HOST_LSP_RETAIN;
+	ret = nvme_telemetry_read(args, tl, lsp, 0, 1, nvme_telemetry_copy, hdr);
+	if (ret)
+		goto out;
+
+	if (tl->lid == NVME_LOG_LID_TELEMETRY_CTRL && !hdr->ctrlavail) {
+		nvme_trace(INFO, "no controller-initiated telemetry\n");
+		goto out;
+	}
+
+	dgn = nvme_telemetry_dgn(tl, hdr);
+	dalb[0] = 0;
+	dalb[1] = hdr->dalb1;
+	dalb[2] = hdr->dalb2;
+	dalb[3] = hdr->dalb3;
+	dalb[4] = hdr->dalb4;
+
+	// Same generation, what is stored of it is still valid.
+	same = tl->have && tl->dgn == dgn && tl->last_block <= dalb[tl->max_area];
+	have = same ? tl->last_block : 0;
+	tl->skip_blocks = have;
+	if (same && have == dalb[tl->max_area])
+		goto out;
+
+	if (fseek(tl->data, tl->data_end, SEEK_SET)) {
+		ret = -NVME_TELEMETRY_ERR_IO;
+		goto out;
+	}
+	if (fwrite(hdr, NVME_TELEMETRY_BLOCK_SIZE, 1, tl->data) != 1) {
+		nvme_trace(ERROR, "write telemetry header\n");
+		ret = -NVME_TELEMETRY_ERR_IO;
+		goto out;
+	}
+	offset[0] = tl->data_end;
+
+	for (int area = 1; area <= tl->max_area; area++) {
+		// Areas are contiguous, each one starts after the last block of the previous one.
+		lo = dalb[area - 1] + 1 > have + 1 ? dalb[area - 1] + 1 : have + 1;
+		hi = dalb[area];
+		offset[area] = offset[0] + NVME_TELEMETRY_BLOCK_SIZE +
+		               (uint64_t)tl->new_blocks * NVME_TELEMETRY_BLOCK_SIZE;
+		if (hi < lo)
+			continue;
+
+		ret = nvme_telemetry_read(args, tl, NVME_LOG_TELEM_HOST_LSP_RETAIN, lo, hi - lo + 1,
+		                          nvme_telemetry_append, tl);
+		if (ret)
+			goto out;
+		tl->new_blocks += hi - lo + 1;
+	}
+
+	ret = nvme_telemetry_read(args, tl, NVME_LOG_TELEM_HOST_LSP_RETAIN, 0, 1,
+	                          nvme_telemetry_copy, check);
+	if (ret)
+		goto out;
+	if (nvme_telemetry_dgn(tl, check) != dgn) {
+		nvme_trace(WARN, "telemetry generation changed during collection (%d,%d)\n", dgn,
+		           nvme_telemetry_dgn(tl, check));
+		ret = -NVME_TELEMETRY_ERR_CHANGED;
+		goto out;
+	}
+
+	// The data is flushed before the records that point to it.
+	if (fflush(tl->data)) {
+		ret = -NVME_TELEMETRY_ERR_IO;
+		goto out;
+	}
+
+	ret = nvme_telemetry_index(tl, dgn, 0, 0, 1, offset[0]);
+	for (int area = 1; !ret && area <= tl->max_area; area++) {
+		lo = dalb[area - 1] + 1 > have + 1 ? dalb[area - 1] + 1 : have + 1;
+		hi = dalb[area];
+		if (hi >= lo)
+			ret = nvme_telemetry_index(tl, dgn, area, lo, hi - lo + 1, offset[area]);
+	}
+	if (!ret && fflush(tl->idx))
+		ret = -NVME_TELEMETRY_ERR_IO;
+	if (ret)
+		goto out;
+
+	tl->data_end = offset[0] + (uint64_t)(1 + tl->new_blocks) * NVME_TELEMETRY_BLOCK_SIZE;
+	tl->have = true;
+	tl->dgn = dgn;
+	tl->last_block = dalb[tl->max_area] > have ? dalb[tl->max_area] : have;
+
+out:
+	tl->elapsed_us = time_us() - start;
+	free(hdr);
+
+	return ret;
+}
+
+void nvme_telemetry_show(const struct nvme_telemetry *tl)
+{
+	printf("Log                         : %s\n",
+	       tl->lid == NVME_LOG_LID_TELEMETRY_HOST ? "Host-Initiated" : "Controller-Initiated");
+	printf("Generation                  : %d\n", tl->dgn);
+	printf("Last Block                  : %d\n", tl->last_block);
+	printf("New Blocks                  : %d\n", tl->new_blocks);
+	printf("Stored Blocks Skipped       : %d\n", tl->skip_blocks);
+	printf("Index Records               : %d\n", tl->nrec);
+	printf("Store Size                  : %llu\n", (unsigned long long)tl->data_end);
+	printf("Elapsed                     : %llu ms\n", (unsigned long long)tl->elapsed_us / 1000);
+}
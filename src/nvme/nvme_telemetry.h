@@ -0,0 +1,74 @@
+#ifndef NVME_TELEMETRY_H
+#define NVME_TELEMETRY_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * NVMe Base, 5.16.1.8 Telemetry Host-Initiated and 5.16.1.9 Telemetry
+ * Controller-Initiated
+ *
+ * The log is a 512 byte header followed by Data Areas 1 to 4 of 512 byte
+ * blocks, each area ending at the Last Block of the header. A capture is
+ * identified by its Data Generation Number.
+ */
+#define NVME_TELEMETRY_BLOCK_SIZE       (512)
+#define NVME_TELEMETRY_AREA_MAX         (4)
+// "NTLX"
+#define NVME_TELEMETRY_IDX_MAGIC        (0x584C544E)
+
+enum nvme_telemetry_error {
+	NVME_TELEMETRY_SUCCESS = 0,
+	NVME_TELEMETRY_ERR_PARAM,
+	NVME_TELEMETRY_ERR_STATUS,
+	NVME_TELEMETRY_ERR_IO,
+	NVME_TELEMETRY_ERR_CHANGED,
+};
+
+#pragma pack(push, 1)
+
+/**
+ * One record of the index, area 0 is the header. The blocks of a record are
+ * stored contiguously in the data file at offset.
+ */
+struct nvme_telemetry_idx {
+	u32 magic;
+	u8 lid;
+	u8 dgn;
+	u8 area;
+	u8 rsvd;
+	u32 first;                      // First block, from the start of the log
+	u32 nblock;
+	u64 offset;
+	u64 time;                       // Seconds since the epoch
+};
+
+#pragma pack(pop)
+
+struct nvme_telemetry {
+	uint8_t lid;                    // NVME_LOG_LID_TELEMETRY_HOST or NVME_LOG_LID_TELEMETRY_CTRL
+	bool create;                    // Host-Initiated: capture a new generation before reading
+	uint8_t max_area;               // Last Data Area to collect
+	// Store, <path>.tld holds the blocks and <path>.tlx the index
+	FILE *data;
+	FILE *idx;
+	uint64_t data_end;              // End of the indexed data
+	uint32_t nrec;
+	// Last collected generation
+	bool have;
+	uint8_t dgn;
+	uint32_t last_block;            // Last block collected of the generation
+	// Last collection
+	uint32_t new_blocks;
+	uint32_t skip_blocks;           // Blocks of the log that were already stored
+	uint64_t elapsed_us;
+};
+
+int nvme_telemetry_open(struct nvme_telemetry *tl, const char *path, uint8_t lid);
+void nvme_telemetry_close(struct nvme_telemetry *tl);
+int nvme_telemetry_collect(struct aa_args *args, struct nvme_telemetry *tl);
+void nvme_telemetry_show(const struct nvme_telemetry *tl);
+
+#endif // NVME_TELEMETRY_H
@@ -0,0 +1,592 @@
+#include "nvme.h"
+#include "nvme_mi.h"
+#include "nvme_vpd.h"
+#include "nvme_decode.h"
+#include "mctp_transport.h"
+#include "checksum.h"
+#include "libnvme_types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *_area[NVME_VPD_AREA_MAX] = {
+	[NVME_VPD_AREA_INTERNAL] = "Internal Use Area",
+	[NVME_VPD_AREA_CHASSIS] = "Chassis Info Area",
+	[NVME_VPD_AREA_BOARD] = "Board Info Area",
+	[NVME_VPD_AREA_PRODUCT] = "Product Info Area",
+};
+
+// Fixed bytes in front of the first Type/Length field of an info area.
+static const uint8_t _area_fixed[NVME_VPD_AREA_MAX] = {
+	[NVME_VPD_AREA_CHASSIS] = 3,    // Version, Length, Chassis Type
+	[NVME_VPD_AREA_BOARD] = 6,      // Version, Length, Language, Mfg. Date/Time
+	[NVME_VPD_AREA_PRODUCT] = 3,    // Version, Length, Language
+};
+
+static const char *_field[NVME_VPD_AREA_MAX][8] = {
+	[NVME_VPD_AREA_CHASSIS] = {
+		"Part Number", "Serial Number",
+	},
+	[NVME_VPD_AREA_BOARD] = {
+		"Manufacturer", "Product Name", "Serial Number", "Part Number", "FRU File ID",
+	},
+	[NVME_VPD_AREA_PRODUCT] = {
+		"Manufacturer", "Product Name", "Part/Model Number", "Version", "Serial Number",
+		"Asset Tag", "FRU File ID",
+	},
+};
+
+static const char *_record[256] = {
+	[0x00] = "Power Supply Information",
+	[0x01] = "DC Output",
+	[0x02] = "DC Load",
+	[0x03] = "Management Access Record",
+	[0x04] = "Base Compatibility Record",
+	[0x05] = "Extended Compatibility Record",
+	[0xB] = "NVMe Record Type ID",
+	[0xC] = "NVMe PCIe Port Record Type ID",
+	[0xD] = "Topology Record Type ID",
+};
+
+static bool nvme_vpd_zero_sum(const uint8_t *buf, uint32_t len)
+{
+	return !checksum8_append(0, (const char *)buf, len);
+}
+
+uint32_t nvme_vpd_chunk_size(bool ic, bool write)
+{
+	// VPD Write carries the data after the request dwords, VPD Read returns it after NMRESP.
+	uint32_t overhead = write ? sizeof(union nvme_mi_req_dw) :
+	                    sizeof(union nvme_mi_msg_header) + sizeof(union nvme_mi_resp);
+	uint32_t max = mctp_transport_get_max_msg_size();
+	uint32_t chunk;
+
+	overhead += ic ? 4 : 0;
+	chunk = max > overhead ? max - overhead : 0;
+
+	return chunk > NVME_VPD_SIZE_MAX ? NVME_VPD_SIZE_MAX : chunk;
+}
+
+/**
+ * Bytes of VPD the areas and records found in the first len bytes of buf
+ * extend to. A result beyond len means more has to be read before the extent
+ * is known; the header alone needs 8 bytes.
+ */
+uint32_t nvme_vpd_extent(const uint8_t *buf, uint32_t len)
+{
+	uint32_t end = 8, off;
+
+	if (len < 8 || !nvme_vpd_zero_sum(buf, 8))
+		return len < 8 ? 8 : len;
+
+	for (int i = NVME_VPD_AREA_CHASSIS; i < NVME_VPD_AREA_MAX; i++) {
+		off = buf[1 + i] * 8;
+		if (!off)
+			continue;
+		// The Area Length byte follows the version byte.
+		if (off + 2 > len)
+			end = off + 2 > end ? off + 2 : end;
+		else if (off + buf[off + 1] * 8 > end)
+			end = off + buf[off + 1] * 8;
+	}
+
+	// The Internal Use Area ends where the next area starts.
+	off = buf[1] * 8;
+	if (off && off + 1 > end)
+		end = off + 1;
+
+	off = buf[5] * 8;
+	for (int i = 0; off && i < NVME_VPD_RECORD_MAX; i++) {
+		if (off + 5 > len) {
+			end = off + 5 > end ? off + 5 : end;
+			break;
+		}
+		if (off + 5 + buf[off + 2] > end)
+			end = off + 5 + buf[off + 2];
+		if (buf[off + 1] & NVME_VPD_MR_EOL || !nvme_vpd_zero_sum(buf + off, 5))
+			break;
+		off += 5 + buf[off + 2];
+	}
+
+	return end > NVME_VPD_SIZE_MAX ? NVME_VPD_SIZE_MAX : end;
+}
+
+static void nvme_vpd_parse_area(struct nvme_vpd *vpd, enum nvme_vpd_area_id id, uint16_t off)
+{
+	struct nvme_vpd_area *area = &vpd->area[id];
+	const uint8_t *data = vpd->data;
+	uint32_t end, p;
+
+	area->present = true;
+	area->offset = off;
+
+	if (off + 2 > vpd->size || off + data[off + 1] * 8 > vpd->size || !data[off + 1]) {
+		nvme_trace(WARN, "%s at %d exceeds vpd\n", _area[id], off);
+		vpd->errors++;
+		return;
+	}
+
+	area->len = data[off + 1] * 8;
+	area->csum_ok = nvme_vpd_zero_sum(data + off, area->len);
+	if (!area->csum_ok) {
+		nvme_trace(WARN, "%s checksum mismatch\n", _area[id]);
+		vpd->errors++;
+	}
+
+	// The last byte of the area is its checksum.
+	end = off + area->len - 1;
+	for (p = off + _area_fixed[id]; p < end && data[p] != NVME_VPD_END_OF_FIELDS;) {
+		uint8_t len = data[p] & 0x3F;
+
+		if (p + 1 + len > end) {
+			nvme_trace(WARN, "%s field at %d exceeds area\n", _area[id], p);
+			vpd->errors++;
+			return;
+		}
+
+		if (area->nfield < NVME_VPD_FIELD_MAX) {
+			struct nvme_vpd_field *field = &area->field[area->nfield++];
+			field->type = data[p] >> 6;
+			field->len = len;
+			field->offset = p + 1;
+		}
+		p += 1 + len;
+	}
+}
+
+static void nvme_vpd_parse_records(struct nvme_vpd *vpd, uint16_t off)
+{
+	const uint8_t *data = vpd->data;
+
+	while (vpd->nrecord < NVME_VPD_RECORD_MAX) {
+		struct nvme_vpd_record *rec;
+
+		if (off + 5 > vpd->size) {
+			nvme_trace(WARN, "multirecord at %d exceeds vpd\n", off);
+			vpd->errors++;
+			return;
+		}
+
+		rec = &vpd->record[vpd->nrecord++];
+		rec->type = data[off];
+		rec->format = data[off + 1] & 0x0F;
+		rec->eol = data[off + 1] & NVME_VPD_MR_EOL;
+		rec->len = data[off + 2];
+		rec->offset = off + 5;
+		rec->hdr_ok = nvme_vpd_zero_sum(data + off, 5);
+		// Record Checksum makes the record data sum to zero.
+		rec->data_ok = rec->offset + rec->len <= vpd->size &&
+		               !checksum8_append(data[off + 3], (const char *)data + rec->offset, rec->len);
+
+		if (!rec->hdr_ok || !rec->data_ok) {
+			nvme_trace(WARN, "multirecord %d checksum mismatch (%d,%d)\n", vpd->nrecord - 1,
+			           rec->hdr_ok, rec->data_ok);
+			vpd->errors++;
+		}
+
+		// Without a valid header the next record cannot be located.
+		if (rec->eol || !rec->hdr_ok)
+			return;
+		off = rec->offset + rec->len;
+	}
+}
+
+/**
+ * Parse vpd->data[0 .. vpd->size). Everything that can be located is parsed
+ * even if checksums fail; vpd->errors counts the problems found.
+ */
+int nvme_vpd_parse(struct nvme_vpd *vpd)
+{
+	const uint8_t *data = vpd->data;
+	uint16_t off[NVME_VPD_AREA_MAX];
+
+	vpd->hdr_ok = false;
+	vpd->nrecord = 0;
+	vpd->errors = 0;
+	memset(vpd->area, 0, sizeof(vpd->area));
+
+	if (vpd->size < sizeof(struct nvme_mi_vpd_hdr))
+		return -NVME_VPD_ERR_FORMAT;
+
+	// IPMI Format Version 01h and a zero checksum over the Common Header.
+	vpd->hdr_ok = (data[0] & 0x0F) == 1 && nvme_vpd_zero_sum(data, 8);
+	if (!vpd->hdr_ok) {
+		vpd->errors++;
+		return -NVME_VPD_ERR_CHECKSUM;
+	}
+
+	for (int i = 0; i < NVME_VPD_AREA_MAX; i++)
+		off[i] = data[1 + i] * 8;
+
+	if (off[NVME_VPD_AREA_INTERNAL]) {
+		struct nvme_vpd_area *area = &vpd->area[NVME_VPD_AREA_INTERNAL];
+		uint32_t end = vpd->size;
+
+		for (int i = NVME_VPD_AREA_CHASSIS; i < NVME_VPD_AREA_MAX; i++)
+			if (off[i] > off[NVME_VPD_AREA_INTERNAL] && off[i] < end)
+				end = off[i];
+		if (data[5] * 8 > off[NVME_VPD_AREA_INTERNAL] && data[5] * 8 < end)
+			end = data[5] * 8;
+
+		area->present = true;
+		area->csum_ok = true;
+		area->offset = off[NVME_VPD_AREA_INTERNAL];
+		area->len = end > area->offset ? end - area->offset : 0;
+	}
+
+	for (int i = NVME_VPD_AREA_CHASSIS; i < NVME_VPD_AREA_MAX; i++)
+		if (off[i])
+			nvme_vpd_parse_area(vpd, i, off[i]);
+
+	if (data[5])
+		nvme_vpd_parse_records(vpd, data[5] * 8);
+
+	return vpd->errors ? -NVME_VPD_ERR_CHECKSUM : NVME_VPD_SUCCESS;
+}
+
+static int nvme_vpd_read_range(struct aa_args *args, uint8_t *buf, uint32_t off, uint32_t len)
+{
+	struct aa_args vpd_args = *args;
+	struct nvme_mi_result res;
+	uint32_t chunk = nvme_vpd_chunk_size(args->ic, false);
+	int ret;
+
+	vpd_args.async = false;
+
+	while (len) {
+		uint32_t n = len > chunk ? chunk : len;
+
+		ret = nvme_mi_mi_vpd_read(&vpd_args, off, n, buf + off);
+		if (ret)
+			return ret;
+
+		nvme_mi_get_result(vpd_args.csi, &res);
+		if (res.status) {
+			nvme_trace(ERROR, "vpd read at %d: status %x\n", off, res.status);
+			return -NVME_VPD_ERR_STATUS;
+		}
+
+		if (nvme_mi_get_data_len(vpd_args.csi) < n)
+			return -NVME_VPD_ERR_SHORT;
+
+		off += n;
+		len -= n;
+	}
+
+	return NVME_VPD_SUCCESS;
+}
+
+/**
+ * Read size bytes of VPD, or with size 0 as much as its areas and records
+ * extend to. Then the common header is read first and each further read
+ * stops where the areas and records found so far end, never past the VPD.
+ */
+int nvme_vpd_read(struct aa_args *args, struct nvme_vpd *vpd, uint32_t size)
+{
+	uint32_t want;
+	int ret;
+
+	if (!nvme_vpd_chunk_size(args->ic, false) || size > NVME_VPD_SIZE_MAX)
+		return -NVME_VPD_ERR_PARAM;
+
+	memset(vpd->data, 0, sizeof(vpd->data));
+	vpd->size = 0;
+
+	want = size ? size : nvme_vpd_extent(vpd->data, 0);
+	while (vpd->size < want) {
+		ret = nvme_vpd_read_range(args, vpd->data, vpd->size, want - vpd->size);
+		if (ret)
+			return ret;
+		vpd->size = want;
+
+		if (size)
+			break;
+
+		want = nvme_vpd_extent(vpd->data, vpd->size);
+	}
+
+	nvme_vpd_parse(vpd);
+
+	return NVME_VPD_SUCCESS;
+}
+
+/**
+ * Byte ranges where want differs from cur. Ranges closer than gap are merged
+ * and none is longer than chunk. Returns the number of ranges, or
+ * -NVME_VPD_ERR_RANGE if more than max would be needed.
+ */
+int nvme_vpd_diff(const uint8_t *cur, const uint8_t *want, uint32_t size, uint32_t gap,
+                  uint32_t chunk, struct nvme_vpd_range *range, int max)
+{
+	int n = 0;
+
+	if (!chunk)
+		return -NVME_VPD_ERR_PARAM;
+
+	for (uint32_t i = 0; i < size; i++) {
+		struct nvme_vpd_range *last = n ? &range[n - 1] : NULL;
+
+		if (cur[i] == want[i])
+			continue;
+
+		if (last && i - (last->offset + last->len) <= gap && i + 1 - last->offset <= chunk) {
+			last->len = i + 1 - last->offset;
+			continue;
+		}
+
+		if (n == max)
+			return -NVME_VPD_ERR_RANGE;
+
+		range[n].offset = i;
+		range[n].len = 1;
+		n++;
+	}
+
+	return n;
+}
+
+static int nvme_vpd_write_range(struct aa_args *args, const uint8_t *buf, uint16_t off, uint16_t len)
+{
+	struct aa_args vpd_args = *args;
+	struct nvme_mi_result res;
+	int ret;
+
+	vpd_args.async = false;
+
+	ret = nvme_mi_mi_vpd_write(&vpd_args, off, len, (void *)(buf + off));
+	if (ret)
+		return ret;
+
+	nvme_mi_get_result(vpd_args.csi, &res);
+	if (res.status) {
+		nvme_trace(ERROR, "vpd write at %d: status %x\n", off, res.status);
+		return -NVME_VPD_ERR_STATUS;
+	}
+
+	return NVME_VPD_SUCCESS;
+}
+
+/**
+ * Make the first size bytes of the VPD equal to want, writing only the ranges
+ * that differ from cur and reading each one back. An image that does not
+ * parse cleanly is refused, a bad FRU checksum would outlast this tool.
+ */
+int nvme_vpd_update(struct aa_args *args, struct nvme_vpd *cur, const uint8_t *want, uint32_t size,
+                    uint32_t *written)
+{
+	struct nvme_vpd_range range[NVME_VPD_RANGE_MAX];
+	uint32_t chunk = nvme_vpd_chunk_size(args->ic, true);
+	uint32_t gap = NVME_VPD_MERGE_GAP;
+	struct nvme_vpd *check;
+	int n, ret;
+
+	*written = 0;
+	if (!size || size > NVME_VPD_SIZE_MAX || !chunk)
+		return -NVME_VPD_ERR_PARAM;
+
+	check = malloc(sizeof(*check));
+	if (!check)
+		return -NVME_VPD_ERR_IO;
+
+	memcpy(check->data, want, size);
+	check->size = size;
+	ret = nvme_vpd_parse(check);
+	if (ret) {
+		nvme_trace(ERROR, "refuse vpd image with %d errors\n", check->errors);
+		free(check);
+		return ret;
+	}
+
+	// The current content is needed up to the end of the new image.
+	if (cur->size < size) {
+		ret = nvme_vpd_read_range(args, cur->data, cur->size, size - cur->size);
+		if (ret) {
+			free(check);
+			return ret;
+		}
+		cur->size = size;
+	}
+
+	// Too many small ranges, merge more of them.
+	while ((n = nvme_vpd_diff(cur->data, want, size, gap, chunk, range, NVME_VPD_RANGE_MAX)) ==
+	       -NVME_VPD_ERR_RANGE)
+		gap *= 2;
+
+	for (int i = 0; i < n; i++) {
+		ret = nvme_vpd_write_range(args, want, range[i].offset, range[i].len);
+		if (!ret)
+			ret = nvme_vpd_read_range(args, check->data, range[i].offset, range[i].len);
+		if (ret)
+			break;
+
+		if (memcmp(check->data + range[i].offset, want + range[i].offset, range[i].len)) {
+			nvme_trace(ERROR, "vpd verify failed at %d\n", range[i].offset);
+			ret = -NVME_VPD_ERR_STATUS;
+			break;
+		}
+
+		memcpy(cur->data + range[i].offset, want + range[i].offset, range[i].len);
+		*written += range[i].len;
+	}
+
+	nvme_trace(INFO, "vpd update: %d ranges, %d of %d bytes written\n", n, *written, size);
+
+	free(check);
+	nvme_vpd_parse(cur);
+
+	return ret;
+}
+
+int nvme_vpd_load_file(const char *path, uint8_t *buf, uint32_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_VPD_ERR_IO;
+	}
+
+	*size = fread(buf, 1, NVME_VPD_SIZE_MAX, fp);
+	if (!feof(fp)) {
+		nvme_trace(ERROR, "%s is larger than %d bytes\n", path, NVME_VPD_SIZE_MAX);
+		fclose(fp);
+		return -NVME_VPD_ERR_PARAM;
+	}
+	fclose(fp);
+
+	return *size ? NVME_VPD_SUCCESS : -NVME_VPD_ERR_PARAM;
+}
+
+int nvme_vpd_save_file(const char *path, const struct nvme_vpd *vpd)
+{
+	FILE *fp = fopen(path, "wb");
+	int ret = NVME_VPD_SUCCESS;
+
+	if (!fp) {
+		nvme_trace(ERROR, "fopen %s\n", path);
+		return -NVME_VPD_ERR_IO;
+	}
+
+	if (fwrite(vpd->data, 1, vpd->size, fp) != vpd->size)
+		ret = -NVME_VPD_ERR_IO;
+	if (fclose(fp))
+		ret = -NVME_VPD_ERR_IO;
+
+	return ret;
+}
+
+// Print a Type/Length field: binary, BCD plus, 6-bit packed ASCII or 8-bit ASCII.
+static void nvme_vpd_show_field(const uint8_t *buf, const struct nvme_vpd_field *field)
+{
+	static const char bcd[] = "0123456789 -.???";
+	const uint8_t *p = buf + field->offset;
+
+	switch (field->type) {
+	case 0:
+		for (int i = 0; i < field->len; i++)
+			printf("%02x", p[i]);
+		break;
+	case 1:
+		for (int i = 0; i < field->len; i++)
+			printf("%c%c", bcd[p[i] >> 4], bcd[p[i] & 0xF]);
+		break;
+	case 2:
+		for (int i = 0; i + 2 < field->len + 2 && i < field->len; i += 3) {
+			uint32_t v = p[i] | (i + 1 < field->len ? p[i + 1] << 8 : 0) |
+			             (i + 2 < field->len ? p[i + 2] << 16 : 0);
+			for (int j = 0; j < 4; j++)
+				printf("%c", ((v >> (6 * j)) & 0x3F) + 0x20);
+		}
+		break;
+	default:
+		printf("%.*s", field->len, p);
+		break;
+	}
+}
+
+static void nvme_vpd_show_record(const struct nvme_vpd *vpd, const struct nvme_vpd_record *rec)
+{
+	const struct nvme_mi_vpd_mr_common *mr = (const void *)(vpd->data + rec->offset - 5);
+
+	printf("MultiRecord at %d\n", rec->offset - 5);
+	printf("  Type                      : %d (%s)\n", rec->type,
+	       _record[rec->type] ? _record[rec->type] : "OEM");
+	printf("  Record Format             : %d%s\n", rec->format, rec->eol ? " (End of List)" : "");
+	printf("  Record Length             : %d\n", rec->len);
+	printf("  Checksum                  : %s\n", rec->hdr_ok && rec->data_ok ? "OK" : "Mismatch");
+
+	switch (rec->type) {
+	case 0xB:
+		if (rec->len < 2)
+			break;
+		printf("  NMRAVN                    : %d\n", mr->nmra.nmravn);
+		printf("  Form Factor               : %d\n", mr->nmra.ff);
+		break;
+	case 0xC:
+		if (rec->len < sizeof(struct nvme_mi_vpd_ppmra))
+			break;
+		printf("  NPPMRAVN                  : %d\n", mr->ppmra.nppmravn);
+		printf("  PCIe Port Number          : %d\n", mr->ppmra.pn);
+		printf("  Port Information          : %d\n", mr->ppmra.ppi);
+		printf("  PCIe Link Speed           : %d\n", mr->ppmra.ls);
+		printf("  PCIe Maximum Link Width   : %x\n", mr->ppmra.mlw);
+		printf("  MCTP Support              : %d\n", mr->ppmra.mctp);
+		printf("  Ref Clk Capability        : %d\n", mr->ppmra.refccap);
+		printf("  Port Identifier           : %d\n", mr->ppmra.pi);
+		break;
+	case 0xD:
+		if (rec->len < 3)
+			break;
+		printf("  Version Number            : %d\n", mr->tmra.vn);
+		printf("  Element Count (N)         : %d\n", mr->tmra.ec);
+		break;
+	default:
+		break;
+	}
+}
+
+void nvme_vpd_show(const struct nvme_vpd *vpd)
+{
+	const uint8_t *data = vpd->data;
+
+	printf("VPD Size                    : %d\n", vpd->size);
+	printf("Errors                      : %d\n", vpd->errors);
+	if (!vpd->hdr_ok) {
+		printf("Common Header               : invalid\n");
+		return;
+	}
+
+	printf("Common Header\n");
+	printf("  IPMIVER                   : %d\n", data[0]);
+	printf("  IUAOFF                    : %d\n", data[1] * 8);
+	printf("  CIAOFF                    : %d\n", data[2] * 8);
+	printf("  BIAOFF                    : %d\n", data[3] * 8);
+	printf("  PIAOFF                    : %d\n", data[4] * 8);
+	printf("  MRIOFF                    : %d\n", data[5] * 8);
+
+	for (int i = 0; i < NVME_VPD_AREA_MAX; i++) {
+		const struct nvme_vpd_area *area = &vpd->area[i];
+
+		if (!area->present)
+			continue;
+
+		printf("%s at %d, %d bytes%s\n", _area[i], area->offset, area->len,
+		       area->csum_ok ? "" : " (checksum mismatch)");
+		if (i == NVME_VPD_AREA_CHASSIS && area->len)
+			printf("  Chassis Type              : %d\n", data[area->offset + 2]);
+		if (i == NVME_VPD_AREA_BOARD && area->len)
+			printf("  Mfg. Date/Time            : %d min\n", data[area->offset + 3] |
+			       data[area->offset + 4] << 8 | data[area->offset + 5] << 16);
+
+		for (int j = 0; j < area->nfield; j++) {
+			const char *name = j < 8 && _field[i][j] ? _field[i][j] : "Custom";
+			printf("  %-26s: ", name);
+			nvme_vpd_show_field(data, &area->field[j]);
+			printf("\n");
+		}
+	}
+
+	for (int i = 0; i < vpd->nrecord; i++)
+		nvme_vpd_show_record(vpd, &vpd->record[i]);
+}
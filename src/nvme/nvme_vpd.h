@@ -0,0 +1,103 @@
+#ifndef NVME_VPD_H
+#define NVME_VPD_H
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * NVMe-MI, 8 Vital Product Data
+ *
+ * The VPD follows the IPMI Platform Management FRU Information Storage
+ * Definition: a Common Header with the offsets of the Internal Use, Chassis
+ * Info, Board Info and Product Info Areas and of the MultiRecord Area, all in
+ * multiples of 8 bytes. Each area and record carries a zero checksum.
+ */
+#define NVME_VPD_SIZE_MAX               (4096)
+#define NVME_VPD_FIELD_MAX              (16)
+#define NVME_VPD_RECORD_MAX             (16)
+#define NVME_VPD_RANGE_MAX              (64)
+/**
+ * Unchanged gaps up to this size are rewritten instead of starting another
+ * VPD Write; the extra bytes cost less than a command and the EEPROM wears
+ * per page, not per byte.
+ */
+#define NVME_VPD_MERGE_GAP              (8)
+// Type/Length byte that ends the fields of an info area
+#define NVME_VPD_END_OF_FIELDS          (0xC1)
+// End of List in the Record Format byte of a MultiRecord header
+#define NVME_VPD_MR_EOL                 (1 << 7)
+
+enum nvme_vpd_error {
+	NVME_VPD_SUCCESS = 0,
+	NVME_VPD_ERR_PARAM,
+	NVME_VPD_ERR_FORMAT,
+	NVME_VPD_ERR_CHECKSUM,
+	NVME_VPD_ERR_STATUS,
+	NVME_VPD_ERR_SHORT,
+	NVME_VPD_ERR_IO,
+	NVME_VPD_ERR_RANGE,
+};
+
+enum nvme_vpd_area_id {
+	NVME_VPD_AREA_INTERNAL = 0,
+	NVME_VPD_AREA_CHASSIS,
+	NVME_VPD_AREA_BOARD,
+	NVME_VPD_AREA_PRODUCT,
+	NVME_VPD_AREA_MAX,
+};
+
+// Type/Length encoded field, offset is where its data starts in the image.
+struct nvme_vpd_field {
+	uint8_t type;                   // Bit[7:6] of the Type/Length byte
+	uint8_t len;
+	uint16_t offset;
+};
+
+struct nvme_vpd_area {
+	bool present;
+	bool csum_ok;
+	uint16_t offset;
+	uint16_t len;                   // Internal Use has no length, it ends at the next area
+	uint8_t nfield;
+	struct nvme_vpd_field field[NVME_VPD_FIELD_MAX];
+};
+
+struct nvme_vpd_record {
+	uint8_t type;
+	uint8_t format;
+	bool eol;
+	bool hdr_ok;
+	bool data_ok;
+	uint16_t offset;                // Record data, after the 5 byte header
+	uint8_t len;
+};
+
+struct nvme_vpd {
+	uint8_t data[NVME_VPD_SIZE_MAX];
+	uint32_t size;
+	bool hdr_ok;
+	struct nvme_vpd_area area[NVME_VPD_AREA_MAX];
+	uint8_t nrecord;
+	struct nvme_vpd_record record[NVME_VPD_RECORD_MAX];
+	uint32_t errors;                // Checksum and format errors found by the parser
+};
+
+struct nvme_vpd_range {
+	uint16_t offset;
+	uint16_t len;
+};
+
+uint32_t nvme_vpd_chunk_size(bool ic, bool write);
+uint32_t nvme_vpd_extent(const uint8_t *buf, uint32_t len);
+int nvme_vpd_parse(struct nvme_vpd *vpd);
+int nvme_vpd_read(struct aa_args *args, struct nvme_vpd *vpd, uint32_t size);
+int nvme_vpd_diff(const uint8_t *cur, const uint8_t *want, uint32_t size, uint32_t gap,
+                  uint32_t chunk, struct nvme_vpd_range *range, int max);
+int nvme_vpd_update(struct aa_args *args, struct nvme_vpd *cur, const uint8_t *want, uint32_t size,
+                    uint32_t *written);
+int nvme_vpd_load_file(const char *path, uint8_t *buf, uint32_t *size);
+int nvme_vpd_save_file(const char *path, const struct nvme_vpd *vpd);
+void nvme_vpd_show(const struct nvme_vpd *vpd);
+
+#endif // NVME_VPD_H
@@ -0,0 +1,1021 @@
+#include "main.h"
+#include "session.h"
+#include "utility.h"
+#include "aardvark_app.h"
+#include "smbus.h"
+#include "mctp.h"
+#include "mctp_core.h"
+#include "mctp_message.h"
+#include "nvme_mi.h"
+#include "nvme_format.h"
+#include "nvme_script.h"
+#include "nvme_fanout.h"
+#include "i2c_mux.h"
+
+#include "types.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+void session_init(struct session *s, int handle, const char *sock_path, u8 owner_eid, int pec,
+                  int verbose)
+{
+	memset(s, 0, sizeof(*s));
+	s->handle = handle;
+	s->sock_path = sock_path;
+	s->owner_eid = owner_eid;
+	s->pec = pec;
+	s->verbose = verbose;
+}
+
+// MCTP itself is torn down by main_exit, once for the whole process.
+void session_deinit(struct session *s)
+{
+	s->mctp_up = false;
+	s->nep = 0;
+	s->cur = NULL;
+}
+
+// A negative seg matches the address on any segment.
+static struct session_endpoint *session_find(struct session *s, int seg, u8 slv_addr)
+{
+	for (int i = 0; i < s->nep; i++)
+		if (s->ep[i].slv_addr == slv_addr && (seg < 0 || s->ep[i].seg == seg))
+			return &s->ep[i];
+
+	return NULL;
+}
+
+/**
+ * Return the endpoint at slv_addr on segment seg, bringing it up first unless
+ * it already is with the same EID: MCTP starts with the first endpoint, later
+ * ones get their address with ARP, their EID and a route like the first. The
+ * bus is left switched to the segment of the endpoint.
+ */
+struct session_endpoint *session_open(struct session *s, u8 seg, u8 slv_addr, u8 eid)
+{
+	struct session_endpoint *ep = session_find(s, seg, slv_addr);
+	int ret;
+
+	if (eid < 8 || eid == s->owner_eid) {
+		main_trace(ERROR, "wrong eid (%d,%d)\n", s->owner_eid, eid);
+		return NULL;
+	}
+
+	if (i2c_mux_route(s->handle, seg)) {
+		main_trace(ERROR, "no route to segment %d\n", seg);
+		return NULL;
+	}
+
+	if (ep && ep->eid == eid) {
+		s->cur = ep;
+		return ep;
+	}
+
+	if (!ep && s->nep == SESSION_ENDPOINT_MAX) {
+		main_trace(ERROR, "too many endpoints\n");
+		return NULL;
+	}
+
+	if (!s->mctp_up) {
+		ret = mctp_open_endpoint(s->handle, s->sock_path, slv_addr, s->owner_eid, eid, s->pec,
+		                         s->verbose);
+		s->mctp_up = !ret;
+	} else {
+		ret = s->sock_path ? 0 : arp_assign_address(s->handle, slv_addr, s->pec);
+		if (!ret)
+			ret = mctp_message_set_eid(slv_addr, EID_NULL_DST, SET_EID, eid, 1, 0, s->verbose);
+		if (!ret && mctp_discover_endpoint(slv_addr, eid, false, 100, s->verbose))
+			main_trace(WARN, "mctp_discover_endpoint %02x/%d\n", slv_addr, eid);
+	}
+	if (ret) {
+		main_trace(ERROR, "endpoint %d:%02x/%d (%d)\n", seg, slv_addr, eid, ret);
+		return NULL;
+	}
+
+	if (!ep)
+		ep = &s->ep[s->nep++];
+	memset(ep, 0, sizeof(*ep));
+	ep->seg = seg;
+	ep->slv_addr = slv_addr;
+	ep->eid = eid;
+	ep->opened_us = time_us();
+
+	// Without ARP on a socket the EID tells endpoints apart.
+	if (s->sock_path)
+		ep->udid.data[sizeof(ep->udid) - 1] = eid;
+	else if (smbus_arp_cmd_get_udid(s->handle, &ep->udid, slv_addr, 1, s->pec))
+		main_trace(WARN, "smbus_arp_cmd_get_udid %02x\n", slv_addr);
+
+	s->cur = ep;
+
+	return ep;
+}
+
+// Forget the endpoint, the next open assigns it again.
+int session_close(struct session *s, u8 seg, u8 slv_addr)
+{
+	struct session_endpoint *ep = session_find(s, seg, slv_addr);
+	int i;
+
+	if (!ep)
+		return -SESSION_ERR_ENDPOINT;
+
+	i = ep - s->ep;
+	memmove(ep, ep + 1, (s->nep - i - 1) * sizeof(*ep));
+	s->nep--;
+	s->cur = s->nep ? &s->ep[s->nep - 1] : NULL;
+
+	return SESSION_SUCCESS;
+}
+
+void session_show(const struct session *s)
+{
+	printf("Endpoints                   : %d\n", s->nep);
+	printf("Requests                    : %d\n", s->requests);
+	printf("  %-3s %-4s %-4s %-8s %-8s %-10s %s\n", "seg", "addr", "eid", "requests", "errors",
+	       "uptime(s)", "udid");
+	for (int i = 0; i < s->nep; i++) {
+		const struct session_endpoint *ep = &s->ep[i];
+
+		printf("%c %-3d %02x   %-4d %-8d %-8d %-10llu ", ep == s->cur ? '*' : ' ', ep->seg,
+		       ep->slv_addr, ep->eid, ep->requests, ep->errors,
+		       (unsigned long long)(time_us() - ep->opened_us) / 1000000);
+		for (int j = 0; j < sizeof(ep->udid); j++)
+			printf("%02x", ep->udid.data[j]);
+		printf("\n");
+	}
+}
+
+// Run the NVMe-MI ops of a request once, against its targets or the current endpoint.
+static int session_run_script(struct session *s, const char *text)
+{
+	struct nvme_script *script = malloc(sizeof(*script));
+	struct session_endpoint *ep[NVME_SCRIPT_TARGET_MAX];
+	int ret, n = 0;
+
+	if (!script)
+		return -SESSION_ERR_IO;
+
+	if (nvme_script_compile(script, text, "request")) {
+		free(script);
+		return -SESSION_ERR_SYNTAX;
+	}
+	script->quiet = true;
+
+	// Script targets have no segment, an endpoint open at the address has one.
+	ret = SESSION_SUCCESS;
+	for (int i = 0; i < script->ntarget; i++) {
+		struct session_endpoint *found = session_find(s, -1, script->target[i].slv_addr);
+
+		ep[n] = session_open(s, found ? found->seg : I2C_MUX_SEGMENT_ROOT,
+		                     script->target[i].slv_addr, script->target[i].eid);
+		if (!ep[n++])
+			ret = -SESSION_ERR_ENDPOINT;
+	}
+	if (!script->ntarget) {
+		ep[n++] = s->cur;
+		if (!s->cur) {
+			main_trace(ERROR, "no endpoint open\n");
+			ret = -SESSION_ERR_ENDPOINT;
+		}
+	}
+	if (!ret && i2c_mux_route(s->handle, s->cur->seg))
+		ret = -SESSION_ERR_IO;
+
+	if (!ret) {
+		struct aa_args args = {
+			.handle = s->handle,
+			.verbose = s->verbose,
+			.slv_addr = s->cur->slv_addr,
+			.dst_eid = s->cur->eid,
+			.pec = s->pec,
+			.ic = true,
+			.timeout = 100,
+		};
+		uint32_t errors = 0;
+
+		nvme_script_run(&args, script);
+		for (int i = 0; i < script->nop; i++)
+			errors += script->op[i].errors;
+		for (int i = 0; i < n; i++) {
+			ep[i]->requests++;
+			if (errors)
+				ep[i]->errors++;
+		}
+		if (errors)
+			ret = -SESSION_ERR_IO;
+	}
+
+	nvme_script_free(script);
+	free(script);
+
+	return ret;
+}
+
+// Send one op to every open endpoint at once, the rest of the line is the op.
+static int session_fanout(struct session *s)
+{
+	struct nvme_fanout *fo;
+	char *tok, *end;
+	int n = 0, ret;
+
+	if (!s->nep) {
+		main_trace(ERROR, "no endpoint open\n");
+		return -SESSION_ERR_ENDPOINT;
+	}
+
+	fo = calloc(1, sizeof(*fo));
+	if (!fo)
+		return -SESSION_ERR_IO;
+
+	tok = strtok(NULL, " \t\r\n");
+	fo->cmd = tok ? nvme_script_find(tok) : NULL;
+	while (fo->cmd && (tok = strtok(NULL, " \t\r\n"))) {
+		if (n == NVME_SCRIPT_PARAM_MAX)
+			break;
+		fo->param[n++] = strtoul(tok, &end, 0);
+		if (*end)
+			break;
+	}
+	if (!fo->cmd || tok || n < fo->cmd->min || n > fo->cmd->max) {
+		free(fo);
+		return -SESSION_ERR_SYNTAX;
+	}
+
+	for (int i = 0; i < s->nep; i++)
+		nvme_fanout_add_target(fo, s->handle, s->ep[i].seg, s->ep[i].slv_addr,
+		                       s->ep[i].eid);
+
+	struct aa_args args = {
+		.handle = s->handle,
+		.verbose = s->verbose,
+		.pec = s->pec,
+		.ic = true,
+		.timeout = 100,
+	};
+
+	ret = nvme_fanout_run(&args, fo);
+	nvme_fanout_show(fo);
+	for (int i = 0; i < fo->ntarget; i++) {
+		s->ep[i].requests++;
+		if (fo->result[i].ret || fo->result[i].res.status)
+			s->ep[i].errors++;
+	}
+	free(fo);
+
+	return ret ? -SESSION_ERR_IO : SESSION_SUCCESS;
+}
+
+/**
+ * Session commands:
+ *   open [seg:]<addr> <eid>  bring up an endpoint and make it current
+ *   close [seg:]<addr>       forget an endpoint
+ *   sessions                 list the endpoints
+ *   fanout <op> [params]     run one op on every open endpoint at once
+ *   format <name>            output format of the rest of the request
+ *   shutdown                 stop serving after this request
+ * Returns 1 for any other line, which belongs to the NVMe-MI ops.
+ */
+static int session_command(struct session *s, char *line)
+{
+	char *name = strtok(line, " \t\r\n");
+	char *tok[3], *end;
+	unsigned long eid;
+	int n = 0, fmt, seg, addr;
+
+	if (!strcmp(name, "format")) {
+		tok[0] = strtok(NULL, " \t\r\n");
+		fmt = tok[0] ? nvme_format_parse(tok[0]) : -1;
+		if (fmt < 0 || strtok(NULL, " \t\r\n"))
+			return -SESSION_ERR_SYNTAX;
+		nvme_format_set(fmt);
+		return SESSION_SUCCESS;
+	}
+
+	if (!strcmp(name, "fanout"))
+		return session_fanout(s);
+
+	if (strcmp(name, "open") && strcmp(name, "close") && strcmp(name, "sessions") &&
+	    strcmp(name, "shutdown"))
+		return 1;
+
+	while (n < 3 && (tok[n] = strtok(NULL, " \t\r\n")))
+		n++;
+	if (n == 3)
+		return -SESSION_ERR_SYNTAX;
+
+	if (!strcmp(name, "open")) {
+		if (n != 2 || i2c_mux_parse_addr(tok[0], &seg, &addr))
+			return -SESSION_ERR_SYNTAX;
+		eid = strtoul(tok[1], &end, 0);
+		if (*end || eid > 0xFF)
+			return -SESSION_ERR_SYNTAX;
+		return session_open(s, seg, addr, eid) ? SESSION_SUCCESS : -SESSION_ERR_ENDPOINT;
+	}
+
+	if (!strcmp(name, "close")) {
+		if (n != 1 || i2c_mux_parse_addr(tok[0], &seg, &addr))
+			return -SESSION_ERR_SYNTAX;
+		return session_close(s, seg, addr);
+	}
+
+	if (n)
+		return -SESSION_ERR_SYNTAX;
+
+	if (!strcmp(name, "sessions"))
+		session_show(s);
+	else
+		s->stop = true;
+
+	return SESSION_SUCCESS;
+}
+
+/**
+ * Execute a request, one session command or NVMe-MI op (see nvme_script) per
+ * line. Consecutive ops run together, in order with the session commands
+ * around them. Output goes to stdout, the first error is returned.
+ */
+int session_exec(struct session *s, const char *text)
+{
+	size_t len = strlen(text), slen = 0;
+	char *buf = malloc(2 * (len + 1) + 2);
+	char *script, *line, *next;
+	int ret, status = SESSION_SUCCESS;
+
+	if (!buf)
+		return -SESSION_ERR_IO;
+	memcpy(buf, text, len + 1);
+	script = buf + len + 1;
+
+	s->requests++;
+
+	for (line = buf; line; line = next) {
+		char copy[256];
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		line += strspn(line, " \t\r");
+		if (!*line || *line == '#')
+			continue;
+
+		if (strlen(line) >= sizeof(copy)) {
+			main_trace(ERROR, "request line too long\n");
+			ret = -SESSION_ERR_SYNTAX;
+		} else {
+			strcpy(copy, line);
+			ret = session_command(s, copy);
+		}
+
+		if (ret == 1) {
+			slen += sprintf(script + slen, "%s\n", line);
+			continue;
+		}
+
+		if (slen) {
+			int r = session_run_script(s, script);
+			if (!status)
+				status = r;
+			slen = 0;
+		}
+
+		if (ret)
+			main_trace(ERROR, "request line '%s' (%d)\n", line, ret);
+		if (!status)
+			status = ret;
+	}
+
+	if (slen) {
+		ret = session_run_script(s, script);
+		if (!status)
+			status = ret;
+	}
+
+	fflush(stdout);
+	free(buf);
+
+	return status;
+}
+
+// A hex frame, "0a1b2c" with an optional 0x prefix, returns its length.
+static int session_hex(const char *hex, u8 *buf, int max)
+{
+	int n = 0;
+
+	if (!hex)
+		return -1;
+	if (!strncmp(hex, "0x", 2))
+		hex += 2;
+
+	for (; hex[0] && hex[1]; hex += 2) {
+		char pair[3] = {hex[0], hex[1], 0}, *end;
+
+		if (n == max)
+			return -1;
+		buf[n++] = strtoul(pair, &end, 16);
+		if (*end)
+			return -1;
+	}
+
+	return *hex ? -1 : n;
+}
+
+static void session_emit(uint32_t seq, int ret, const u8 *buf, int len)
+{
+	printf("%u %d", seq, ret);
+	if (len > 0)
+		putchar(' ');
+	for (int i = 0; i < len; i++)
+		printf("%02x", buf[i]);
+	putchar('\n');
+}
+
+/**
+ * Bus records, <addr> may be [seg:]<addr> behind a mux:
+ *   i2c-write <addr> <hex>
+ *   i2c-read <addr> <len>
+ *   i2c-write-read <addr> <hex> <len>
+ *   smb-send-byte <addr> <data>
+ *   smb-write-byte|smb-write-word|smb-write-32|smb-write-64 <addr> <cmd> <data>
+ *   smb-block-write <addr> <cmd> <hex>
+ * Returns 1 for a record that is not one, data read is put in buf.
+ */
+static int session_bus(struct session *s, char **tok, int ntok, u8 *buf, int *len)
+{
+	u8 out[SESSION_FRAME_MAX];
+	unsigned long long val[2] = {0};
+	u16 num_written, num_read;
+	char *end = "";
+	int n = 0, seg, addr, status;
+	bool wr;
+
+	*len = 0;
+	if (strncmp(tok[0], "i2c-", 4) && strncmp(tok[0], "smb-", 4))
+		return 1;
+	if (ntok < 3)
+		return -SESSION_ERR_SYNTAX;
+
+	if (i2c_mux_parse_addr(tok[1], &seg, &addr))
+		return -SESSION_ERR_SYNTAX;
+	if (i2c_mux_route(s->handle, seg))
+		return -SESSION_ERR_IO;
+
+	wr = !strcmp(tok[0], "i2c-write-read");
+	if (wr || !strcmp(tok[0], "i2c-write")) {
+		n = session_hex(tok[2], out, sizeof(out));
+		if (n <= 0 || ntok != (wr ? 4 : 3))
+			return -SESSION_ERR_SYNTAX;
+		if (!wr) {
+			status = aa_i2c_write_ext(s->handle, addr, AA_I2C_NO_FLAGS, n, out, &num_written);
+			return status || num_written != n ? -SESSION_ERR_IO : SESSION_SUCCESS;
+		}
+		val[0] = strtoul(tok[3], &end, 0);
+		if (*end || !val[0] || val[0] > SESSION_FRAME_MAX)
+			return -SESSION_ERR_SYNTAX;
+		status = aa_i2c_write_read(s->handle, addr, AA_I2C_NO_FLAGS, n, out, &num_written, val[0],
+		                           buf, &num_read);
+		*len = num_read;
+		return status ? -SESSION_ERR_IO : SESSION_SUCCESS;
+	}
+
+	if (!strcmp(tok[0], "i2c-read")) {
+		val[0] = strtoul(tok[2], &end, 0);
+		if (*end || ntok != 3 || !val[0] || val[0] > SESSION_FRAME_MAX)
+			return -SESSION_ERR_SYNTAX;
+		status = aa_i2c_read_ext(s->handle, addr, AA_I2C_NO_FLAGS, val[0], buf, &num_read);
+		*len = num_read;
+		return status ? -SESSION_ERR_IO : SESSION_SUCCESS;
+	}
+
+	if (!strcmp(tok[0], "smb-block-write")) {
+		val[0] = strtoul(tok[2], &end, 0);
+		n = ntok == 4 && !*end ? session_hex(tok[3], out, 255) : -1;
+		if (n <= 0 || val[0] > UINT8_MAX)
+			return -SESSION_ERR_SYNTAX;
+		return smbus_block_write(s->handle, addr, val[0], n, out, s->pec, s->verbose) ?
+		       -SESSION_ERR_IO : SESSION_SUCCESS;
+	}
+
+	for (int i = 2; i < ntok && i < 4 && !*end; i++)
+		val[i - 2] = strtoull(tok[i], &end, 0);
+	if (*end)
+		return -SESSION_ERR_SYNTAX;
+
+	if (!strcmp(tok[0], "smb-send-byte") && ntok == 3 && val[0] <= UINT8_MAX)
+		status = smbus_send_byte(s->handle, addr, val[0], s->pec);
+	else if (ntok != 4 || val[0] > UINT8_MAX)
+		return -SESSION_ERR_SYNTAX;
+	else if (!strcmp(tok[0], "smb-write-byte") && val[1] <= UINT8_MAX)
+		status = smbus_write_byte(s->handle, addr, val[0], val[1], s->pec);
+	else if (!strcmp(tok[0], "smb-write-word") && val[1] <= UINT16_MAX)
+		status = smbus_write_word(s->handle, addr, val[0], val[1], s->pec);
+	else if (!strcmp(tok[0], "smb-write-32") && val[1] <= UINT32_MAX)
+		status = smbus_write32(s->handle, addr, val[0], val[1], s->pec);
+	else if (!strcmp(tok[0], "smb-write-64"))
+		status = smbus_write64(s->handle, addr, val[0], val[1], s->pec);
+	else
+		return -SESSION_ERR_SYNTAX;
+
+	return status ? -SESSION_ERR_IO : SESSION_SUCCESS;
+}
+
+// NVMe-MI ops in flight, one per command slot.
+struct session_stream {
+	struct aa_args args;
+	struct nvme_script *script;     // Scratch of the ops that move data through its buffer
+	bool slot;                      // Next slot to use, its op is the older of the two
+	bool busy[NVME_MI_SLOT_MAX];
+	uint32_t seq[NVME_MI_SLOT_MAX];
+};
+
+static void session_stream_result(struct session_stream *st, bool csi, uint32_t seq)
+{
+	struct nvme_mi_result res;
+	int ret;
+
+	st->args.csi = csi;
+	ret = nvme_mi_wait_slot(&st->args, csi);
+	if (!ret)
+		ret = nvme_mi_get_result(csi, &res);
+	if (ret) {
+		session_emit(seq, ret, NULL, 0);
+		return;
+	}
+
+	printf("%u %d ", seq, res.status);
+	nvme_format_result(stdout, &res, NVME_FORMAT_JSON);
+}
+
+// Complete the op on a slot if there is one, its result is the next in order.
+static void session_stream_complete(struct session_stream *st, bool csi)
+{
+	if (!st->busy[csi])
+		return;
+	st->busy[csi] = false;
+	session_stream_result(st, csi, st->seq[csi]);
+}
+
+static void session_stream_drain(struct session_stream *st)
+{
+	session_stream_complete(st, st->slot);
+	session_stream_complete(st, !st->slot);
+}
+
+static int session_stream_op(struct session *s, struct session_stream *st,
+                             const struct nvme_script_cmd *cmd, char **tok, int ntok, uint32_t seq)
+{
+	uint32_t param[NVME_SCRIPT_PARAM_MAX] = {0};
+	char *end;
+	int ret;
+
+	if (ntok - 1 < cmd->min || ntok - 1 > cmd->max)
+		return -SESSION_ERR_SYNTAX;
+	for (int i = 1; i < ntok; i++) {
+		param[i - 1] = strtoul(tok[i], &end, 0);
+		if (*end)
+			return -SESSION_ERR_SYNTAX;
+	}
+	if (!s->cur)
+		return -SESSION_ERR_ENDPOINT;
+	// Bus records may have switched the muxes since the endpoint was opened.
+	if (i2c_mux_route(s->handle, s->cur->seg))
+		return -SESSION_ERR_IO;
+
+	st->args.slv_addr = s->cur->slv_addr;
+	st->args.dst_eid = s->cur->eid;
+	s->cur->requests++;
+
+	if (cmd->drain) {
+		session_stream_drain(st);
+		st->args.csi = st->slot;
+		ret = cmd->fn(&st->args, st->script, param);
+		if (ret)
+			return ret;
+		// wait and sleep have no response of their own.
+		if (!strcmp(cmd->name, "wait") || !strcmp(cmd->name, "sleep"))
+			session_emit(seq, 0, NULL, 0);
+		else
+			session_stream_result(st, st->slot, seq);
+		return SESSION_SUCCESS;
+	}
+
+	session_stream_complete(st, st->slot);
+	st->args.csi = st->slot;
+	ret = cmd->fn(&st->args, st->script, param);
+	if (ret) {
+		// The op on the other slot is older, its result goes first.
+		session_stream_complete(st, !st->slot);
+		return ret;
+	}
+
+	st->busy[st->slot] = true;
+	st->seq[st->slot] = seq;
+	st->slot = !st->slot;
+
+	return SESSION_SUCCESS;
+}
+
+static void session_stream_record(struct session *s, struct session_stream *st, char *line,
+                                  uint32_t seq)
+{
+	const struct nvme_script_cmd *cmd;
+	char *tok[8];
+	u8 buf[SESSION_FRAME_MAX];
+	unsigned long eid = 0;
+	int ntok = 0, len = 0, seg, addr, ret;
+	char *end = "";
+
+	for (char *t = strtok(line, " \t\r"); t && ntok < 8; t = strtok(NULL, " \t\r"))
+		tok[ntok++] = t;
+
+	cmd = nvme_script_find(tok[0]);
+	if (cmd) {
+		ret = session_stream_op(s, st, cmd, tok, ntok, seq);
+		if (ret) {
+			if (s->cur)
+				s->cur->errors++;
+			session_emit(seq, ret, NULL, 0);
+		}
+		return;
+	}
+
+	// Everything else runs on its own, after the ops before it.
+	session_stream_drain(st);
+
+	if (!strcmp(tok[0], "open") || !strcmp(tok[0], "target") || !strcmp(tok[0], "close")) {
+		if (ntok == 3)
+			eid = strtoul(tok[2], &end, 0);
+		if (*end || ntok != (strcmp(tok[0], "close") ? 3 : 2) ||
+		    i2c_mux_parse_addr(tok[1], &seg, &addr))
+			ret = -SESSION_ERR_SYNTAX;
+		else if (ntok == 2)
+			ret = session_close(s, seg, addr);
+		else
+			ret = eid <= 0xFF && session_open(s, seg, addr, eid) ? SESSION_SUCCESS :
+			      -SESSION_ERR_ENDPOINT;
+	} else {
+		ret = session_bus(s, tok, ntok, buf, &len);
+		if (ret == 1)
+			ret = -SESSION_ERR_SYNTAX;
+	}
+
+	session_emit(seq, ret, buf, ret ? 0 : len);
+}
+
+/**
+ * Read newline-delimited records from stdin and write one result line per
+ * record to stdout: "<seq> <status> [payload]", seq counting the records
+ * from 1. Status is 0, a negative error, or the NVMe-MI response status with
+ * the result as JSON for payload; data read from the bus is a hex payload.
+ * Records are the bus records of session_bus(), open|target [seg:]<addr> <eid>,
+ * close [seg:]<addr> and the NVMe-MI ops of nvme_script, sent to the current
+ * endpoint with both command slots in flight. Results stay in record order
+ * and are flushed in batches, whenever no further record is waiting.
+ */
+int session_stream(struct session *s)
+{
+	enum nvme_format_type fmt = nvme_format_get();
+	struct session_stream st = {
+		.args = {
+			.handle = s->handle,
+			.verbose = s->verbose,
+			.pec = s->pec,
+			.ic = true,
+			.timeout = 100,
+			.async = true,
+		},
+	};
+	size_t start = 0, have = 0;
+	uint32_t seq = 0;
+	char *buf;
+	ssize_t n;
+
+	buf = malloc(SESSION_REQUEST_MAX);
+	st.script = calloc(1, sizeof(*st.script));
+	if (!buf || !st.script) {
+		free(buf);
+		free(st.script);
+		return -SESSION_ERR_IO;
+	}
+
+	// Results are only printed as records, in order.
+	nvme_format_set(NVME_FORMAT_NONE);
+	setvbuf(stdout, NULL, _IOFBF, SESSION_REQUEST_MAX);
+
+	while (!s->stop) {
+		char *line = buf + start;
+		char *eol = memchr(line, '\n', have - start);
+
+		if (!eol) {
+			// Input is idle: finish what is in flight and hand the results over.
+			session_stream_drain(&st);
+			fflush(stdout);
+
+			memmove(buf, line, have - start);
+			have -= start;
+			start = 0;
+			if (have == SESSION_REQUEST_MAX) {
+				session_emit(++seq, -SESSION_ERR_PARAM, NULL, 0);
+				have = 0;
+			}
+
+			n = read(STDIN_FILENO, buf + have, SESSION_REQUEST_MAX - have);
+			if (n <= 0)
+				break;
+			have += n;
+			continue;
+		}
+
+		*eol = 0;
+		start = eol + 1 - buf;
+		s->requests++;
+
+		line += strspn(line, " \t\r");
+		if (!*line || *line == '#')
+			continue;
+
+		session_stream_record(s, &st, line, ++seq);
+	}
+
+	session_stream_drain(&st);
+	fflush(stdout);
+	nvme_format_set(fmt);
+	free(st.script);
+	free(buf);
+
+	return SESSION_SUCCESS;
+}
+
+#ifndef WIN32
+static volatile sig_atomic_t session_signal;
+
+static void session_on_signal(int sig)
+{
+	session_signal = sig;
+}
+
+static int session_socket(const char *path, struct sockaddr_un *addr)
+{
+	int fd;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		main_trace(ERROR, "socket path too long (%s)\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		main_trace(ERROR, "socket (%d)\n", errno);
+		return -1;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	strcpy(addr->sun_path, path);
+
+	return fd;
+}
+
+static int session_write(int fd, const void *buf, size_t len)
+{
+	while (len) {
+		ssize_t n = write(fd, buf, len);
+		if (n <= 0)
+			return -SESSION_ERR_IO;
+		buf = (const u8 *)buf + n;
+		len -= n;
+	}
+
+	return SESSION_SUCCESS;
+}
+
+/**
+ * A request is everything the client sends before it shuts down its side,
+ * within SESSION_REQUEST_TIMEOUT_MS so that a stalled client cannot hold the
+ * daemon.
+ */
+static int session_read_request(int fd, char *buf, size_t size)
+{
+	u64 deadline = time_us() + SESSION_REQUEST_TIMEOUT_MS * 1000ULL;
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < size - 1) {
+		struct pollfd pfd = {
+			.fd = fd,
+			.events = POLLIN,
+		};
+		u64 now = time_us();
+
+		if (now >= deadline ||
+		    poll(&pfd, 1, (deadline - now + 999) / 1000) <= 0)
+			return -SESSION_ERR_TIMEOUT;
+
+		n = read(fd, buf + len, size - 1 - len);
+		if (n < 0)
+			return -SESSION_ERR_IO;
+		if (!n)
+			break;
+		len += n;
+	}
+	buf[len] = 0;
+
+	return len < size - 1 ? SESSION_SUCCESS : -SESSION_ERR_PARAM;
+}
+
+/**
+ * Run the request with stdout captured so the output of every existing
+ * printer goes back to the client, then restore stdout and the output format.
+ */
+static void session_serve_one(struct session *s, int fd, char *req)
+{
+	struct session_response rsp = {.magic = SESSION_RESPONSE_MAGIC};
+	enum nvme_format_type fmt = nvme_format_get();
+	FILE *out = tmpfile();
+	int saved;
+	long len;
+
+	if (!out) {
+		main_trace(ERROR, "tmpfile\n");
+		return;
+	}
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	dup2(fileno(out), STDOUT_FILENO);
+
+	rsp.status = session_exec(s, req);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	nvme_format_set(fmt);
+
+	len = ftell(out);
+	rsp.len = len > 0 ? len : 0;
+	rewind(out);
+
+	if (session_write(fd, &rsp, sizeof(rsp)) == SESSION_SUCCESS) {
+		char buf[4096];
+		size_t n;
+
+		while ((n = fread(buf, 1, sizeof(buf), out)) > 0)
+			if (session_write(fd, buf, n))
+				break;
+	}
+
+	fclose(out);
+}
+#endif
+
+/**
+ * Serve requests on a local stream socket, one connection per request and
+ * one request at a time, until a shutdown request, SIGINT or SIGTERM.
+ */
+int session_serve(struct session *s, const char *path)
+{
+#ifndef WIN32
+	struct sockaddr_un addr;
+	char *req;
+	int fd;
+
+	fd = session_socket(path, &addr);
+	if (fd < 0)
+		return -SESSION_ERR_IO;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8)) {
+		main_trace(ERROR, "bind %s (%d)\n", path, errno);
+		close(fd);
+		return -SESSION_ERR_IO;
+	}
+
+	req = malloc(SESSION_REQUEST_MAX);
+	if (!req) {
+		close(fd);
+		unlink(path);
+		return -SESSION_ERR_IO;
+	}
+
+	signal(SIGINT, session_on_signal);
+	signal(SIGTERM, session_on_signal);
+	// A client that goes away must not take the daemon with it.
+	signal(SIGPIPE, SIG_IGN);
+
+	main_trace(INFO, "serving on %s\n", path);
+
+	while (!s->stop && !session_signal) {
+		struct pollfd pfd = {
+			.fd = fd,
+			.events = POLLIN,
+		};
+		struct timeval tv = {
+			.tv_sec = SESSION_REQUEST_TIMEOUT_MS / 1000,
+			.tv_usec = SESSION_REQUEST_TIMEOUT_MS % 1000 * 1000,
+		};
+		int cfd, ret;
+
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		cfd = accept(fd, NULL, NULL);
+		if (cfd < 0)
+			continue;
+		// Nor can a client that does not take its response.
+		setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+		ret = session_read_request(cfd, req, SESSION_REQUEST_MAX);
+		if (ret == -SESSION_ERR_PARAM) {
+			struct session_response rsp = {
+				.magic = SESSION_RESPONSE_MAGIC,
+				.status = ret,
+			};
+
+			main_trace(ERROR, "request too long\n");
+			session_write(cfd, &rsp, sizeof(rsp));
+		} else if (ret) {
+			main_trace(WARN, "drop client (%d)\n", ret);
+		} else {
+			session_serve_one(s, cfd, req);
+		}
+		close(cfd);
+	}
+
+	main_trace(INFO, "stopped after %d requests\n", s->requests);
+
+	free(req);
+	close(fd);
+	unlink(path);
+
+	return SESSION_SUCCESS;
+#else
+	main_trace(ERROR, "unix domain socket is not supported\n");
+	return -SESSION_ERR_IO;
+#endif
+}
+
+// Send one request to a daemon and copy its output to out, returns its status.
+int session_request(const char *path, const char *text, FILE *out)
+{
+#ifndef WIN32
+	struct session_response rsp;
+	struct sockaddr_un addr;
+	size_t len = 0;
+	char buf[4096];
+	ssize_t n;
+	int fd;
+
+	fd = session_socket(path, &addr);
+	if (fd < 0)
+		return -SESSION_ERR_IO;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		main_trace(ERROR, "connect %s (%d)\n", path, errno);
+		close(fd);
+		return -SESSION_ERR_IO;
+	}
+
+	if (session_write(fd, text, strlen(text)) || shutdown(fd, SHUT_WR)) {
+		main_trace(ERROR, "send request (%d)\n", errno);
+		close(fd);
+		return -SESSION_ERR_IO;
+	}
+
+	while (len < sizeof(rsp) && (n = read(fd, (u8 *)&rsp + len, sizeof(rsp) - len)) > 0)
+		len += n;
+	if (len < sizeof(rsp) || rsp.magic != SESSION_RESPONSE_MAGIC) {
+		main_trace(ERROR, "invalid response\n");
+		close(fd);
+		return -SESSION_ERR_IO;
+	}
+
+	for (len = 0; len < rsp.len && (n = read(fd, buf, sizeof(buf))) > 0; len += n)
+		fwrite(buf, 1, n, out);
+	fflush(out);
+	close(fd);
+
+	if (len < rsp.len) {
+		main_trace(ERROR, "response cut short\n");
+		return -SESSION_ERR_IO;
+	}
+
+	return rsp.status;
+#else
+	main_trace(ERROR, "unix domain socket is not supported\n");
+	return -SESSION_ERR_IO;
+#endif
+}
@@ -0,0 +1,80 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "smbus.h"
+
+#include "types.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define SESSION_ENDPOINT_MAX            (16)
+#define SESSION_REQUEST_MAX             (64 * 1024)
+// A client has this long to send its whole request and to take the response
+#define SESSION_REQUEST_TIMEOUT_MS      (5000)
+// Largest I2C frame of a stream record
+#define SESSION_FRAME_MAX               (1024)
+// "ASRS"
+#define SESSION_RESPONSE_MAGIC          (0x53525341)
+
+enum session_error {
+	SESSION_SUCCESS = 0,
+	SESSION_ERR_PARAM,
+	SESSION_ERR_SYNTAX,
+	SESSION_ERR_ENDPOINT,
+	SESSION_ERR_IO,
+	SESSION_ERR_TIMEOUT,
+};
+
+#pragma pack(push, 1)
+
+// Sent ahead of the output of every request.
+struct session_response {
+	u32 magic;
+	s32 status;                     // 0, or the negative error of the first line that failed
+	u32 len;                        // Bytes of output that follow
+};
+
+#pragma pack(pop)
+
+struct session_endpoint {
+	u8 seg;                         // Mux segment, see i2c_mux
+	u8 slv_addr;
+	u8 eid;
+	union udid_ds udid;
+	uint32_t requests;
+	uint32_t errors;
+	uint64_t opened_us;
+};
+
+/**
+ * The adapter and the MCTP endpoints of a long-running process. Endpoints
+ * stay assigned and discovered between requests, so a request that targets
+ * one costs only its own bus exchange.
+ */
+struct session {
+	int handle;
+	const char *sock_path;          // MCTP over a local socket instead of the adapter
+	u8 owner_eid;
+	int pec;
+	int verbose;
+	bool mctp_up;
+	bool stop;
+	uint8_t nep;
+	struct session_endpoint ep[SESSION_ENDPOINT_MAX];
+	struct session_endpoint *cur;   // Target of the ops of a request without one
+	uint32_t requests;
+};
+
+void session_init(struct session *s, int handle, const char *sock_path, u8 owner_eid, int pec,
+                  int verbose);
+void session_deinit(struct session *s);
+struct session_endpoint *session_open(struct session *s, u8 seg, u8 slv_addr, u8 eid);
+int session_close(struct session *s, u8 seg, u8 slv_addr);
+int session_exec(struct session *s, const char *text);
+void session_show(const struct session *s);
+int session_stream(struct session *s);
+int session_serve(struct session *s, const char *path);
+int session_request(const char *path, const char *text, FILE *out);
+
+#endif // ~ SESSION_H
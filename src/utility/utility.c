@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "utility.h"
 
@@ -163,3 +165,28 @@ void reverse(void *in, u32 len)
 		}
 	}
 }
+
+// Monotonic time in microseconds, for measuring intervals only.
+u64 time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Move len bytes through a pipe or socket, a short transfer is an error (-1).
+int fd_xfer(int fd, void *buf, size_t len, bool out)
+{
+	while (len) {
+		ssize_t n = out ? write(fd, buf, len) : read(fd, buf, len);
+
+		if (n <= 0)
+			return -1;
+		buf = (u8 *)buf + n;
+		len -= n;
+	}
+
+	return 0;
+}
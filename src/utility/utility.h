@@ -13,6 +13,8 @@ void align_free(void *aligned_ptr);
 size_t strlen(const char *s);
 void print_buf(const void *buf, size_t size, const char *title, ...);
 void reverse(void *in, u32 len);
+u64 time_us(void);
+int fd_xfer(int fd, void *buf, size_t len, bool out);
 
 #define DBGPRINT(filter, ...)   printf(__VA_ARGS__)
 